@@ -2,18 +2,115 @@
 //
 
 #include "pch.h"
-#include "Src/Core/Geometry.h"
+#include "Src/Core/Parallel.h"
+#include "Src/Core/Parser.h"
+#include "Src/Core/Profiler.h"
+#include "Src/Core/SceneCache.h"
+#include "Src/Core/Stats.h"
+#include "Src/Shapes/Triangle.h"
+#include "Tests/Benchmarks.h"
+#include "glog/logging.h"
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
 using namespace PBRT;
 
-int main()
+int main(int argc, char *argv[])
 {
-    std::cout << "Hello World!\n"; 
+    google::InitGoogleLogging(argv[0]);
 
-    auto a = Vector3<float>(1.0f, -2.0f, 3.0f);
-    auto b = Vector3<float>(1, 2, 3);
-    auto c = MinComponent(a);
+    // --bench [name]：只运行名字中包含name的微基准测试
+    if ((argc > 1) && (0 == std::strcmp(argv[1], "--bench")))
+    {
+        return RunBenchmarks((argc > 2) ? argv[2] : "");
+    }
+
+    // --cache <file>：从场景缓存中取出没有变化的网格，有新网格时更新缓存
+    std::string cacheFilename;
+    int firstScene = 1;
+    if ((argc > 2) && (0 == std::strcmp(argv[1], "--cache")))
+    {
+        cacheFilename = argv[2];
+        firstScene = 3;
+    }
+
+    if (argc <= firstScene)
+    {
+        std::cerr << "usage: " << argv[0] << " [--cache <filename>] <filename.pbrt> ...\n"
+                  << "       " << argv[0] << " --bench [name]\n";
+        return 1;
+    }
+
+    ParallelInit();
+    ProfilerStart();
+
+    std::shared_ptr<SceneCache> cache = cacheFilename.empty() ? nullptr : SceneCache::Open(cacheFilename);
+    SceneCacheWriter cacheWriter;
+    int nCacheMisses = 0;
+
+    int result = 0;
+    for (int i = firstScene; i < argc; ++i)
+    {
+        SceneDescription scene;
+        if (!ParseFile(argv[i], &scene, cache.get()))
+        {
+            result = 1;
+            continue;
+        }
+
+        int64_t nTriangles = 0;
+        auto countMesh = [&](const ShapeEntity &shape)
+        {
+            if (!shape.mesh)
+            {
+                return;
+            }
+            nTriangles += shape.mesh->nTriangles;
+            if (!cacheFilename.empty())
+            {
+                cacheWriter.AddMesh(shape.meshKey, shape.mesh);
+                nCacheMisses += (cache && cache->FindMesh(shape.meshKey)) ? 0 : 1;
+            }
+        };
+        for (const ShapeEntity &shape : scene.shapes)
+        {
+            countMesh(shape);
+        }
+        for (const auto &object : scene.objects)
+        {
+            for (const ShapeEntity &shape : object.second)
+            {
+                countMesh(shape);
+            }
+        }
+        std::cout << argv[i] << ": " << scene.shapes.size() << " shapes, " << nTriangles << " triangles, "
+                  << scene.lights.size() << " lights, " << scene.instances.size() << " instances\n";
+    }
+
+    if (nCacheMisses > 0)
+    {
+        // 缓存中取出的网格还映射着旧文件，Windows下不能替换正在映射的文件，
+        // 所以先写到新文件，释放旧缓存后再替换
+        std::string newFilename = cacheFilename + ".new";
+        bool written = cacheWriter.Write(newFilename);
+        cacheWriter = SceneCacheWriter();
+        cache.reset();
+        if (written)
+        {
+            std::remove(cacheFilename.c_str());
+            if (0 != std::rename(newFilename.c_str(), cacheFilename.c_str()))
+            {
+                LOG(ERROR) << "Unable to update scene cache \"" << cacheFilename << "\"";
+            }
+        }
+    }
+
+    // 工作线程退出时已经合并了各自的统计
+    ParallelCleanup();
+    ProfilerStopAndReport();
+    PrintStats();
+    return result;
 }
 
 // 运行程序: Ctrl + F5 或调试 >“开始执行(不调试)”菜单
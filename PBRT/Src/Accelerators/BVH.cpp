@@ -0,0 +1,840 @@
+﻿#include "BVH.h"
+#include "Src/Core/Memory.h"
+#include "Src/Core/Parallel.h"
+#include <algorithm>
+#include <limits>
+
+namespace PBRT
+{
+    STAT_COUNTER("BVH/Rays traced", nBVHRays);
+    STAT_RATIO("BVH/Nodes visited per ray", nBVHNodesVisited, nBVHNodeRays);
+    STAT_COUNTER("BVH/Ray-box tests", nBVHBoxTests);
+    STAT_PERCENT("BVH/Primitive tests that hit", nBVHPrimitiveHits, nBVHPrimitiveTests);
+
+    namespace
+    {
+        // 图元数超过这个值时，节点内部的包围盒计算、分桶和划分都并行执行
+        const int ParallelThreshold = 64 * 1024;
+
+        // 图元数超过这个值时，左右子树作为两个任务并行构建
+        const int ParallelSubtreeThreshold = 4 * 1024;
+
+        const int ChunkSize = 16 * 1024;
+
+        const int MaxLeafPrimitives = 0xFFFF;
+
+        // 分桶数越多划分越接近完整SAH，32个桶的构建代价和质量比较均衡
+        const int NumBuckets = 32;
+
+        // HLBVH顶层树的深度上限，子树从这一层开始计深度
+        // @remarks: 子树最多4096个，等数量划分只需要12层
+        const int UpperTreeMaxDepth = 32;
+
+        struct BucketInfo
+        {
+            int count = 0;
+            Bounds3f bounds;
+        };
+    }
+
+    struct BVHPrimitiveInfo
+    {
+        BVHPrimitiveInfo()
+        {}
+
+        BVHPrimitiveInfo(int primitiveNumber, const Bounds3f &bounds)
+            : primitiveNumber(primitiveNumber)
+            , bounds(bounds)
+            , centroid((0.5f * bounds.minPoint) + (0.5f * bounds.maxPoint))
+        {}
+
+        int primitiveNumber = 0;
+        Bounds3f bounds;
+        Point3f centroid;
+    };
+
+    struct BVHBuildNode
+    {
+        void InitLeaf(int first, int n, const Bounds3f &b)
+        {
+            firstPrimOffset = first;
+            nPrimitives = n;
+            bounds = b;
+            children[0] = children[1] = nullptr;
+            subtreeNodes = 1;
+            depth = 0;
+        }
+
+        void InitInterior(int axis, BVHBuildNode *c0, BVHBuildNode *c1, const Bounds3f &b)
+        {
+            children[0] = c0;
+            children[1] = c1;
+            bounds = b;
+            splitAxis = axis;
+            nPrimitives = 0;
+            subtreeNodes = 1 + c0->subtreeNodes + c1->subtreeNodes;
+            depth = 1 + std::max(c0->depth, c1->depth);
+        }
+
+        Bounds3f bounds;
+        BVHBuildNode *children[2];
+        int splitAxis;
+        int firstPrimOffset;
+        int nPrimitives;
+
+        // 以该节点为根的子树的节点总数，展开时用来直接算出第二个子节点的位置
+        int subtreeNodes;
+        // 子树中根到叶子路径上内部节点数的最大值
+        int depth;
+    };
+
+    // 构建节点按线程分块分配，各线程互不竞争，构建结束后统一释放
+    class BVH::NodeAllocator
+    {
+    public:
+        NodeAllocator()
+            : perThread(MaxThreadIndex())
+        {}
+
+        ~NodeAllocator()
+        {
+            for (ThreadBlocks &threadBlocks : perThread)
+            {
+                for (BVHBuildNode *block : threadBlocks.blocks)
+                {
+                    delete[] block;
+                }
+            }
+        }
+
+        BVHBuildNode *Alloc(void)
+        {
+            ThreadBlocks &threadBlocks = perThread[ThreadIndex];
+            if (threadBlocks.blocks.empty() || (BlockSize == threadBlocks.used))
+            {
+                threadBlocks.blocks.push_back(new BVHBuildNode[BlockSize]);
+                threadBlocks.used = 0;
+            }
+            return &threadBlocks.blocks.back()[threadBlocks.used++];
+        }
+
+    private:
+        static const int BlockSize = 4096;
+
+        // 按缓存行对齐，避免不同线程的计数器落在同一缓存行上
+        struct alignas(PBRT_L1_CACHE_LINE_SIZE) ThreadBlocks
+        {
+            std::vector<BVHBuildNode *> blocks;
+            int used = 0;
+        };
+
+        std::vector<ThreadBlocks> perThread;
+    };
+
+    namespace
+    {
+        void ComputeBounds(const BVHPrimitiveInfo *primitiveInfo, int start, int end
+                         , Bounds3f *bounds, Bounds3f *centroidBounds)
+        {
+            int n = end - start;
+            if (n < ParallelThreshold)
+            {
+                for (int i = start; i < end; ++i)
+                {
+                    *bounds = Union(*bounds, primitiveInfo[i].bounds);
+                    *centroidBounds = Union(*centroidBounds, primitiveInfo[i].centroid);
+                }
+                return;
+            }
+
+            int nChunks = (n + ChunkSize - 1) / ChunkSize;
+            std::vector<Bounds3f> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                ComputeBounds(primitiveInfo
+                            , start + (int)chunk * ChunkSize
+                            , std::min(end, start + ((int)chunk + 1) * ChunkSize)
+                            , &chunkBounds[chunk]
+                            , &chunkCentroidBounds[chunk]);
+            });
+
+            for (int i = 0; i < nChunks; ++i)
+            {
+                *bounds = Union(*bounds, chunkBounds[i]);
+                *centroidBounds = Union(*centroidBounds, chunkCentroidBounds[i]);
+            }
+        }
+
+        // 把质心在dim轴上的位置映射到桶编号，预先算好缩放系数以免每个图元都做除法
+        // @remarks: 质心范围是非规格化数时缩放系数会溢出，限制为最大有限值，乘积在转成整数前截断
+        class BucketMapping
+        {
+        public:
+            BucketMapping(const Bounds3f &centroidBounds, int dim)
+                : dim(dim)
+                , minValue(centroidBounds.minPoint[dim])
+                , scale(std::min(NumBuckets / (centroidBounds.maxPoint[dim] - centroidBounds.minPoint[dim])
+                               , std::numeric_limits<Float>::max()))
+            {}
+
+            int operator()(const BVHPrimitiveInfo &info) const
+            {
+                return (int)std::min((info.centroid[dim] - minValue) * scale, (Float)(NumBuckets - 1));
+            }
+
+        private:
+            int dim;
+            Float minValue;
+            Float scale;
+        };
+
+        void ComputeBuckets(const BVHPrimitiveInfo *primitiveInfo, int start, int end
+                          , const BucketMapping &bucketIndex, BucketInfo buckets[NumBuckets])
+        {
+            int n = end - start;
+            if (n < ParallelThreshold)
+            {
+                for (int i = start; i < end; ++i)
+                {
+                    BucketInfo &bucket = buckets[bucketIndex(primitiveInfo[i])];
+                    ++bucket.count;
+                    bucket.bounds = Union(bucket.bounds, primitiveInfo[i].bounds);
+                }
+                return;
+            }
+
+            int nChunks = (n + ChunkSize - 1) / ChunkSize;
+            std::vector<BucketInfo> chunkBuckets(nChunks * NumBuckets);
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                ComputeBuckets(primitiveInfo
+                             , start + (int)chunk * ChunkSize
+                             , std::min(end, start + ((int)chunk + 1) * ChunkSize)
+                             , bucketIndex
+                             , &chunkBuckets[chunk * NumBuckets]);
+            });
+
+            for (int chunk = 0; chunk < nChunks; ++chunk)
+            {
+                for (int b = 0; b < NumBuckets; ++b)
+                {
+                    const BucketInfo &chunkBucket = chunkBuckets[chunk * NumBuckets + b];
+                    buckets[b].count += chunkBucket.count;
+                    buckets[b].bounds = Union(buckets[b].bounds, chunkBucket.bounds);
+                }
+            }
+        }
+
+        // n个元素一直按数量对半划分时，根到叶子路径上内部节点数的最大值
+        inline int EqualSplitDepth(int n)
+        {
+            int depth = 0;
+            while ((1u << depth) < (unsigned)n)
+            {
+                ++depth;
+            }
+            return depth;
+        }
+
+        // 已经有depth个祖先节点时，剩余的层数只够按数量对半划分n个元素，不能再按代价划分
+        // @remarks: 不满足时子节点的EqualSplitDepth不会超过父节点，所以子节点仍然有足够的层数
+        inline bool MustSplitEqually(int depth, int n, int maxDepth)
+        {
+            return (depth + EqualSplitDepth(n) >= maxDepth);
+        }
+
+        // 叶子相交测试的次数：每次测试blockSize个图元
+        inline int LeafTests(int nPrimitives, int blockSize)
+        {
+            return (nPrimitives + blockSize - 1) / blockSize;
+        }
+
+        // 代价 = 遍历代价 + 两侧的叶子测试次数按表面积加权，返回代价最小时在哪个桶之后划分
+        // @remarks: 两侧都非空的划分都不存在时返回-1
+        int FindSAHSplit(const BucketInfo buckets[NumBuckets], const Bounds3f &bounds, Float traversalCost, int blockSize, Float *minCost)
+        {
+            // 从右向左累积，得到每个划分位置右侧的图元数和包围盒
+            int rightCounts[NumBuckets];
+            Float rightAreas[NumBuckets];
+            Bounds3f rightBounds;
+            int rightCount = 0;
+            for (int i = NumBuckets - 1; i > 0; --i)
+            {
+                rightBounds = Union(rightBounds, buckets[i].bounds);
+                rightCount += buckets[i].count;
+                rightCounts[i - 1] = rightCount;
+                rightAreas[i - 1] = (0 == rightCount) ? 0 : rightBounds.SurfaceArea();
+            }
+
+            *minCost = Infinity;
+            int minCostSplitBucket = -1;
+            Bounds3f leftBounds;
+            int leftCount = 0;
+            Float invArea = 1 / bounds.SurfaceArea();
+            for (int i = 0; i < NumBuckets - 1; ++i)
+            {
+                leftBounds = Union(leftBounds, buckets[i].bounds);
+                leftCount += buckets[i].count;
+                if ((0 == leftCount) || (0 == rightCounts[i]))
+                {
+                    continue;
+                }
+
+                Float cost = traversalCost + ((LeafTests(leftCount, blockSize) * leftBounds.SurfaceArea())
+                                            + (LeafTests(rightCounts[i], blockSize) * rightAreas[i])) * invArea;
+                if (cost < *minCost)
+                {
+                    *minCost = cost;
+                    minCostSplitBucket = i;
+                }
+            }
+            return minCostSplitBucket;
+        }
+
+        // 把pred为true的图元移到前面，返回分界位置
+        template <typename Predicate>
+        int Partition(BVHPrimitiveInfo *primitiveInfo, int start, int end, Predicate pred)
+        {
+            int n = end - start;
+            if (n < ParallelThreshold)
+            {
+                return (int)(std::partition(&primitiveInfo[start], &primitiveInfo[end], pred) - primitiveInfo);
+            }
+
+            // 先并行统计每块中左侧图元的个数，前缀和得到各块的写入位置后再并行分发
+            int nChunks = (n + ChunkSize - 1) / ChunkSize;
+            std::vector<int> leftCounts(nChunks);
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                int chunkEnd = std::min(end, start + ((int)chunk + 1) * ChunkSize);
+                int count = 0;
+                for (int i = start + (int)chunk * ChunkSize; i < chunkEnd; ++i)
+                {
+                    count += pred(primitiveInfo[i]) ? 1 : 0;
+                }
+                leftCounts[chunk] = count;
+            });
+
+            std::vector<int> leftOffsets(nChunks), rightOffsets(nChunks);
+            int nLeft = 0;
+            for (int chunk = 0; chunk < nChunks; ++chunk)
+            {
+                leftOffsets[chunk] = nLeft;
+                nLeft += leftCounts[chunk];
+            }
+            for (int chunk = 0, nRight = 0; chunk < nChunks; ++chunk)
+            {
+                rightOffsets[chunk] = nLeft + nRight;
+                int chunkSize = std::min(end, start + (chunk + 1) * ChunkSize) - (start + chunk * ChunkSize);
+                nRight += chunkSize - leftCounts[chunk];
+            }
+
+            std::vector<BVHPrimitiveInfo> scratch(n);
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                int chunkEnd = std::min(end, start + ((int)chunk + 1) * ChunkSize);
+                int left = leftOffsets[chunk];
+                int right = rightOffsets[chunk];
+                for (int i = start + (int)chunk * ChunkSize; i < chunkEnd; ++i)
+                {
+                    scratch[pred(primitiveInfo[i]) ? left++ : right++] = primitiveInfo[i];
+                }
+            });
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                int chunkEnd = std::min(n, ((int)chunk + 1) * ChunkSize);
+                std::copy(&scratch[0] + chunk * ChunkSize, &scratch[0] + chunkEnd, &primitiveInfo[start + chunk * ChunkSize]);
+            });
+
+            return start + nLeft;
+        }
+    }
+
+    namespace
+    {
+        // 每个图元的Morton码，index为其在primitiveInfo中的位置
+        struct MortonPrimitive
+        {
+            uint64_t mortonCode;
+            int index;
+        };
+
+        // 把10位整数的各位间隔两个0展开，用于30位Morton码
+        inline uint64_t LeftShift3(uint32_t x)
+        {
+            CHECK_LE(x, (1u << 10));
+            if ((1u << 10) == x) --x;
+            x = (x | (x << 16)) & 0x030000FF;
+            x = (x | (x << 8)) & 0x0300F00F;
+            x = (x | (x << 4)) & 0x030C30C3;
+            x = (x | (x << 2)) & 0x09249249;
+            return x;
+        }
+
+        // 把21位整数的各位间隔两个0展开，用于63位Morton码
+        inline uint64_t LeftShift3_64(uint64_t x)
+        {
+            CHECK_LE(x, (1ull << 21));
+            if ((1ull << 21) == x) --x;
+            x = (x | (x << 32)) & 0x001F00000000FFFFull;
+            x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+            x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+            x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+            x = (x | (x << 2)) & 0x1249249249249249ull;
+            return x;
+        }
+
+        // v的各分量在[0, 2^(bits/3)]内，第3k、3k+1、3k+2位分别来自x、y、z
+        inline uint64_t EncodeMorton3(const Vector3f &v, int bits)
+        {
+            if (30 == bits)
+            {
+                return (LeftShift3((uint32_t)v.z) << 2) | (LeftShift3((uint32_t)v.y) << 1) | LeftShift3((uint32_t)v.x);
+            }
+            return (LeftShift3_64((uint64_t)v.z) << 2) | (LeftShift3_64((uint64_t)v.y) << 1) | LeftShift3_64((uint64_t)v.x);
+        }
+
+        // 并行LSD基数排序，每趟8位：各块先统计直方图，前缀和后再并行分发，保持稳定
+        void RadixSort(std::vector<MortonPrimitive> *v, int nBits)
+        {
+            const int BitsPerPass = 8;
+            const int RadixBuckets = 1 << BitsPerPass;
+            const int nPasses = (nBits + BitsPerPass - 1) / BitsPerPass;
+
+            int n = (int)v->size();
+            int nChunks = (n + ChunkSize - 1) / ChunkSize;
+            std::vector<MortonPrimitive> temp(n);
+            std::vector<int> offsets(nChunks * RadixBuckets);
+            for (int pass = 0; pass < nPasses; ++pass)
+            {
+                const int lowBit = pass * BitsPerPass;
+                const std::vector<MortonPrimitive> &in = (pass & 1) ? temp : *v;
+                std::vector<MortonPrimitive> &out = (pass & 1) ? *v : temp;
+
+                ParallelFor(nChunks, 1, [&](int64_t chunk)
+                {
+                    int *counts = &offsets[chunk * RadixBuckets];
+                    std::fill(counts, counts + RadixBuckets, 0);
+                    int chunkEnd = std::min(n, ((int)chunk + 1) * ChunkSize);
+                    for (int i = (int)chunk * ChunkSize; i < chunkEnd; ++i)
+                    {
+                        ++counts[(in[i].mortonCode >> lowBit) & (RadixBuckets - 1)];
+                    }
+                });
+
+                // 桶优先、块其次的前缀和，得到每块每个桶的起始写入位置
+                int sum = 0;
+                for (int bucket = 0; bucket < RadixBuckets; ++bucket)
+                {
+                    for (int chunk = 0; chunk < nChunks; ++chunk)
+                    {
+                        int count = offsets[chunk * RadixBuckets + bucket];
+                        offsets[chunk * RadixBuckets + bucket] = sum;
+                        sum += count;
+                    }
+                }
+
+                ParallelFor(nChunks, 1, [&](int64_t chunk)
+                {
+                    int *chunkOffsets = &offsets[chunk * RadixBuckets];
+                    int chunkEnd = std::min(n, ((int)chunk + 1) * ChunkSize);
+                    for (int i = (int)chunk * ChunkSize; i < chunkEnd; ++i)
+                    {
+                        out[chunkOffsets[(in[i].mortonCode >> lowBit) & (RadixBuckets - 1)]++] = in[i];
+                    }
+                });
+            }
+
+            if (nPasses & 1)
+            {
+                std::swap(*v, temp);
+            }
+        }
+    }
+
+    BVH::BVH(const std::vector<Bounds3f> &primitiveBounds, int maxPrimsInNode, SplitMethod splitMethod, int leafBlockSize)
+        : maxPrimsInNode(std::min(MaxLeafPrimitives, maxPrimsInNode))
+        , splitMethod(splitMethod)
+        , leafBlockSize(std::max(1, leafBlockSize))
+    {
+        if (primitiveBounds.empty())
+        {
+            return;
+        }
+
+        ProfilePhase _(Prof::BVHBuild);
+        nPrimitives = (int)primitiveBounds.size();
+        std::vector<BVHPrimitiveInfo> primitiveInfo(nPrimitives);
+        ParallelFor(nPrimitives, ChunkSize, [&](int64_t i)
+        {
+            primitiveInfo[i] = BVHPrimitiveInfo((int)i, primitiveBounds[i]);
+        });
+
+        NodeAllocator allocator;
+        BVHBuildNode *root = (SplitMethod::SAH == splitMethod)
+                           ? RecursiveBuild(allocator, &primitiveInfo[0], 0, nPrimitives, 0)
+                           : HLBVHBuild(allocator, primitiveInfo);
+
+        // 各构建方法在层数用完前改为等数量划分，超过时遍历栈会越界
+        CHECK_LE(root->depth, MaxDepth);
+
+        // 节点按深度优先顺序展开到连续且按缓存行对齐的数组中
+        totalNodes = root->subtreeNodes;
+        nodeStorage = AllocAligned<LinearBVHNode>(totalNodes);
+        Flatten(root, 0);
+        nodes = nodeStorage;
+
+        indexStorage.resize(nPrimitives);
+        ParallelFor(nPrimitives, ChunkSize, [&](int64_t i)
+        {
+            indexStorage[i] = primitiveInfo[i].primitiveNumber;
+        });
+        primitiveIndices = indexStorage.data();
+    }
+
+    BVH::BVH(const LinearBVHNode *nodes, int totalNodes
+           , const int *primitiveIndices, int nPrimitives
+           , int maxPrimsInNode, SplitMethod splitMethod, int leafBlockSize
+           , std::shared_ptr<const void> backing)
+        : maxPrimsInNode(maxPrimsInNode)
+        , splitMethod(splitMethod)
+        , leafBlockSize(leafBlockSize)
+        , backing(std::move(backing))
+        , primitiveIndices(primitiveIndices)
+        , nodes(nodes)
+        , totalNodes(totalNodes)
+        , nPrimitives(nPrimitives)
+    {
+        CHECK_EQ((uintptr_t)nodes % alignof(LinearBVHNode), (uintptr_t)0);
+    }
+
+    BVH::~BVH()
+    {
+        FreeAligned(nodeStorage);
+    }
+
+    BVHBuildNode *BVH::RecursiveBuild(NodeAllocator &allocator, BVHPrimitiveInfo *primitiveInfo, int start, int end, int depth)
+    {
+        CHECK_NE(start, end);
+
+        BVHBuildNode *node = allocator.Alloc();
+        int nPrimitives = end - start;
+
+        Bounds3f bounds, centroidBounds;
+        ComputeBounds(primitiveInfo, start, end, &bounds, &centroidBounds);
+
+        if (1 == nPrimitives)
+        {
+            node->InitLeaf(start, nPrimitives, bounds);
+            return node;
+        }
+
+        int dim = centroidBounds.MaximumExtent();
+        int mid = -1;
+        if (centroidBounds.maxPoint[dim] == centroidBounds.minPoint[dim])
+        {
+            // 所有质心重合，无法再划分
+            if (nPrimitives <= MaxLeafPrimitives)
+            {
+                node->InitLeaf(start, nPrimitives, bounds);
+                return node;
+            }
+            mid = (start + end) / 2;
+        }
+        else if ((nPrimitives <= 2) && (1 == leafBlockSize))
+        {
+            mid = (start + end) / 2;
+            std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end]
+                           , [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                           {
+                               return a.centroid[dim] < b.centroid[dim];
+                           });
+        }
+        else
+        {
+            BucketMapping bucketIndex(centroidBounds, dim);
+            BucketInfo buckets[NumBuckets];
+            ComputeBuckets(primitiveInfo, start, end, bucketIndex, buckets);
+
+            Float minCost;
+            int minCostSplitBucket = FindSAHSplit(buckets, bounds, 1, leafBlockSize, &minCost);
+
+            Float leafCost = (Float)LeafTests(nPrimitives, leafBlockSize);
+            if ((nPrimitives <= maxPrimsInNode) && !(minCost < leafCost))
+            {
+                node->InitLeaf(start, nPrimitives, bounds);
+                return node;
+            }
+
+            // 质心极不均匀时按代价划分会生成很深的树
+            if ((minCostSplitBucket >= 0) && !MustSplitEqually(depth, nPrimitives, MaxDepth))
+            {
+                mid = Partition(primitiveInfo, start, end, [=](const BVHPrimitiveInfo &info)
+                {
+                    return bucketIndex(info) <= minCostSplitBucket;
+                });
+            }
+
+            // 所有图元都落在同一个桶里时退化为等数量划分
+            if ((mid <= start) || (mid >= end))
+            {
+                mid = (start + end) / 2;
+                std::nth_element(&primitiveInfo[start], &primitiveInfo[mid], &primitiveInfo[end]
+                               , [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                               {
+                                   return a.centroid[dim] < b.centroid[dim];
+                               });
+            }
+        }
+
+        BVHBuildNode *children[2];
+        if (nPrimitives >= ParallelSubtreeThreshold)
+        {
+            ParallelFor(2, 1, [&](int64_t i)
+            {
+                children[i] = (0 == i) ? RecursiveBuild(allocator, primitiveInfo, start, mid, depth + 1)
+                                       : RecursiveBuild(allocator, primitiveInfo, mid, end, depth + 1);
+            });
+        }
+        else
+        {
+            children[0] = RecursiveBuild(allocator, primitiveInfo, start, mid, depth + 1);
+            children[1] = RecursiveBuild(allocator, primitiveInfo, mid, end, depth + 1);
+        }
+
+        node->InitInterior(dim, children[0], children[1], bounds);
+        return node;
+    }
+
+    void BVH::Flatten(const BVHBuildNode *node, int offset)
+    {
+        LinearBVHNode *linearNode = &nodeStorage[offset];
+        linearNode->bounds = node->bounds;
+        if (node->nPrimitives > 0)
+        {
+            CHECK(!node->children[0] && !node->children[1]);
+            linearNode->primitivesOffset = node->firstPrimOffset;
+            linearNode->nPrimitives = (uint16_t)node->nPrimitives;
+            return;
+        }
+
+        // 第一个子节点紧跟在父节点后面，第二个子节点跳过整棵第一个子树
+        int secondOffset = offset + 1 + node->children[0]->subtreeNodes;
+        linearNode->axis = (uint8_t)node->splitAxis;
+        linearNode->nPrimitives = 0;
+        linearNode->secondChildOffset = secondOffset;
+
+        if (node->subtreeNodes >= ParallelSubtreeThreshold)
+        {
+            ParallelFor(2, 1, [&](int64_t i)
+            {
+                Flatten(node->children[i], (0 == i) ? (offset + 1) : secondOffset);
+            });
+        }
+        else
+        {
+            Flatten(node->children[0], offset + 1);
+            Flatten(node->children[1], secondOffset);
+        }
+    }
+
+    BVHBuildNode *BVH::HLBVHBuild(NodeAllocator &allocator, std::vector<BVHPrimitiveInfo> &primitiveInfo)
+    {
+        int nPrimitives = (int)primitiveInfo.size();
+
+        Bounds3f bounds, centroidBounds;
+        ComputeBounds(&primitiveInfo[0], 0, nPrimitives, &bounds, &centroidBounds);
+
+        // 图元较多时10位/轴的量化会产生大量重复编码，改用21位/轴的63位编码
+        const int mortonBits = (nPrimitives > (1 << 20)) ? 63 : 30;
+        const Float mortonScale = (Float)(1ull << (mortonBits / 3));
+
+        std::vector<MortonPrimitive> mortonPrims(nPrimitives);
+        ParallelFor(nPrimitives, ChunkSize, [&](int64_t i)
+        {
+            mortonPrims[i].index = (int)i;
+            mortonPrims[i].mortonCode = EncodeMorton3(centroidBounds.Offset(primitiveInfo[i].centroid) * mortonScale, mortonBits);
+        });
+
+        RadixSort(&mortonPrims, mortonBits);
+
+        // 按Morton顺序重排图元，之后每个叶子都对应一段连续的区间
+        std::vector<BVHPrimitiveInfo> sortedInfo(nPrimitives);
+        std::vector<uint64_t> mortonCodes(nPrimitives);
+        ParallelFor(nPrimitives, ChunkSize, [&](int64_t i)
+        {
+            sortedInfo[i] = primitiveInfo[mortonPrims[i].index];
+            mortonCodes[i] = mortonPrims[i].mortonCode;
+        });
+        primitiveInfo.swap(sortedInfo);
+        std::vector<MortonPrimitive>().swap(mortonPrims);
+
+        if (SplitMethod::LBVH == splitMethod)
+        {
+            return EmitLBVH(allocator, &primitiveInfo[0], &mortonCodes[0], 0, nPrimitives, mortonBits - 1, 0);
+        }
+
+        // 最高12位相同的图元组成一个子树，最多4096个子树并行生成
+        const int TreeletBits = 12;
+        const int firstBitIndex = mortonBits - 1 - TreeletBits;
+        const uint64_t treeletMask = ((1ull << TreeletBits) - 1) << (mortonBits - TreeletBits);
+
+        std::vector<int> treeletStarts;
+        for (int start = 0, end = 1; end <= nPrimitives; ++end)
+        {
+            if ((nPrimitives == end) || ((mortonCodes[start] & treeletMask) != (mortonCodes[end] & treeletMask)))
+            {
+                treeletStarts.push_back(start);
+                start = end;
+            }
+        }
+        treeletStarts.push_back(nPrimitives);
+
+        int nTreelets = (int)treeletStarts.size() - 1;
+        std::vector<BVHBuildNode *> treeletRoots(nTreelets);
+        ParallelFor(nTreelets, 1, [&](int64_t i)
+        {
+            treeletRoots[i] = EmitLBVH(allocator, &primitiveInfo[0], &mortonCodes[0]
+                                     , treeletStarts[i], treeletStarts[i + 1], firstBitIndex, UpperTreeMaxDepth);
+        });
+
+        return BuildUpperSAH(allocator, &treeletRoots[0], 0, nTreelets, 0);
+    }
+
+    BVHBuildNode *BVH::EmitLBVH(NodeAllocator &allocator
+                              , const BVHPrimitiveInfo *primitiveInfo
+                              , const uint64_t *mortonCodes
+                              , int start
+                              , int end
+                              , int bitIndex
+                              , int depth)
+    {
+        CHECK_LT(start, end);
+        int nPrimitives = end - start;
+
+        // 跳过区间内所有编码都相同的位
+        while ((bitIndex >= 0) && (nPrimitives > maxPrimsInNode))
+        {
+            uint64_t mask = 1ull << bitIndex;
+            if ((mortonCodes[start] & mask) != (mortonCodes[end - 1] & mask))
+            {
+                break;
+            }
+            --bitIndex;
+        }
+
+        int mid;
+        int axis;
+        if ((bitIndex < 0) || (nPrimitives <= maxPrimsInNode))
+        {
+            if (nPrimitives <= MaxLeafPrimitives)
+            {
+                Bounds3f bounds, centroidBounds;
+                ComputeBounds(primitiveInfo, start, end, &bounds, &centroidBounds);
+
+                BVHBuildNode *node = allocator.Alloc();
+                node->InitLeaf(start, nPrimitives, bounds);
+                return node;
+            }
+
+            // 编码完全相同的图元太多，放不进一个叶子
+            mid = (start + end) / 2;
+            axis = 0;
+        }
+        else if (MustSplitEqually(depth, nPrimitives, MaxDepth))
+        {
+            // 编码按位划分每层可能只分出一个图元，层数不够时改为按数量对半划分
+            mid = (start + end) / 2;
+            axis = bitIndex % 3;
+        }
+        else
+        {
+            // 编码有序，区间内该位从0变为1的位置就是划分点
+            uint64_t mask = 1ull << bitIndex;
+            mid = (int)(std::partition_point(mortonCodes + start, mortonCodes + end, [mask](uint64_t code)
+            {
+                return 0 == (code & mask);
+            }) - mortonCodes);
+            axis = bitIndex % 3;
+            --bitIndex;
+        }
+        CHECK((mid > start) && (mid < end));
+
+        BVHBuildNode *children[2];
+        if (nPrimitives >= ParallelSubtreeThreshold)
+        {
+            ParallelFor(2, 1, [&](int64_t i)
+            {
+                children[i] = (0 == i) ? EmitLBVH(allocator, primitiveInfo, mortonCodes, start, mid, bitIndex, depth + 1)
+                                       : EmitLBVH(allocator, primitiveInfo, mortonCodes, mid, end, bitIndex, depth + 1);
+            });
+        }
+        else
+        {
+            children[0] = EmitLBVH(allocator, primitiveInfo, mortonCodes, start, mid, bitIndex, depth + 1);
+            children[1] = EmitLBVH(allocator, primitiveInfo, mortonCodes, mid, end, bitIndex, depth + 1);
+        }
+
+        BVHBuildNode *node = allocator.Alloc();
+        node->InitInterior(axis, children[0], children[1], Union(children[0]->bounds, children[1]->bounds));
+        return node;
+    }
+
+    BVHBuildNode *BVH::BuildUpperSAH(NodeAllocator &allocator, BVHBuildNode **treeletRoots, int start, int end, int depth)
+    {
+        CHECK_LT(start, end);
+        int nNodes = end - start;
+        if (1 == nNodes)
+        {
+            return treeletRoots[start];
+        }
+
+        Bounds3f bounds, centroidBounds;
+        for (int i = start; i < end; ++i)
+        {
+            bounds = Union(bounds, treeletRoots[i]->bounds);
+            centroidBounds = Union(centroidBounds, (0.5f * treeletRoots[i]->bounds.minPoint) + (0.5f * treeletRoots[i]->bounds.maxPoint));
+        }
+
+        int dim = centroidBounds.MaximumExtent();
+        int mid = (start + end) / 2;
+        if ((centroidBounds.maxPoint[dim] != centroidBounds.minPoint[dim]) && !MustSplitEqually(depth, nNodes, UpperTreeMaxDepth))
+        {
+            auto bucketOf = [&](const BVHBuildNode *node)
+            {
+                Float centroid = (node->bounds.minPoint[dim] + node->bounds.maxPoint[dim]) * 0.5f;
+                int b = (int)(NumBuckets * ((centroid - centroidBounds.minPoint[dim])
+                                          / (centroidBounds.maxPoint[dim] - centroidBounds.minPoint[dim])));
+                return std::min(b, NumBuckets - 1);
+            };
+
+            BucketInfo buckets[NumBuckets];
+            for (int i = start; i < end; ++i)
+            {
+                BucketInfo &bucket = buckets[bucketOf(treeletRoots[i])];
+                ++bucket.count;
+                bucket.bounds = Union(bucket.bounds, treeletRoots[i]->bounds);
+            }
+
+            // 子树之间的遍历代价相对较低
+            Float minCost;
+            int minCostSplitBucket = FindSAHSplit(buckets, bounds, 0.125f, 1, &minCost);
+
+            if (minCostSplitBucket >= 0)
+            {
+                mid = (int)(std::partition(&treeletRoots[start], &treeletRoots[end], [&](const BVHBuildNode *node)
+                {
+                    return bucketOf(node) <= minCostSplitBucket;
+                }) - treeletRoots);
+            }
+        }
+        CHECK((mid > start) && (mid < end));
+
+        BVHBuildNode *node = allocator.Alloc();
+        node->InitInterior(dim
+                         , BuildUpperSAH(allocator, treeletRoots, start, mid, depth + 1)
+                         , BuildUpperSAH(allocator, treeletRoots, mid, end, depth + 1)
+                         , bounds);
+        return node;
+    }
+}
@@ -0,0 +1,278 @@
+﻿#pragma once
+
+#include "Src/Core/Geometry.h"
+#include "Src/Core/Profiler.h"
+#include "Src/Core/Stats.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace PBRT
+{
+    struct BVHBuildNode;
+    struct BVHPrimitiveInfo;
+
+    // 展开后的BVH节点，32字节对齐，一条缓存行正好放两个节点
+    // 内部节点的第一个子节点紧跟在自己后面，只需记录第二个子节点的位置
+    struct alignas(32) LinearBVHNode
+    {
+        Bounds3f bounds;
+        union
+        {
+            int primitivesOffset;   // 叶子节点
+            int secondChildOffset;  // 内部节点
+        };
+        uint16_t nPrimitives;       // 0表示内部节点
+        uint8_t axis;               // 内部节点的划分轴
+        uint8_t pad[1];
+    };
+
+    // 只依赖图元包围盒的BVH，构建完成后用PrimitiveIndices()把叶子中的下标映射回原图元
+    class BVH
+    {
+    public:
+        enum class SplitMethod
+        {
+            SAH,    // 分桶SAH，构建最慢但树的质量最好
+            LBVH,   // 按Morton码排序后直接按编码位划分，适合每帧重建
+            HLBVH,  // 底层按Morton码生成子树，顶层再用SAH组合
+        };
+
+        // 根到叶子路径上内部节点数的上限，遍历栈按它分配
+        // @remarks: 构建时剩余层数不够时改为等数量划分，任何输入都不会超过
+        static const int MaxDepth = 128;
+
+        // leafBlockSize: 叶子中的图元按多少个一组做SIMD测试，SAH按组数而不是图元数估计叶子代价
+        // @remarks: 构建过程会使用ParallelFor，在ParallelInit()之后调用才会并行
+        BVH(const std::vector<Bounds3f> &primitiveBounds
+          , int maxPrimsInNode = 4
+          , SplitMethod splitMethod = SplitMethod::SAH
+          , int leafBlockSize = 1);
+
+        // 直接引用已展开的节点和图元下标，不复制；backing保证它们在BVH销毁前一直有效（如场景缓存的内存映射）
+        // @remarks: nodes必须按LinearBVHNode的要求对齐
+        BVH(const LinearBVHNode *nodes, int totalNodes
+          , const int *primitiveIndices, int nPrimitives
+          , int maxPrimsInNode, SplitMethod splitMethod, int leafBlockSize
+          , std::shared_ptr<const void> backing);
+        ~BVH();
+
+        BVH(const BVH &) = delete;
+        BVH &operator=(const BVH &) = delete;
+
+        Bounds3f WorldBound(void) const
+        {
+            return (nullptr != nodes) ? nodes[0].bounds : Bounds3f();
+        }
+
+        const LinearBVHNode *Nodes(void) const
+        {
+            return nodes;
+        }
+
+        int NodeCount(void) const
+        {
+            return totalNodes;
+        }
+
+        const int *PrimitiveIndices(void) const
+        {
+            return primitiveIndices;
+        }
+
+        int PrimitiveCount(void) const
+        {
+            return nPrimitives;
+        }
+
+        int MaxPrimsInNode(void) const
+        {
+            return maxPrimsInNode;
+        }
+
+        SplitMethod GetSplitMethod(void) const
+        {
+            return splitMethod;
+        }
+
+        int LeafBlockSize(void) const
+        {
+            return leafBlockSize;
+        }
+
+        // 由近到远遍历，intersectPrimitive(primitiveIndex, ray)命中时应更新ray.tMax并返回true
+        template <typename Func>
+        bool Intersect(const Ray &ray, Func &&intersectPrimitive) const;
+
+        // 只判断是否有遮挡，遇到第一个命中就返回
+        template <typename Func>
+        bool IntersectP(const Ray &ray, Func &&intersectPrimitiveP) const;
+
+        // 以叶子为单位回调visitLeaf(nodeIndex, ray)，用于叶子另外存放了预处理数据（如SoA三角形块）的情况，
+        // 返回值约定与intersectPrimitive相同
+        template <typename Func>
+        bool IntersectLeaves(const Ray &ray, Func &&visitLeaf) const;
+
+        template <typename Func>
+        bool IntersectPLeaves(const Ray &ray, Func &&visitLeafP) const;
+
+    private:
+        class NodeAllocator;
+
+        BVHBuildNode *RecursiveBuild(NodeAllocator &allocator, BVHPrimitiveInfo *primitiveInfo, int start, int end, int depth);
+        BVHBuildNode *HLBVHBuild(NodeAllocator &allocator, std::vector<BVHPrimitiveInfo> &primitiveInfo);
+        BVHBuildNode *EmitLBVH(NodeAllocator &allocator
+                             , const BVHPrimitiveInfo *primitiveInfo
+                             , const uint64_t *mortonCodes
+                             , int start
+                             , int end
+                             , int bitIndex
+                             , int depth);
+        BVHBuildNode *BuildUpperSAH(NodeAllocator &allocator, BVHBuildNode **treeletRoots, int start, int end, int depth);
+        void Flatten(const BVHBuildNode *node, int offset);
+
+        template <bool AnyHit, typename Func>
+        bool VisitPrimitives(const LinearBVHNode &leaf, const Ray &ray, Func &intersectPrimitive) const;
+
+        template <bool AnyHit, typename Func>
+        bool Traverse(const Ray &ray, Func &visitLeaf) const;
+
+        const int maxPrimsInNode;
+        const SplitMethod splitMethod;
+        const int leafBlockSize;
+
+        std::vector<int> indexStorage;
+        LinearBVHNode *nodeStorage = nullptr;
+        std::shared_ptr<const void> backing;
+
+        // 指向上面的存储或backing持有的外部内存
+        const int *primitiveIndices = nullptr;
+        const LinearBVHNode *nodes = nullptr;
+        int totalNodes = 0;
+        int nPrimitives = 0;
+    };
+
+    template <typename Func>
+    inline bool BVH::Intersect(const Ray &ray, Func &&intersectPrimitive) const
+    {
+        auto visitLeaf = [&](int nodeIndex, const Ray &r)
+        {
+            return VisitPrimitives<false>(nodes[nodeIndex], r, intersectPrimitive);
+        };
+        return Traverse<false>(ray, visitLeaf);
+    }
+
+    template <typename Func>
+    inline bool BVH::IntersectP(const Ray &ray, Func &&intersectPrimitiveP) const
+    {
+        auto visitLeaf = [&](int nodeIndex, const Ray &r)
+        {
+            return VisitPrimitives<true>(nodes[nodeIndex], r, intersectPrimitiveP);
+        };
+        return Traverse<true>(ray, visitLeaf);
+    }
+
+    template <typename Func>
+    inline bool BVH::IntersectLeaves(const Ray &ray, Func &&visitLeaf) const
+    {
+        return Traverse<false>(ray, visitLeaf);
+    }
+
+    template <typename Func>
+    inline bool BVH::IntersectPLeaves(const Ray &ray, Func &&visitLeafP) const
+    {
+        return Traverse<true>(ray, visitLeafP);
+    }
+
+    // 在BVH.cpp中定义
+    STAT_EXTERN_COUNTER(nBVHRays);
+    STAT_EXTERN_RATIO(nBVHNodesVisited, nBVHNodeRays);
+    STAT_EXTERN_COUNTER(nBVHBoxTests);
+    STAT_EXTERN_PERCENT(nBVHPrimitiveHits, nBVHPrimitiveTests);
+
+    template <bool AnyHit, typename Func>
+    inline bool BVH::VisitPrimitives(const LinearBVHNode &leaf, const Ray &ray, Func &intersectPrimitive) const
+    {
+        bool hit = false;
+        nBVHPrimitiveTests += leaf.nPrimitives;
+        for (int i = 0; i < leaf.nPrimitives; ++i)
+        {
+            if (intersectPrimitive(primitiveIndices[leaf.primitivesOffset + i], ray))
+            {
+                ++nBVHPrimitiveHits;
+                if (AnyHit)
+                {
+                    return true;
+                }
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+    template <bool AnyHit, typename Func>
+    inline bool BVH::Traverse(const Ray &ray, Func &visitLeaf) const
+    {
+        if (nullptr == nodes)
+        {
+            return false;
+        }
+
+        ProfilePhase _(Prof::Traversal);
+        ++nBVHRays;
+        ++nBVHNodeRays;
+
+        Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+        int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+        bool hit = false;
+        int toVisitOffset = 0;
+        int currentNodeIndex = 0;
+        int nodesToVisit[MaxDepth];
+        while (true)
+        {
+            const LinearBVHNode *node = &nodes[currentNodeIndex];
+            ++nBVHBoxTests;
+            if (node->bounds.IntersectP(ray, invDir, dirIsNeg))
+            {
+                ++nBVHNodesVisited;
+                if (node->nPrimitives > 0)
+                {
+                    if (visitLeaf(currentNodeIndex, ray))
+                    {
+                        if (AnyHit)
+                        {
+                            return true;
+                        }
+                        hit = true;
+                    }
+
+                    if (0 == toVisitOffset) break;
+                    currentNodeIndex = nodesToVisit[--toVisitOffset];
+                }
+                else
+                {
+                    // 先访问光线方向上更近的子节点
+                    DCHECK_LT(toVisitOffset, MaxDepth);
+                    if (dirIsNeg[node->axis])
+                    {
+                        nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                        currentNodeIndex = node->secondChildOffset;
+                    }
+                    else
+                    {
+                        nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                        currentNodeIndex = currentNodeIndex + 1;
+                    }
+                }
+            }
+            else
+            {
+                if (0 == toVisitOffset) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+        }
+
+        return hit;
+    }
+}
@@ -0,0 +1,168 @@
+﻿#include "WideBVH.h"
+#include "Src/Core/Memory.h"
+#include <algorithm>
+
+namespace PBRT
+{
+    STAT_COUNTER("WideBVH/Rays traced", nWideBVHRays);
+    STAT_RATIO("WideBVH/Nodes visited per ray", nWideBVHNodesVisited, nWideBVHNodeRays);
+    STAT_COUNTER("WideBVH/Ray-box tests", nWideBVHBoxTests);
+    STAT_PERCENT("WideBVH/Primitive tests that hit", nWideBVHPrimitiveHits, nWideBVHPrimitiveTests);
+
+    namespace
+    {
+        // 选择2的幂次的量化步长，使255个步长能覆盖整个父包围盒
+        int QuantizationExponent(Float minValue, Float maxValue)
+        {
+            int exponent;
+            std::frexp((maxValue - minValue) / 255, &exponent);
+            exponent = std::min(std::max(exponent, -126), 127);
+
+            // 浮点加法的舍入可能让最后一格差一点，不够时再放大一倍
+            while ((exponent < 127) && ((minValue + 255 * std::ldexp((Float)1, exponent)) < maxValue))
+            {
+                ++exponent;
+            }
+            return exponent;
+        }
+
+        // 向外取整：解码出的下界不大于原下界，上界不小于原上界
+        void Quantize(Float origin, Float scale, Float minValue, Float maxValue, uint8_t *qMin, uint8_t *qMax)
+        {
+            int lo = (int)std::floor((minValue - origin) / scale);
+            lo = std::min(std::max(lo, 0), 255);
+            while ((lo > 0) && ((origin + lo * scale) > minValue))
+            {
+                --lo;
+            }
+
+            int hi = (int)std::ceil((maxValue - origin) / scale);
+            hi = std::min(std::max(hi, 0), 255);
+            while ((hi < 255) && ((origin + hi * scale) < maxValue))
+            {
+                ++hi;
+            }
+
+            *qMin = (uint8_t)lo;
+            *qMax = (uint8_t)hi;
+        }
+    }
+
+    template <int N>
+    WideBVH<N>::WideBVH(const BVH &bvh)
+        : worldBound(bvh.WorldBound())
+        , primitiveIndices(bvh.PrimitiveIndices(), bvh.PrimitiveIndices() + bvh.PrimitiveCount())
+    {
+        if (0 == bvh.NodeCount())
+        {
+            return;
+        }
+
+        ProfilePhase _(Prof::BVHBuild);
+        std::vector<WideBVHNode<N>> wideNodes;
+        wideNodes.reserve(bvh.NodeCount() / (N - 1) + 1);
+        Collapse(bvh.Nodes(), 0, &wideNodes);
+
+        totalNodes = (int)wideNodes.size();
+        nodes = AllocAligned<WideBVHNode<N>>(totalNodes);
+        std::copy(wideNodes.begin(), wideNodes.end(), nodes);
+    }
+
+    template <int N>
+    WideBVH<N>::~WideBVH()
+    {
+        FreeAligned(nodes);
+    }
+
+    template <int N>
+    int WideBVH<N>::Collapse(const LinearBVHNode *binaryNodes, int binaryIndex, std::vector<WideBVHNode<N>> *wideNodes)
+    {
+        const LinearBVHNode &binaryNode = binaryNodes[binaryIndex];
+
+        // 从两个子节点开始，每次把表面积最大的内部子节点展开成它的两个子节点，直到凑满N个
+        int children[N];
+        int nChildren = 0;
+        if (0 == binaryNode.nPrimitives)
+        {
+            children[nChildren++] = binaryIndex + 1;
+            children[nChildren++] = binaryNode.secondChildOffset;
+        }
+        else
+        {
+            // 整棵树只有一个叶子
+            children[nChildren++] = binaryIndex;
+        }
+
+        while (nChildren < N)
+        {
+            int best = -1;
+            Float bestArea = -1;
+            for (int i = 0; i < nChildren; ++i)
+            {
+                const LinearBVHNode &child = binaryNodes[children[i]];
+                if ((0 == child.nPrimitives) && (child.bounds.SurfaceArea() > bestArea))
+                {
+                    best = i;
+                    bestArea = child.bounds.SurfaceArea();
+                }
+            }
+            if (best < 0)
+            {
+                break;
+            }
+
+            int expanded = children[best];
+            children[best] = expanded + 1;
+            children[nChildren++] = binaryNodes[expanded].secondChildOffset;
+        }
+
+        // 先占位，递归时wideNodes会扩容，之后只能通过下标访问
+        int wideIndex = (int)wideNodes->size();
+        wideNodes->push_back(WideBVHNode<N>());
+
+        WideBVHNode<N> node;
+        std::memset(&node, 0, sizeof(node));
+        const Bounds3f &parentBounds = binaryNode.bounds;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            node.origin[axis] = parentBounds.minPoint[axis];
+            node.exponent[axis] = (int8_t)QuantizationExponent(parentBounds.minPoint[axis], parentBounds.maxPoint[axis]);
+        }
+        node.nChildren = (uint8_t)nChildren;
+
+        uint8_t *const qMin[3] = { node.qMinX, node.qMinY, node.qMinZ };
+        uint8_t *const qMax[3] = { node.qMaxX, node.qMaxY, node.qMaxZ };
+        for (int i = 0; i < N; ++i)
+        {
+            if (i >= nChildren)
+            {
+                // 空槽位解码为min > max，同时被nChildren屏蔽
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    qMin[axis][i] = 255;
+                    qMax[axis][i] = 0;
+                }
+                node.child[i] = -1;
+                continue;
+            }
+
+            const LinearBVHNode &child = binaryNodes[children[i]];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                Quantize(node.origin[axis], node.Scale(axis)
+                       , child.bounds.minPoint[axis], child.bounds.maxPoint[axis]
+                       , &qMin[axis][i], &qMax[axis][i]);
+            }
+
+            node.nPrimitives[i] = child.nPrimitives;
+            node.child[i] = (child.nPrimitives > 0) ? child.primitivesOffset
+                                                    : Collapse(binaryNodes, children[i], wideNodes);
+        }
+
+        (*wideNodes)[wideIndex] = node;
+        return wideIndex;
+    }
+
+    template class WideBVH<4>;
+    template class WideBVH<8>;
+}
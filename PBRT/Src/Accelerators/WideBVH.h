@@ -0,0 +1,263 @@
+﻿#pragma once
+
+#include "BVH.h"
+#include "Src/Core/BoundsPacket.h"
+#include "Src/Core/SIMD.h"
+#include <cmath>
+#include <cstring>
+
+namespace PBRT
+{
+    // N叉BVH节点，子节点包围盒以父包围盒为基准量化到8位并按SoA存放
+    // 子包围盒 = origin + q * 2^exponent，量化时向外取整，保证只会变大不会变小
+    // @remarks: N为4时正好一条缓存行（64字节），N为8时两条
+    template <int N>
+    struct alignas(64) WideBVHNode
+    {
+        // 把量化的子包围盒解码成浮点，供一次性的SIMD slab测试使用
+        void Decode(Bounds3Packet<N> *bounds) const;
+
+        Float Scale(int axis) const
+        {
+            return std::ldexp((Float)1, exponent[axis]);
+        }
+
+        Float origin[3];
+        int8_t exponent[3];
+        uint8_t nChildren;
+
+        uint8_t qMinX[N], qMinY[N], qMinZ[N];
+        uint8_t qMaxX[N], qMaxY[N], qMaxZ[N];
+
+        // nPrimitives为0时child为子节点下标，否则为叶子的第一个图元在PrimitiveIndices()中的位置
+        int32_t child[N];
+        uint16_t nPrimitives[N];
+    };
+
+    // 由二叉BVH塌缩得到的4叉/8叉BVH，遍历时一次SIMD测试全部子节点
+    template <int N>
+    class WideBVH
+    {
+        static_assert((4 == N) || (8 == N), "WideBVH only supports 4 or 8 children");
+
+    public:
+        explicit WideBVH(const BVH &bvh);
+        ~WideBVH();
+
+        WideBVH(const WideBVH &) = delete;
+        WideBVH &operator=(const WideBVH &) = delete;
+
+        Bounds3f WorldBound(void) const
+        {
+            return worldBound;
+        }
+
+        const WideBVHNode<N> *Nodes(void) const
+        {
+            return nodes;
+        }
+
+        int NodeCount(void) const
+        {
+            return totalNodes;
+        }
+
+        size_t NodeMemory(void) const
+        {
+            return totalNodes * sizeof(WideBVHNode<N>);
+        }
+
+        const std::vector<int> &PrimitiveIndices(void) const
+        {
+            return primitiveIndices;
+        }
+
+        // 与BVH::Intersect相同的回调约定
+        template <typename Func>
+        bool Intersect(const Ray &ray, Func &&intersectPrimitive) const;
+
+        template <typename Func>
+        bool IntersectP(const Ray &ray, Func &&intersectPrimitiveP) const;
+
+    private:
+        int Collapse(const LinearBVHNode *binaryNodes, int binaryIndex, std::vector<WideBVHNode<N>> *wideNodes);
+
+        template <bool AnyHit, typename Func>
+        bool Traverse(const Ray &ray, Func &intersectPrimitive) const;
+
+        Bounds3f worldBound;
+        std::vector<int> primitiveIndices;
+        WideBVHNode<N> *nodes = nullptr;
+        int totalNodes = 0;
+    };
+
+    typedef WideBVH<4> BVH4;
+    typedef WideBVH<8> BVH8;
+
+    template <int N>
+    inline void WideBVHNode<N>::Decode(Bounds3Packet<N> *bounds) const
+    {
+        const uint8_t *const q[2][3] = { { qMinX, qMinY, qMinZ }, { qMaxX, qMaxY, qMaxZ } };
+        Float *const planes[2][3] = { { bounds->minX, bounds->minY, bounds->minZ }
+                                    , { bounds->maxX, bounds->maxY, bounds->maxZ } };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            Float scale = Scale(axis);
+            for (int side = 0; side < 2; ++side)
+            {
+                for (int i = 0; i < N; ++i)
+                {
+                    planes[side][axis][i] = origin[axis] + q[side][axis][i] * scale;
+                }
+            }
+        }
+    }
+
+#ifdef PBRT_HAVE_SSE
+    namespace SIMD
+    {
+        // 4个8位无符号整数转成4个float
+        inline __m128 LoadU8x4(const uint8_t *q)
+        {
+            int32_t packed;
+            std::memcpy(&packed, q, sizeof(packed));
+            return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+        }
+    }
+
+    template <>
+    inline void WideBVHNode<4>::Decode(Bounds3Packet<4> *bounds) const
+    {
+        const uint8_t *const q[2][3] = { { qMinX, qMinY, qMinZ }, { qMaxX, qMaxY, qMaxZ } };
+        Float *const planes[2][3] = { { bounds->minX, bounds->minY, bounds->minZ }
+                                    , { bounds->maxX, bounds->maxY, bounds->maxZ } };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // q * 2^e是精确的，只有加法会舍入，与构建时的校验方式一致
+            __m128 o = _mm_set1_ps(origin[axis]);
+            __m128 scale = _mm_set1_ps(Scale(axis));
+            _mm_store_ps(planes[0][axis], _mm_add_ps(o, _mm_mul_ps(SIMD::LoadU8x4(q[0][axis]), scale)));
+            _mm_store_ps(planes[1][axis], _mm_add_ps(o, _mm_mul_ps(SIMD::LoadU8x4(q[1][axis]), scale)));
+        }
+    }
+
+#ifdef PBRT_HAVE_AVX
+    template <>
+    inline void WideBVHNode<8>::Decode(Bounds3Packet<8> *bounds) const
+    {
+        const uint8_t *const q[2][3] = { { qMinX, qMinY, qMinZ }, { qMaxX, qMaxY, qMaxZ } };
+        Float *const planes[2][3] = { { bounds->minX, bounds->minY, bounds->minZ }
+                                    , { bounds->maxX, bounds->maxY, bounds->maxZ } };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            __m256 o = _mm256_set1_ps(origin[axis]);
+            __m256 scale = _mm256_set1_ps(Scale(axis));
+            for (int side = 0; side < 2; ++side)
+            {
+                __m256 value = _mm256_insertf128_ps(_mm256_castps128_ps256(SIMD::LoadU8x4(q[side][axis]))
+                                                  , SIMD::LoadU8x4(q[side][axis] + 4), 1);
+                _mm256_store_ps(planes[side][axis], _mm256_add_ps(o, _mm256_mul_ps(value, scale)));
+            }
+        }
+    }
+#endif // PBRT_HAVE_AVX
+#endif // PBRT_HAVE_SSE
+
+    template <int N>
+    template <typename Func>
+    inline bool WideBVH<N>::Intersect(const Ray &ray, Func &&intersectPrimitive) const
+    {
+        return Traverse<false>(ray, intersectPrimitive);
+    }
+
+    template <int N>
+    template <typename Func>
+    inline bool WideBVH<N>::IntersectP(const Ray &ray, Func &&intersectPrimitiveP) const
+    {
+        return Traverse<true>(ray, intersectPrimitiveP);
+    }
+
+    // 在WideBVH.cpp中定义
+    STAT_EXTERN_COUNTER(nWideBVHRays);
+    STAT_EXTERN_RATIO(nWideBVHNodesVisited, nWideBVHNodeRays);
+    STAT_EXTERN_COUNTER(nWideBVHBoxTests);
+    STAT_EXTERN_PERCENT(nWideBVHPrimitiveHits, nWideBVHPrimitiveTests);
+
+    template <int N>
+    template <bool AnyHit, typename Func>
+    inline bool WideBVH<N>::Traverse(const Ray &ray, Func &intersectPrimitive) const
+    {
+        if (nullptr == nodes)
+        {
+            return false;
+        }
+
+        ProfilePhase _(Prof::Traversal);
+        Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+        int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+        ++nWideBVHRays;
+        ++nWideBVHNodeRays;
+
+        Bounds3Packet<N> childBounds;
+        alignas(64) Float tEntry[N];
+
+        bool hit = false;
+        int toVisitOffset = 0;
+        // 每层最多压入N - 1个子节点，宽BVH的层数不超过二叉BVH
+        int nodesToVisit[BVH::MaxDepth * (N - 1) + 1];
+        nodesToVisit[toVisitOffset++] = 0;
+        while (toVisitOffset > 0)
+        {
+            const WideBVHNode<N> &node = nodes[nodesToVisit[--toVisitOffset]];
+            node.Decode(&childBounds);
+            ++nWideBVHNodesVisited;
+            nWideBVHBoxTests += node.nChildren;
+
+            uint32_t mask = PBRT::IntersectP(childBounds, ray, invDir, dirIsNeg, tEntry) & ((1u << node.nChildren) - 1);
+
+            // 命中的内部子节点按进入距离从远到近压栈，保证先访问近的
+            int hitChildren[N];
+            int nHitChildren = 0;
+            for (; 0 != mask; mask &= (mask - 1))
+            {
+                int i = 0;
+                while (0 == (mask & (1u << i))) ++i;
+
+                if (node.nPrimitives[i] > 0)
+                {
+                    nWideBVHPrimitiveTests += node.nPrimitives[i];
+                    for (int p = 0; p < node.nPrimitives[i]; ++p)
+                    {
+                        if (intersectPrimitive(primitiveIndices[node.child[i] + p], ray))
+                        {
+                            ++nWideBVHPrimitiveHits;
+                            if (AnyHit)
+                            {
+                                return true;
+                            }
+                            hit = true;
+                        }
+                    }
+                }
+                else
+                {
+                    int j = nHitChildren++;
+                    for (; (j > 0) && (tEntry[hitChildren[j - 1]] < tEntry[i]); --j)
+                    {
+                        hitChildren[j] = hitChildren[j - 1];
+                    }
+                    hitChildren[j] = i;
+                }
+            }
+
+            for (int j = 0; j < nHitChildren; ++j)
+            {
+                DCHECK_LT(toVisitOffset, BVH::MaxDepth * (N - 1) + 1);
+                nodesToVisit[toVisitOffset++] = node.child[hitChildren[j]];
+            }
+        }
+
+        return hit;
+    }
+}
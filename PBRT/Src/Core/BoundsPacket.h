@@ -0,0 +1,195 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "RayPacket.h"
+#include "SIMD.h"
+#include <cstdint>
+
+namespace PBRT
+{
+    // N个包围盒按SoA存放，用于一条光线同时测试多个包围盒（如宽BVH的子节点）
+    template <int N>
+    class Bounds3Packet
+    {
+        static_assert((4 == N) || (8 == N) || (16 == N), "Bounds3Packet only supports 4/8/16 lanes");
+
+    public:
+        Bounds3Packet()
+        {
+            for (int i = 0; i < N; ++i)
+            {
+                Set(i, Bounds3f());
+            }
+        }
+
+        void Set(int i, const Bounds3f &b)
+        {
+            DCHECK((i >= 0) && (i < N));
+            minX[i] = b.minPoint.x;
+            minY[i] = b.minPoint.y;
+            minZ[i] = b.minPoint.z;
+            maxX[i] = b.maxPoint.x;
+            maxY[i] = b.maxPoint.y;
+            maxZ[i] = b.maxPoint.z;
+        }
+
+        Bounds3f Get(int i) const
+        {
+            DCHECK((i >= 0) && (i < N));
+            Bounds3f b;
+            b.minPoint = Point3f(minX[i], minY[i], minZ[i]);
+            b.maxPoint = Point3f(maxX[i], maxY[i], maxZ[i]);
+            return b;
+        }
+
+        // 按dirIsNeg取近平面(0)或远平面(1)所在的数组
+        const Float *Slab(int axis, int isFar) const
+        {
+            const Float *const planes[2][3] = { { minX, minY, minZ }, { maxX, maxY, maxZ } };
+            return planes[isFar][axis];
+        }
+
+        // 默认构造的空包围盒min > max，永远不会被命中
+        alignas(64) Float minX[N];
+        alignas(64) Float minY[N];
+        alignas(64) Float minZ[N];
+        alignas(64) Float maxX[N];
+        alignas(64) Float maxY[N];
+        alignas(64) Float maxZ[N];
+    };
+
+    typedef Bounds3Packet<4> Bounds3fx4;
+    typedef Bounds3Packet<8> Bounds3fx8;
+
+    // 一条光线同时与N个包围盒求交，返回命中掩码（第i位对应第i个包围盒）
+    // @remarks: tEntry非空时输出每个包围盒的进入距离，可用于由近到远遍历子节点
+    template <int N>
+    inline uint32_t IntersectP(const Bounds3Packet<N> &bounds
+                             , const Ray &ray
+                             , const Vector3f &invDir
+                             , const int dirIsNeg[3]
+                             , Float *tEntry = nullptr)
+    {
+        const Float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        const Float inv[3] = { invDir.x, invDir.y, invDir.z };
+        const Float farScale = 1 + 2 * Gamma(3);
+
+        alignas(64) Float tNear[N];
+        alignas(64) Float tFar[N];
+        for (int i = 0; i < N; ++i)
+        {
+            tNear[i] = 0;
+            tFar[i] = ray.tMax;
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const Float *nearPlane = bounds.Slab(axis, dirIsNeg[axis]);
+            const Float *farPlane = bounds.Slab(axis, 1 - dirIsNeg[axis]);
+            for (int i = 0; i < N; ++i)
+            {
+                Float t0 = (nearPlane[i] - origin[axis]) * inv[axis];
+                Float t1 = (farPlane[i] - origin[axis]) * inv[axis] * farScale;
+                tNear[i] = (t0 > tNear[i]) ? t0 : tNear[i];
+                tFar[i] = (t1 < tFar[i]) ? t1 : tFar[i];
+            }
+        }
+
+        uint32_t mask = 0;
+        for (int i = 0; i < N; ++i)
+        {
+            mask |= (uint32_t)(tNear[i] <= tFar[i]) << i;
+            if (nullptr != tEntry) tEntry[i] = tNear[i];
+        }
+        return mask;
+    }
+
+#ifdef PBRT_HAVE_SSE
+    template <>
+    inline uint32_t IntersectP(const Bounds3Packet<4> &bounds
+                             , const Ray &ray
+                             , const Vector3f &invDir
+                             , const int dirIsNeg[3]
+                             , Float *tEntry)
+    {
+        const Float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        const Float inv[3] = { invDir.x, invDir.y, invDir.z };
+        const __m128 farScale = _mm_set1_ps(1 + 2 * Gamma(3));
+
+        __m128 tNear = _mm_setzero_ps();
+        __m128 tFar = _mm_set1_ps(ray.tMax);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            __m128 o = _mm_set1_ps(origin[axis]);
+            __m128 d = _mm_set1_ps(inv[axis]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds.Slab(axis, dirIsNeg[axis])), o), d);
+            __m128 t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds.Slab(axis, 1 - dirIsNeg[axis])), o), d), farScale);
+
+            // maxps/minps在有NaN时返回第二个操作数，因此把累积值放在第二位
+            tNear = _mm_max_ps(t0, tNear);
+            tFar = _mm_min_ps(t1, tFar);
+        }
+
+        if (nullptr != tEntry) _mm_storeu_ps(tEntry, tNear);
+        return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+    }
+#endif // PBRT_HAVE_SSE
+
+#ifdef PBRT_HAVE_AVX
+    template <>
+    inline uint32_t IntersectP(const Bounds3Packet<8> &bounds
+                             , const Ray &ray
+                             , const Vector3f &invDir
+                             , const int dirIsNeg[3]
+                             , Float *tEntry)
+    {
+        const Float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        const Float inv[3] = { invDir.x, invDir.y, invDir.z };
+        const __m256 farScale = _mm256_set1_ps(1 + 2 * Gamma(3));
+
+        __m256 tNear = _mm256_setzero_ps();
+        __m256 tFar = _mm256_set1_ps(ray.tMax);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            __m256 o = _mm256_set1_ps(origin[axis]);
+            __m256 d = _mm256_set1_ps(inv[axis]);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds.Slab(axis, dirIsNeg[axis])), o), d);
+            __m256 t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds.Slab(axis, 1 - dirIsNeg[axis])), o), d), farScale);
+
+            tNear = _mm256_max_ps(t0, tNear);
+            tFar = _mm256_min_ps(t1, tFar);
+        }
+
+        if (nullptr != tEntry) _mm256_storeu_ps(tEntry, tNear);
+        return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+    }
+#endif // PBRT_HAVE_AVX
+
+    // 光线包中的N条光线同时与一个包围盒求交，只测试激活的通道，返回命中掩码
+    template <int N>
+    inline uint32_t IntersectP(const Bounds3f &bounds, const RayPacket<N> &rays)
+    {
+        const Float farScale = 1 + 2 * Gamma(3);
+
+        uint32_t mask = 0;
+        for (int i = 0; i < N; ++i)
+        {
+            Float t0 = 0;
+            Float t1 = rays.tMax[i];
+            const Float origin[3] = { rays.originX[i], rays.originY[i], rays.originZ[i] };
+            const Float dir[3] = { rays.dirX[i], rays.dirY[i], rays.dirZ[i] };
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                Float inv = 1 / dir[axis];
+                Float tNear = (bounds.minPoint[axis] - origin[axis]) * inv;
+                Float tFar = (bounds.maxPoint[axis] - origin[axis]) * inv;
+                if (tNear > tFar) std::swap(tNear, tFar);
+                tFar *= farScale;
+                t0 = (tNear > t0) ? tNear : t0;
+                t1 = (tFar < t1) ? tFar : t1;
+            }
+            mask |= (uint32_t)(t0 <= t1) << i;
+        }
+        return (mask & rays.activeMask);
+    }
+}
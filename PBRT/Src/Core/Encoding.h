@@ -0,0 +1,155 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // 半精度浮点
+    // ----------------------------------------------------------------------------
+    inline uint32_t FloatToBits(float f)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+
+    inline float BitsToFloat(uint32_t bits)
+    {
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // 按就近舍入到偶数转换，超出范围的值变为无穷大
+    inline uint16_t FloatToHalf(float f)
+    {
+        uint32_t bits = FloatToBits(f);
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        uint16_t half;
+        if (bits >= 0x47800000u)
+        {
+            // 溢出或者本身是无穷大/NaN
+            half = (bits > 0x7F800000u) ? 0x7E00 : 0x7C00;
+        }
+        else if (bits < 0x38800000u)
+        {
+            // 结果是非规格化数或0：加上一个魔数让尾数对齐到最低10位，由浮点加法完成舍入
+            const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+            half = (uint16_t)(FloatToBits(BitsToFloat(bits) + BitsToFloat(magicBits)) - magicBits);
+        }
+        else
+        {
+            uint32_t mantissaOdd = (bits >> 13) & 1;
+            bits += ((uint32_t)(15 - 127) << 23) + 0xFFF + mantissaOdd;
+            half = (uint16_t)(bits >> 13);
+        }
+        return (uint16_t)(half | (sign >> 16));
+    }
+
+    inline float HalfToFloat(uint16_t half)
+    {
+        const uint32_t shiftedExponent = 0x7C00u << 13;
+        uint32_t bits = (half & 0x7FFFu) << 13;
+        uint32_t exponent = bits & shiftedExponent;
+        bits += (uint32_t)(127 - 15) << 23;
+        if (shiftedExponent == exponent)
+        {
+            // 无穷大/NaN
+            bits += (uint32_t)(128 - 16) << 23;
+        }
+        else if (0 == exponent)
+        {
+            // 非规格化数
+            bits += 1u << 23;
+            bits = FloatToBits(BitsToFloat(bits) - BitsToFloat(113u << 23));
+        }
+        return BitsToFloat(bits | ((uint32_t)(half & 0x8000u) << 16));
+    }
+
+    // ----------------------------------------------------------------------------
+    // 八面体法线编码：单位球按L1范数投影到八面体再展开到正方形，每个分量16位
+    // @remarks: 最大角度误差约0.004度
+    // ----------------------------------------------------------------------------
+    inline uint32_t EncodeOctahedral(const Vector3f &v)
+    {
+        Float invL1 = 1 / (std::abs(v.x) + std::abs(v.y) + std::abs(v.z));
+        Float x = v.x * invL1;
+        Float y = v.y * invL1;
+        if (v.z < 0)
+        {
+            Float xo = x;
+            x = (1 - std::abs(y)) * std::copysign((Float)1, xo);
+            y = (1 - std::abs(xo)) * std::copysign((Float)1, y);
+        }
+
+        auto encode = [](Float f) -> uint32_t
+        {
+            return (uint32_t)std::round(Clamp((f + 1) / 2, (Float)0, (Float)1) * 65535);
+        };
+        return encode(x) | (encode(y) << 16);
+    }
+
+    inline Vector3f DecodeOctahedral(uint32_t encoded)
+    {
+        Float x = -1 + 2 * ((Float)(encoded & 0xFFFF) / 65535);
+        Float y = -1 + 2 * ((Float)(encoded >> 16) / 65535);
+        Float z = 1 - (std::abs(x) + std::abs(y));
+        if (z < 0)
+        {
+            Float xo = x;
+            x = (1 - std::abs(y)) * std::copysign((Float)1, xo);
+            y = (1 - std::abs(xo)) * std::copysign((Float)1, y);
+        }
+        return Normalize(Vector3f(x, y, z));
+    }
+
+    // ----------------------------------------------------------------------------
+    // 在包围盒内量化到每轴16位的点
+    // ----------------------------------------------------------------------------
+    struct QuantizedPoint3
+    {
+        uint16_t x, y, z;
+    };
+
+    // 量化参数：p = origin + q * scale
+    struct PointQuantizer
+    {
+        PointQuantizer(void)
+        {}
+
+        explicit PointQuantizer(const Bounds3f &bounds)
+            : origin(bounds.minPoint)
+        {
+            Vector3f extent = bounds.Diagonal();
+            scale = Vector3f(extent.x / 65535, extent.y / 65535, extent.z / 65535);
+        }
+
+        QuantizedPoint3 Encode(const Point3f &p) const
+        {
+            auto encode = [](Float value, Float origin, Float scale) -> uint16_t
+            {
+                return (0 == scale) ? 0 : (uint16_t)Clamp(std::round((value - origin) / scale), (Float)0, (Float)65535);
+            };
+
+            QuantizedPoint3 q;
+            q.x = encode(p.x, origin.x, scale.x);
+            q.y = encode(p.y, origin.y, scale.y);
+            q.z = encode(p.z, origin.z, scale.z);
+            return q;
+        }
+
+        Point3f Decode(const QuantizedPoint3 &q) const
+        {
+            return Point3f(origin.x + (q.x * scale.x), origin.y + (q.y * scale.y), origin.z + (q.z * scale.z));
+        }
+
+        Point3f origin;
+        Vector3f scale;
+    };
+}
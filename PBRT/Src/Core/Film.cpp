@@ -0,0 +1,48 @@
+#include "Film.h"
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // FilmTile
+    // ----------------------------------------------------------------------------
+    void FilmTile::Reset(const Bounds2i &bounds)
+    {
+        pixelBounds = bounds;
+        pixels.assign(std::max(0, bounds.Area()), FilmPixel());
+    }
+
+    // ----------------------------------------------------------------------------
+    // Film
+    // ----------------------------------------------------------------------------
+    Film::Film(const Point2i &resolution)
+        : fullResolution(resolution)
+        , pixels((size_t)resolution.x * resolution.y)
+    {
+        CHECK((resolution.x > 0) && (resolution.y > 0));
+    }
+
+    void Film::MergeFilmTile(const FilmTile &tile)
+    {
+        ProfilePhase _(Prof::FilmAddSample);
+        Bounds2i bounds = Intersect(tile.PixelBounds(), PixelBounds());
+        for (Point2i p : bounds)
+        {
+            const FilmPixel &from = tile.GetPixel(p);
+            FilmPixel &to = pixels[((size_t)p.y * fullResolution.x) + p.x];
+            to.rgbSum[0] += from.rgbSum[0];
+            to.rgbSum[1] += from.rgbSum[1];
+            to.rgbSum[2] += from.rgbSum[2];
+            to.weightSum += from.weightSum;
+        }
+    }
+
+    void Film::GetPixelRGB(const Point2i &p, Float rgb[3]) const
+    {
+        DCHECK(InsideExclusive(p, PixelBounds()));
+        const FilmPixel &pixel = pixels[((size_t)p.y * fullResolution.x) + p.x];
+        Float invWeight = (0 != pixel.weightSum) ? (1 / pixel.weightSum) : 0;
+        rgb[0] = pixel.rgbSum[0] * invWeight;
+        rgb[1] = pixel.rgbSum[1] * invWeight;
+        rgb[2] = pixel.rgbSum[2] * invWeight;
+    }
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "Profiler.h"
+#include <vector>
+
+namespace PBRT
+{
+    // 像素中样本的加权RGB之和与权重之和，输出时相除
+    struct FilmPixel
+    {
+        Float rgbSum[3] = { 0, 0, 0 };
+        Float weightSum = 0;
+    };
+
+    // 胶片上的一块矩形区域，由一个线程独占地写入，完成后再累加到胶片上
+    // @remarks: 每个样本只贡献给它所在的像素（盒式滤波），不同瓦片的像素互不重叠
+    class FilmTile
+    {
+    public:
+        // 切换到新的像素范围并清零，已分配的存储会被复用
+        void Reset(const Bounds2i &bounds);
+
+        const Bounds2i &PixelBounds(void) const
+        {
+            return pixelBounds;
+        }
+
+        void AddSample(const Point2i &pixel, const Float rgb[3], Float weight = 1)
+        {
+            ProfilePhase _(Prof::FilmAddSample);
+            FilmPixel &p = GetPixel(pixel);
+            p.rgbSum[0] += weight * rgb[0];
+            p.rgbSum[1] += weight * rgb[1];
+            p.rgbSum[2] += weight * rgb[2];
+            p.weightSum += weight;
+        }
+
+        FilmPixel &GetPixel(const Point2i &p)
+        {
+            DCHECK(InsideExclusive(p, pixelBounds));
+            int width = pixelBounds.maxPoint.x - pixelBounds.minPoint.x;
+            return pixels[((p.y - pixelBounds.minPoint.y) * width) + (p.x - pixelBounds.minPoint.x)];
+        }
+
+        const FilmPixel &GetPixel(const Point2i &p) const
+        {
+            return const_cast<FilmTile *>(this)->GetPixel(p);
+        }
+
+    private:
+        Bounds2i pixelBounds;
+        std::vector<FilmPixel> pixels;
+    };
+
+    class Film
+    {
+    public:
+        explicit Film(const Point2i &resolution);
+
+        Bounds2i PixelBounds(void) const
+        {
+            return Bounds2i(Point2i(0, 0), fullResolution);
+        }
+
+        // 把瓦片累加到胶片上
+        // @remarks: 不加锁，像素范围不重叠的瓦片可以从多个线程同时写回
+        void MergeFilmTile(const FilmTile &tile);
+
+        // 加权平均后的颜色，没有样本的像素为黑色
+        void GetPixelRGB(const Point2i &p, Float rgb[3]) const;
+
+        const Point2i fullResolution;
+
+    private:
+        std::vector<FilmPixel> pixels;
+    };
+}
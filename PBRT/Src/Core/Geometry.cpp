@@ -1 +1,62 @@
-#include "Geometry.h"
+﻿#include "Geometry.h"
+
+namespace PBRT
+{
+    void CoordinateSystems(const Normal3f *n, Vector3f *ss, Vector3f *ts, size_t count)
+    {
+        size_t i = 0;
+#ifdef PBRT_HAVE_SSE
+        // 与标量版本相同的运算顺序，结果逐位一致
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; (i + 4) <= count; i += 4)
+        {
+            __m128 x, y, z;
+            SIMD::LoadSoA3x4(&n[i].x, &x, &y, &z);
+
+            __m128 sign = SIMD::SignOf(z);
+            __m128 a = SIMD::Negate(_mm_div_ps(one, _mm_add_ps(sign, z)));
+            __m128 b = _mm_mul_ps(_mm_mul_ps(x, y), a);
+            SIMD::StoreSoA3x4(_mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(sign, x), x), a))
+                            , _mm_mul_ps(sign, b)
+                            , _mm_mul_ps(SIMD::Negate(sign), x)
+                            , &ss[i].x);
+            SIMD::StoreSoA3x4(b
+                            , _mm_add_ps(sign, _mm_mul_ps(_mm_mul_ps(y, y), a))
+                            , SIMD::Negate(y)
+                            , &ts[i].x);
+        }
+#endif // PBRT_HAVE_SSE
+        for (; i < count; ++i)
+        {
+            CoordinateSystem(Vector3f(n[i]), &ss[i], &ts[i]);
+        }
+    }
+
+    void Cross(const Vector3f *v1, const Vector3f *v2, Vector3f *result, size_t count)
+    {
+        size_t i = 0;
+#ifdef PBRT_HAVE_SSE
+        for (; (i + 4) <= count; i += 4)
+        {
+            __m128 ax, ay, az, bx, by, bz;
+            SIMD::LoadSoA3x4(&v1[i].x, &ax, &ay, &az);
+            SIMD::LoadSoA3x4(&v2[i].x, &bx, &by, &bz);
+#ifdef PBRT_HAVE_FMA
+            SIMD::StoreSoA3x4(SIMD::DifferenceOfProducts(ay, bz, az, by)
+                            , SIMD::DifferenceOfProducts(az, bx, ax, bz)
+                            , SIMD::DifferenceOfProducts(ax, by, ay, bx)
+                            , &result[i].x);
+#else
+            SIMD::StoreSoA3x4(SIMD::DifferenceOfProductsDouble(ay, bz, az, by)
+                            , SIMD::DifferenceOfProductsDouble(az, bx, ax, bz)
+                            , SIMD::DifferenceOfProductsDouble(ax, by, ay, bx)
+                            , &result[i].x);
+#endif // PBRT_HAVE_FMA
+        }
+#endif // PBRT_HAVE_SSE
+        for (; i < count; ++i)
+        {
+            result[i] = Cross(v1[i], v2[i]);
+        }
+    }
+}
@@ -1,11 +1,18 @@
 ﻿#pragma once
 
 #include "PBRT.h"
-#include "Medium.h"
+#include "SIMD.h"
 #include "glog/logging.h"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 
 namespace PBRT
 {
+    class Medium;
+
     template <typename T>
     inline bool isNaN(const T x)
     {
@@ -281,13 +288,6 @@ namespace PBRT
             DCHECK(!HasNaNs());
         }
 
-        Point2(const Point2<T> &p)
-        {
-            DCHECK(!p.HasNaNs());
-            x = p.x;
-            y = p.y;
-        }
-
         explicit Point2(const Point3<T> &p)
             : x(p.x), y(p.y)
         {
@@ -437,14 +437,6 @@ namespace PBRT
             DCHECK(!HasNaNs());
         }
 
-        Point3(const Point3<T> &p)
-        {
-            DCHECK(!p.HasNaNs());
-            x = p.x;
-            y = p.y;
-            z = p.z;
-        }
-
         template <typename U>
         explicit Point3(const Point3<U> &p)
         {
@@ -516,7 +508,7 @@ namespace PBRT
         Vector3<T> operator-(const Point3<T> &p) const
         {
             DCHECK(!p.HasNaNs());
-            return Vector3<T>(x - p.x, y - p.y, z - p.y);
+            return Vector3<T>(x - p.x, y - p.y, z - p.z);
         }
 
         template <typename U>
@@ -621,6 +613,8 @@ namespace PBRT
         T x, y, z;
     };
 
+    typedef Normal3<Float> Normal3f;
+
     class Ray
     {
     public:
@@ -719,6 +713,12 @@ namespace PBRT
             return (maxPoint - minPoint);
         }
 
+        T Area() const
+        {
+            Vector2<T> diagonal = Diagonal();
+            return (diagonal.x * diagonal.y);
+        }
+
         int MaximumExtent() const
         {
             Vector2<T> diagonal = Diagonal();
@@ -805,6 +805,22 @@ namespace PBRT
                          , ::Lerp(t.z, minPoint.z, maxPoint.z));
         }
 
+        // 点在包围盒内的相对位置，minPoint处为0，maxPoint处为1
+        Vector3<T> Offset(const Point3<T> &p) const
+        {
+            Vector3<T> o = p - minPoint;
+            if (maxPoint.x > minPoint.x) o.x /= (maxPoint.x - minPoint.x);
+            if (maxPoint.y > minPoint.y) o.y /= (maxPoint.y - minPoint.y);
+            if (maxPoint.z > minPoint.z) o.z /= (maxPoint.z - minPoint.z);
+            return o;
+        }
+
+        // 光线与包围盒求交（slab方法），命中时返回进入和离开的参数t
+        bool IntersectP(const Ray &ray, Float *hitt0 = nullptr, Float *hitt1 = nullptr) const;
+
+        // BVH遍历用的快速版本，invDir和dirIsNeg由调用者对每条光线预先计算一次
+        bool IntersectP(const Ray &ray, const Vector3f &invDir, const int dirIsNeg[3]) const;
+
         Point3<T> minPoint, maxPoint;
     };
 
@@ -813,6 +829,16 @@ namespace PBRT
     typedef Bounds3<Float> Bounds3f;
     typedef Bounds3<int>   Bounds3i;
 
+    // 场景缓存按字节读写这些类型的数组（见SceneCache.h），不能有自定义的复制、析构或虚函数
+    static_assert(std::is_trivially_copyable<Vector2f>::value && std::is_standard_layout<Vector2f>::value, "Vector2f must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Vector3f>::value && std::is_standard_layout<Vector3f>::value, "Vector3f must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Point2f>::value && std::is_standard_layout<Point2f>::value, "Point2f must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Point3f>::value && std::is_standard_layout<Point3f>::value, "Point3f must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Normal3f>::value && std::is_standard_layout<Normal3f>::value, "Normal3f must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Bounds3f>::value && std::is_standard_layout<Bounds3f>::value, "Bounds3f must be trivially copyable");
+    static_assert((sizeof(Point2f) == 2 * sizeof(Float)) && (sizeof(Point3f) == 3 * sizeof(Float)) && (sizeof(Normal3f) == 3 * sizeof(Float))
+                , "geometry types must not be padded");
+
     // --------------------------------------------------------------------
     // Vector2 functions
     template <typename T, typename U>
@@ -888,15 +914,16 @@ namespace PBRT
     template <typename T>
     inline Vector3<T> Cross(const Vector3<T> &v1, const Vector3<T> &v2)
     {
-        // 避免单精度浮点情况下引起的误差错误
-        double v1x = v1.x, v1y = v1.y, v1z = v1.z;
-        double v2x = v2.x, v2y = v2.y, v2z = v2.z;
-
-        return Vector3<T>((T)(v1y * v2z - v1z * v2y),
-                          (T)(v1z * v2x - v1x * v2z),
-                          (T)(v1x * v2y - v1y * v2x));
+        // 每个分量都是两个乘积之差，由DifferenceOfProducts处理抵消误差
+        return Vector3<T>(DifferenceOfProducts(v1.y, v2.z, v1.z, v2.y),
+                          DifferenceOfProducts(v1.z, v2.x, v1.x, v2.z),
+                          DifferenceOfProducts(v1.x, v2.y, v1.y, v2.x));
     }
 
+    // 批量叉积：result[i] = Cross(v1[i], v2[i])
+    // @remarks: 启用SIMD时每次以SoA形式处理4组向量
+    void Cross(const Vector3f *v1, const Vector3f *v2, Vector3f *result, size_t count);
+
     template <typename T>
     inline Vector3<T> Normalize(const Vector3<T> &v)
     {
@@ -939,24 +966,22 @@ namespace PBRT
         return Vector3<T>(v[xIndex], v[yIndex], v[zIndex]);
     }
 
-    // 通过单个向量构建坐标系
-    // @remarks: v1应该是单位向量
+    // 通过单个向量构建坐标系，(v2, v3, v1)构成右手正交基
+    // @remarks: v1应该是单位向量；采用Duff等人的无分支构造，只需一次倒数，没有开方
     template <typename T>
     inline void CoordinateSystem(const Vector3<T> &v1, Vector3<T> *v2, Vector3<T> *v3)
     {
-        // 把较小的分量置为0，可以防止出现(0, 0, 0)向量的情况
-        if (std::abs(v1.x) > std::abs(v1.y))
-        {
-            *v2 = Vector3<T>(-v1.z, 0, v1.x) / std::sqrt(v1.x * v1.x + v1.z * v1.z);
-        }
-        else
-        {
-            *v2 = Vector3<T>(0, v1.z, -v1.y) / std::sqrt(v1.y * v1.y + v1.z * v1.z);
-        }
-
-        *v3 = Cross(v1, *v2);
+        T sign = std::copysign(T(1), v1.z);
+        T a = -1 / (sign + v1.z);
+        T b = v1.x * v1.y * a;
+        *v2 = Vector3<T>(1 + (sign * v1.x * v1.x * a), sign * b, -sign * v1.x);
+        *v3 = Vector3<T>(b, sign + (v1.y * v1.y * a), -v1.y);
     }
 
+    // 批量为网格的每个单位法线生成切线框架，ss[i]、ts[i]与CoordinateSystem(n[i])的结果相同
+    // @remarks: 启用SIMD时每次处理4个法线
+    void CoordinateSystems(const Normal3f *n, Vector3f *ss, Vector3f *ts, size_t count);
+
     // --------------------------------------------------------------------
     // Point2 functions
     template <typename T, typename U>
@@ -1211,6 +1236,69 @@ namespace PBRT
                         , b.maxPoint + Vector2<U>(delta, delta));
     }
 
+    // 按行遍历Bounds2i中的每个像素，范围为[minPoint, maxPoint)：for (Point2i p : bounds)
+    class Bounds2iIterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Point2i value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Point2i *pointer;
+        typedef const Point2i &reference;
+
+        Bounds2iIterator(const Bounds2i &b, const Point2i &p)
+            : p(p), bounds(&b)
+        {}
+
+        Bounds2iIterator &operator++()
+        {
+            if (++p.x == bounds->maxPoint.x)
+            {
+                p.x = bounds->minPoint.x;
+                ++p.y;
+            }
+            return *this;
+        }
+
+        Bounds2iIterator operator++(int)
+        {
+            Bounds2iIterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const Bounds2iIterator &it) const
+        {
+            return (p.x == it.p.x) && (p.y == it.p.y) && (bounds == it.bounds);
+        }
+
+        bool operator!=(const Bounds2iIterator &it) const
+        {
+            return !(*this == it);
+        }
+
+        const Point2i &operator*() const
+        {
+            return p;
+        }
+
+    private:
+        Point2i p;
+        const Bounds2i *bounds;
+    };
+
+    inline Bounds2iIterator begin(const Bounds2i &b)
+    {
+        return Bounds2iIterator(b, b.minPoint);
+    }
+
+    inline Bounds2iIterator end(const Bounds2i &b)
+    {
+        // 空的范围让begin与end相等
+        bool empty = (b.minPoint.x >= b.maxPoint.x) || (b.minPoint.y >= b.maxPoint.y);
+        return Bounds2iIterator(b, empty ? b.minPoint : Point2i(b.minPoint.x, b.maxPoint.y));
+    }
+
     // --------------------------------------------------------------------
     // Bound3 functions
     template <typename T>
@@ -1291,4 +1379,112 @@ namespace PBRT
         return Bounds3<T>(b.minPoint - Vector3<U>(delta, delta, delta)
                         , b.maxPoint + Vector3<U>(delta, delta, delta));
     }
+
+    template <typename T>
+    inline bool Bounds3<T>::IntersectP(const Ray &ray, Float *hitt0, Float *hitt1) const
+    {
+        Float t0 = 0;
+        Float t1 = ray.tMax;
+        for (int i = 0; i < 3; ++i)
+        {
+            // 方向分量为0时倒数为无穷大，tNear和tFar也会是正确的无穷大
+            Float invRayDir = 1 / ray.dir[i];
+            Float tNear = (minPoint[i] - ray.origin[i]) * invRayDir;
+            Float tFar = (maxPoint[i] - ray.origin[i]) * invRayDir;
+            if (tNear > tFar)
+            {
+                std::swap(tNear, tFar);
+            }
+
+            // 放大tFar以覆盖舍入误差，保证薄包围盒不会被漏掉
+            tFar *= 1 + 2 * Gamma(3);
+
+            // 写成这种形式是为了让NaN（0 * 无穷大）时保留原来的值
+            t0 = (tNear > t0) ? tNear : t0;
+            t1 = (tFar < t1) ? tFar : t1;
+            if (t0 > t1)
+            {
+                return false;
+            }
+        }
+
+        if (nullptr != hitt0) *hitt0 = t0;
+        if (nullptr != hitt1) *hitt1 = t1;
+        return true;
+    }
+
+    template <typename T>
+    inline bool Bounds3<T>::IntersectP(const Ray &ray, const Vector3f &invDir, const int dirIsNeg[3]) const
+    {
+        const Bounds3<T> &bounds = *this;
+
+        Float tMin = (bounds[dirIsNeg[0]].x - ray.origin.x) * invDir.x;
+        Float tMax = (bounds[1 - dirIsNeg[0]].x - ray.origin.x) * invDir.x;
+        Float tyMin = (bounds[dirIsNeg[1]].y - ray.origin.y) * invDir.y;
+        Float tyMax = (bounds[1 - dirIsNeg[1]].y - ray.origin.y) * invDir.y;
+
+        tMax *= 1 + 2 * Gamma(3);
+        tyMax *= 1 + 2 * Gamma(3);
+        if ((tMin > tyMax) || (tyMin > tMax))
+        {
+            return false;
+        }
+        if (tyMin > tMin) tMin = tyMin;
+        if (tyMax < tMax) tMax = tyMax;
+
+        Float tzMin = (bounds[dirIsNeg[2]].z - ray.origin.z) * invDir.z;
+        Float tzMax = (bounds[1 - dirIsNeg[2]].z - ray.origin.z) * invDir.z;
+
+        tzMax *= 1 + 2 * Gamma(3);
+        if ((tMin > tzMax) || (tzMin > tMax))
+        {
+            return false;
+        }
+        if (tzMin > tMin) tMin = tzMin;
+        if (tzMax < tMax) tMax = tzMax;
+
+        return (tMin < ray.tMax) && (tMax > 0);
+    }
+
+#ifdef PBRT_HAVE_SSE
+    // --------------------------------------------------------------------
+    // float版本的SSE特化，结果与通用模板相同，包括有NaN时的处理
+    // @remarks: 通用模板的std::fmin/std::fmax通常不会内联，这里快3倍左右；
+    //           Dot和Normalize用_mm_dp_ps并不比标量版本快，装入和取出分量的开销抵消了收益，所以没有特化
+    template <>
+    inline Vector3<float> Min(const Vector3<float> &v1, const Vector3<float> &v2)
+    {
+        Vector3<float> result;
+        SIMD::Store3(SIMD::FMin(SIMD::Set3(v1.x, v1.y, v1.z), SIMD::Set3(v2.x, v2.y, v2.z))
+                   , &result.x, &result.y, &result.z);
+        return result;
+    }
+
+    template <>
+    inline Vector3<float> Max(const Vector3<float> &v1, const Vector3<float> &v2)
+    {
+        Vector3<float> result;
+        SIMD::Store3(SIMD::FMax(SIMD::Set3(v1.x, v1.y, v1.z), SIMD::Set3(v2.x, v2.y, v2.z))
+                   , &result.x, &result.y, &result.z);
+        return result;
+    }
+
+    template <>
+    inline Point3<float> Min(const Point3<float> &p1, const Point3<float> &p2)
+    {
+        Point3<float> result;
+        SIMD::Store3(SIMD::FMin(SIMD::Set3(p1.x, p1.y, p1.z), SIMD::Set3(p2.x, p2.y, p2.z))
+                   , &result.x, &result.y, &result.z);
+        return result;
+    }
+
+    template <>
+    inline Point3<float> Max(const Point3<float> &p1, const Point3<float> &p2)
+    {
+        Point3<float> result;
+        SIMD::Store3(SIMD::FMax(SIMD::Set3(p1.x, p1.y, p1.z), SIMD::Set3(p2.x, p2.y, p2.z))
+                   , &result.x, &result.y, &result.z);
+        return result;
+    }
+#endif // PBRT_HAVE_SSE
 }
@@ -0,0 +1,139 @@
+﻿#include "MappedFile.h"
+#include "glog/logging.h"
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace PBRT
+{
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+#ifdef _WIN32
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+
+        HANDLE fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr
+                                      , OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (INVALID_HANDLE_VALUE == fileHandle)
+        {
+            LOG(ERROR) << "Unable to open \"" << filename << "\": error " << GetLastError();
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize))
+        {
+            LOG(ERROR) << "Unable to get the size of \"" << filename << "\": error " << GetLastError();
+            CloseHandle(fileHandle);
+            return false;
+        }
+
+        file = fileHandle;
+        size = (size_t)fileSize.QuadPart;
+        if (0 == size)
+        {
+            // 空文件不能创建映射，用一个非空指针表示已打开
+            data = "";
+            return true;
+        }
+
+        mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (nullptr != mapping)
+        {
+            data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (nullptr == data)
+        {
+            LOG(ERROR) << "Unable to map \"" << filename << "\": error " << GetLastError();
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::Close(void)
+    {
+        if ((nullptr != data) && (0 != size))
+        {
+            UnmapViewOfFile(data);
+        }
+        if (nullptr != mapping)
+        {
+            CloseHandle(mapping);
+        }
+        if (nullptr != file)
+        {
+            CloseHandle(file);
+        }
+        data = nullptr;
+        size = 0;
+        mapping = nullptr;
+        file = nullptr;
+    }
+#else
+    bool MappedFile::Open(const std::string &filename)
+    {
+        Close();
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            PLOG(ERROR) << "Unable to open \"" << filename << "\"";
+            return false;
+        }
+
+        struct stat fileStat;
+        if (0 != fstat(fd, &fileStat))
+        {
+            PLOG(ERROR) << "Unable to get the size of \"" << filename << "\"";
+            close(fd);
+            return false;
+        }
+
+        size = (size_t)fileStat.st_size;
+        if (0 == size)
+        {
+            data = "";
+            close(fd);
+            return true;
+        }
+
+        // 映射建立后即可关闭文件描述符
+        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == ptr)
+        {
+            PLOG(ERROR) << "Unable to map \"" << filename << "\"";
+            size = 0;
+            return false;
+        }
+        madvise(ptr, size, MADV_WILLNEED);
+
+        data = (const char *)ptr;
+        return true;
+    }
+
+    void MappedFile::Close(void)
+    {
+        if ((nullptr != data) && (0 != size))
+        {
+            munmap((void *)data, size);
+        }
+        data = nullptr;
+        size = 0;
+    }
+#endif
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include <cstddef>
+#include <string>
+
+namespace PBRT
+{
+    // 只读的内存映射文件，文件内容按需由操作系统换入，不占用进程的堆内存
+    // @remarks: 映射的起始地址按页对齐
+    class MappedFile
+    {
+    public:
+        MappedFile(void)
+        {}
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        // 失败时输出错误日志并返回false
+        bool Open(const std::string &filename);
+
+        void Close(void);
+
+        bool IsOpen(void) const
+        {
+            return (nullptr != data);
+        }
+
+        const char *Data(void) const
+        {
+            return data;
+        }
+
+        size_t Size(void) const
+        {
+            return size;
+        }
+
+    private:
+        const char *data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        void *file = nullptr;
+        void *mapping = nullptr;
+#endif
+    };
+}
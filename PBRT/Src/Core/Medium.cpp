@@ -0,0 +1,99 @@
+﻿#include "Medium.h"
+#include "ParamSet.h"
+#include "Profiler.h"
+#include "Sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // HenyeyGreenstein
+    // ----------------------------------------------------------------------------
+    Float PhaseHG(Float cosTheta, Float g)
+    {
+        Float denom = 1 + (g * g) + (2 * g * cosTheta);
+        return (Inv4Pi * (1 - (g * g)) / (denom * std::sqrt(denom)));
+    }
+
+    Float HenyeyGreenstein::Sample_p(const Vector3f &wo, Vector3f *wi, const Point2f &u) const
+    {
+        // 反演HG的累积分布得到wo与wi夹角的余弦，g接近0时公式数值不稳定，直接均匀采样球面
+        Float cosTheta;
+        if (std::abs(g) < 1e-3f)
+        {
+            cosTheta = 1 - (2 * u.x);
+        }
+        else
+        {
+            Float sqrTerm = (1 - (g * g)) / (1 + g - (2 * g * u.x));
+            cosTheta = -(1 + (g * g) - (sqrTerm * sqrTerm)) / (2 * g);
+        }
+
+        Float sinTheta = std::sqrt(std::max((Float)0, 1 - (cosTheta * cosTheta)));
+        Float phi = 2 * Pi * u.y;
+        Vector3f v1, v2;
+        CoordinateSystem(wo, &v1, &v2);
+        *wi = (v1 * (sinTheta * std::cos(phi))) + (v2 * (sinTheta * std::sin(phi))) + (wo * cosTheta);
+        return PhaseHG(cosTheta, g);
+    }
+
+    // ----------------------------------------------------------------------------
+    // HomogeneousMedium
+    // ----------------------------------------------------------------------------
+    HomogeneousMedium::HomogeneousMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g)
+        : sigma_a(sigma_a), sigma_s(sigma_s), sigma_t(sigma_a + sigma_s), g(g)
+    {}
+
+    Spectrum HomogeneousMedium::Tr(const Ray &ray, Sampler &) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        // tMax为无穷大时避免0 * inf
+        Float distance = std::min(ray.tMax * ray.dir.Length(), std::numeric_limits<Float>::max());
+        return Exp(-sigma_t * distance);
+    }
+
+    Spectrum HomogeneousMedium::Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        // 随机选一个通道，按该通道的σt指数分布采样距离；pdf取三个通道的平均（单样本MIS）
+        int channel = std::min((int)(sampler.Get1D() * 3), 2);
+        Float dirLength = ray.dir.Length();
+        Float distance = -std::log(1 - sampler.Get1D()) / sigma_t[channel];
+        Float t = std::min(distance / dirLength, ray.tMax);
+        bool sampledMedium = (t < ray.tMax);
+        if (sampledMedium)
+        {
+            mi->p = ray(t);
+            mi->wo = ray.dir * (-1 / dirLength);
+            mi->time = ray.time;
+            mi->medium = this;
+            mi->phase = HenyeyGreenstein(g);
+        }
+
+        Spectrum tr = Exp(-sigma_t * std::min(t * dirLength, std::numeric_limits<Float>::max()));
+        Spectrum density = sampledMedium ? (sigma_t * tr) : tr;
+        Float pdf = density.Average();
+        if (0 == pdf)
+        {
+            pdf = 1;
+        }
+        return sampledMedium ? (tr * sigma_s / pdf) : (tr / pdf);
+    }
+
+    std::shared_ptr<Medium> CreateHomogeneousMedium(const ParamSet &params)
+    {
+        // 默认值与pbrt-v3相同
+        Spectrum sigma_a = params.FindOneRGB("sigma_a", Spectrum(0.0011f, 0.0024f, 0.014f));
+        Spectrum sigma_s = params.FindOneRGB("sigma_s", Spectrum(2.55f, 3.21f, 3.77f));
+        Float scale = params.FindOneFloat("scale", 1);
+        Float g = params.FindOneFloat("g", 0);
+        if ((g <= -1) || (g >= 1))
+        {
+            LOG(ERROR) << "homogeneous medium: \"g\" must be in (-1, 1), got " << g << ", clamping";
+            g = Clamp(g, (Float)-0.99, (Float)0.99);
+        }
+        return std::make_shared<HomogeneousMedium>(sigma_a * scale, sigma_s * scale, g);
+    }
+}
@@ -1,6 +1,81 @@
-#pragma once
+﻿#pragma once
 
-class Medium
+#include "Geometry.h"
+#include "Spectrum.h"
+#include <memory>
+
+namespace PBRT
 {
+    class ParamSet;
+    class Sampler;
+
+    // Henyey-Greenstein相函数的值，cosTheta为wo与wi夹角的余弦（两者都指向外）
+    Float PhaseHG(Float cosTheta, Float g);
+
+    // g∈(-1, 1)为散射角余弦的平均值：g > 0时向前散射，g = 0时各向同性
+    class HenyeyGreenstein
+    {
+    public:
+        explicit HenyeyGreenstein(Float g = 0)
+            : g(g)
+        {}
+
+        Float p(const Vector3f &wo, const Vector3f &wi) const
+        {
+            return PhaseHG(Dot(wo, wi), g);
+        }
+
+        // 按相函数精确采样wi，返回的相函数值同时也是pdf
+        Float Sample_p(const Vector3f &wo, Vector3f *wi, const Point2f &u) const;
+
+        Float g;
+    };
+
+    // 介质内部的散射点，medium为nullptr时表示没有发生散射
+    struct MediumInteraction
+    {
+        bool IsValid(void) const
+        {
+            return nullptr != medium;
+        }
+
+        Point3f p;
+        Vector3f wo;
+        Float time = 0;
+        const Medium *medium = nullptr;
+        HenyeyGreenstein phase;
+    };
+
+    // 参与介质：光线穿过时被吸收和散射
+    // @remarks: 实现必须是线程安全的，所有随机数都从调用者传入的sampler中取
+    class Medium
+    {
+    public:
+        virtual ~Medium()
+        {}
+
+        // ray的原点到ray(ray.tMax)之间的透射率
+        virtual Spectrum Tr(const Ray &ray, Sampler &sampler) const = 0;
+
+        // 在ray的[0, tMax)上按透射率采样一个散射点：
+        // 散射时填写*mi并返回Tr * σs / pdf，否则不修改*mi，返回到tMax的Tr / pdf
+        virtual Spectrum Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const = 0;
+    };
+
+    // 系数处处相同的介质，透射率为exp(-σt * d)，不需要步进
+    class HomogeneousMedium : public Medium
+    {
+    public:
+        HomogeneousMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g);
+
+        Spectrum Tr(const Ray &ray, Sampler &sampler) const override;
+        Spectrum Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const override;
+
+    private:
+        const Spectrum sigma_a, sigma_s, sigma_t;
+        const Float g;
+    };
 
-};
+    // 按pbrt-v3的"homogeneous"介质参数创建："rgb sigma_a"、"rgb sigma_s"、"float scale"、"float g"
+    std::shared_ptr<Medium> CreateHomogeneousMedium(const ParamSet &params);
+}
@@ -0,0 +1,126 @@
+﻿#include "Memory.h"
+#include "Parallel.h"
+#include "glog/logging.h"
+#include <cstdlib>
+
+#ifdef _MSC_VER
+    #include <malloc.h>
+#endif
+
+namespace PBRT
+{
+    void *AllocAligned(size_t size)
+    {
+#ifdef _MSC_VER
+        void *ptr = _aligned_malloc(size, PBRT_L1_CACHE_LINE_SIZE);
+#else
+        void *ptr = nullptr;
+        if (0 != posix_memalign(&ptr, PBRT_L1_CACHE_LINE_SIZE, size))
+        {
+            ptr = nullptr;
+        }
+#endif
+        CHECK((nullptr != ptr) || (0 == size)) << "AllocAligned failed: " << size << " bytes";
+        return ptr;
+    }
+
+    void FreeAligned(void *ptr)
+    {
+        if (nullptr == ptr)
+        {
+            return;
+        }
+
+#ifdef _MSC_VER
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    // ----------------------------------------------------------------------------
+    // MemoryArena
+    // ----------------------------------------------------------------------------
+    MemoryArena::~MemoryArena()
+    {
+        for (const Block &block : blocks)
+        {
+            FreeAligned(block.ptr);
+        }
+    }
+
+    void *MemoryArena::AllocFromNextBlock(size_t nBytes)
+    {
+        // 块的起始地址按缓存行对齐，放在块开头的对象满足任何不超过缓存行的对齐要求
+        if (!blocks.empty())
+        {
+            usedBeforeCurrent += currentSize;
+            ++currentBlock;
+        }
+
+        // 超过块大小的分配单独占一个块，插在当前位置，以后Reset()后仍然可以复用
+        if ((currentBlock == blocks.size()) || (blocks[currentBlock].size < nBytes))
+        {
+            size_t size = std::max(nBytes, blockSize);
+            Block block = { AllocAligned<uint8_t>(size), size };
+            blocks.insert(blocks.begin() + currentBlock, block);
+        }
+
+        current = blocks[currentBlock].ptr;
+        currentSize = blocks[currentBlock].size;
+        currentPos = nBytes;
+        return current;
+    }
+
+    size_t MemoryArena::TotalAllocated(void) const
+    {
+        size_t total = 0;
+        for (const Block &block : blocks)
+        {
+            total += block.size;
+        }
+        return total;
+    }
+
+    // ----------------------------------------------------------------------------
+    // PerThreadArenas
+    // ----------------------------------------------------------------------------
+    PerThreadArenas::PerThreadArenas(size_t blockSize)
+        : nArenas(MaxThreadIndex())
+    {
+        // new[]在C++17之前不保证按缓存行对齐
+        arenas = AllocAligned<MemoryArena>(nArenas);
+        for (int i = 0; i < nArenas; ++i)
+        {
+            new (&arenas[i]) MemoryArena(blockSize);
+        }
+    }
+
+    PerThreadArenas::~PerThreadArenas()
+    {
+        for (int i = 0; i < nArenas; ++i)
+        {
+            arenas[i].~MemoryArena();
+        }
+        FreeAligned(arenas);
+    }
+
+    MemoryArena &PerThreadArenas::Get(void)
+    {
+        DCHECK_LT(ThreadIndex, nArenas);
+        return arenas[ThreadIndex];
+    }
+
+    void PerThreadArenas::ReportStats(const char *name) const
+    {
+        size_t totalPeak = 0, totalAllocated = 0;
+        for (int i = 0; i < nArenas; ++i)
+        {
+            LOG(INFO) << name << " arena, thread " << i << ": peak " << arenas[i].PeakBytes()
+                      << " bytes, allocated " << arenas[i].TotalAllocated() << " bytes";
+            totalPeak += arenas[i].PeakBytes();
+            totalAllocated += arenas[i].TotalAllocated();
+        }
+        LOG(INFO) << name << " arena, all threads: peak " << totalPeak << " bytes, allocated " << totalAllocated << " bytes";
+    }
+}
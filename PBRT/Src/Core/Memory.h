@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#ifndef PBRT_L1_CACHE_LINE_SIZE
+    #define PBRT_L1_CACHE_LINE_SIZE 64
+#endif
+
+// 在MemoryArena中构造一个对象：ARENA_ALLOC(arena, BSDF)(args...)
+#define ARENA_ALLOC(arena, Type) new ((arena).Alloc(sizeof(Type), alignof(Type))) Type
+
+namespace PBRT
+{
+    // 按缓存行对齐分配内存，必须用FreeAligned释放
+    void *AllocAligned(size_t size);
+
+    template <typename T>
+    T *AllocAligned(size_t count)
+    {
+        return (T *)AllocAligned(count * sizeof(T));
+    }
+
+    void FreeAligned(void *ptr);
+
+    // 按块分配的线性内存池，用于着色点上BSDF、临时记录等生命周期只有一个样本的小对象
+    // 块按缓存行对齐，分配只移动指针；Reset()把所有块一次性标记为空闲，不释放也不调用析构函数
+    // @remarks: 不是线程安全的，每个线程使用自己的MemoryArena（见PerThreadArenas）；
+    //           对象本身按缓存行对齐，相邻线程的arena不会共享缓存行
+    class alignas(PBRT_L1_CACHE_LINE_SIZE) MemoryArena
+    {
+    public:
+        explicit MemoryArena(size_t blockSize = 262144)
+            : blockSize(blockSize)
+        {}
+
+        ~MemoryArena();
+
+        MemoryArena(const MemoryArena &) = delete;
+        MemoryArena &operator=(const MemoryArena &) = delete;
+
+        // align必须是2的幂且不超过缓存行大小
+        void *Alloc(size_t nBytes, size_t align = 16)
+        {
+            uintptr_t p = (uintptr_t)(current + currentPos);
+            size_t padding = (size_t)(((p + align - 1) & ~(uintptr_t)(align - 1)) - p);
+            if (currentPos + padding + nBytes > currentSize)
+            {
+                return AllocFromNextBlock(nBytes);
+            }
+            void *result = current + currentPos + padding;
+            currentPos += padding + nBytes;
+            return result;
+        }
+
+        // 分配n个T并默认构造
+        template <typename T>
+        T *Alloc(size_t n = 1)
+        {
+            T *result = (T *)Alloc(n * sizeof(T), alignof(T));
+            for (size_t i = 0; i < n; ++i)
+            {
+                new (&result[i]) T();
+            }
+            return result;
+        }
+
+        // O(1)：回到第一个块的开头，已分配的块全部保留供下次使用
+        void Reset(void)
+        {
+            UpdatePeak();
+            currentBlock = 0;
+            usedBeforeCurrent = 0;
+            current = blocks.empty() ? nullptr : blocks[0].ptr;
+            currentSize = blocks.empty() ? 0 : blocks[0].size;
+            currentPos = 0;
+        }
+
+        // 从上次Reset()到现在使用的字节数（含对齐的填充和块末尾浪费的部分）
+        size_t BytesInUse(void) const
+        {
+            return usedBeforeCurrent + currentPos;
+        }
+
+        // 两次Reset()之间使用过的最大字节数
+        size_t PeakBytes(void) const
+        {
+            return std::max(peakBytes, BytesInUse());
+        }
+
+        // 向系统申请的总字节数
+        size_t TotalAllocated(void) const;
+
+    private:
+        struct Block
+        {
+            uint8_t *ptr;
+            size_t size;
+        };
+
+        void *AllocFromNextBlock(size_t nBytes);
+
+        void UpdatePeak(void)
+        {
+            peakBytes = std::max(peakBytes, BytesInUse());
+        }
+
+        const size_t blockSize;
+        std::vector<Block> blocks;
+        size_t currentBlock = 0;
+        uint8_t *current = nullptr;
+        size_t currentSize = 0, currentPos = 0;
+        size_t usedBeforeCurrent = 0;
+        size_t peakBytes = 0;
+    };
+
+    // 每个线程一个MemoryArena，按ThreadIndex取用，线程之间没有任何同步
+    // @remarks: 必须在ParallelInit()之后创建
+    class PerThreadArenas
+    {
+    public:
+        explicit PerThreadArenas(size_t blockSize = 262144);
+        ~PerThreadArenas();
+
+        PerThreadArenas(const PerThreadArenas &) = delete;
+        PerThreadArenas &operator=(const PerThreadArenas &) = delete;
+
+        // 当前线程的arena
+        MemoryArena &Get(void);
+
+        int Count(void) const
+        {
+            return nArenas;
+        }
+
+        MemoryArena &operator[](int threadIndex)
+        {
+            return arenas[threadIndex];
+        }
+
+        // 用LOG(INFO)输出每个线程的峰值用量和申请的总字节数
+        void ReportStats(const char *name) const;
+
+    private:
+        MemoryArena *arenas;
+        int nArenas;
+    };
+}
@@ -1,7 +1,22 @@
 ﻿#pragma once
 
+#include <cmath>
 #include <limits>
 
+// SIMD开关：定义PBRT_USE_SIMD后为float版本的几何类型启用SSE4.1实现，
+// 额外定义PBRT_USE_AVX（或编译器开启/arch:AVX）后批量接口使用8宽的AVX实现
+#if defined(PBRT_USE_SIMD) && !defined(PBRT_FLOAT_AS_DOUBLE)
+    #define PBRT_HAVE_SSE
+    #if defined(PBRT_USE_AVX) || defined(__AVX__)
+        #define PBRT_HAVE_AVX
+    #endif
+#endif
+
+// 目标CPU有FMA指令：定义PBRT_USE_FMA或编译器开启/arch:AVX2
+#if defined(PBRT_USE_FMA) || defined(__FMA__) || defined(__AVX2__)
+    #define PBRT_HAVE_FMA
+#endif
+
 namespace PBRT
 {
     template <typename T>
@@ -28,12 +43,100 @@ namespace PBRT
 // 全局常量
 #ifdef _MSC_VER
     #define Infinity std::numeric_limits<Float>::infinity()
+    #define MachineEpsilon (std::numeric_limits<Float>::epsilon() * 0.5)
 #else
     static PBRT_CONSTEXPR Float Infinity = std::numeric_limits<Float>::infinity();
+    static PBRT_CONSTEXPR Float MachineEpsilon = std::numeric_limits<Float>::epsilon() * 0.5;
 #endif
 
+    static PBRT_CONSTEXPR Float Pi = 3.14159265358979323846;
+    static PBRT_CONSTEXPR Float InvPi = 0.31830988618379067154;
+    static PBRT_CONSTEXPR Float Inv2Pi = 0.15915494309189533577;
+    static PBRT_CONSTEXPR Float Inv4Pi = 0.07957747154594766788;
+    static PBRT_CONSTEXPR Float PiOver2 = 1.57079632679489661923;
+    static PBRT_CONSTEXPR Float PiOver4 = 0.78539816339744830961;
+
+    // n次浮点运算累积的相对误差上界γn，用于保守的误差边界
+    inline PBRT_CONSTEXPR Float Gamma(int n)
+    {
+        return (n * MachineEpsilon) / (1 - n * MachineEpsilon);
+    }
+
+    // a * b + c，只舍入一次
+    template <typename T>
+    inline T FMA(T a, T b, T c)
+    {
+        return ((a * b) + c);
+    }
+
+    inline float FMA(float a, float b, float c)
+    {
+        return std::fma(a, b, c);
+    }
+
+    inline double FMA(double a, double b, double c)
+    {
+        return std::fma(a, b, c);
+    }
+
+    // a * b - c * d，用FMA补回c * d的舍入误差（Kahan），误差不超过1.5ulp，
+    // 不需要提升到double就能避免相近乘积相减时的灾难性抵消
+    // @remarks: double版本只在有FMA指令时补偿误差
+    template <typename T>
+    inline T DifferenceOfProducts(T a, T b, T c, T d)
+    {
+        T cd = c * d;
+        T differenceOfProducts = FMA(a, b, -cd);
+        T error = FMA(-c, d, cd);
+        return (differenceOfProducts + error);
+    }
+
+    inline float DifferenceOfProducts(float a, float b, float c, float d)
+    {
+#ifdef PBRT_HAVE_FMA
+        float cd = c * d;
+        float differenceOfProducts = FMA(a, b, -cd);
+        float error = FMA(-c, d, cd);
+        return (differenceOfProducts + error);
+#else
+        // 没有FMA指令时std::fma是库函数调用，很慢；float的乘积在double下是精确的，只在相减时舍入一次
+        return (float)(((double)a * b) - ((double)c * d));
+#endif // PBRT_HAVE_FMA
+    }
+
+    inline double DifferenceOfProducts(double a, double b, double c, double d)
+    {
+#ifdef PBRT_HAVE_FMA
+        double cd = c * d;
+        double differenceOfProducts = FMA(a, b, -cd);
+        double error = FMA(-c, d, cd);
+        return (differenceOfProducts + error);
+#else
+        // 没有FMA指令时也没有更宽的类型可以提升，std::fma的软件实现比直接计算慢数倍，这里不补偿误差
+        return ((a * b) - (c * d));
+#endif // PBRT_HAVE_FMA
+    }
+
     inline Float Lerp(Float t, Float v1, Float v2)
     {
         return (((1.0f - t) * v1) + (t * v2));
     }
+
+    template <typename T, typename U, typename V>
+    inline T Clamp(T val, U low, V high)
+    {
+        if (val < low) return low;
+        if (val > high) return high;
+        return val;
+    }
+
+    inline Float Radians(Float deg)
+    {
+        return ((Pi / 180) * deg);
+    }
+
+    inline Float Degrees(Float rad)
+    {
+        return ((180 / Pi) * rad);
+    }
 }
@@ -0,0 +1,471 @@
+﻿#include "Parallel.h"
+#include "Memory.h"
+#include "Profiler.h"
+#include "Stats.h"
+#include "glog/logging.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace PBRT
+{
+    thread_local int ThreadIndex = 0;
+
+    namespace
+    {
+        // 一个并行循环，remaining为还没有执行完的迭代数
+        // profilerState为创建循环的线程所处的阶段，执行迭代的线程在这期间也计入这些阶段
+        struct ParallelForLoop
+        {
+            ParallelForLoop(const std::function<void(int64_t)> &func, int64_t count, int chunkSize)
+                : func(func), chunkSize(chunkSize), remaining(count)
+                , profilerState(ProfilerState().load(std::memory_order_relaxed))
+            {}
+
+            const std::function<void(int64_t)> &func;
+            const int chunkSize;
+            std::atomic<int64_t> remaining;
+            const uint64_t profilerState;
+        };
+
+        // 循环中的一段迭代[begin, end)
+        struct Task
+        {
+            ParallelForLoop *loop;
+            int64_t begin, end;
+        };
+
+        // 每个线程的任务队列：自己从尾部存取，其他线程从头部窃取
+        // @remarks: 锁只在同一个队列的主人和窃取者之间竞争；按缓存行对齐，避免相邻队列的锁互相干扰
+        struct alignas(PBRT_L1_CACHE_LINE_SIZE) WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::thread> threads;
+        WorkQueue *queues = nullptr;
+        int nQueues = 0;
+        std::atomic<bool> shutdownThreads(false);
+
+        // 所有队列中的任务总数，空闲的线程据此决定是否睡眠
+        std::atomic<int64_t> pendingTasks(0);
+
+        // 睡眠的线程在有新任务、有循环结束或关闭线程池时被唤醒
+        std::atomic<int> nSleeping(0);
+        std::mutex sleepMutex;
+        std::condition_variable sleepCondition;
+
+        void WakeSleepers(bool all)
+        {
+            if (nSleeping.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                if (all)
+                {
+                    sleepCondition.notify_all();
+                }
+                else
+                {
+                    sleepCondition.notify_one();
+                }
+            }
+        }
+
+        void PushTask(const Task &task)
+        {
+            WorkQueue &queue = queues[ThreadIndex];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(task);
+            }
+            ++pendingTasks;
+            WakeSleepers(false);
+        }
+
+        // 先取自己队列尾部的任务，没有时从其他线程队列的头部窃取
+        bool PopTask(Task *task)
+        {
+            if (0 == pendingTasks.load())
+            {
+                return false;
+            }
+
+            {
+                WorkQueue &queue = queues[ThreadIndex];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (!queue.tasks.empty())
+                {
+                    *task = queue.tasks.back();
+                    queue.tasks.pop_back();
+                    --pendingTasks;
+                    return true;
+                }
+            }
+
+            // 从每个线程不同的位置开始找，避免所有窃取者挤在同一个队列上
+            for (int i = 1; i < nQueues; ++i)
+            {
+                WorkQueue &victim = queues[(ThreadIndex + i) % nQueues];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                    *task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    --pendingTasks;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // 执行任务：大于一个chunk的区间把右半部分放回自己的队列，供自己稍后执行或被其他线程窃取
+        void RunTask(Task task)
+        {
+            ParallelForLoop &loop = *task.loop;
+            while (task.end - task.begin > loop.chunkSize)
+            {
+                int64_t nChunks = (task.end - task.begin + loop.chunkSize - 1) / loop.chunkSize;
+                int64_t mid = task.begin + (nChunks / 2) * loop.chunkSize;
+                PushTask({ &loop, mid, task.end });
+                task.end = mid;
+            }
+
+            std::atomic<uint64_t> &profilerState = ProfilerState();
+            uint64_t savedProfilerState = profilerState.load(std::memory_order_relaxed);
+            profilerState.store(savedProfilerState | loop.profilerState, std::memory_order_relaxed);
+            for (int64_t i = task.begin; i < task.end; ++i)
+            {
+                loop.func(i);
+            }
+            profilerState.store(savedProfilerState, std::memory_order_relaxed);
+
+            // 减到0之后loop可能已被等待者销毁，不能再访问
+            if (task.end - task.begin == loop.remaining.fetch_sub(task.end - task.begin))
+            {
+                WakeSleepers(true);
+            }
+        }
+
+        // 没有可执行的任务时睡眠，直到wakeUp()为true
+        template <typename Pred>
+        void Sleep(Pred wakeUp)
+        {
+            // 先短暂让出时间片，任务很快出现时不必付出睡眠和唤醒的开销
+            for (int i = 0; (i < 16) && !wakeUp(); ++i)
+            {
+                std::this_thread::yield();
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            ++nSleeping;
+            while (!wakeUp())
+            {
+                sleepCondition.wait(lock);
+            }
+            --nSleeping;
+        }
+
+        // 等待loop结束，期间执行自己或其他线程的任务
+        void WaitForLoop(ParallelForLoop &loop)
+        {
+            Task task;
+            while (loop.remaining.load() > 0)
+            {
+                if (PopTask(&task))
+                {
+                    RunTask(task);
+                }
+                else
+                {
+                    Sleep([&]()
+                    {
+                        return (0 == loop.remaining.load()) || (pendingTasks.load() > 0);
+                    });
+                }
+            }
+        }
+
+        void WorkerThreadFunc(int tIndex)
+        {
+            ThreadIndex = tIndex;
+
+            Task task;
+            while (!shutdownThreads.load())
+            {
+                if (PopTask(&task))
+                {
+                    RunTask(task);
+                }
+                else
+                {
+                    Sleep([]()
+                    {
+                        return shutdownThreads.load() || (pendingTasks.load() > 0);
+                    });
+                }
+            }
+
+            // 线程局部的统计计数器随线程一起销毁，退出前合并到全局统计
+            ReportThreadStats();
+        }
+
+        // 把线程绑定到一个逻辑核上
+        void PinThread(std::thread::native_handle_type handle, int core)
+        {
+#ifdef _WIN32
+            if (0 == SetThreadAffinityMask(handle, (DWORD_PTR)1 << (core % (8 * sizeof(DWORD_PTR)))))
+            {
+                LOG(WARNING) << "Unable to pin thread to core " << core << ": error " << GetLastError();
+            }
+#elif defined(__linux__)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(core % CPU_SETSIZE, &cpuSet);
+            int error = pthread_setaffinity_np(handle, sizeof(cpuSet), &cpuSet);
+            if (0 != error)
+            {
+                LOG(WARNING) << "Unable to pin thread to core " << core << ": error " << error;
+            }
+#else
+            (void)handle;
+            LOG(WARNING) << "Thread pinning is not supported on this platform, core " << core << " ignored";
+#endif
+        }
+
+        // 主线程在线程池之外还要继续运行，绑定前记下原来的亲和性，ParallelCleanup()时恢复
+#ifdef _WIN32
+        DWORD_PTR mainThreadAffinity = 0;
+#elif defined(__linux__)
+        cpu_set_t mainThreadAffinity;
+#endif
+        bool mainThreadPinned = false;
+
+        void PinMainThread(void)
+        {
+#ifdef _WIN32
+            // SetThreadAffinityMask返回原来的亲和性
+            mainThreadAffinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+            if (0 == mainThreadAffinity)
+            {
+                LOG(WARNING) << "Unable to pin thread to core 0: error " << GetLastError();
+                return;
+            }
+            mainThreadPinned = true;
+#elif defined(__linux__)
+            int error = pthread_getaffinity_np(pthread_self(), sizeof(mainThreadAffinity), &mainThreadAffinity);
+            if (0 != error)
+            {
+                LOG(WARNING) << "Unable to query the affinity of the main thread: error " << error << ", not pinning it";
+                return;
+            }
+            PinThread(pthread_self(), 0);
+            mainThreadPinned = true;
+#else
+            LOG(WARNING) << "Thread pinning is not supported on this platform, core 0 ignored";
+#endif
+        }
+
+        void RestoreMainThreadAffinity(void)
+        {
+            if (!mainThreadPinned)
+            {
+                return;
+            }
+            mainThreadPinned = false;
+
+#ifdef _WIN32
+            if (0 == SetThreadAffinityMask(GetCurrentThread(), mainThreadAffinity))
+            {
+                LOG(WARNING) << "Unable to restore the affinity of the main thread: error " << GetLastError();
+            }
+#elif defined(__linux__)
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(mainThreadAffinity), &mainThreadAffinity);
+            if (0 != error)
+            {
+                LOG(WARNING) << "Unable to restore the affinity of the main thread: error " << error;
+            }
+#endif
+        }
+    }
+
+    void ParallelInit(int nThreads, bool pinThreads)
+    {
+        CHECK(threads.empty());
+
+        if (nThreads <= 0)
+        {
+            nThreads = NumSystemCores();
+        }
+
+        // new[]在C++17之前不保证按缓存行对齐
+        nQueues = nThreads;
+        queues = AllocAligned<WorkQueue>(nQueues);
+        for (int i = 0; i < nQueues; ++i)
+        {
+            new (&queues[i]) WorkQueue();
+        }
+        shutdownThreads = false;
+
+        if (pinThreads)
+        {
+            PinMainThread();
+        }
+
+        // 主线程也参与计算，所以只需要额外启动nThreads - 1个线程
+        for (int i = 0; i < nThreads - 1; ++i)
+        {
+            try
+            {
+                threads.push_back(std::thread(WorkerThreadFunc, i + 1));
+            }
+            catch (const std::system_error &e)
+            {
+                LOG(WARNING) << "Unable to create worker thread " << (i + 1) << ": " << e.what()
+                             << ", continuing with " << threads.size() + 1 << " threads";
+                break;
+            }
+
+            if (pinThreads)
+            {
+                PinThread(threads.back().native_handle(), (i + 1) % NumSystemCores());
+            }
+        }
+    }
+
+    void ParallelCleanup(void)
+    {
+        if (!threads.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                shutdownThreads = true;
+                sleepCondition.notify_all();
+            }
+
+            for (std::thread &thread : threads)
+            {
+                thread.join();
+            }
+            threads.erase(threads.begin(), threads.end());
+            shutdownThreads = false;
+        }
+
+        CHECK_EQ(pendingTasks.load(), 0);
+        for (int i = 0; i < nQueues; ++i)
+        {
+            queues[i].~WorkQueue();
+        }
+        FreeAligned(queues);
+        queues = nullptr;
+        nQueues = 0;
+
+        RestoreMainThreadAffinity();
+    }
+
+    int NumSystemCores(void)
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int MaxThreadIndex(void)
+    {
+        return (int)threads.size() + 1;
+    }
+
+    void ParallelFor(int64_t count, int chunkSize, const std::function<void(int64_t)> &func)
+    {
+        CHECK_GT(chunkSize, 0);
+
+        if (threads.empty() || (count <= chunkSize))
+        {
+            for (int64_t i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+            return;
+        }
+
+        ParallelForLoop loop(func, count, chunkSize);
+        RunTask({ &loop, 0, count });
+        WaitForLoop(loop);
+    }
+
+    void ParallelFor2D(const Bounds2i &bounds, int tileSize, const std::function<void(const Bounds2i &)> &func)
+    {
+        CHECK_GT(tileSize, 0);
+
+        Vector2i extent = bounds.Diagonal();
+        if ((extent.x <= 0) || (extent.y <= 0))
+        {
+            return;
+        }
+
+        int nTilesX = (extent.x + tileSize - 1) / tileSize;
+        int nTilesY = (extent.y + tileSize - 1) / tileSize;
+        ParallelFor((int64_t)nTilesX * nTilesY, 1, [&](int64_t i)
+        {
+            Point2i tileMin(bounds.minPoint.x + (int)(i % nTilesX) * tileSize, bounds.minPoint.y + (int)(i / nTilesX) * tileSize);
+            Point2i tileMax(std::min(tileMin.x + tileSize, bounds.maxPoint.x), std::min(tileMin.y + tileSize, bounds.maxPoint.y));
+            func(Bounds2i(tileMin, tileMax));
+        });
+    }
+
+    // ----------------------------------------------------------------------------
+    // AsyncTask
+    // ----------------------------------------------------------------------------
+    AsyncTask::AsyncTask(std::function<void(void)> func)
+        : func([func](int64_t)
+          {
+              func();
+          })
+    {}
+
+    AsyncTask::~AsyncTask()
+    {
+        Wait();
+    }
+
+    void AsyncTask::Wait(void)
+    {
+        if (nullptr == loop)
+        {
+            return;
+        }
+
+        std::unique_ptr<ParallelForLoop> asyncLoop((ParallelForLoop *)loop);
+        WaitForLoop(*asyncLoop);
+        loop = nullptr;
+    }
+
+    std::unique_ptr<AsyncTask> RunAsync(std::function<void(void)> func)
+    {
+        std::unique_ptr<AsyncTask> task(new AsyncTask(std::move(func)));
+        if (threads.empty())
+        {
+            task->func(0);
+            return task;
+        }
+
+        // 放入当前线程的队列，由空闲的线程窃取执行，或者在Wait()时由等待的线程自己执行
+        ParallelForLoop *asyncLoop = new ParallelForLoop(task->func, 1, 1);
+        task->loop = asyncLoop;
+        PushTask({ asyncLoop, 0, 1 });
+        return task;
+    }
+}
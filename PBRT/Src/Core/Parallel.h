@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace PBRT
+{
+    // 当前线程的编号：主线程为0，工作线程为1 ~ MaxThreadIndex() - 1
+    extern thread_local int ThreadIndex;
+
+    // 启动线程池，nThreads为0时使用全部逻辑核，为1时所有并行接口都串行执行
+    // 每个线程（包括主线程）有自己的任务队列，空闲的线程从其他线程的队列中窃取任务
+    // pinThreads为true时把第i个线程绑定到第i个逻辑核上，只在Windows和Linux上有效；主线程原来的亲和性在ParallelCleanup()时恢复
+    // @remarks: 创建线程失败时输出警告，用已经创建的线程继续运行
+    void ParallelInit(int nThreads = 0, bool pinThreads = false);
+    void ParallelCleanup(void);
+
+    int NumSystemCores(void);
+
+    // 可用于按线程编号分配的存储的上界
+    int MaxThreadIndex(void);
+
+    // 并行执行func(0) ~ func(count - 1)，chunkSize个迭代为最小的任务单位
+    // 区间按需对半拆分：自己的队列后进先出，窃取时取最早放入的（也是最大的）区间
+    // @remarks: 可以嵌套调用，调用线程会参与执行直到整个循环结束；
+    //           线程池未初始化时退化为串行执行
+    void ParallelFor(int64_t count, int chunkSize, const std::function<void(int64_t)> &func);
+
+    // 把bounds划分为tileSize x tileSize的瓦片，并行执行func(tileBounds)
+    void ParallelFor2D(const Bounds2i &bounds, int tileSize, const std::function<void(const Bounds2i &)> &func);
+
+    // 交给线程池异步执行的任务，析构时会等待任务结束
+    class AsyncTask
+    {
+    public:
+        ~AsyncTask();
+
+        AsyncTask(const AsyncTask &) = delete;
+        AsyncTask &operator=(const AsyncTask &) = delete;
+
+        // 等待期间当前线程会帮助执行线程池中的其他工作
+        void Wait(void);
+
+    private:
+        friend std::unique_ptr<AsyncTask> RunAsync(std::function<void(void)> func);
+
+        AsyncTask(std::function<void(void)> func);
+
+        // 包装成只有一次迭代的并行循环
+        std::function<void(int64_t)> func;
+        void *loop = nullptr;
+    };
+
+    // 异步执行func
+    // @remarks: 线程池未初始化时在调用线程上直接执行完再返回
+    std::unique_ptr<AsyncTask> RunAsync(std::function<void(void)> func);
+}
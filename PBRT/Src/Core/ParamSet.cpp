@@ -0,0 +1,119 @@
+#include "ParamSet.h"
+
+namespace PBRT
+{
+    namespace
+    {
+        template <typename T>
+        const T *FindArray(const ParamSet &params, const std::string &name, const char *type
+                         , std::vector<T> ParamSetItem::*values, int *count)
+        {
+            const ParamSetItem *item = params.Find(name, type);
+            if ((nullptr == item) || (item->*values).empty())
+            {
+                *count = 0;
+                return nullptr;
+            }
+            *count = (int)(item->*values).size();
+            return &(item->*values)[0];
+        }
+    }
+
+    void ParamSet::Add(std::shared_ptr<const ParamSetItem> item)
+    {
+        for (auto &existing : items)
+        {
+            if (existing->name == item->name)
+            {
+                existing = std::move(item);
+                return;
+            }
+        }
+        items.push_back(std::move(item));
+    }
+
+    const ParamSetItem *ParamSet::Find(const std::string &name, const char *type) const
+    {
+        for (const auto &item : items)
+        {
+            if ((item->name == name) && (item->type == type))
+            {
+                return item.get();
+            }
+        }
+        return nullptr;
+    }
+
+    const int *ParamSet::FindInt(const std::string &name, int *count) const
+    {
+        return FindArray(*this, name, "integer", &ParamSetItem::ints, count);
+    }
+
+    const Float *ParamSet::FindFloat(const std::string &name, int *count) const
+    {
+        return FindArray(*this, name, "float", &ParamSetItem::floats, count);
+    }
+
+    const Point2f *ParamSet::FindPoint2f(const std::string &name, int *count) const
+    {
+        return FindArray(*this, name, "point2", &ParamSetItem::point2fs, count);
+    }
+
+    const Point3f *ParamSet::FindPoint3f(const std::string &name, int *count) const
+    {
+        return FindArray(*this, name, "point3", &ParamSetItem::point3fs, count);
+    }
+
+    const Normal3f *ParamSet::FindNormal3f(const std::string &name, int *count) const
+    {
+        return FindArray(*this, name, "normal3", &ParamSetItem::normals, count);
+    }
+
+    int ParamSet::FindOneInt(const std::string &name, int d) const
+    {
+        const ParamSetItem *item = Find(name, "integer");
+        return ((nullptr != item) && (1 == item->ints.size())) ? item->ints[0] : d;
+    }
+
+    Float ParamSet::FindOneFloat(const std::string &name, Float d) const
+    {
+        const ParamSetItem *item = Find(name, "float");
+        return ((nullptr != item) && (1 == item->floats.size())) ? item->floats[0] : d;
+    }
+
+    bool ParamSet::FindOneBool(const std::string &name, bool d) const
+    {
+        const ParamSetItem *item = Find(name, "bool");
+        return ((nullptr != item) && (1 == item->bools.size())) ? item->bools[0] : d;
+    }
+
+    std::string ParamSet::FindOneString(const std::string &name, const std::string &d) const
+    {
+        const ParamSetItem *item = Find(name, "string");
+        return ((nullptr != item) && (1 == item->strings.size())) ? item->strings[0] : d;
+    }
+
+    std::string ParamSet::FindTexture(const std::string &name) const
+    {
+        const ParamSetItem *item = Find(name, "texture");
+        return ((nullptr != item) && (1 == item->strings.size())) ? item->strings[0] : std::string();
+    }
+
+    Point3f ParamSet::FindOnePoint3f(const std::string &name, const Point3f &d) const
+    {
+        const ParamSetItem *item = Find(name, "point3");
+        return ((nullptr != item) && (1 == item->point3fs.size())) ? item->point3fs[0] : d;
+    }
+
+    Vector3f ParamSet::FindOneVector3f(const std::string &name, const Vector3f &d) const
+    {
+        const ParamSetItem *item = Find(name, "vector3");
+        return ((nullptr != item) && (1 == item->vector3fs.size())) ? item->vector3fs[0] : d;
+    }
+
+    Spectrum ParamSet::FindOneRGB(const std::string &name, const Spectrum &d) const
+    {
+        const ParamSetItem *item = Find(name, "rgb");
+        return ((nullptr != item) && (3 == item->floats.size())) ? Spectrum::FromRGB(item->floats.data()) : d;
+    }
+}
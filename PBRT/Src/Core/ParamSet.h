@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "Spectrum.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PBRT
+{
+    // 场景文件中的一个参数："类型 名字"和它的值，按类型存到对应的数组中，其他数组为空
+    struct ParamSetItem
+    {
+        // 类型名已规范化：point/vector/normal分别记为point3/vector3/normal3，color记为rgb
+        std::string type, name;
+
+        std::vector<int> ints;
+        std::vector<Float> floats;          // float、rgb、xyz、blackbody以及数值形式的spectrum
+        std::vector<bool> bools;
+        std::vector<std::string> strings;   // string、texture以及文件形式的spectrum
+        std::vector<Point2f> point2fs;
+        std::vector<Vector2f> vector2fs;
+        std::vector<Point3f> point3fs;
+        std::vector<Vector3f> vector3fs;
+        std::vector<Normal3f> normals;
+    };
+
+    // 一条指令的参数列表
+    // @remarks: 参数项是共享的，复制ParamSet不会复制大数组，可以放心地按值传给异步任务
+    class ParamSet
+    {
+    public:
+        // 同名的参数后出现的覆盖先出现的
+        void Add(std::shared_ptr<const ParamSetItem> item);
+
+        // 按名字和类型查找，找不到时返回nullptr
+        const ParamSetItem *Find(const std::string &name, const char *type) const;
+
+        // 找不到时返回nullptr并把*count置0
+        const int *FindInt(const std::string &name, int *count) const;
+        const Float *FindFloat(const std::string &name, int *count) const;
+        const Point2f *FindPoint2f(const std::string &name, int *count) const;
+        const Point3f *FindPoint3f(const std::string &name, int *count) const;
+        const Normal3f *FindNormal3f(const std::string &name, int *count) const;
+
+        int FindOneInt(const std::string &name, int d) const;
+        Float FindOneFloat(const std::string &name, Float d) const;
+        bool FindOneBool(const std::string &name, bool d) const;
+        std::string FindOneString(const std::string &name, const std::string &d) const;
+        std::string FindTexture(const std::string &name) const;
+        Point3f FindOnePoint3f(const std::string &name, const Point3f &d) const;
+        Vector3f FindOneVector3f(const std::string &name, const Vector3f &d) const;
+        Spectrum FindOneRGB(const std::string &name, const Spectrum &d) const;
+
+        const std::vector<std::shared_ptr<const ParamSetItem>> &Items(void) const
+        {
+            return items;
+        }
+
+    private:
+        std::vector<std::shared_ptr<const ParamSetItem>> items;
+    };
+}
@@ -0,0 +1,1683 @@
+﻿#include "Parser.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include "SceneCache.h"
+#include "Src/Shapes/PLYMesh.h"
+#include "glog/logging.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // Tokenizer
+    // ----------------------------------------------------------------------------
+    std::string Token::Dequote(void) const
+    {
+        if (!IsQuoted())
+        {
+            return ToString();
+        }
+
+        std::string str;
+        str.reserve(length - 2);
+        for (size_t i = 1; i + 1 < length; ++i)
+        {
+            char c = text[i];
+            if (('\\' == c) && (i + 2 < length))
+            {
+                switch (text[++i])
+                {
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                default:  c = text[i]; break;
+                }
+            }
+            str.push_back(c);
+        }
+        return str;
+    }
+
+    std::unique_ptr<Tokenizer> Tokenizer::CreateFromFile(const std::string &filename)
+    {
+        std::unique_ptr<Tokenizer> tokenizer(new Tokenizer());
+        if (!tokenizer->file.Open(filename))
+        {
+            return nullptr;
+        }
+        tokenizer->filename = filename;
+        tokenizer->pos = tokenizer->file.Data();
+        tokenizer->end = tokenizer->pos + tokenizer->file.Size();
+        return tokenizer;
+    }
+
+    std::unique_ptr<Tokenizer> Tokenizer::CreateFromString(std::string str)
+    {
+        std::unique_ptr<Tokenizer> tokenizer(new Tokenizer());
+        tokenizer->contents = std::move(str);
+        tokenizer->pos = tokenizer->contents.data();
+        tokenizer->end = tokenizer->pos + tokenizer->contents.size();
+        return tokenizer;
+    }
+
+    bool Tokenizer::Next(Token *token)
+    {
+        while (pos < end)
+        {
+            const char *tokenStart = pos;
+            char c = *pos++;
+            if (('\n' == c) || (' ' == c) || ('\t' == c) || ('\r' == c))
+            {
+                line += ('\n' == c) ? 1 : 0;
+            }
+            else if ('#' == c)
+            {
+                // 注释直到行尾
+                while ((pos < end) && ('\n' != *pos) && ('\r' != *pos))
+                {
+                    ++pos;
+                }
+            }
+            else if ('"' == c)
+            {
+                bool escaped = false;
+                while ((pos < end) && ((escaped) || ('"' != *pos)))
+                {
+                    if ('\n' == *pos)
+                    {
+                        LOG(ERROR) << filename << ":" << line << ": unterminated string";
+                        failed = true;
+                        return false;
+                    }
+                    escaped = (!escaped && ('\\' == *pos));
+                    ++pos;
+                }
+                if (pos == end)
+                {
+                    LOG(ERROR) << filename << ":" << line << ": unterminated string";
+                    failed = true;
+                    return false;
+                }
+                ++pos;
+
+                token->text = tokenStart;
+                token->length = pos - tokenStart;
+                token->line = line;
+                return true;
+            }
+            else if (('[' == c) || (']' == c))
+            {
+                token->text = tokenStart;
+                token->length = 1;
+                token->line = line;
+                return true;
+            }
+            else
+            {
+                while ((pos < end) && (' ' != *pos) && ('\n' != *pos) && ('\t' != *pos) && ('\r' != *pos)
+                    && ('"' != *pos) && ('[' != *pos) && (']' != *pos))
+                {
+                    ++pos;
+                }
+                token->text = tokenStart;
+                token->length = pos - tokenStart;
+                token->line = line;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    namespace
+    {
+        std::string DirectoryOf(const std::string &filename)
+        {
+            size_t slash = filename.find_last_of("/\\");
+            return (std::string::npos == slash) ? std::string() : filename.substr(0, slash + 1);
+        }
+
+        // 相对路径相对于引用它的文件所在的目录
+        std::string ResolveFilename(const std::string &directory, const std::string &filename)
+        {
+            bool absolute = (!filename.empty() && (('/' == filename[0]) || ('\\' == filename[0])))
+                         || ((filename.size() > 1) && (':' == filename[1]));
+            return absolute ? filename : directory + filename;
+        }
+
+        // 映射的内存不以'\0'结尾，数值先复制到局部缓冲区再转换
+        bool ParseNumber(const Token &token, double *value)
+        {
+            char buffer[64];
+            if ((0 == token.length) || (token.length >= sizeof(buffer)))
+            {
+                return false;
+            }
+            std::memcpy(buffer, token.text, token.length);
+            buffer[token.length] = '\0';
+
+            char *numberEnd;
+            *value = std::strtod(buffer, &numberEnd);
+            return (numberEnd == buffer + token.length);
+        }
+
+        bool ParseInt(const Token &token, int *value)
+        {
+            char buffer[32];
+            if ((0 == token.length) || (token.length >= sizeof(buffer)))
+            {
+                return false;
+            }
+            std::memcpy(buffer, token.text, token.length);
+            buffer[token.length] = '\0';
+
+            char *numberEnd;
+            long v = std::strtol(buffer, &numberEnd, 10);
+            *value = (int)v;
+            return (numberEnd == buffer + token.length) && (v == (long)*value);
+        }
+
+        std::unique_ptr<TriangleMesh> CreateTriangleMesh(const ParamSet &params, const Transform &objectToWorld, const std::string &loc)
+        {
+            int nIndices, nP, nN, nUV;
+            const int *indices = params.FindInt("indices", &nIndices);
+            const Point3f *P = params.FindPoint3f("P", &nP);
+            const Normal3f *N = params.FindNormal3f("N", &nN);
+
+            // uv可以是point2，也可以是成对的float，旧文件中叫st
+            std::vector<Point2f> uvFromFloats;
+            const Point2f *uv = params.FindPoint2f("uv", &nUV);
+            if (nullptr == uv)
+            {
+                const Float *uvFloats = params.FindFloat("uv", &nUV);
+                if (nullptr == uvFloats)
+                {
+                    uvFloats = params.FindFloat("st", &nUV);
+                }
+                for (int i = 0; i + 1 < nUV; i += 2)
+                {
+                    uvFromFloats.push_back(Point2f(uvFloats[i], uvFloats[i + 1]));
+                }
+                nUV = (int)uvFromFloats.size();
+                uv = uvFromFloats.empty() ? nullptr : uvFromFloats.data();
+            }
+
+            const int defaultIndices[3] = { 0, 1, 2 };
+            if ((nullptr == indices) && (3 == nP))
+            {
+                indices = defaultIndices;
+                nIndices = 3;
+            }
+
+            if ((nullptr == P) || (nullptr == indices) || (0 != (nIndices % 3)))
+            {
+                LOG(ERROR) << loc << ": trianglemesh needs \"P\" and a multiple of 3 \"indices\"";
+                return nullptr;
+            }
+            for (int i = 0; i < nIndices; ++i)
+            {
+                if ((indices[i] < 0) || (indices[i] >= nP))
+                {
+                    LOG(ERROR) << loc << ": trianglemesh has out-of-bounds vertex index " << indices[i];
+                    return nullptr;
+                }
+            }
+            if ((nullptr != N) && (nN != nP))
+            {
+                LOG(ERROR) << loc << ": number of \"N\"s doesn't match \"P\"s, discarding";
+                N = nullptr;
+            }
+            if ((nullptr != uv) && (nUV != nP))
+            {
+                LOG(ERROR) << loc << ": number of \"uv\"s doesn't match \"P\"s, discarding";
+                uv = nullptr;
+            }
+
+            return std::unique_ptr<TriangleMesh>(new TriangleMesh(objectToWorld, nIndices / 3, indices, nP, P, N, uv));
+        }
+
+        template <typename T>
+        uint64_t HashArray(const std::vector<T> &values, uint64_t hash)
+        {
+            uint64_t size = values.size();
+            hash = HashBytes(&size, sizeof(size), hash);
+            return values.empty() ? hash : HashBytes(&values[0], values.size() * sizeof(T), hash);
+        }
+
+        uint64_t HashString(const std::string &str, uint64_t hash)
+        {
+            // 连同结尾的'\0'一起散列，"ab"+"c"与"a"+"bc"不会相同
+            return HashBytes(str.c_str(), str.size() + 1, hash);
+        }
+
+        // 网格在场景缓存中的键：只要形状的类型、参数、变换和引用的文件都没有变，键就不变
+        uint64_t MeshKey(const std::string &name, const ParamSet &params, const Transform &objectToWorld, const std::string &plyFilename)
+        {
+            uint64_t hash = HashBytes(name.c_str(), name.size() + 1);
+            for (const auto &item : params.Items())
+            {
+                hash = HashString(item->type, hash);
+                hash = HashString(item->name, hash);
+                hash = HashArray(item->ints, hash);
+                hash = HashArray(item->floats, hash);
+                hash = HashArray(item->point2fs, hash);
+                hash = HashArray(item->vector2fs, hash);
+                hash = HashArray(item->point3fs, hash);
+                hash = HashArray(item->vector3fs, hash);
+                hash = HashArray(item->normals, hash);
+                for (bool b : item->bools)
+                {
+                    hash = HashBytes(&b, sizeof(b), hash);
+                }
+                for (const std::string &str : item->strings)
+                {
+                    hash = HashString(str, hash);
+                }
+            }
+            hash = HashBytes(&objectToWorld.GetMatrix().m[0][0], sizeof(Matrix4x4::m), hash);
+
+            // 文件的内容用大小和修改时间代替，不需要读取整个文件
+            if (!plyFilename.empty())
+            {
+                hash = HashString(plyFilename, hash);
+#ifdef _WIN32
+                struct _stat64 info;
+                bool found = (0 == _stat64(plyFilename.c_str(), &info));
+#else
+                struct stat info;
+                bool found = (0 == stat(plyFilename.c_str(), &info));
+#endif
+                int64_t stamp[2] = { found ? (int64_t)info.st_size : -1, found ? (int64_t)info.st_mtime : -1 };
+                hash = HashBytes(stamp, sizeof(stamp), hash);
+            }
+            return hash;
+        }
+
+        class SceneBuilder;
+        bool Parse(std::unique_ptr<Tokenizer> tokenizer, SceneBuilder *builder);
+
+        // 维护图形状态，把指令转换为场景描述
+        class SceneBuilder
+        {
+        public:
+            SceneBuilder(SceneDescription *scene, const SceneCache *cache)
+                : scene(scene), cache(cache)
+            {
+                auto matte = std::make_shared<SceneEntity>();
+                matte->name = "matte";
+                graphicsState.material = matte;
+            }
+
+            // Import的文件：继承当前的图形状态，结果写入自己的场景描述，最后由父构建器合并
+            SceneBuilder(const SceneBuilder &parent, SceneDescription *scene)
+                : scene(scene)
+                , cache(parent.cache)
+                , curTransform(parent.curTransform)
+                , activeTransformBits(parent.activeTransformBits)
+                , namedCoordinateSystems(parent.namedCoordinateSystems)
+                , graphicsState(parent.graphicsState)
+                , inWorld(parent.inWorld)
+                , currentObjectName(parent.currentObjectName)
+            {
+                scene->transformStartTime = parent.scene->transformStartTime;
+                scene->transformEndTime = parent.scene->transformEndTime;
+                if (!currentObjectName.empty())
+                {
+                    currentObject = &scene->objects[currentObjectName];
+                }
+            }
+
+            // ----------------------------------------------------------------------------
+            // 变换
+            // ----------------------------------------------------------------------------
+            void Identity(void)
+            {
+                ForActiveTransforms([](const Transform &)
+                {
+                    return Transform();
+                });
+            }
+
+            void Translate(const Vector3f &delta)
+            {
+                ForActiveTransforms([&](const Transform &t)
+                {
+                    return t * PBRT::Translate(delta);
+                });
+            }
+
+            void Scale(Float x, Float y, Float z)
+            {
+                ForActiveTransforms([&](const Transform &t)
+                {
+                    return t * PBRT::Scale(x, y, z);
+                });
+            }
+
+            void Rotate(Float angle, const Vector3f &axis)
+            {
+                ForActiveTransforms([&](const Transform &t)
+                {
+                    return t * PBRT::Rotate(angle, axis);
+                });
+            }
+
+            void LookAt(const Point3f &eye, const Point3f &look, const Vector3f &up)
+            {
+                Transform lookAt = PBRT::LookAt(eye, look, up);
+                ForActiveTransforms([&](const Transform &t)
+                {
+                    return t * lookAt;
+                });
+            }
+
+            // 场景文件中的矩阵按列存储
+            void ConcatTransform(const Float m[16])
+            {
+                Transform transform(Transpose(Matrix4x4(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7]
+                                                      , m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15])));
+                ForActiveTransforms([&](const Transform &t)
+                {
+                    return t * transform;
+                });
+            }
+
+            void SetTransform(const Float m[16])
+            {
+                Transform transform(Transpose(Matrix4x4(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7]
+                                                      , m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15])));
+                ForActiveTransforms([&](const Transform &)
+                {
+                    return transform;
+                });
+            }
+
+            void CoordinateSystem(const std::string &name)
+            {
+                namedCoordinateSystems[name] = curTransform;
+            }
+
+            void CoordSysTransform(const std::string &name, const std::string &loc)
+            {
+                auto it = namedCoordinateSystems.find(name);
+                if (namedCoordinateSystems.end() == it)
+                {
+                    LOG(WARNING) << loc << ": couldn't find named coordinate system \"" << name << "\"";
+                    return;
+                }
+                curTransform = it->second;
+            }
+
+            void ActiveTransform(const std::string &which, const std::string &loc)
+            {
+                if ("All" == which)
+                {
+                    activeTransformBits = AllTransformsBits;
+                }
+                else if ("StartTime" == which)
+                {
+                    activeTransformBits = StartTransformBits;
+                }
+                else if ("EndTime" == which)
+                {
+                    activeTransformBits = EndTransformBits;
+                }
+                else
+                {
+                    LOG(ERROR) << loc << ": unknown ActiveTransform \"" << which << "\"";
+                }
+            }
+
+            void TransformTimes(Float start, Float end)
+            {
+                scene->transformStartTime = start;
+                scene->transformEndTime = end;
+            }
+
+            // ----------------------------------------------------------------------------
+            // 状态栈
+            // ----------------------------------------------------------------------------
+            void AttributeBegin(void)
+            {
+                pushedGraphicsStates.push_back(graphicsState);
+                TransformBegin();
+            }
+
+            void AttributeEnd(const std::string &loc)
+            {
+                if (pushedGraphicsStates.empty())
+                {
+                    LOG(ERROR) << loc << ": unmatched AttributeEnd, ignoring";
+                    return;
+                }
+                graphicsState = pushedGraphicsStates.back();
+                pushedGraphicsStates.pop_back();
+                TransformEnd(loc);
+            }
+
+            void TransformBegin(void)
+            {
+                pushedTransforms.push_back(curTransform);
+                pushedActiveTransformBits.push_back(activeTransformBits);
+            }
+
+            void TransformEnd(const std::string &loc)
+            {
+                if (pushedTransforms.empty())
+                {
+                    LOG(ERROR) << loc << ": unmatched TransformEnd, ignoring";
+                    return;
+                }
+                curTransform = pushedTransforms.back();
+                pushedTransforms.pop_back();
+                activeTransformBits = pushedActiveTransformBits.back();
+                pushedActiveTransformBits.pop_back();
+            }
+
+            // ----------------------------------------------------------------------------
+            // 渲染选项，只能出现在WorldBegin之前
+            // ----------------------------------------------------------------------------
+            void Camera(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                if (VerifyOptions("Camera", loc))
+                {
+                    SetEntity(&scene->camera, name, params, loc);
+                    scene->camera.cameraToWorld = Inverse(curTransform);
+                    scene->camera.medium = graphicsState.outsideMedium;
+                    namedCoordinateSystems["camera"] = scene->camera.cameraToWorld;
+                }
+            }
+
+            enum class OptionType
+            {
+                Film,
+                Sampler,
+                PixelFilter,
+                Integrator,
+                Accelerator,
+            };
+
+            void Option(OptionType type, const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                static const char *const directives[] = { "Film", "Sampler", "PixelFilter", "Integrator", "Accelerator" };
+                SceneEntity *const entities[] = { &scene->film, &scene->sampler, &scene->filter, &scene->integrator, &scene->accelerator };
+                if (VerifyOptions(directives[(int)type], loc))
+                {
+                    SetEntity(entities[(int)type], name, params, loc);
+                }
+            }
+
+            void WorldBegin(void)
+            {
+                inWorld = true;
+                activeTransformBits = AllTransformsBits;
+                curTransform = TransformSet();
+                namedCoordinateSystems["world"] = curTransform;
+            }
+
+            void WorldEnd(const std::string &loc)
+            {
+                if (!pushedGraphicsStates.empty() || !pushedTransforms.empty())
+                {
+                    LOG(ERROR) << loc << ": missing end to AttributeBegin or TransformBegin";
+                }
+                pushedGraphicsStates.clear();
+                pushedTransforms.clear();
+                pushedActiveTransformBits.clear();
+            }
+
+            // ----------------------------------------------------------------------------
+            // 场景内容
+            // ----------------------------------------------------------------------------
+            void Material(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                auto material = std::make_shared<SceneEntity>();
+                SetEntity(material.get(), name, params, loc);
+                graphicsState.material = material;
+                graphicsState.materialName.clear();
+            }
+
+            void MakeNamedMaterial(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                std::string type = params.FindOneString("type", "");
+                if (type.empty())
+                {
+                    LOG(ERROR) << loc << ": no parameter string \"type\" found in MakeNamedMaterial";
+                    return;
+                }
+                if (scene->namedMaterials.count(name) > 0)
+                {
+                    LOG(WARNING) << loc << ": named material \"" << name << "\" redefined";
+                }
+
+                auto material = std::make_shared<SceneEntity>();
+                SetEntity(material.get(), type, params, loc);
+                scene->namedMaterials[name] = material;
+            }
+
+            void NamedMaterial(const std::string &name)
+            {
+                graphicsState.materialName = name;
+                graphicsState.material = nullptr;
+            }
+
+            void Texture(const std::string &textureName, const std::string &type, const std::string &className
+                       , const ParamSet &params, const std::string &loc)
+            {
+                TextureEntity texture;
+                SetEntity(&texture, className, params, loc);
+                texture.transform = curTransform;
+                texture.textureName = textureName;
+                texture.type = type;
+                scene->textures.push_back(std::move(texture));
+            }
+
+            void MakeNamedMedium(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                TransformedSceneEntity medium;
+                SetEntity(&medium, params.FindOneString("type", ""), params, loc);
+                medium.transform = curTransform;
+                scene->media[name] = std::move(medium);
+            }
+
+            void MediumInterface(const std::string &insideName, const std::string &outsideName)
+            {
+                graphicsState.insideMedium = insideName;
+                graphicsState.outsideMedium = outsideName;
+            }
+
+            void LightSource(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                LightEntity light;
+                SetEntity(&light, name, params, loc);
+                light.transform = curTransform;
+                light.medium = graphicsState.outsideMedium;
+                scene->lights.push_back(std::move(light));
+            }
+
+            void AreaLightSource(const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                auto areaLight = std::make_shared<SceneEntity>();
+                SetEntity(areaLight.get(), name, params, loc);
+                graphicsState.areaLight = areaLight;
+            }
+
+            void ReverseOrientation(void)
+            {
+                graphicsState.reverseOrientation = !graphicsState.reverseOrientation;
+            }
+
+            // 网格交给线程池异步创建，解析可以继续进行；场景缓存中已有的网格直接取出
+            void Shape(const std::string &name, const ParamSet &params, const std::string &loc, const std::string &directory)
+            {
+                ShapeEntity shape;
+                SetEntity(&shape, name, params, loc);
+                shape.objectToWorld = curTransform;
+                shape.reverseOrientation = graphicsState.reverseOrientation;
+                shape.material = graphicsState.material;
+                shape.materialName = graphicsState.materialName;
+                shape.areaLight = graphicsState.areaLight;
+                shape.insideMedium = graphicsState.insideMedium;
+                shape.outsideMedium = graphicsState.outsideMedium;
+
+                bool isMesh = ("trianglemesh" == name) || ("plymesh" == name);
+                std::string filename = ("plymesh" == name) ? ResolveFilename(directory, params.FindOneString("filename", "")) : std::string();
+
+                // 运动的形状在物体空间创建
+                Transform objectToWorld = curTransform.IsAnimated() ? Transform() : curTransform[0];
+                if (isMesh)
+                {
+                    shape.meshKey = MeshKey(name, params, objectToWorld, filename);
+                    if (nullptr != cache)
+                    {
+                        shape.mesh = cache->FindMesh(shape.meshKey);
+                    }
+                }
+
+                std::vector<ShapeEntity> *shapes = (nullptr != currentObject) ? currentObject : &scene->shapes;
+                shapes->push_back(std::move(shape));
+
+                if (!isMesh || shapes->back().mesh)
+                {
+                    return;
+                }
+
+                std::unique_ptr<PendingMesh> pending(new PendingMesh());
+                pending->shapes = shapes;
+                pending->index = shapes->size() - 1;
+                pending->loc = loc;
+
+                PendingMesh *p = pending.get();
+                if ("plymesh" == name)
+                {
+                    pending->task = RunAsync([p, filename, objectToWorld]()
+                    {
+                        p->mesh = CreatePLYMesh(objectToWorld, filename);
+                    });
+                }
+                else
+                {
+                    pending->task = RunAsync([p, params, objectToWorld, loc]()
+                    {
+                        p->mesh = CreateTriangleMesh(params, objectToWorld, loc);
+                    });
+                }
+                pendingMeshes.push_back(std::move(pending));
+            }
+
+            void ObjectBegin(const std::string &name, const std::string &loc)
+            {
+                if (nullptr != currentObject)
+                {
+                    LOG(ERROR) << loc << ": ObjectBegin called inside of instance definition";
+                    return;
+                }
+                AttributeBegin();
+                if (scene->objects.count(name) > 0)
+                {
+                    LOG(WARNING) << loc << ": object \"" << name << "\" redefined";
+                }
+                currentObjectName = name;
+                currentObject = &scene->objects[name];
+                DiscardPendingMeshes(currentObject);
+                currentObject->clear();
+            }
+
+            void ObjectEnd(const std::string &loc)
+            {
+                if (nullptr == currentObject)
+                {
+                    LOG(ERROR) << loc << ": ObjectEnd called outside of instance definition";
+                    return;
+                }
+                currentObject = nullptr;
+                currentObjectName.clear();
+                AttributeEnd(loc);
+            }
+
+            void ObjectInstance(const std::string &name, const std::string &loc)
+            {
+                if (nullptr != currentObject)
+                {
+                    LOG(ERROR) << loc << ": ObjectInstance can't be called inside instance definition";
+                    return;
+                }
+
+                InstanceEntity instance;
+                instance.name = name;
+                instance.instanceToWorld = curTransform;
+                scene->instances.push_back(std::move(instance));
+            }
+
+            void Import(const std::string &filename, const std::string &loc)
+            {
+                std::unique_ptr<PendingImport> pending(new PendingImport());
+                pending->scene.reset(new SceneDescription());
+                pending->builder.reset(new SceneBuilder(*this, pending->scene.get()));
+                pending->loc = loc;
+
+                PendingImport *p = pending.get();
+                pending->task = RunAsync([p, filename]()
+                {
+                    std::unique_ptr<Tokenizer> tokenizer = Tokenizer::CreateFromFile(filename);
+                    p->ok = (nullptr != tokenizer) && Parse(std::move(tokenizer), p->builder.get());
+                    p->ok = p->builder->Finish() && p->ok;
+                });
+                pendingImports.push_back(std::move(pending));
+            }
+
+            // 等待所有异步创建的网格和并行解析的Import文件，并把结果合并到场景中
+            bool Finish(void)
+            {
+                bool ok = true;
+                for (auto &pending : pendingMeshes)
+                {
+                    pending->task->Wait();
+                    if (nullptr == pending->mesh)
+                    {
+                        LOG(ERROR) << pending->loc << ": unable to create mesh";
+                        ok = false;
+                        continue;
+                    }
+                    CHECK_LT(pending->index, pending->shapes->size());
+                    (*pending->shapes)[pending->index].mesh = std::move(pending->mesh);
+                }
+                pendingMeshes.clear();
+
+                for (auto &pending : pendingImports)
+                {
+                    pending->task->Wait();
+                    if (!pending->ok)
+                    {
+                        LOG(ERROR) << pending->loc << ": error in imported file";
+                        ok = false;
+                    }
+                    Merge(pending->scene.get());
+                }
+                pendingImports.clear();
+                return ok;
+            }
+
+        private:
+            static const uint32_t StartTransformBits = 1 << 0;
+            static const uint32_t EndTransformBits = 1 << 1;
+            static const uint32_t AllTransformsBits = StartTransformBits | EndTransformBits;
+
+            struct GraphicsState
+            {
+                std::string insideMedium, outsideMedium;
+                std::shared_ptr<const SceneEntity> material;
+                std::string materialName;
+                std::shared_ptr<const SceneEntity> areaLight;
+                bool reverseOrientation = false;
+            };
+
+            struct PendingMesh
+            {
+                std::vector<ShapeEntity> *shapes;
+                size_t index;
+                std::string loc;
+                std::unique_ptr<TriangleMesh> mesh;
+                std::unique_ptr<AsyncTask> task;
+            };
+
+            struct PendingImport
+            {
+                std::unique_ptr<SceneDescription> scene;
+                std::unique_ptr<SceneBuilder> builder;
+                std::string loc;
+                bool ok = false;
+                std::unique_ptr<AsyncTask> task;
+            };
+
+            // 物体被重新定义时丢弃旧定义中还在创建的网格，它们在shapes中的下标清空后就失效了
+            void DiscardPendingMeshes(const std::vector<ShapeEntity> *shapes)
+            {
+                auto discard = std::remove_if(pendingMeshes.begin(), pendingMeshes.end(), [shapes](const std::unique_ptr<PendingMesh> &pending)
+                {
+                    if (shapes != pending->shapes)
+                    {
+                        return false;
+                    }
+                    pending->task->Wait();
+                    return true;
+                });
+                pendingMeshes.erase(discard, pendingMeshes.end());
+            }
+
+            template <typename Func>
+            void ForActiveTransforms(Func func)
+            {
+                for (int i = 0; i < 2; ++i)
+                {
+                    if (activeTransformBits & (1 << i))
+                    {
+                        curTransform[i] = func(curTransform[i]);
+                    }
+                }
+            }
+
+            void SetEntity(SceneEntity *entity, const std::string &name, const ParamSet &params, const std::string &loc)
+            {
+                entity->name = name;
+                entity->params = params;
+                entity->loc = loc;
+            }
+
+            bool VerifyOptions(const char *directive, const std::string &loc)
+            {
+                if (inWorld)
+                {
+                    LOG(ERROR) << loc << ": options cannot be set inside world block; \"" << directive << "\" not allowed, ignoring";
+                    return false;
+                }
+                return true;
+            }
+
+            template <typename T>
+            static void Append(std::vector<T> *to, std::vector<T> *from)
+            {
+                to->insert(to->end(), std::make_move_iterator(from->begin()), std::make_move_iterator(from->end()));
+            }
+
+            void Merge(SceneDescription *imported)
+            {
+                Append(&scene->shapes, &imported->shapes);
+                Append(&scene->lights, &imported->lights);
+                Append(&scene->textures, &imported->textures);
+                Append(&scene->instances, &imported->instances);
+                for (auto &object : imported->objects)
+                {
+                    Append(&scene->objects[object.first], &object.second);
+                }
+                for (auto &material : imported->namedMaterials)
+                {
+                    if (scene->namedMaterials.count(material.first) > 0)
+                    {
+                        LOG(WARNING) << material.second->loc << ": named material \"" << material.first << "\" redefined";
+                    }
+                    scene->namedMaterials[material.first] = material.second;
+                }
+                for (auto &medium : imported->media)
+                {
+                    scene->media[medium.first] = std::move(medium.second);
+                }
+            }
+
+            SceneDescription *scene;
+            const SceneCache *cache;
+            TransformSet curTransform;
+            uint32_t activeTransformBits = AllTransformsBits;
+            std::map<std::string, TransformSet> namedCoordinateSystems;
+            GraphicsState graphicsState;
+            std::vector<GraphicsState> pushedGraphicsStates;
+            std::vector<TransformSet> pushedTransforms;
+            std::vector<uint32_t> pushedActiveTransformBits;
+            bool inWorld = false;
+
+            std::string currentObjectName;
+            std::vector<ShapeEntity> *currentObject = nullptr;
+
+            std::vector<std::unique_ptr<PendingMesh>> pendingMeshes;
+            std::vector<std::unique_ptr<PendingImport>> pendingImports;
+        };
+
+        // Include展开时的词法分析器栈，支持回退一个词法单元
+        // @remarks: Filename()是最后一个取出的词法单元所在的文件；预读越过被包含文件的末尾再回退时，仍然是被包含的文件
+        class TokenStream
+        {
+        public:
+            explicit TokenStream(std::unique_ptr<Tokenizer> tokenizer)
+            {
+                tokenizers.push_back(std::move(tokenizer));
+            }
+
+            bool Next(Token *token)
+            {
+                if (hasUnget)
+                {
+                    *token = ungetToken;
+                    hasUnget = false;
+                    previous = current;
+                    current = ungetSource;
+                    return true;
+                }
+
+                while (!tokenizers.empty())
+                {
+                    if (tokenizers.back()->Next(token))
+                    {
+                        previous = current;
+                        current = tokenizers.back().get();
+                        return true;
+                    }
+                    if (tokenizers.back()->Failed())
+                    {
+                        failed = true;
+                        return false;
+                    }
+
+                    // 已经返回的词法单元可能还在使用，文件读完后保留到解析结束
+                    finished.push_back(std::move(tokenizers.back()));
+                    tokenizers.pop_back();
+                }
+                return false;
+            }
+
+            void Unget(const Token &token)
+            {
+                CHECK(!hasUnget);
+                ungetToken = token;
+                ungetSource = current;
+                current = previous;
+                hasUnget = true;
+            }
+
+            void Push(std::unique_ptr<Tokenizer> tokenizer)
+            {
+                tokenizers.push_back(std::move(tokenizer));
+            }
+
+            bool Failed(void) const
+            {
+                return failed;
+            }
+
+            const std::string &Filename(void) const
+            {
+                static const std::string empty;
+                if (nullptr != current)
+                {
+                    return current->Filename();
+                }
+                return tokenizers.empty() ? empty : tokenizers.back()->Filename();
+            }
+
+            std::string Loc(const Token &token) const
+            {
+                return (Filename().empty() ? std::string("<string>") : Filename()) + ":" + std::to_string(token.line);
+            }
+
+        private:
+            std::vector<std::unique_ptr<Tokenizer>> tokenizers;
+            std::vector<std::unique_ptr<Tokenizer>> finished;
+            // 指向tokenizers或finished中的词法分析器，解析结束前一直有效
+            const Tokenizer *current = nullptr;
+            const Tokenizer *previous = nullptr;
+            const Tokenizer *ungetSource = nullptr;
+            Token ungetToken;
+            bool hasUnget = false;
+            bool failed = false;
+        };
+
+        // 规范化参数类型名
+        const char *NormalizeType(const std::string &type)
+        {
+            static const char *const aliases[][2] =
+            {
+                { "point", "point3" }, { "vector", "vector3" }, { "normal", "normal3" }, { "color", "rgb" },
+            };
+            static const char *const types[] =
+            {
+                "integer", "float", "point2", "vector2", "point3", "vector3", "normal3",
+                "rgb", "xyz", "blackbody", "spectrum", "bool", "string", "texture",
+            };
+            for (const auto &alias : aliases)
+            {
+                if (type == alias[0])
+                {
+                    return alias[1];
+                }
+            }
+            for (const char *t : types)
+            {
+                if (type == t)
+                {
+                    return t;
+                }
+            }
+            return nullptr;
+        }
+
+        // 把读到的数值按声明的类型放入参数项
+        bool FinishParamItem(ParamSetItem *item, std::vector<Float> *numbers, std::vector<std::string> *strings
+                           , const std::string &loc)
+        {
+            const std::string &type = item->type;
+            if (("integer" == type) || ("bool" == type))
+            {
+                // 已在读取时处理
+            }
+            else if (("string" == type) || ("texture" == type))
+            {
+                item->strings = std::move(*strings);
+            }
+            else if ("spectrum" == type)
+            {
+                // 数值为(波长, 值)对，字符串为光谱文件名
+                item->floats = std::move(*numbers);
+                item->strings = std::move(*strings);
+            }
+            else if (("float" == type) || ("rgb" == type) || ("xyz" == type) || ("blackbody" == type))
+            {
+                item->floats = std::move(*numbers);
+            }
+            else
+            {
+                int nComponents = (("point2" == type) || ("vector2" == type)) ? 2 : 3;
+                if (0 != (numbers->size() % nComponents))
+                {
+                    LOG(ERROR) << loc << ": number of values for \"" << item->name << "\" is not a multiple of " << nComponents;
+                    return false;
+                }
+
+                const Float *v = numbers->data();
+                size_t n = numbers->size() / nComponents;
+                if ("point2" == type)
+                {
+                    item->point2fs.resize(n);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        item->point2fs[i] = Point2f(v[2 * i], v[(2 * i) + 1]);
+                    }
+                }
+                else if ("vector2" == type)
+                {
+                    item->vector2fs.resize(n);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        item->vector2fs[i] = Vector2f(v[2 * i], v[(2 * i) + 1]);
+                    }
+                }
+                else if ("point3" == type)
+                {
+                    item->point3fs.resize(n);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        item->point3fs[i] = Point3f(v[3 * i], v[(3 * i) + 1], v[(3 * i) + 2]);
+                    }
+                }
+                else if ("vector3" == type)
+                {
+                    item->vector3fs.resize(n);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        item->vector3fs[i] = Vector3f(v[3 * i], v[(3 * i) + 1], v[(3 * i) + 2]);
+                    }
+                }
+                else
+                {
+                    item->normals.resize(n);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        item->normals[i] = Normal3f(v[3 * i], v[(3 * i) + 1], v[(3 * i) + 2]);
+                    }
+                }
+            }
+            return true;
+        }
+
+        // 读取"类型 名字" 值 形式的参数列表，直到下一个不带引号的词法单元
+        bool ParseParams(TokenStream &stream, ParamSet *params)
+        {
+            std::vector<Float> numbers;
+            std::vector<std::string> strings;
+            Token token;
+            while (stream.Next(&token))
+            {
+                if (!token.IsQuoted())
+                {
+                    stream.Unget(token);
+                    return true;
+                }
+
+                std::string loc = stream.Loc(token);
+                std::istringstream decl(token.Dequote());
+                std::string typeName, name;
+                decl >> typeName >> name;
+                const char *type = NormalizeType(typeName);
+                if ((nullptr == type) || name.empty())
+                {
+                    LOG(ERROR) << loc << ": bad parameter declaration " << token.ToString();
+                    return false;
+                }
+
+                auto item = std::make_shared<ParamSetItem>();
+                item->type = type;
+                item->name = name;
+                bool isInt = ("integer" == item->type);
+                bool isBool = ("bool" == item->type);
+
+                // 值可以是单个词法单元，也可以是方括号括起来的列表
+                Token value;
+                if (!stream.Next(&value))
+                {
+                    LOG(ERROR) << loc << ": missing value for parameter \"" << name << "\"";
+                    return false;
+                }
+                bool isList = (value == "[");
+                if (isList && !stream.Next(&value))
+                {
+                    LOG(ERROR) << loc << ": unterminated parameter list";
+                    return false;
+                }
+
+                numbers.clear();
+                strings.clear();
+                while (!isList || (value != "]"))
+                {
+                    bool ok = true;
+                    if (isBool)
+                    {
+                        std::string str = value.Dequote();
+                        ok = ("true" == str) || ("false" == str);
+                        item->bools.push_back("true" == str);
+                    }
+                    else if (value.IsQuoted())
+                    {
+                        strings.push_back(value.Dequote());
+                    }
+                    else if (isInt)
+                    {
+                        int v;
+                        ok = ParseInt(value, &v);
+                        if (ok)
+                        {
+                            item->ints.push_back(v);
+                        }
+                    }
+                    else
+                    {
+                        double v;
+                        ok = ParseNumber(value, &v);
+                        if (ok)
+                        {
+                            numbers.push_back((Float)v);
+                        }
+                    }
+                    if (!ok)
+                    {
+                        LOG(ERROR) << stream.Loc(value) << ": bad value " << value.ToString() << " for parameter \"" << name << "\"";
+                        return false;
+                    }
+
+                    if (!isList)
+                    {
+                        break;
+                    }
+                    if (!stream.Next(&value))
+                    {
+                        LOG(ERROR) << loc << ": unterminated parameter list";
+                        return false;
+                    }
+                }
+
+                if (!FinishParamItem(item.get(), &numbers, &strings, loc))
+                {
+                    return false;
+                }
+                params->Add(item);
+            }
+            return !stream.Failed();
+        }
+
+        bool ReadFloats(TokenStream &stream, Float *values, int count, const char *directive)
+        {
+            Token token;
+            for (int i = 0; i < count; ++i)
+            {
+                double v;
+                if (!stream.Next(&token) || !ParseNumber(token, &v))
+                {
+                    LOG(ERROR) << stream.Loc(token) << ": expected " << count << " numbers for " << directive;
+                    return false;
+                }
+                values[i] = (Float)v;
+            }
+            return true;
+        }
+
+        // 矩阵两侧的方括号可以省略
+        bool ReadMatrix(TokenStream &stream, Float m[16], const char *directive)
+        {
+            Token token;
+            if (!stream.Next(&token))
+            {
+                LOG(ERROR) << stream.Filename() << ": expected matrix for " << directive;
+                return false;
+            }
+            bool bracketed = (token == "[");
+            if (!bracketed)
+            {
+                stream.Unget(token);
+            }
+            if (!ReadFloats(stream, m, 16, directive))
+            {
+                return false;
+            }
+            if (bracketed && (!stream.Next(&token) || (token != "]")))
+            {
+                LOG(ERROR) << stream.Loc(token) << ": expected ] after " << directive;
+                return false;
+            }
+            return true;
+        }
+
+        bool ReadString(TokenStream &stream, std::string *str, const char *directive)
+        {
+            Token token;
+            if (!stream.Next(&token) || !token.IsQuoted())
+            {
+                LOG(ERROR) << stream.Loc(token) << ": expected quoted string after " << directive;
+                return false;
+            }
+            *str = token.Dequote();
+            return true;
+        }
+
+        // "名字" 参数列表
+        bool ReadNameAndParams(TokenStream &stream, std::string *name, ParamSet *params, const char *directive)
+        {
+            return ReadString(stream, name, directive) && ParseParams(stream, params);
+        }
+
+        typedef bool (*DirectiveHandler)(TokenStream &stream, SceneBuilder *builder, const std::string &loc);
+
+        struct Directive
+        {
+            const char *name;
+            DirectiveHandler handler;
+        };
+
+        // 各指令读取自己的参数并调用SceneBuilder
+        const Directive Directives[] =
+        {
+            { "AttributeBegin", [](TokenStream &, SceneBuilder *builder, const std::string &)
+            {
+                builder->AttributeBegin();
+                return true;
+            } },
+            { "AttributeEnd", [](TokenStream &, SceneBuilder *builder, const std::string &loc)
+            {
+                builder->AttributeEnd(loc);
+                return true;
+            } },
+            { "TransformBegin", [](TokenStream &, SceneBuilder *builder, const std::string &)
+            {
+                builder->TransformBegin();
+                return true;
+            } },
+            { "TransformEnd", [](TokenStream &, SceneBuilder *builder, const std::string &loc)
+            {
+                builder->TransformEnd(loc);
+                return true;
+            } },
+            { "Identity", [](TokenStream &, SceneBuilder *builder, const std::string &)
+            {
+                builder->Identity();
+                return true;
+            } },
+            { "Translate", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float v[3];
+                if (!ReadFloats(stream, v, 3, "Translate"))
+                {
+                    return false;
+                }
+                builder->Translate(Vector3f(v[0], v[1], v[2]));
+                return true;
+            } },
+            { "Scale", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float v[3];
+                if (!ReadFloats(stream, v, 3, "Scale"))
+                {
+                    return false;
+                }
+                builder->Scale(v[0], v[1], v[2]);
+                return true;
+            } },
+            { "Rotate", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float v[4];
+                if (!ReadFloats(stream, v, 4, "Rotate"))
+                {
+                    return false;
+                }
+                builder->Rotate(v[0], Vector3f(v[1], v[2], v[3]));
+                return true;
+            } },
+            { "LookAt", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float v[9];
+                if (!ReadFloats(stream, v, 9, "LookAt"))
+                {
+                    return false;
+                }
+                builder->LookAt(Point3f(v[0], v[1], v[2]), Point3f(v[3], v[4], v[5]), Vector3f(v[6], v[7], v[8]));
+                return true;
+            } },
+            { "ConcatTransform", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float m[16];
+                if (!ReadMatrix(stream, m, "ConcatTransform"))
+                {
+                    return false;
+                }
+                builder->ConcatTransform(m);
+                return true;
+            } },
+            { "Transform", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float m[16];
+                if (!ReadMatrix(stream, m, "Transform"))
+                {
+                    return false;
+                }
+                builder->SetTransform(m);
+                return true;
+            } },
+            { "CoordinateSystem", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                std::string name;
+                if (!ReadString(stream, &name, "CoordinateSystem"))
+                {
+                    return false;
+                }
+                builder->CoordinateSystem(name);
+                return true;
+            } },
+            { "CoordSysTransform", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                if (!ReadString(stream, &name, "CoordSysTransform"))
+                {
+                    return false;
+                }
+                builder->CoordSysTransform(name, loc);
+                return true;
+            } },
+            { "ActiveTransform", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                Token which;
+                if (!stream.Next(&which))
+                {
+                    LOG(ERROR) << loc << ": expected All, StartTime or EndTime after ActiveTransform";
+                    return false;
+                }
+                builder->ActiveTransform(which.Dequote(), loc);
+                return true;
+            } },
+            { "TransformTimes", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                Float v[2];
+                if (!ReadFloats(stream, v, 2, "TransformTimes"))
+                {
+                    return false;
+                }
+                builder->TransformTimes(v[0], v[1]);
+                return true;
+            } },
+            { "Camera", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Camera"))
+                {
+                    return false;
+                }
+                builder->Camera(name, params, loc);
+                return true;
+            } },
+            { "Film", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Film"))
+                {
+                    return false;
+                }
+                builder->Option(SceneBuilder::OptionType::Film, name, params, loc);
+                return true;
+            } },
+            { "Sampler", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Sampler"))
+                {
+                    return false;
+                }
+                builder->Option(SceneBuilder::OptionType::Sampler, name, params, loc);
+                return true;
+            } },
+            { "PixelFilter", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "PixelFilter"))
+                {
+                    return false;
+                }
+                builder->Option(SceneBuilder::OptionType::PixelFilter, name, params, loc);
+                return true;
+            } },
+            { "Integrator", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Integrator"))
+                {
+                    return false;
+                }
+                builder->Option(SceneBuilder::OptionType::Integrator, name, params, loc);
+                return true;
+            } },
+            { "Accelerator", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Accelerator"))
+                {
+                    return false;
+                }
+                builder->Option(SceneBuilder::OptionType::Accelerator, name, params, loc);
+                return true;
+            } },
+            { "WorldBegin", [](TokenStream &, SceneBuilder *builder, const std::string &)
+            {
+                builder->WorldBegin();
+                return true;
+            } },
+            { "WorldEnd", [](TokenStream &, SceneBuilder *builder, const std::string &loc)
+            {
+                builder->WorldEnd(loc);
+                return true;
+            } },
+            { "Material", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Material"))
+                {
+                    return false;
+                }
+                builder->Material(name, params, loc);
+                return true;
+            } },
+            { "MakeNamedMaterial", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "MakeNamedMaterial"))
+                {
+                    return false;
+                }
+                builder->MakeNamedMaterial(name, params, loc);
+                return true;
+            } },
+            { "NamedMaterial", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                std::string name;
+                if (!ReadString(stream, &name, "NamedMaterial"))
+                {
+                    return false;
+                }
+                builder->NamedMaterial(name);
+                return true;
+            } },
+            { "Texture", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string textureName, type, className;
+                ParamSet params;
+                if (!ReadString(stream, &textureName, "Texture") || !ReadString(stream, &type, "Texture")
+                 || !ReadNameAndParams(stream, &className, &params, "Texture"))
+                {
+                    return false;
+                }
+                builder->Texture(textureName, type, className, params, loc);
+                return true;
+            } },
+            { "MakeNamedMedium", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "MakeNamedMedium"))
+                {
+                    return false;
+                }
+                builder->MakeNamedMedium(name, params, loc);
+                return true;
+            } },
+            { "MediumInterface", [](TokenStream &stream, SceneBuilder *builder, const std::string &)
+            {
+                // 只给一个名字时内外介质相同
+                std::string insideName, outsideName;
+                if (!ReadString(stream, &insideName, "MediumInterface"))
+                {
+                    return false;
+                }
+                // @remarks: 文件在第一个名字后结束时没有读到记号，不能回退
+                outsideName = insideName;
+                Token token;
+                if (stream.Next(&token))
+                {
+                    if (token.IsQuoted())
+                    {
+                        outsideName = token.Dequote();
+                    }
+                    else
+                    {
+                        stream.Unget(token);
+                    }
+                }
+                builder->MediumInterface(insideName, outsideName);
+                return !stream.Failed();
+            } },
+            { "LightSource", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "LightSource"))
+                {
+                    return false;
+                }
+                builder->LightSource(name, params, loc);
+                return true;
+            } },
+            { "AreaLightSource", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "AreaLightSource"))
+                {
+                    return false;
+                }
+                builder->AreaLightSource(name, params, loc);
+                return true;
+            } },
+            { "ReverseOrientation", [](TokenStream &, SceneBuilder *builder, const std::string &)
+            {
+                builder->ReverseOrientation();
+                return true;
+            } },
+            { "Shape", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                ParamSet params;
+                if (!ReadNameAndParams(stream, &name, &params, "Shape"))
+                {
+                    return false;
+                }
+                builder->Shape(name, params, loc, DirectoryOf(stream.Filename()));
+                return true;
+            } },
+            { "ObjectBegin", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                if (!ReadString(stream, &name, "ObjectBegin"))
+                {
+                    return false;
+                }
+                builder->ObjectBegin(name, loc);
+                return true;
+            } },
+            { "ObjectEnd", [](TokenStream &, SceneBuilder *builder, const std::string &loc)
+            {
+                builder->ObjectEnd(loc);
+                return true;
+            } },
+            { "ObjectInstance", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string name;
+                if (!ReadString(stream, &name, "ObjectInstance"))
+                {
+                    return false;
+                }
+                builder->ObjectInstance(name, loc);
+                return true;
+            } },
+            { "Include", [](TokenStream &stream, SceneBuilder *, const std::string &)
+            {
+                std::string filename;
+                if (!ReadString(stream, &filename, "Include"))
+                {
+                    return false;
+                }
+                std::unique_ptr<Tokenizer> tokenizer = Tokenizer::CreateFromFile(ResolveFilename(DirectoryOf(stream.Filename()), filename));
+                if (nullptr == tokenizer)
+                {
+                    return false;
+                }
+                stream.Push(std::move(tokenizer));
+                return true;
+            } },
+            { "Import", [](TokenStream &stream, SceneBuilder *builder, const std::string &loc)
+            {
+                std::string filename;
+                if (!ReadString(stream, &filename, "Import"))
+                {
+                    return false;
+                }
+                builder->Import(ResolveFilename(DirectoryOf(stream.Filename()), filename), loc);
+                return true;
+            } },
+        };
+
+        bool Parse(std::unique_ptr<Tokenizer> tokenizer, SceneBuilder *builder)
+        {
+            TokenStream stream(std::move(tokenizer));
+            Token token;
+            while (stream.Next(&token))
+            {
+                DirectiveHandler handler = nullptr;
+                for (const Directive &directive : Directives)
+                {
+                    if (token == directive.name)
+                    {
+                        handler = directive.handler;
+                        break;
+                    }
+                }
+
+                std::string loc = stream.Loc(token);
+                if (nullptr == handler)
+                {
+                    LOG(ERROR) << loc << ": unknown directive " << token.ToString();
+                    return false;
+                }
+                if (!handler(stream, builder, loc))
+                {
+                    return false;
+                }
+            }
+            return !stream.Failed();
+        }
+    }
+
+    bool ParseFile(const std::string &filename, SceneDescription *scene, const SceneCache *cache)
+    {
+        std::unique_ptr<Tokenizer> tokenizer = Tokenizer::CreateFromFile(filename);
+        if (nullptr == tokenizer)
+        {
+            return false;
+        }
+
+        ProfilePhase _(Prof::SceneParsing);
+        SceneBuilder builder(scene, cache);
+        bool ok = Parse(std::move(tokenizer), &builder);
+        return builder.Finish() && ok;
+    }
+
+    bool ParseString(const std::string &str, SceneDescription *scene, const SceneCache *cache)
+    {
+        ProfilePhase _(Prof::SceneParsing);
+        SceneBuilder builder(scene, cache);
+        bool ok = Parse(Tokenizer::CreateFromString(str), &builder);
+        return builder.Finish() && ok;
+    }
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include "MappedFile.h"
+#include "SceneDescription.h"
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace PBRT
+{
+    class SceneCache;
+
+    // 词法单元，直接指向Tokenizer的缓冲区，不复制字符
+    // @remarks: 带引号的字符串包含两侧的引号
+    struct Token
+    {
+        bool IsQuoted(void) const
+        {
+            return (length >= 2) && ('"' == text[0]);
+        }
+
+        bool operator==(const char *str) const
+        {
+            return (std::strlen(str) == length) && (0 == std::memcmp(text, str, length));
+        }
+
+        bool operator!=(const char *str) const
+        {
+            return !(*this == str);
+        }
+
+        std::string ToString(void) const
+        {
+            return std::string(text, length);
+        }
+
+        // 去掉引号并处理转义字符
+        std::string Dequote(void) const;
+
+        const char *text = nullptr;
+        size_t length = 0;
+        int line = 0;
+    };
+
+    // pbrt场景文件的词法分析器，文件以内存映射方式打开，整个分析过程不分配内存
+    class Tokenizer
+    {
+    public:
+        // 失败时输出错误日志并返回nullptr
+        static std::unique_ptr<Tokenizer> CreateFromFile(const std::string &filename);
+
+        static std::unique_ptr<Tokenizer> CreateFromString(std::string str);
+
+        Tokenizer(const Tokenizer &) = delete;
+        Tokenizer &operator=(const Tokenizer &) = delete;
+
+        // 到达末尾或出错时返回false，出错时Failed()为true
+        bool Next(Token *token);
+
+        bool Failed(void) const
+        {
+            return failed;
+        }
+
+        // 文件名，从字符串创建时为空
+        const std::string &Filename(void) const
+        {
+            return filename;
+        }
+
+    private:
+        Tokenizer(void)
+        {}
+
+        std::string filename;
+        MappedFile file;
+        std::string contents;
+        const char *pos = nullptr;
+        const char *end = nullptr;
+        int line = 1;
+        bool failed = false;
+    };
+
+    // 解析pbrt-v3格式的场景文件
+    // Include的文件按顺序原地展开；Import的文件不改变当前的图形状态，在线程池中与主文件并行解析；
+    // trianglemesh和plymesh形状的网格在解析过程中异步创建，返回前全部完成；
+    // 给出cache时先按ShapeEntity::meshKey在缓存中查找，找到的网格不再创建
+    // @remarks: 出错时输出错误日志并返回false
+    bool ParseFile(const std::string &filename, SceneDescription *scene, const SceneCache *cache = nullptr);
+
+    bool ParseString(const std::string &str, SceneDescription *scene, const SceneCache *cache = nullptr);
+}
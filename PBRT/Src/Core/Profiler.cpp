@@ -0,0 +1,150 @@
+﻿#include "Profiler.h"
+#include "glog/logging.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace PBRT
+{
+    ProfilerSlot ProfilerSlots[MaxProfiledThreads];
+
+    namespace
+    {
+        const char *const ProfNames[] =
+        {
+            "Scene parsing",
+            "BVH construction",
+            "BVH traversal",
+            "Shading",
+            "Medium sampling",
+            "Film AddSample",
+        };
+        static_assert((sizeof(ProfNames) / sizeof(ProfNames[0])) == (size_t)Prof::NumProfCategories, "ProfNames must match Prof");
+
+        std::thread samplerThread;
+        std::mutex profilerMutex;
+        std::condition_variable profilerCondition;
+        bool stopSampling = false;
+        int sampleRate = 0;
+
+        // 阶段组合 -> 样本数，只有采样线程写，停止采样后才读
+        std::unordered_map<uint64_t, uint64_t> profileSamples;
+
+        void SamplerThreadFunc(std::chrono::microseconds period)
+        {
+            std::unique_lock<std::mutex> lock(profilerMutex);
+            std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now() + period;
+            while (!profilerCondition.wait_until(lock, next, []() { return stopSampling; }))
+            {
+                for (int i = 0; i < MaxProfiledThreads; ++i)
+                {
+                    uint64_t state = ProfilerSlots[i].state.load(std::memory_order_relaxed);
+                    if (0 != state)
+                    {
+                        ++profileSamples[state];
+                    }
+                }
+
+                // 落后时不补采，避免一次性连续采很多次
+                next = std::max(next + period, std::chrono::steady_clock::now());
+            }
+        }
+
+        // 组合中的阶段按枚举顺序用" / "连接
+        std::string StateName(uint64_t state)
+        {
+            std::string name;
+            for (int i = 0; i < (int)Prof::NumProfCategories; ++i)
+            {
+                if (0 != (state & ((uint64_t)1 << i)))
+                {
+                    if (!name.empty())
+                    {
+                        name += " / ";
+                    }
+                    name += ProfNames[i];
+                }
+            }
+            return name;
+        }
+    }
+
+    void ProfilerStart(int samplesPerSecond)
+    {
+        CHECK(!samplerThread.joinable());
+        CHECK_GT(samplesPerSecond, 0);
+
+        sampleRate = samplesPerSecond;
+        stopSampling = false;
+        profileSamples.clear();
+        samplerThread = std::thread(SamplerThreadFunc, std::chrono::microseconds(1000000 / samplesPerSecond));
+    }
+
+    void ProfilerStopAndReport(void)
+    {
+        if (!samplerThread.joinable())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(profilerMutex);
+            stopSampling = true;
+        }
+        profilerCondition.notify_all();
+        samplerThread.join();
+
+        uint64_t totalSamples = 0;
+        for (const auto &sample : profileSamples)
+        {
+            totalSamples += sample.second;
+        }
+        if (0 == totalSamples)
+        {
+            return;
+        }
+
+        char buf[512];
+        LOG(INFO) << "Profile (" << totalSamples << " thread samples, about "
+                  << (double)totalSamples / sampleRate << " thread-seconds):";
+
+        // 每个阶段的总占比，包括嵌套在其中的其他阶段
+        for (int i = 0; i < (int)Prof::NumProfCategories; ++i)
+        {
+            uint64_t count = 0;
+            for (const auto &sample : profileSamples)
+            {
+                if (0 != (sample.first & ((uint64_t)1 << i)))
+                {
+                    count += sample.second;
+                }
+            }
+            if (count > 0)
+            {
+                snprintf(buf, sizeof(buf), "    %-56s %6.2f%%", ProfNames[i], (100.0 * count) / totalSamples);
+                LOG(INFO) << buf;
+            }
+        }
+
+        // 按阶段组合细分，从多到少
+        std::vector<std::pair<uint64_t, uint64_t>> sorted(profileSamples.begin(), profileSamples.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b)
+        {
+            return a.second > b.second;
+        });
+        LOG(INFO) << "  Breakdown:";
+        for (const auto &sample : sorted)
+        {
+            snprintf(buf, sizeof(buf), "    %-56s %6.2f%%", StateName(sample.first).c_str(), (100.0 * sample.second) / totalSamples);
+            LOG(INFO) << buf;
+        }
+        profileSamples.clear();
+    }
+}
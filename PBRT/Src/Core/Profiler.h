@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace PBRT
+{
+    // 渲染的各个阶段，每个阶段占线程状态中的一位，可以嵌套
+    enum class Prof
+    {
+        SceneParsing,
+        BVHBuild,
+        Traversal,
+        Shading,
+        MediumSampling,
+        FilmAddSample,
+        NumProfCategories
+    };
+
+    static const int MaxProfiledThreads = 256;
+
+    // 线程当前所处阶段的位掩码，只由线程自己写，采样线程读
+    // @remarks: 按缓存行对齐，相邻线程写各自的状态时不会互相干扰
+    struct alignas(64) ProfilerSlot
+    {
+        std::atomic<uint64_t> state;
+    };
+
+    extern ProfilerSlot ProfilerSlots[MaxProfiledThreads];
+
+    // 按ThreadIndex取调用线程的状态，线程池之外的线程与主线程共用0号
+    inline std::atomic<uint64_t> &ProfilerState(void)
+    {
+        return ProfilerSlots[std::min(ThreadIndex, MaxProfiledThreads - 1)].state;
+    }
+
+    // 在作用域内把调用线程标记为处于phase阶段
+    // @remarks: 只有线程自己写自己的状态，用relaxed读写就够了，没有原子读改写
+    class ProfilePhase
+    {
+    public:
+        explicit ProfilePhase(Prof phase)
+            : bit((uint64_t)1 << (int)phase)
+        {
+            std::atomic<uint64_t> &state = ProfilerState();
+            uint64_t current = state.load(std::memory_order_relaxed);
+            reset = (0 == (current & bit));
+            state.store(current | bit, std::memory_order_relaxed);
+        }
+
+        ~ProfilePhase()
+        {
+            if (reset)
+            {
+                std::atomic<uint64_t> &state = ProfilerState();
+                state.store(state.load(std::memory_order_relaxed) & ~bit, std::memory_order_relaxed);
+            }
+        }
+
+        ProfilePhase(const ProfilePhase &) = delete;
+        ProfilePhase &operator=(const ProfilePhase &) = delete;
+
+    private:
+        const uint64_t bit;
+        bool reset;
+    };
+
+    // 启动采样线程：每秒samplesPerSecond次读取所有线程的状态，按阶段组合计数
+    // @remarks: 采样的是墙上时间，线程在某阶段中等待也会计入；状态为0（不在任何阶段）的线程不计数
+    void ProfilerStart(int samplesPerSecond = 100);
+
+    // 停止采样线程并通过glog输出各阶段所占的百分比
+    void ProfilerStopAndReport(void);
+}
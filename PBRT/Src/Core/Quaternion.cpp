@@ -0,0 +1,91 @@
+﻿#include "Quaternion.h"
+#include "Transform.h"
+
+namespace PBRT
+{
+    Quaternion::Quaternion(const Matrix4x4 &m)
+    {
+        Float trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+        if (trace > 0.0f)
+        {
+            // 先由迹求w，再求xyz
+            Float s = std::sqrt(trace + 1.0f);
+            w = s / 2.0f;
+            s = 0.5f / s;
+            v.x = (m.m[2][1] - m.m[1][2]) * s;
+            v.y = (m.m[0][2] - m.m[2][0]) * s;
+            v.z = (m.m[1][0] - m.m[0][1]) * s;
+        }
+        else
+        {
+            // 先求x、y、z中绝对值最大的一个，再求其余分量
+            const int next[3] = { 1, 2, 0 };
+            Float q[3];
+            int i = 0;
+            if (m.m[1][1] > m.m[0][0]) i = 1;
+            if (m.m[2][2] > m.m[i][i]) i = 2;
+            int j = next[i];
+            int k = next[j];
+            Float s = std::sqrt((m.m[i][i] - (m.m[j][j] + m.m[k][k])) + 1.0f);
+            q[i] = s * 0.5f;
+            if (0.0f != s)
+            {
+                s = 0.5f / s;
+            }
+            w = (m.m[k][j] - m.m[j][k]) * s;
+            q[j] = (m.m[j][i] + m.m[i][j]) * s;
+            q[k] = (m.m[k][i] + m.m[i][k]) * s;
+            v.x = q[0];
+            v.y = q[1];
+            v.z = q[2];
+        }
+    }
+
+    Quaternion::Quaternion(const Transform &t)
+        : Quaternion(t.GetMatrix())
+    {}
+
+    void Quaternion::ToMatrix(Float r[3][3]) const
+    {
+        Float xx = v.x * v.x, yy = v.y * v.y, zz = v.z * v.z, ww = w * w;
+        Float xy = v.x * v.y, xz = v.x * v.z, yz = v.y * v.z;
+        Float wx = v.x * w, wy = v.y * w, wz = v.z * w;
+
+        r[0][0] = ww + xx - yy - zz;
+        r[0][1] = 2 * (xy - wz);
+        r[0][2] = 2 * (xz + wy);
+        r[1][0] = 2 * (xy + wz);
+        r[1][1] = ww - xx + yy - zz;
+        r[1][2] = 2 * (yz - wx);
+        r[2][0] = 2 * (xz - wy);
+        r[2][1] = 2 * (yz + wx);
+        r[2][2] = ww - xx - yy + zz;
+    }
+
+    Transform Quaternion::ToTransform(void) const
+    {
+        Float r[3][3];
+        ToMatrix(r);
+        Matrix4x4 m(r[0][0], r[0][1], r[0][2], 0
+                  , r[1][0], r[1][1], r[1][2], 0
+                  , r[2][0], r[2][1], r[2][2], 0
+                  , 0, 0, 0, 1);
+        return Transform(m, Transpose(m));
+    }
+
+    Quaternion Slerp(Float t, const Quaternion &q1, const Quaternion &q2)
+    {
+        Float cosTheta = Dot(q1, q2);
+        if (cosTheta > 0.9995f)
+        {
+            return Normalize(((1 - t) * q1) + (t * q2));
+        }
+        else
+        {
+            Float theta = std::acos(Clamp(cosTheta, -1, 1));
+            Float thetap = theta * t;
+            Quaternion qperp = Normalize(q2 - (q1 * cosTheta));
+            return ((q1 * std::cos(thetap)) + (qperp * std::sin(thetap)));
+        }
+    }
+}
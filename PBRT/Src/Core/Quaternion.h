@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include "Geometry.h"
+
+namespace PBRT
+{
+    class Transform;
+    struct Matrix4x4;
+
+    // 单位四元数表示旋转，用于关键帧之间的球面插值
+    struct Quaternion
+    {
+        Quaternion(void)
+            : v(0, 0, 0), w(1)
+        {}
+
+        Quaternion(const Vector3f &v, Float w)
+            : v(v), w(w)
+        {}
+
+        // 从旋转矩阵（变换的左上3x3部分）提取
+        explicit Quaternion(const Matrix4x4 &m);
+
+        explicit Quaternion(const Transform &t);
+
+        Quaternion operator+(const Quaternion &q) const
+        {
+            return Quaternion(v + q.v, w + q.w);
+        }
+
+        Quaternion &operator+=(const Quaternion &q)
+        {
+            v += q.v;
+            w += q.w;
+            return *this;
+        }
+
+        Quaternion operator-(const Quaternion &q) const
+        {
+            return Quaternion(v - q.v, w - q.w);
+        }
+
+        Quaternion operator-(void) const
+        {
+            return Quaternion(Vector3f(-v.x, -v.y, -v.z), -w);
+        }
+
+        Quaternion operator*(Float f) const
+        {
+            return Quaternion(v * f, w * f);
+        }
+
+        Quaternion operator/(Float f) const
+        {
+            return Quaternion(v / f, w / f);
+        }
+
+        // 写出对应的3x3旋转矩阵
+        // @remarks: 使用齐次形式（w² + x² - y² - z²而不是1 - 2(y² + z²)），对非单位四元数是二次型
+        void ToMatrix(Float r[3][3]) const;
+
+        Transform ToTransform(void) const;
+
+        Vector3f v;
+        Float w;
+    };
+
+    inline Quaternion operator*(Float f, const Quaternion &q)
+    {
+        return (q * f);
+    }
+
+    inline Float Dot(const Quaternion &q1, const Quaternion &q2)
+    {
+        return (Dot(q1.v, q2.v) + (q1.w * q2.w));
+    }
+
+    inline Quaternion Normalize(const Quaternion &q)
+    {
+        return (q / std::sqrt(Dot(q, q)));
+    }
+
+    // 球面线性插值，两者几乎平行时退化为归一化的线性插值
+    Quaternion Slerp(Float t, const Quaternion &q1, const Quaternion &q2);
+}
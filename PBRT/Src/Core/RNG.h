@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace PBRT
+{
+    // 小于1的最大浮点数，[0, 1)内的均匀随机数不会取到1
+#ifdef PBRT_FLOAT_AS_DOUBLE
+    static PBRT_CONSTEXPR Float OneMinusEpsilon = 0.99999999999999989;
+#else
+    static PBRT_CONSTEXPR Float OneMinusEpsilon = 0.99999994f;
+#endif
+
+    // PCG32伪随机数生成器（O'Neill），状态只有16字节，不同的序列编号产生互不相关的流
+    class RNG
+    {
+    public:
+        RNG(void)
+            : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL)
+        {}
+
+        explicit RNG(uint64_t sequenceIndex)
+        {
+            SetSequence(sequenceIndex);
+        }
+
+        void SetSequence(uint64_t sequenceIndex)
+        {
+            state = 0u;
+            inc = (sequenceIndex << 1u) | 1u;
+            UniformUInt32();
+            state += 0x853c49e6748fea9bULL;
+            UniformUInt32();
+        }
+
+        uint32_t UniformUInt32(void)
+        {
+            uint64_t oldState = state;
+            state = (oldState * 0x5851f42d4c957f2dULL) + inc;
+            uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+            uint32_t rot = (uint32_t)(oldState >> 59u);
+            return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+        }
+
+        // [0, 1)内的均匀随机数
+        Float UniformFloat(void)
+        {
+            return std::min(OneMinusEpsilon, (Float)(UniformUInt32() * 2.3283064365386963e-10));
+        }
+
+    private:
+        uint64_t state, inc;
+    };
+}
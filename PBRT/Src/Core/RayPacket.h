@@ -0,0 +1,245 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include <cstdint>
+
+namespace PBRT
+{
+    // SoA布局的光线包，每个分量单独连续存放，方便一次装载到SIMD寄存器中
+    // @remarks: N只支持4、8、16，分别对应SSE、AVX、AVX-512的宽度
+    template <int N>
+    class RayPacket
+    {
+        static_assert((4 == N) || (8 == N) || (16 == N), "RayPacket only supports 4/8/16 lanes");
+
+    public:
+        static PBRT_CONSTEXPR int Width = N;
+        static PBRT_CONSTEXPR uint32_t AllLanes = (uint32_t)((1ull << N) - 1);
+
+        RayPacket()
+            : activeMask(0)
+        {
+            for (int i = 0; i < N; ++i)
+            {
+                originX[i] = originY[i] = originZ[i] = 0;
+                dirX[i] = dirY[i] = dirZ[i] = 0;
+                tMax[i] = Infinity;
+                time[i] = 0;
+                medium[i] = nullptr;
+            }
+        }
+
+        // 用rays[0, count)填充光线包，剩余通道保持非激活
+        RayPacket(const Ray *rays, int count)
+            : RayPacket()
+        {
+            DCHECK((count >= 0) && (count <= N));
+            for (int i = 0; i < count; ++i)
+            {
+                Set(i, rays[i]);
+            }
+        }
+
+        void Set(int lane, const Ray &ray)
+        {
+            DCHECK((lane >= 0) && (lane < N));
+            originX[lane] = ray.origin.x;
+            originY[lane] = ray.origin.y;
+            originZ[lane] = ray.origin.z;
+            dirX[lane] = ray.dir.x;
+            dirY[lane] = ray.dir.y;
+            dirZ[lane] = ray.dir.z;
+            tMax[lane] = ray.tMax;
+            time[lane] = ray.time;
+            medium[lane] = ray.medium;
+            activeMask |= (1u << lane);
+        }
+
+        Ray Get(int lane) const
+        {
+            DCHECK((lane >= 0) && (lane < N));
+            return Ray(Origin(lane), Dir(lane), tMax[lane], time[lane], medium[lane]);
+        }
+
+        // 把求交更新过的tMax写回原始光线
+        void WriteBack(int lane, const Ray &ray) const
+        {
+            DCHECK((lane >= 0) && (lane < N));
+            ray.tMax = tMax[lane];
+        }
+
+        Point3f Origin(int lane) const
+        {
+            return Point3f(originX[lane], originY[lane], originZ[lane]);
+        }
+
+        Vector3f Dir(int lane) const
+        {
+            return Vector3f(dirX[lane], dirY[lane], dirZ[lane]);
+        }
+
+        Point3f operator()(int lane, Float t) const
+        {
+            return Point3f(originX[lane] + dirX[lane] * t
+                         , originY[lane] + dirY[lane] * t
+                         , originZ[lane] + dirZ[lane] * t);
+        }
+
+        bool IsActive(int lane) const
+        {
+            DCHECK((lane >= 0) && (lane < N));
+            return (0 != (activeMask & (1u << lane)));
+        }
+
+        void SetActive(int lane, bool active)
+        {
+            DCHECK((lane >= 0) && (lane < N));
+            if (active)
+            {
+                activeMask |= (1u << lane);
+            }
+            else
+            {
+                activeMask &= ~(1u << lane);
+            }
+        }
+
+        bool Any(void) const
+        {
+            return (0 != activeMask);
+        }
+
+        bool All(void) const
+        {
+            return (AllLanes == activeMask);
+        }
+
+        int ActiveCount(void) const
+        {
+            int count = 0;
+            for (uint32_t mask = activeMask; 0 != mask; mask &= (mask - 1))
+            {
+                ++count;
+            }
+            return count;
+        }
+
+        // 所有激活光线的方向符号是否一致，一致时可以按统一的顺序遍历BVH
+        bool IsCoherent(void) const
+        {
+            uint32_t negX = 0, negY = 0, negZ = 0;
+            for (int i = 0; i < N; ++i)
+            {
+                negX |= (uint32_t)(dirX[i] < 0) << i;
+                negY |= (uint32_t)(dirY[i] < 0) << i;
+                negZ |= (uint32_t)(dirZ[i] < 0) << i;
+            }
+            negX &= activeMask;
+            negY &= activeMask;
+            negZ &= activeMask;
+            return ((0 == negX) || (activeMask == negX))
+                && ((0 == negY) || (activeMask == negY))
+                && ((0 == negZ) || (activeMask == negZ));
+        }
+
+        // 每个数组按自身大小对齐，可以整体装入一个SIMD寄存器，数组之间没有填充
+        alignas(sizeof(Float) * N) Float originX[N];
+        alignas(sizeof(Float) * N) Float originY[N];
+        alignas(sizeof(Float) * N) Float originZ[N];
+        alignas(sizeof(Float) * N) Float dirX[N];
+        alignas(sizeof(Float) * N) Float dirY[N];
+        alignas(sizeof(Float) * N) Float dirZ[N];
+        alignas(sizeof(Float) * N) mutable Float tMax[N];
+        alignas(sizeof(Float) * N) Float time[N];
+        const Medium *medium[N];
+
+        // 第i位为1表示第i条光线仍需求交
+        uint32_t activeMask;
+    };
+
+    template <int N>
+    class RayDifferentialPacket : public RayPacket<N>
+    {
+    public:
+        RayDifferentialPacket()
+            : hasDifferentials(0)
+        {
+            for (int i = 0; i < N; ++i)
+            {
+                rxOriginX[i] = rxOriginY[i] = rxOriginZ[i] = 0;
+                ryOriginX[i] = ryOriginY[i] = ryOriginZ[i] = 0;
+                rxDirX[i] = rxDirY[i] = rxDirZ[i] = 0;
+                ryDirX[i] = ryDirY[i] = ryDirZ[i] = 0;
+            }
+        }
+
+        RayDifferentialPacket(const RayDifferential *rays, int count)
+            : RayDifferentialPacket()
+        {
+            DCHECK((count >= 0) && (count <= N));
+            for (int i = 0; i < count; ++i)
+            {
+                Set(i, rays[i]);
+            }
+        }
+
+        using RayPacket<N>::Set;
+
+        void Set(int lane, const RayDifferential &ray)
+        {
+            RayPacket<N>::Set(lane, ray);
+
+            rxOriginX[lane] = ray.rxOrigin.x;
+            rxOriginY[lane] = ray.rxOrigin.y;
+            rxOriginZ[lane] = ray.rxOrigin.z;
+            ryOriginX[lane] = ray.ryOrigin.x;
+            ryOriginY[lane] = ray.ryOrigin.y;
+            ryOriginZ[lane] = ray.ryOrigin.z;
+            rxDirX[lane] = ray.rxDir.x;
+            rxDirY[lane] = ray.rxDir.y;
+            rxDirZ[lane] = ray.rxDir.z;
+            ryDirX[lane] = ray.ryDir.x;
+            ryDirY[lane] = ray.ryDir.y;
+            ryDirZ[lane] = ray.ryDir.z;
+
+            if (ray.hasDifferentials)
+            {
+                hasDifferentials |= (1u << lane);
+            }
+            else
+            {
+                hasDifferentials &= ~(1u << lane);
+            }
+        }
+
+        RayDifferential GetDifferential(int lane) const
+        {
+            RayDifferential ray(this->Get(lane));
+            ray.hasDifferentials = (0 != (hasDifferentials & (1u << lane)));
+            ray.rxOrigin = Point3f(rxOriginX[lane], rxOriginY[lane], rxOriginZ[lane]);
+            ray.ryOrigin = Point3f(ryOriginX[lane], ryOriginY[lane], ryOriginZ[lane]);
+            ray.rxDir = Vector3f(rxDirX[lane], rxDirY[lane], rxDirZ[lane]);
+            ray.ryDir = Vector3f(ryDirX[lane], ryDirY[lane], ryDirZ[lane]);
+            return ray;
+        }
+
+        alignas(sizeof(Float) * N) Float rxOriginX[N];
+        alignas(sizeof(Float) * N) Float rxOriginY[N];
+        alignas(sizeof(Float) * N) Float rxOriginZ[N];
+        alignas(sizeof(Float) * N) Float ryOriginX[N];
+        alignas(sizeof(Float) * N) Float ryOriginY[N];
+        alignas(sizeof(Float) * N) Float ryOriginZ[N];
+        alignas(sizeof(Float) * N) Float rxDirX[N];
+        alignas(sizeof(Float) * N) Float rxDirY[N];
+        alignas(sizeof(Float) * N) Float rxDirZ[N];
+        alignas(sizeof(Float) * N) Float ryDirX[N];
+        alignas(sizeof(Float) * N) Float ryDirY[N];
+        alignas(sizeof(Float) * N) Float ryDirZ[N];
+
+        uint32_t hasDifferentials;
+    };
+
+    typedef RayPacket<4>  RayPacket4;
+    typedef RayPacket<8>  RayPacket8;
+    typedef RayPacket<16> RayPacket16;
+}
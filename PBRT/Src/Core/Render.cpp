@@ -0,0 +1,53 @@
+﻿#include "Render.h"
+#include "Parallel.h"
+#include <memory>
+#include <vector>
+
+namespace PBRT
+{
+    void RenderTiles(Film *film, int tileSize, const std::function<void(FilmTile *tile)> &renderTile
+                   , TraversalOrder tileOrder)
+    {
+        CHECK_GT(tileSize, 0);
+
+        Bounds2i pixelBounds = film->PixelBounds();
+        Vector2i extent = pixelBounds.Diagonal();
+        int nTilesX = (extent.x + tileSize - 1) / tileSize;
+        int nTilesY = (extent.y + tileSize - 1) / tileSize;
+
+        std::vector<Point2i> tiles;
+        tiles.reserve((size_t)nTilesX * nTilesY);
+        for (Point2i tile : Traverse(Bounds2i(Point2i(0, 0), Point2i(nTilesX, nTilesY)), tileOrder))
+        {
+            tiles.push_back(tile);
+        }
+
+        // 每个线程缓存用过的FilmTile，存储只在第一次使用时分配
+        // 用栈而不是单个瓦片：renderTile内部嵌套ParallelFor时，等待的线程可能又领到一个瓦片
+        std::vector<std::vector<std::unique_ptr<FilmTile>>> freeTiles(MaxThreadIndex());
+
+        ParallelFor((int64_t)tiles.size(), 1, [&](int64_t i)
+        {
+            Point2i tileMin(pixelBounds.minPoint.x + (tiles[i].x * tileSize), pixelBounds.minPoint.y + (tiles[i].y * tileSize));
+            Point2i tileMax(std::min(tileMin.x + tileSize, pixelBounds.maxPoint.x), std::min(tileMin.y + tileSize, pixelBounds.maxPoint.y));
+
+            std::vector<std::unique_ptr<FilmTile>> &threadTiles = freeTiles[ThreadIndex];
+            std::unique_ptr<FilmTile> tile;
+            if (threadTiles.empty())
+            {
+                tile.reset(new FilmTile());
+            }
+            else
+            {
+                tile = std::move(threadTiles.back());
+                threadTiles.pop_back();
+            }
+
+            tile->Reset(Bounds2i(tileMin, tileMax));
+            renderTile(tile.get());
+            film->MergeFilmTile(*tile);
+
+            threadTiles.push_back(std::move(tile));
+        });
+    }
+}
@@ -0,0 +1,16 @@
+﻿#pragma once
+
+#include "Film.h"
+#include "Traversal.h"
+#include <functional>
+
+namespace PBRT
+{
+    // 把胶片划分为tileSize x tileSize的瓦片，交给线程池并行渲染
+    // renderTile(tile)负责计算tile->PixelBounds()中的像素并调用tile->AddSample；
+    // 瓦片由执行它的线程独占，渲染完立即写回胶片，瓦片互不重叠，整个过程不需要锁
+    // 瓦片按tileOrder顺序分发，沿空间填充曲线时先后领取的瓦片在画面上相邻，访问的几何和纹理也相近
+    // @remarks: 线程池未初始化时串行执行
+    void RenderTiles(Film *film, int tileSize, const std::function<void(FilmTile *tile)> &renderTile
+                   , TraversalOrder tileOrder = TraversalOrder::Hilbert);
+}
@@ -0,0 +1,352 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include <cstdint>
+
+#ifdef PBRT_HAVE_SSE
+
+#include <smmintrin.h>
+#if defined(PBRT_HAVE_AVX) || defined(PBRT_HAVE_FMA)
+    #include <immintrin.h>
+#endif
+
+namespace PBRT
+{
+    namespace SIMD
+    {
+        // 把3个分量放入__m128的低3个通道，第4个通道置0
+        inline __m128 Set3(float x, float y, float z)
+        {
+            return _mm_set_ps(0.0f, z, y, x);
+        }
+
+        inline void Store3(__m128 v, float *x, float *y, float *z)
+        {
+            *x = _mm_cvtss_f32(v);
+            *y = _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+            *z = _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)));
+        }
+
+        // 与std::fmin/std::fmax一致：只有一个操作数是NaN时返回另一个
+        // @remarks: _mm_min_ps/_mm_max_ps在有NaN时总是返回第二个操作数
+        inline __m128 FMin(__m128 a, __m128 b)
+        {
+            return _mm_blendv_ps(_mm_min_ps(a, b), a, _mm_cmpunord_ps(b, b));
+        }
+
+        inline __m128 FMax(__m128 a, __m128 b)
+        {
+            return _mm_blendv_ps(_mm_max_ps(a, b), a, _mm_cmpunord_ps(b, b));
+        }
+
+        // (y, z, x)排列，用于叉积
+        inline __m128 YZX(__m128 v)
+        {
+            return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+        }
+
+        // (z, x, y)排列，用于叉积
+        inline __m128 ZXY(__m128 v)
+        {
+            return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2));
+        }
+
+        // 以double精度计算 a * b - c * d 后再舍入回float，结果与标量的double版本逐位一致
+        inline __m128 DifferenceOfProductsDouble(__m128 a, __m128 b, __m128 c, __m128 d)
+        {
+            __m128d lo = _mm_sub_pd(_mm_mul_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(b))
+                                  , _mm_mul_pd(_mm_cvtps_pd(c), _mm_cvtps_pd(d)));
+            __m128d hi = _mm_sub_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)), _mm_cvtps_pd(_mm_movehl_ps(b, b)))
+                                  , _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(c, c)), _mm_cvtps_pd(_mm_movehl_ps(d, d))));
+            return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+        }
+
+#ifdef PBRT_HAVE_FMA
+        // 与标量的DifferenceOfProducts相同的Kahan算法，FMA只舍入一次，结果逐位一致
+        inline __m128 DifferenceOfProducts(__m128 a, __m128 b, __m128 c, __m128 d)
+        {
+            __m128 cd = _mm_mul_ps(c, d);
+            __m128 differenceOfProducts = _mm_fmsub_ps(a, b, cd);
+            __m128 error = _mm_fnmadd_ps(c, d, cd);
+            return _mm_add_ps(differenceOfProducts, error);
+        }
+#endif // PBRT_HAVE_FMA
+
+        // 从连续存放的4个(x, y, z)读出SoA形式的xxxx、yyyy、zzzz
+        inline void LoadSoA3x4(const float *p, __m128 *x, __m128 *y, __m128 *z)
+        {
+            __m128 a = _mm_loadu_ps(p);         // x0 y0 z0 x1
+            __m128 b = _mm_loadu_ps(p + 4);     // y1 z1 x2 y2
+            __m128 c = _mm_loadu_ps(p + 8);     // z2 x3 y3 z3
+            *x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+            *y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1))
+                              , _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+            *z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+        }
+
+        // LoadSoA3x4的逆操作
+        inline void StoreSoA3x4(__m128 x, __m128 y, __m128 z, float *p)
+        {
+            _mm_storeu_ps(p, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0))
+                                          , _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1))
+                                              , _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2))
+                                              , _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+
+        // 取反，也就是翻转符号位
+        inline __m128 Negate(__m128 v)
+        {
+            return _mm_xor_ps(v, _mm_set1_ps(-0.0f));
+        }
+
+        // copysign(1, v)
+        inline __m128 SignOf(__m128 v)
+        {
+            return _mm_or_ps(_mm_set1_ps(1.0f), _mm_and_ps(v, _mm_set1_ps(-0.0f)));
+        }
+
+        // W个float通道的基本运算，用同一份模板代码生成SSE（W = 4）和AVX（W = 8）两个版本的内核
+        // 比较结果是逐通道的全1/全0掩码
+        template <int W>
+        struct Lanes;
+
+        template <>
+        struct Lanes<4>
+        {
+            typedef __m128 Vec;
+
+            static Vec Load(const float *p)
+            {
+                return _mm_load_ps(p);
+            }
+
+            static void Store(float *p, Vec v)
+            {
+                _mm_store_ps(p, v);
+            }
+
+            static Vec Set1(float f)
+            {
+                return _mm_set1_ps(f);
+            }
+
+            static Vec Zero(void)
+            {
+                return _mm_setzero_ps();
+            }
+
+            static Vec Add(Vec a, Vec b)
+            {
+                return _mm_add_ps(a, b);
+            }
+
+            static Vec Sub(Vec a, Vec b)
+            {
+                return _mm_sub_ps(a, b);
+            }
+
+            static Vec Mul(Vec a, Vec b)
+            {
+                return _mm_mul_ps(a, b);
+            }
+
+            static Vec Div(Vec a, Vec b)
+            {
+                return _mm_div_ps(a, b);
+            }
+
+            static Vec Min(Vec a, Vec b)
+            {
+                return _mm_min_ps(a, b);
+            }
+
+            static Vec Max(Vec a, Vec b)
+            {
+                return _mm_max_ps(a, b);
+            }
+
+            static Vec Abs(Vec a)
+            {
+                return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+            }
+
+            static Vec SignBit(Vec a)
+            {
+                return _mm_and_ps(a, _mm_set1_ps(-0.0f));
+            }
+
+            static Vec CmpEq(Vec a, Vec b)
+            {
+                return _mm_cmpeq_ps(a, b);
+            }
+
+            static Vec CmpNeq(Vec a, Vec b)
+            {
+                return _mm_cmpneq_ps(a, b);
+            }
+
+            static Vec CmpLt(Vec a, Vec b)
+            {
+                return _mm_cmplt_ps(a, b);
+            }
+
+            static Vec CmpLe(Vec a, Vec b)
+            {
+                return _mm_cmple_ps(a, b);
+            }
+
+            static Vec CmpGt(Vec a, Vec b)
+            {
+                return _mm_cmpgt_ps(a, b);
+            }
+
+            static Vec And(Vec a, Vec b)
+            {
+                return _mm_and_ps(a, b);
+            }
+
+            static Vec Or(Vec a, Vec b)
+            {
+                return _mm_or_ps(a, b);
+            }
+
+            static Vec Xor(Vec a, Vec b)
+            {
+                return _mm_xor_ps(a, b);
+            }
+
+            // ~a & b
+            static Vec AndNot(Vec a, Vec b)
+            {
+                return _mm_andnot_ps(a, b);
+            }
+
+            static uint32_t MoveMask(Vec mask)
+            {
+                return (uint32_t)_mm_movemask_ps(mask);
+            }
+        };
+
+#ifdef PBRT_HAVE_AVX
+        template <>
+        struct Lanes<8>
+        {
+            typedef __m256 Vec;
+
+            static Vec Load(const float *p)
+            {
+                return _mm256_load_ps(p);
+            }
+
+            static void Store(float *p, Vec v)
+            {
+                _mm256_store_ps(p, v);
+            }
+
+            static Vec Set1(float f)
+            {
+                return _mm256_set1_ps(f);
+            }
+
+            static Vec Zero(void)
+            {
+                return _mm256_setzero_ps();
+            }
+
+            static Vec Add(Vec a, Vec b)
+            {
+                return _mm256_add_ps(a, b);
+            }
+
+            static Vec Sub(Vec a, Vec b)
+            {
+                return _mm256_sub_ps(a, b);
+            }
+
+            static Vec Mul(Vec a, Vec b)
+            {
+                return _mm256_mul_ps(a, b);
+            }
+
+            static Vec Div(Vec a, Vec b)
+            {
+                return _mm256_div_ps(a, b);
+            }
+
+            static Vec Min(Vec a, Vec b)
+            {
+                return _mm256_min_ps(a, b);
+            }
+
+            static Vec Max(Vec a, Vec b)
+            {
+                return _mm256_max_ps(a, b);
+            }
+
+            static Vec Abs(Vec a)
+            {
+                return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+            }
+
+            static Vec SignBit(Vec a)
+            {
+                return _mm256_and_ps(a, _mm256_set1_ps(-0.0f));
+            }
+
+            static Vec CmpEq(Vec a, Vec b)
+            {
+                return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+            }
+
+            static Vec CmpNeq(Vec a, Vec b)
+            {
+                return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ);
+            }
+
+            static Vec CmpLt(Vec a, Vec b)
+            {
+                return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+            }
+
+            static Vec CmpLe(Vec a, Vec b)
+            {
+                return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+            }
+
+            static Vec CmpGt(Vec a, Vec b)
+            {
+                return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+            }
+
+            static Vec And(Vec a, Vec b)
+            {
+                return _mm256_and_ps(a, b);
+            }
+
+            static Vec Or(Vec a, Vec b)
+            {
+                return _mm256_or_ps(a, b);
+            }
+
+            static Vec Xor(Vec a, Vec b)
+            {
+                return _mm256_xor_ps(a, b);
+            }
+
+            static Vec AndNot(Vec a, Vec b)
+            {
+                return _mm256_andnot_ps(a, b);
+            }
+
+            static uint32_t MoveMask(Vec mask)
+            {
+                return (uint32_t)_mm256_movemask_ps(mask);
+            }
+        };
+#endif // PBRT_HAVE_AVX
+    }
+}
+
+#endif // PBRT_HAVE_SSE
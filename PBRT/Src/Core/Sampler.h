@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "RNG.h"
+#include <cstdint>
+
+namespace PBRT
+{
+    // 为积分器提供[0, 1)^n内的样本值，每个线程使用自己的Sampler
+    class Sampler
+    {
+    public:
+        virtual ~Sampler()
+        {}
+
+        virtual Float Get1D(void) = 0;
+        virtual Point2f Get2D(void) = 0;
+    };
+
+    // 每一维都是独立的均匀随机数
+    class RandomSampler : public Sampler
+    {
+    public:
+        explicit RandomSampler(uint64_t seed = 0)
+            : rng(seed)
+        {}
+
+        // 切换到另一个随机数序列，例如按像素编号区分各个像素的样本
+        void SetSequence(uint64_t sequenceIndex)
+        {
+            rng.SetSequence(sequenceIndex);
+        }
+
+        Float Get1D(void) override
+        {
+            return rng.UniformFloat();
+        }
+
+        Point2f Get2D(void) override
+        {
+            Float u0 = rng.UniformFloat();
+            Float u1 = rng.UniformFloat();
+            return Point2f(u0, u1);
+        }
+
+    private:
+        RNG rng;
+    };
+}
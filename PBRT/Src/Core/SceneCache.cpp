@@ -0,0 +1,394 @@
+﻿#include "SceneCache.h"
+#include "glog/logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+namespace PBRT
+{
+    namespace
+    {
+        const char Magic[8] = { 'P', 'B', 'R', 'T', 'S', 'C', 'N', 0 };
+
+        // 修改文件格式或者任何写入文件的类型的布局时都要加1，旧的缓存会被忽略并重新生成
+        const uint32_t Version = 1;
+
+        // 按写入机器的字节序存储，读取时字节序不同则忽略
+        const uint32_t ByteOrderMark = 0x01020304;
+
+        // 数组都按缓存行对齐，LinearBVHNode要求32字节对齐
+        const size_t ArrayAlignment = 64;
+
+        static_assert(std::is_trivially_copyable<Transform>::value, "Transform must be trivially copyable");
+        static_assert(std::is_trivially_copyable<PointQuantizer>::value, "PointQuantizer must be trivially copyable");
+        static_assert(std::is_trivially_copyable<QuantizedPoint3>::value, "QuantizedPoint3 must be trivially copyable");
+        static_assert(std::is_trivially_copyable<LinearBVHNode>::value, "LinearBVHNode must be trivially copyable");
+        static_assert(ArrayAlignment % alignof(LinearBVHNode) == 0, "BVH nodes would be misaligned");
+
+        uint64_t RoundUp(uint64_t offset, size_t align)
+        {
+            return ((offset + align - 1) / align) * align;
+        }
+
+        // 要写入文件的一段数据
+        struct Chunk
+        {
+            const void *data;
+            size_t size;
+            uint64_t offset;
+        };
+
+        // 按键排序并去掉重复的键，相同的键对应相同的输入，保留哪一个都一样
+        template <typename T>
+        std::vector<std::pair<uint64_t, T>> SortByKey(std::vector<std::pair<uint64_t, T>> entries)
+        {
+            std::stable_sort(entries.begin(), entries.end()
+                           , [](const std::pair<uint64_t, T> &a, const std::pair<uint64_t, T> &b)
+            {
+                return (a.first < b.first);
+            });
+            entries.erase(std::unique(entries.begin(), entries.end()
+                                    , [](const std::pair<uint64_t, T> &a, const std::pair<uint64_t, T> &b)
+            {
+                return (a.first == b.first);
+            }), entries.end());
+            return entries;
+        }
+
+        template <typename Record>
+        const Record *FindRecord(const Record *records, uint32_t count, uint64_t key)
+        {
+            const Record *end = records + count;
+            const Record *r = std::lower_bound(records, end, key, [](const Record &record, uint64_t k)
+            {
+                return (record.key < k);
+            });
+            return ((end != r) && (key == r->key)) ? r : nullptr;
+        }
+    }
+
+    // 文件头，位于文件开始处
+    // @remarks: 所有偏移都相对于文件开始，0表示没有这个数组
+    struct SceneCache::Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t floatSize;
+        uint32_t nodeSize;
+        uint32_t nMeshes, nBVHs, nTransforms;
+        uint32_t pad;
+        uint64_t meshRecords, bvhRecords, transformRecords;
+        uint64_t fileSize;
+    };
+
+    // 各类记录都按键从小到大排列，查找时二分
+    struct SceneCache::MeshRecord
+    {
+        uint64_t key;
+        int32_t nTriangles, nVertices;
+        uint32_t format;
+        uint32_t pad;
+        PointQuantizer quantizer;
+        uint64_t vertexIndices;
+        uint64_t p, n, uv;
+        uint64_t pEncoded, nEncoded, uvEncoded;
+    };
+
+    struct SceneCache::BVHRecord
+    {
+        uint64_t key;
+        int32_t totalNodes, nPrimitives;
+        int32_t maxPrimsInNode, splitMethod, leafBlockSize;
+        uint32_t pad;
+        uint64_t nodes, primitiveIndices;
+    };
+
+    struct SceneCache::TransformRecord
+    {
+        uint64_t key;
+        Transform transform;
+    };
+
+    // ----------------------------------------------------------------------------
+    // SceneCacheWriter
+    // ----------------------------------------------------------------------------
+    void SceneCacheWriter::AddMesh(uint64_t key, std::shared_ptr<const TriangleMesh> mesh)
+    {
+        CHECK(mesh);
+        meshes.emplace_back(key, std::move(mesh));
+    }
+
+    void SceneCacheWriter::AddBVH(uint64_t key, std::shared_ptr<const BVH> bvh)
+    {
+        CHECK(bvh);
+        bvhs.emplace_back(key, std::move(bvh));
+    }
+
+    void SceneCacheWriter::AddTransform(uint64_t key, const Transform &transform)
+    {
+        transforms.emplace_back(key, transform);
+    }
+
+    bool SceneCacheWriter::Write(const std::string &filename) const
+    {
+        auto sortedMeshes = SortByKey(meshes);
+        auto sortedBVHs = SortByKey(bvhs);
+        auto sortedTransforms = SortByKey(transforms);
+
+        SceneCache::Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.byteOrder = ByteOrderMark;
+        header.floatSize = sizeof(Float);
+        header.nodeSize = sizeof(LinearBVHNode);
+        header.nMeshes = (uint32_t)sortedMeshes.size();
+        header.nBVHs = (uint32_t)sortedBVHs.size();
+        header.nTransforms = (uint32_t)sortedTransforms.size();
+
+        // 先排好每段数据在文件中的位置，记录中的偏移随之确定
+        std::vector<Chunk> chunks;
+        uint64_t offset = 0;
+        auto place = [&](const void *data, size_t size, size_t align) -> uint64_t
+        {
+            if ((nullptr == data) || (0 == size))
+            {
+                return 0;
+            }
+            offset = RoundUp(offset, align);
+            chunks.push_back({ data, size, offset });
+            offset += size;
+            return chunks.back().offset;
+        };
+
+        // vector按值初始化记录：没有用户提供的构造函数时先整体置零（包括填充字节）再构造成员，写出的字节是确定的
+        std::vector<SceneCache::MeshRecord> meshRecords(sortedMeshes.size());
+        std::vector<SceneCache::BVHRecord> bvhRecords(sortedBVHs.size());
+        std::vector<SceneCache::TransformRecord> transformRecords(sortedTransforms.size());
+
+        place(&header, sizeof(header), alignof(SceneCache::Header));
+        header.meshRecords = place(meshRecords.data(), meshRecords.size() * sizeof(SceneCache::MeshRecord), alignof(SceneCache::MeshRecord));
+        header.bvhRecords = place(bvhRecords.data(), bvhRecords.size() * sizeof(SceneCache::BVHRecord), alignof(SceneCache::BVHRecord));
+        header.transformRecords = place(transformRecords.data(), transformRecords.size() * sizeof(SceneCache::TransformRecord), alignof(SceneCache::TransformRecord));
+
+        for (size_t i = 0; i < sortedMeshes.size(); ++i)
+        {
+            const TriangleMesh &mesh = *sortedMeshes[i].second;
+            SceneCache::MeshRecord &r = meshRecords[i];
+            size_t nVertices = (size_t)mesh.nVertices;
+            r.key = sortedMeshes[i].first;
+            r.nTriangles = mesh.nTriangles;
+            r.nVertices = mesh.nVertices;
+            r.format = (uint32_t)mesh.format;
+            r.quantizer = mesh.quantizer;
+            r.vertexIndices = place(mesh.vertexIndices, 3 * (size_t)mesh.nTriangles * sizeof(int), ArrayAlignment);
+            r.p = place(mesh.p, nVertices * sizeof(Point3f), ArrayAlignment);
+            r.n = place(mesh.n, nVertices * sizeof(Normal3f), ArrayAlignment);
+            r.uv = place(mesh.uv, nVertices * sizeof(Point2f), ArrayAlignment);
+            r.pEncoded = place(mesh.pEncoded, nVertices * sizeof(QuantizedPoint3), ArrayAlignment);
+            r.nEncoded = place(mesh.nEncoded, nVertices * sizeof(uint32_t), ArrayAlignment);
+            r.uvEncoded = place(mesh.uvEncoded, nVertices * sizeof(uint32_t), ArrayAlignment);
+        }
+
+        for (size_t i = 0; i < sortedBVHs.size(); ++i)
+        {
+            const BVH &bvh = *sortedBVHs[i].second;
+            SceneCache::BVHRecord &r = bvhRecords[i];
+            r.key = sortedBVHs[i].first;
+            r.totalNodes = bvh.NodeCount();
+            r.nPrimitives = bvh.PrimitiveCount();
+            r.maxPrimsInNode = bvh.MaxPrimsInNode();
+            r.splitMethod = (int32_t)bvh.GetSplitMethod();
+            r.leafBlockSize = bvh.LeafBlockSize();
+            r.nodes = place(bvh.Nodes(), (size_t)bvh.NodeCount() * sizeof(LinearBVHNode), ArrayAlignment);
+            r.primitiveIndices = place(bvh.PrimitiveIndices(), (size_t)bvh.PrimitiveCount() * sizeof(int), ArrayAlignment);
+        }
+
+        for (size_t i = 0; i < sortedTransforms.size(); ++i)
+        {
+            transformRecords[i].key = sortedTransforms[i].first;
+            transformRecords[i].transform = sortedTransforms[i].second;
+        }
+
+        header.fileSize = offset;
+
+        std::string tempFilename = filename + ".tmp";
+        {
+            std::ofstream out(tempFilename, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                LOG(ERROR) << "Unable to create \"" << tempFilename << "\"";
+                return false;
+            }
+
+            const char zeros[ArrayAlignment] = {};
+            uint64_t written = 0;
+            for (const Chunk &chunk : chunks)
+            {
+                out.write(zeros, (std::streamsize)(chunk.offset - written));
+                out.write((const char *)chunk.data, (std::streamsize)chunk.size);
+                written = chunk.offset + chunk.size;
+            }
+
+            out.flush();
+            if (!out)
+            {
+                LOG(ERROR) << "Unable to write \"" << tempFilename << "\"";
+                out.close();
+                std::remove(tempFilename.c_str());
+                return false;
+            }
+        }
+
+        // Windows下rename不能覆盖已有的文件
+        std::remove(filename.c_str());
+        if (0 != std::rename(tempFilename.c_str(), filename.c_str()))
+        {
+            LOG(ERROR) << "Unable to rename \"" << tempFilename << "\" to \"" << filename << "\"";
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // ----------------------------------------------------------------------------
+    // SceneCache
+    // ----------------------------------------------------------------------------
+    std::shared_ptr<SceneCache> SceneCache::Open(const std::string &filename)
+    {
+        // 缓存不存在是正常情况，不输出错误
+        if (!std::ifstream(filename, std::ios::binary))
+        {
+            return nullptr;
+        }
+
+        std::shared_ptr<SceneCache> cache(new SceneCache());
+        if (!cache->file.Open(filename))
+        {
+            return nullptr;
+        }
+
+        const Header *header = (const Header *)cache->file.Data();
+        if ((cache->file.Size() < sizeof(Header)) || (0 != std::memcmp(header->magic, Magic, sizeof(Magic))))
+        {
+            LOG(WARNING) << "\"" << filename << "\" is not a scene cache, ignored";
+            return nullptr;
+        }
+        if ((Version != header->version) || (ByteOrderMark != header->byteOrder)
+         || (sizeof(Float) != header->floatSize) || (sizeof(LinearBVHNode) != header->nodeSize))
+        {
+            LOG(WARNING) << "Scene cache \"" << filename << "\" was written by a different build, ignored";
+            return nullptr;
+        }
+        if (cache->file.Size() != header->fileSize)
+        {
+            LOG(WARNING) << "Scene cache \"" << filename << "\" is truncated, ignored";
+            return nullptr;
+        }
+
+        cache->nMeshes = header->nMeshes;
+        cache->nBVHs = header->nBVHs;
+        cache->nTransforms = header->nTransforms;
+        bool valid = cache->IsValidRange(header->meshRecords, (uint64_t)header->nMeshes * sizeof(MeshRecord), alignof(MeshRecord))
+                  && cache->IsValidRange(header->bvhRecords, (uint64_t)header->nBVHs * sizeof(BVHRecord), alignof(BVHRecord))
+                  && cache->IsValidRange(header->transformRecords, (uint64_t)header->nTransforms * sizeof(TransformRecord), alignof(TransformRecord));
+        if (valid)
+        {
+            cache->meshRecords = (const MeshRecord *)(cache->file.Data() + header->meshRecords);
+            cache->bvhRecords = (const BVHRecord *)(cache->file.Data() + header->bvhRecords);
+            cache->transformRecords = (const TransformRecord *)(cache->file.Data() + header->transformRecords);
+        }
+
+        // 只检查每个数组的范围，开销与记录数成正比，与顶点数无关
+        for (uint32_t i = 0; valid && (i < cache->nMeshes); ++i)
+        {
+            const MeshRecord &r = cache->meshRecords[i];
+            uint64_t nVertices = (uint64_t)r.nVertices;
+            bool full = ((uint32_t)TriangleMesh::VertexFormat::Full == r.format);
+            bool compressed = ((uint32_t)TriangleMesh::VertexFormat::Compressed == r.format);
+            valid = (r.nTriangles > 0) && (r.nVertices > 0) && (full || compressed)
+                 && (0 != r.vertexIndices) && (0 != (full ? r.p : r.pEncoded))
+                 && cache->IsValidRange(r.vertexIndices, 3 * (uint64_t)r.nTriangles * sizeof(int), alignof(int))
+                 && cache->IsValidRange(r.p, nVertices * sizeof(Point3f), alignof(Point3f))
+                 && cache->IsValidRange(r.n, nVertices * sizeof(Normal3f), alignof(Normal3f))
+                 && cache->IsValidRange(r.uv, nVertices * sizeof(Point2f), alignof(Point2f))
+                 && cache->IsValidRange(r.pEncoded, nVertices * sizeof(QuantizedPoint3), alignof(QuantizedPoint3))
+                 && cache->IsValidRange(r.nEncoded, nVertices * sizeof(uint32_t), alignof(uint32_t))
+                 && cache->IsValidRange(r.uvEncoded, nVertices * sizeof(uint32_t), alignof(uint32_t));
+        }
+        for (uint32_t i = 0; valid && (i < cache->nBVHs); ++i)
+        {
+            const BVHRecord &r = cache->bvhRecords[i];
+            valid = (r.totalNodes >= 0) && (r.nPrimitives >= 0)
+                 && (r.splitMethod >= 0) && (r.splitMethod <= (int32_t)BVH::SplitMethod::HLBVH)
+                 && cache->IsValidRange(r.nodes, (uint64_t)r.totalNodes * sizeof(LinearBVHNode), alignof(LinearBVHNode))
+                 && cache->IsValidRange(r.primitiveIndices, (uint64_t)r.nPrimitives * sizeof(int), alignof(int));
+        }
+
+        if (!valid)
+        {
+            LOG(WARNING) << "Scene cache \"" << filename << "\" is corrupted, ignored";
+            return nullptr;
+        }
+        return cache;
+    }
+
+    bool SceneCache::IsValidRange(uint64_t offset, uint64_t size, size_t align) const
+    {
+        if (0 == offset)
+        {
+            return true;
+        }
+        return (0 == (offset % align)) && (offset <= file.Size()) && (size <= (file.Size() - offset));
+    }
+
+    std::shared_ptr<TriangleMesh> SceneCache::FindMesh(uint64_t key) const
+    {
+        const MeshRecord *r = FindRecord(meshRecords, nMeshes, key);
+        if (nullptr == r)
+        {
+            return nullptr;
+        }
+
+        const char *data = file.Data();
+        auto mesh = std::make_shared<TriangleMesh>(r->nTriangles, r->nVertices, (TriangleMesh::VertexFormat)r->format, shared_from_this());
+        mesh->vertexIndices = (const int *)(data + r->vertexIndices);
+        mesh->p = r->p ? (const Point3f *)(data + r->p) : nullptr;
+        mesh->n = r->n ? (const Normal3f *)(data + r->n) : nullptr;
+        mesh->uv = r->uv ? (const Point2f *)(data + r->uv) : nullptr;
+        mesh->quantizer = r->quantizer;
+        mesh->pEncoded = r->pEncoded ? (const QuantizedPoint3 *)(data + r->pEncoded) : nullptr;
+        mesh->nEncoded = r->nEncoded ? (const uint32_t *)(data + r->nEncoded) : nullptr;
+        mesh->uvEncoded = r->uvEncoded ? (const uint32_t *)(data + r->uvEncoded) : nullptr;
+        return mesh;
+    }
+
+    std::shared_ptr<BVH> SceneCache::FindBVH(uint64_t key) const
+    {
+        const BVHRecord *r = FindRecord(bvhRecords, nBVHs, key);
+        if (nullptr == r)
+        {
+            return nullptr;
+        }
+
+        const char *data = file.Data();
+        return std::make_shared<BVH>(r->nodes ? (const LinearBVHNode *)(data + r->nodes) : nullptr, r->totalNodes
+                                   , r->primitiveIndices ? (const int *)(data + r->primitiveIndices) : nullptr, r->nPrimitives
+                                   , r->maxPrimsInNode, (BVH::SplitMethod)r->splitMethod, r->leafBlockSize
+                                   , shared_from_this());
+    }
+
+    bool SceneCache::FindTransform(uint64_t key, Transform *transform) const
+    {
+        const TransformRecord *r = FindRecord(transformRecords, nTransforms, key);
+        if (nullptr == r)
+        {
+            return false;
+        }
+        *transform = r->transform;
+        return true;
+    }
+}
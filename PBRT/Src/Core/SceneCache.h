@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include "MappedFile.h"
+#include "Transform.h"
+#include "Src/Accelerators/BVH.h"
+#include "Src/Shapes/Triangle.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PBRT
+{
+    // 64位FNV-1a散列，用于根据网格的来源计算缓存的键
+    inline uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // 把网格、BVH和变换写成一个二进制的场景缓存文件
+    // 每项用调用者计算的64位键标识，键应当覆盖生成它的全部输入（文件名、参数、变换等），
+    // 这样只修改灯光、材质时几何的键不变，可以直接复用缓存
+    class SceneCacheWriter
+    {
+    public:
+        void AddMesh(uint64_t key, std::shared_ptr<const TriangleMesh> mesh);
+
+        void AddBVH(uint64_t key, std::shared_ptr<const BVH> bvh);
+
+        void AddTransform(uint64_t key, const Transform &transform);
+
+        // 先写到临时文件再改名，写出失败时不会破坏已有的缓存
+        // @remarks: 失败时输出错误日志并返回false
+        bool Write(const std::string &filename) const;
+
+    private:
+        std::vector<std::pair<uint64_t, std::shared_ptr<const TriangleMesh>>> meshes;
+        std::vector<std::pair<uint64_t, std::shared_ptr<const BVH>>> bvhs;
+        std::vector<std::pair<uint64_t, Transform>> transforms;
+    };
+
+    // 以内存映射方式打开的场景缓存
+    // 文件中的数组就是内存中的布局，取出的网格和BVH直接指向映射的内存，不逐个元素反序列化；
+    // 它们持有缓存的引用，缓存对象在最后一个使用者销毁后才解除映射
+    // @remarks: 缓存由本程序写出，打开时只检查版本和各数组的范围，不检查顶点下标等内容
+    class SceneCache : public std::enable_shared_from_this<SceneCache>
+    {
+    public:
+        // 文件不存在、版本或数据布局不同（如Float的精度不同）时返回nullptr
+        static std::shared_ptr<SceneCache> Open(const std::string &filename);
+
+        SceneCache(const SceneCache &) = delete;
+        SceneCache &operator=(const SceneCache &) = delete;
+
+        // 找不到时返回nullptr
+        std::shared_ptr<TriangleMesh> FindMesh(uint64_t key) const;
+
+        std::shared_ptr<BVH> FindBVH(uint64_t key) const;
+
+        bool FindTransform(uint64_t key, Transform *transform) const;
+
+    private:
+        struct Header;
+        struct MeshRecord;
+        struct BVHRecord;
+        struct TransformRecord;
+
+        friend class SceneCacheWriter;
+
+        SceneCache(void)
+        {}
+
+        // 检查[offset, offset + size)在文件内且按align对齐
+        bool IsValidRange(uint64_t offset, uint64_t size, size_t align) const;
+
+        MappedFile file;
+        const MeshRecord *meshRecords = nullptr;
+        const BVHRecord *bvhRecords = nullptr;
+        const TransformRecord *transformRecords = nullptr;
+        uint32_t nMeshes = 0, nBVHs = 0, nTransforms = 0;
+    };
+}
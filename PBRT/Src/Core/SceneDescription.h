@@ -0,0 +1,119 @@
+﻿#pragma once
+
+#include "ParamSet.h"
+#include "Transform.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PBRT
+{
+    struct TriangleMesh;
+
+    // 开始和结束时刻的一对变换，两者不同时表示运动的物体
+    struct TransformSet
+    {
+        Transform &operator[](int i)
+        {
+            return t[i];
+        }
+
+        const Transform &operator[](int i) const
+        {
+            return t[i];
+        }
+
+        bool IsAnimated(void) const
+        {
+            return (t[0] != t[1]);
+        }
+
+        friend TransformSet Inverse(const TransformSet &ts)
+        {
+            TransformSet inv;
+            inv.t[0] = Inverse(ts.t[0]);
+            inv.t[1] = Inverse(ts.t[1]);
+            return inv;
+        }
+
+        Transform t[2];
+    };
+
+    // 场景文件中的一个实体：Camera、Film、Material等指令的类型名和参数
+    struct SceneEntity
+    {
+        std::string name;
+        ParamSet params;
+        // 出现的位置，"文件名:行号"，用于报错
+        std::string loc;
+    };
+
+    struct TransformedSceneEntity : public SceneEntity
+    {
+        TransformSet transform;
+    };
+
+    struct CameraEntity : public SceneEntity
+    {
+        TransformSet cameraToWorld;
+        std::string medium;
+    };
+
+    struct LightEntity : public TransformedSceneEntity
+    {
+        std::string medium;
+    };
+
+    // Texture "textureName" "float|spectrum" "class"
+    struct TextureEntity : public TransformedSceneEntity
+    {
+        std::string textureName;
+        std::string type;
+    };
+
+    struct ShapeEntity : public SceneEntity
+    {
+        // 运动的形状按物体空间创建网格，由渲染时的AnimatedTransform变换到世界空间
+        TransformSet objectToWorld;
+        bool reverseOrientation = false;
+
+        // Material指令指定的匿名材质与NamedMaterial指定的名字二选一
+        std::shared_ptr<const SceneEntity> material;
+        std::string materialName;
+
+        // 没有面光源时为nullptr
+        std::shared_ptr<const SceneEntity> areaLight;
+        std::string insideMedium, outsideMedium;
+
+        // trianglemesh和plymesh解析完成时已经创建好网格，其他形状或创建失败时为nullptr
+        std::shared_ptr<TriangleMesh> mesh;
+        // 由形状类型、参数、变换（plymesh还有文件的大小和修改时间）计算，作为网格在场景缓存中的键
+        uint64_t meshKey = 0;
+    };
+
+    struct InstanceEntity
+    {
+        std::string name;
+        TransformSet instanceToWorld;
+    };
+
+    // 解析场景文件得到的完整描述，渲染器据此创建相机、光源和图元
+    struct SceneDescription
+    {
+        CameraEntity camera;
+        SceneEntity film, sampler, filter, integrator, accelerator;
+        Float transformStartTime = 0, transformEndTime = 1;
+
+        std::map<std::string, std::shared_ptr<const SceneEntity>> namedMaterials;
+        std::map<std::string, TransformedSceneEntity> media;
+        std::vector<TextureEntity> textures;
+        std::vector<LightEntity> lights;
+        std::vector<ShapeEntity> shapes;
+
+        // ObjectBegin/ObjectEnd定义的物体和它们的实例
+        std::map<std::string, std::vector<ShapeEntity>> objects;
+        std::vector<InstanceEntity> instances;
+    };
+}
@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include "glog/logging.h"
+#include <algorithm>
+#include <cmath>
+
+namespace PBRT
+{
+    // 按RGB三个通道存储的光谱量：系数、透射率、辐亮度等
+    class Spectrum
+    {
+    public:
+        Spectrum(Float v = 0)
+        {
+            c[0] = c[1] = c[2] = v;
+        }
+
+        Spectrum(Float r, Float g, Float b)
+        {
+            c[0] = r;
+            c[1] = g;
+            c[2] = b;
+        }
+
+        static Spectrum FromRGB(const Float rgb[3])
+        {
+            return Spectrum(rgb[0], rgb[1], rgb[2]);
+        }
+
+        void ToRGB(Float rgb[3]) const
+        {
+            rgb[0] = c[0];
+            rgb[1] = c[1];
+            rgb[2] = c[2];
+        }
+
+        Spectrum operator+(const Spectrum &s) const
+        {
+            return Spectrum(c[0] + s.c[0], c[1] + s.c[1], c[2] + s.c[2]);
+        }
+
+        Spectrum &operator+=(const Spectrum &s)
+        {
+            c[0] += s.c[0];
+            c[1] += s.c[1];
+            c[2] += s.c[2];
+            return *this;
+        }
+
+        Spectrum operator-(const Spectrum &s) const
+        {
+            return Spectrum(c[0] - s.c[0], c[1] - s.c[1], c[2] - s.c[2]);
+        }
+
+        Spectrum operator*(const Spectrum &s) const
+        {
+            return Spectrum(c[0] * s.c[0], c[1] * s.c[1], c[2] * s.c[2]);
+        }
+
+        Spectrum &operator*=(const Spectrum &s)
+        {
+            c[0] *= s.c[0];
+            c[1] *= s.c[1];
+            c[2] *= s.c[2];
+            return *this;
+        }
+
+        Spectrum operator*(Float s) const
+        {
+            return Spectrum(c[0] * s, c[1] * s, c[2] * s);
+        }
+
+        Spectrum &operator*=(Float s)
+        {
+            c[0] *= s;
+            c[1] *= s;
+            c[2] *= s;
+            return *this;
+        }
+
+        Spectrum operator/(const Spectrum &s) const
+        {
+            DCHECK(!s.HasZeros());
+            return Spectrum(c[0] / s.c[0], c[1] / s.c[1], c[2] / s.c[2]);
+        }
+
+        Spectrum operator/(Float s) const
+        {
+            DCHECK_NE(s, 0);
+            Float inv = 1 / s;
+            return Spectrum(c[0] * inv, c[1] * inv, c[2] * inv);
+        }
+
+        Spectrum operator-(void) const
+        {
+            return Spectrum(-c[0], -c[1], -c[2]);
+        }
+
+        bool operator==(const Spectrum &s) const
+        {
+            return (c[0] == s.c[0]) && (c[1] == s.c[1]) && (c[2] == s.c[2]);
+        }
+
+        bool operator!=(const Spectrum &s) const
+        {
+            return !(*this == s);
+        }
+
+        Float operator[](int i) const
+        {
+            DCHECK((i >= 0) && (i < 3));
+            return c[i];
+        }
+
+        Float &operator[](int i)
+        {
+            DCHECK((i >= 0) && (i < 3));
+            return c[i];
+        }
+
+        bool IsBlack(void) const
+        {
+            return (0 == c[0]) && (0 == c[1]) && (0 == c[2]);
+        }
+
+        bool HasZeros(void) const
+        {
+            return (0 == c[0]) || (0 == c[1]) || (0 == c[2]);
+        }
+
+        bool HasNaNs(void) const
+        {
+            return std::isnan(c[0]) || std::isnan(c[1]) || std::isnan(c[2]);
+        }
+
+        Float MaxComponentValue(void) const
+        {
+            return std::max(c[0], std::max(c[1], c[2]));
+        }
+
+        Float Average(void) const
+        {
+            return ((c[0] + c[1] + c[2]) / 3);
+        }
+
+        Float c[3];
+    };
+
+    inline Spectrum operator*(Float s, const Spectrum &sp)
+    {
+        return sp * s;
+    }
+
+    inline Spectrum Exp(const Spectrum &s)
+    {
+        return Spectrum(std::exp(s.c[0]), std::exp(s.c[1]), std::exp(s.c[2]));
+    }
+}
@@ -0,0 +1,181 @@
+﻿#include "Stats.h"
+#include "glog/logging.h"
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace PBRT
+{
+    namespace
+    {
+        // 静态初始化期间就会被StatRegisterer访问，用函数内的静态变量保证已经构造
+        std::vector<void (*)(StatsAccumulator &)> &StatFuncs(void)
+        {
+            static std::vector<void (*)(StatsAccumulator &)> funcs;
+            return funcs;
+        }
+
+        StatsAccumulator statsAccumulator;
+        std::mutex statsMutex;
+
+        // "类别/名字"拆成类别和名字，没有'/'时类别为空
+        void SplitTitle(const std::string &title, std::string *category, std::string *name)
+        {
+            size_t slash = title.find('/');
+            if (std::string::npos == slash)
+            {
+                category->clear();
+                *name = title;
+            }
+            else
+            {
+                *category = title.substr(0, slash);
+                *name = title.substr(slash + 1);
+            }
+        }
+
+        std::string FormatMemory(int64_t bytes)
+        {
+            char buf[64];
+            double kib = (double)bytes / 1024.0;
+            if (kib < 1024.0)
+            {
+                snprintf(buf, sizeof(buf), "%9.2f KiB", kib);
+            }
+            else if (kib < (1024.0 * 1024.0))
+            {
+                snprintf(buf, sizeof(buf), "%9.2f MiB", kib / 1024.0);
+            }
+            else
+            {
+                snprintf(buf, sizeof(buf), "%9.2f GiB", kib / (1024.0 * 1024.0));
+            }
+            return buf;
+        }
+    }
+
+    // ----------------------------------------------------------------------------
+    // StatsAccumulator
+    // ----------------------------------------------------------------------------
+    void StatsAccumulator::Print(void) const
+    {
+        std::map<std::string, std::vector<std::string>> lines;
+        auto addLine = [&](const std::string &title, const char *value)
+        {
+            std::string category, name;
+            SplitTitle(title, &category, &name);
+            char buf[512];
+            snprintf(buf, sizeof(buf), "    %-42s %s", name.c_str(), value);
+            lines[category].push_back(buf);
+        };
+
+        char value[256];
+        for (const auto &counter : counters)
+        {
+            if (0 != counter.second)
+            {
+                snprintf(value, sizeof(value), "%12lld", (long long)counter.second);
+                addLine(counter.first, value);
+            }
+        }
+
+        for (const auto &counter : memoryCounters)
+        {
+            if (0 != counter.second)
+            {
+                addLine(counter.first, FormatMemory(counter.second).c_str());
+            }
+        }
+
+        for (const auto &distribution : distributions)
+        {
+            const Distribution &d = distribution.second;
+            if (d.isFloat)
+            {
+                snprintf(value, sizeof(value), "%.3f avg [range %.3f - %.3f]", d.sum / d.count, d.minValue, d.maxValue);
+            }
+            else
+            {
+                snprintf(value, sizeof(value), "%.3f avg [range %lld - %lld]", d.sum / d.count, (long long)d.minValue, (long long)d.maxValue);
+            }
+            addLine(distribution.first, value);
+        }
+
+        for (const auto &percentage : percentages)
+        {
+            int64_t num = percentage.second.first;
+            int64_t denom = percentage.second.second;
+            if (0 != denom)
+            {
+                snprintf(value, sizeof(value), "%12lld / %12lld (%.2f%%)", (long long)num, (long long)denom, (100.0 * num) / denom);
+                addLine(percentage.first, value);
+            }
+        }
+
+        for (const auto &ratio : ratios)
+        {
+            int64_t num = ratio.second.first;
+            int64_t denom = ratio.second.second;
+            if (0 != denom)
+            {
+                snprintf(value, sizeof(value), "%12lld / %12lld (%.2fx)", (long long)num, (long long)denom, (double)num / denom);
+                addLine(ratio.first, value);
+            }
+        }
+
+        if (lines.empty())
+        {
+            return;
+        }
+
+        LOG(INFO) << "Statistics:";
+        for (const auto &category : lines)
+        {
+            LOG(INFO) << "  " << category.first;
+            for (const std::string &line : category.second)
+            {
+                LOG(INFO) << line;
+            }
+        }
+    }
+
+    void StatsAccumulator::Clear(void)
+    {
+        counters.clear();
+        memoryCounters.clear();
+        distributions.clear();
+        percentages.clear();
+        ratios.clear();
+    }
+
+    // ----------------------------------------------------------------------------
+    // StatRegisterer
+    // ----------------------------------------------------------------------------
+    StatRegisterer::StatRegisterer(void (*func)(StatsAccumulator &))
+    {
+        // 静态初始化在main()之前单线程执行，不需要加锁
+        StatFuncs().push_back(func);
+    }
+
+    void ReportThreadStats(void)
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (void (*func)(StatsAccumulator &) : StatFuncs())
+        {
+            func(statsAccumulator);
+        }
+    }
+
+    void PrintStats(void)
+    {
+        ReportThreadStats();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        statsAccumulator.Print();
+    }
+
+    void ClearStats(void)
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        statsAccumulator.Clear();
+    }
+}
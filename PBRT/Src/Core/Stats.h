@@ -0,0 +1,206 @@
+﻿#pragma once
+
+#include "PBRT.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// 统计开关：定义PBRT_NO_STATS后所有统计宏都变成空操作，计数器不占存储，也不产生任何代码
+// 统计项的标题写成"类别/名字"，输出时按类别分组
+// 计数器是线程局部的普通整数，热路径上没有原子操作和锁；线程结束时（或调用ReportThreadStats()时）合并到全局统计
+// @remarks: 宏只能在命名空间作用域中使用，定义的计数器有外部链接，名字在整个程序中不能重复；
+//           头文件中的内联函数或模板要用计数器时，在头文件中用STAT_EXTERN_*声明，在对应的.cpp中用STAT_*定义
+#ifndef PBRT_NO_STATS
+
+    // 计数：++var或var += n
+    #define STAT_COUNTER(title, var)                                         \
+        thread_local int64_t var;                                            \
+        static void STATS_FUNC_##var(PBRT::StatsAccumulator &accum)          \
+        {                                                                    \
+            accum.ReportCounter(title, var);                                 \
+            var = 0;                                                         \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##var(STATS_FUNC_##var)
+
+    // 字节数：var += size，按KiB/MiB/GiB输出
+    #define STAT_MEMORY_COUNTER(title, var)                                  \
+        thread_local int64_t var;                                            \
+        static void STATS_FUNC_##var(PBRT::StatsAccumulator &accum)          \
+        {                                                                    \
+            accum.ReportMemoryCounter(title, var);                           \
+            var = 0;                                                         \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##var(STATS_FUNC_##var)
+
+    // 取值分布：STAT_REPORT_VALUE(var, value)，输出平均值、最小值和最大值
+    #define STAT_INT_DISTRIBUTION(title, var)                                \
+        thread_local PBRT::StatDistribution<int64_t> var;                    \
+        static void STATS_FUNC_##var(PBRT::StatsAccumulator &accum)          \
+        {                                                                    \
+            accum.ReportDistribution(title, var);                            \
+            var = PBRT::StatDistribution<int64_t>();                         \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##var(STATS_FUNC_##var)
+
+    #define STAT_FLOAT_DISTRIBUTION(title, var)                              \
+        thread_local PBRT::StatDistribution<double> var;                     \
+        static void STATS_FUNC_##var(PBRT::StatsAccumulator &accum)          \
+        {                                                                    \
+            accum.ReportDistribution(title, var);                            \
+            var = PBRT::StatDistribution<double>();                          \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##var(STATS_FUNC_##var)
+
+    // 百分比和比值：分子、分母是两个独立的计数器
+    #define STAT_PERCENT(title, numVar, denomVar)                            \
+        thread_local int64_t numVar, denomVar;                               \
+        static void STATS_FUNC_##numVar(PBRT::StatsAccumulator &accum)       \
+        {                                                                    \
+            accum.ReportPercentage(title, numVar, denomVar);                 \
+            numVar = denomVar = 0;                                           \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##numVar(STATS_FUNC_##numVar)
+
+    #define STAT_RATIO(title, numVar, denomVar)                              \
+        thread_local int64_t numVar, denomVar;                               \
+        static void STATS_FUNC_##numVar(PBRT::StatsAccumulator &accum)       \
+        {                                                                    \
+            accum.ReportRatio(title, numVar, denomVar);                      \
+            numVar = denomVar = 0;                                           \
+        }                                                                    \
+        static PBRT::StatRegisterer STATS_REG_##numVar(STATS_FUNC_##numVar)
+
+    #define STAT_REPORT_VALUE(var, value) (var).Add(value)
+
+    // 头文件中的声明
+    #define STAT_EXTERN_COUNTER(var) extern thread_local int64_t var
+    #define STAT_EXTERN_INT_DISTRIBUTION(var) extern thread_local PBRT::StatDistribution<int64_t> var
+    #define STAT_EXTERN_FLOAT_DISTRIBUTION(var) extern thread_local PBRT::StatDistribution<double> var
+    #define STAT_EXTERN_PERCENT(numVar, denomVar) extern thread_local int64_t numVar, denomVar
+    #define STAT_EXTERN_RATIO(numVar, denomVar) extern thread_local int64_t numVar, denomVar
+
+#else
+
+    #define STAT_COUNTER(title, var) PBRT::NullStat var
+    #define STAT_MEMORY_COUNTER(title, var) PBRT::NullStat var
+    #define STAT_INT_DISTRIBUTION(title, var) PBRT::NullStat var
+    #define STAT_FLOAT_DISTRIBUTION(title, var) PBRT::NullStat var
+    #define STAT_PERCENT(title, numVar, denomVar) PBRT::NullStat numVar, denomVar
+    #define STAT_RATIO(title, numVar, denomVar) PBRT::NullStat numVar, denomVar
+    #define STAT_REPORT_VALUE(var, value) ((void)0)
+
+    #define STAT_EXTERN_COUNTER(var) extern PBRT::NullStat var
+    #define STAT_EXTERN_INT_DISTRIBUTION(var) extern PBRT::NullStat var
+    #define STAT_EXTERN_FLOAT_DISTRIBUTION(var) extern PBRT::NullStat var
+    #define STAT_EXTERN_PERCENT(numVar, denomVar) extern PBRT::NullStat numVar, denomVar
+    #define STAT_EXTERN_RATIO(numVar, denomVar) extern PBRT::NullStat numVar, denomVar
+
+#endif // PBRT_NO_STATS
+
+namespace PBRT
+{
+    // 一个线程上报的取值：没有初始化器，线程局部变量按零初始化，访问时不需要检查是否已构造
+    template <typename T>
+    struct StatDistribution
+    {
+        void Add(T value)
+        {
+            if ((0 == count) || (value < minValue)) minValue = value;
+            if ((0 == count) || (value > maxValue)) maxValue = value;
+            sum += value;
+            ++count;
+        }
+
+        T sum, minValue, maxValue;
+        int64_t count;
+    };
+
+    // 关闭统计时代替计数器，所有操作都是空的
+    struct NullStat
+    {
+        void operator++(void) {}
+        void operator++(int) {}
+
+        template <typename T>
+        void operator+=(T) {}
+    };
+
+    // 按标题合并各线程上报的统计
+    class StatsAccumulator
+    {
+    public:
+        void ReportCounter(const std::string &name, int64_t val)
+        {
+            counters[name] += val;
+        }
+
+        void ReportMemoryCounter(const std::string &name, int64_t val)
+        {
+            memoryCounters[name] += val;
+        }
+
+        template <typename T>
+        void ReportDistribution(const std::string &name, const StatDistribution<T> &d)
+        {
+            if (0 == d.count)
+            {
+                return;
+            }
+
+            Distribution &to = distributions[name];
+            to.isFloat = !std::is_integral<T>::value;
+            to.minValue = (0 == to.count) ? (double)d.minValue : std::min(to.minValue, (double)d.minValue);
+            to.maxValue = (0 == to.count) ? (double)d.maxValue : std::max(to.maxValue, (double)d.maxValue);
+            to.sum += (double)d.sum;
+            to.count += d.count;
+        }
+
+        void ReportPercentage(const std::string &name, int64_t num, int64_t denom)
+        {
+            percentages[name].first += num;
+            percentages[name].second += denom;
+        }
+
+        void ReportRatio(const std::string &name, int64_t num, int64_t denom)
+        {
+            ratios[name].first += num;
+            ratios[name].second += denom;
+        }
+
+        // 通过glog逐行输出，每类统计按标题排序
+        void Print(void) const;
+        void Clear(void);
+
+    private:
+        struct Distribution
+        {
+            double sum = 0, minValue = 0, maxValue = 0;
+            int64_t count = 0;
+            bool isFloat = false;
+        };
+
+        std::map<std::string, int64_t> counters;
+        std::map<std::string, int64_t> memoryCounters;
+        std::map<std::string, Distribution> distributions;
+        std::map<std::string, std::pair<int64_t, int64_t>> percentages;
+        std::map<std::string, std::pair<int64_t, int64_t>> ratios;
+    };
+
+    // 把读取并清零本线程计数器的函数登记到全局表中
+    class StatRegisterer
+    {
+    public:
+        explicit StatRegisterer(void (*func)(StatsAccumulator &));
+    };
+
+    // 把调用线程的计数器合并到全局统计并清零
+    // @remarks: 线程池的工作线程退出时会自动调用
+    void ReportThreadStats(void);
+
+    // 合并调用线程的计数器后输出全局统计；应在ParallelCleanup()之后调用，使工作线程的计数已经合并
+    void PrintStats(void);
+    void ClearStats(void);
+}
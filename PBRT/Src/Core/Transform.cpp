@@ -0,0 +1,826 @@
+﻿#include "Transform.h"
+#include "Parallel.h"
+#include <cmath>
+#include <cstring>
+
+namespace PBRT
+{
+    static_assert(sizeof(Point3f) == (3 * sizeof(Float)), "Point3f must be tightly packed");
+    static_assert(sizeof(Vector3f) == (3 * sizeof(Float)), "Vector3f must be tightly packed");
+    static_assert(sizeof(Normal3f) == (3 * sizeof(Float)), "Normal3f must be tightly packed");
+
+    namespace
+    {
+        // 批量变换的系数按列存放：r = c[0] * x + c[1] * y + c[2] * z + c[3]
+        // project为true时再除以r的第4个分量
+        struct BatchMatrix
+        {
+            alignas(16) Float c[4][4];
+            bool project;
+        };
+
+        // 每块的大小，小于一块时直接在调用线程上完成
+        const size_t BatchChunkSize = 16384;
+
+        void TransformRange(const BatchMatrix &bm, const Float *in, Float *out, size_t begin, size_t end)
+        {
+#ifdef PBRT_HAVE_SSE
+            const __m128 c0 = _mm_load_ps(bm.c[0]);
+            const __m128 c1 = _mm_load_ps(bm.c[1]);
+            const __m128 c2 = _mm_load_ps(bm.c[2]);
+            const __m128 c3 = _mm_load_ps(bm.c[3]);
+            for (size_t i = begin; i < end; ++i)
+            {
+                const Float *p = in + (3 * i);
+                // 运算顺序与标量版本相同，结果逐位一致
+                __m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+                r = _mm_add_ps(_mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(p[2]))), c3);
+                if (bm.project)
+                {
+                    r = _mm_div_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)));
+                }
+
+                // 只写3个分量，原地变换时不会覆盖下一个还没读取的点
+                Float *q = out + (3 * i);
+                _mm_storel_pi((__m64 *)q, r);
+                _mm_store_ss(q + 2, _mm_movehl_ps(r, r));
+            }
+#else
+            for (size_t i = begin; i < end; ++i)
+            {
+                const Float *p = in + (3 * i);
+                Float x = p[0], y = p[1], z = p[2];
+                Float r[4];
+                for (int k = 0; k < 4; ++k)
+                {
+                    r[k] = (bm.c[0][k] * x) + (bm.c[1][k] * y) + (bm.c[2][k] * z) + bm.c[3][k];
+                }
+                if (bm.project)
+                {
+                    r[0] /= r[3];
+                    r[1] /= r[3];
+                    r[2] /= r[3];
+                }
+
+                Float *q = out + (3 * i);
+                q[0] = r[0];
+                q[1] = r[1];
+                q[2] = r[2];
+            }
+#endif // PBRT_HAVE_SSE
+        }
+
+        // 求运动包围盒时用的区间算术
+        struct Interval
+        {
+            Interval(Float v)
+                : low(v), high(v)
+            {}
+
+            Interval(Float v0, Float v1)
+                : low(std::min(v0, v1)), high(std::max(v0, v1))
+            {}
+
+            Interval operator+(const Interval &i) const
+            {
+                return Interval(low + i.low, high + i.high);
+            }
+
+            Interval operator*(const Interval &i) const
+            {
+                Float a = low * i.low, b = high * i.low, c = low * i.high, d = high * i.high;
+                return Interval(std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)));
+            }
+
+            Float low, high;
+        };
+
+        // 区间须在[0, 2π]内
+        Interval Sin(const Interval &i)
+        {
+            CHECK_GE(i.low, 0);
+            CHECK_LE(i.high, 2.0001 * Pi);
+            Float sinLow = std::sin(i.low), sinHigh = std::sin(i.high);
+            if (sinLow > sinHigh) std::swap(sinLow, sinHigh);
+            if ((i.low < (Pi / 2)) && (i.high > (Pi / 2))) sinHigh = 1;
+            if ((i.low < ((3.0f / 2.0f) * Pi)) && (i.high > ((3.0f / 2.0f) * Pi))) sinLow = -1;
+            return Interval(sinLow, sinHigh);
+        }
+
+        Interval Cos(const Interval &i)
+        {
+            CHECK_GE(i.low, 0);
+            CHECK_LE(i.high, 2.0001 * Pi);
+            Float cosLow = std::cos(i.low), cosHigh = std::cos(i.high);
+            if (cosLow > cosHigh) std::swap(cosLow, cosHigh);
+            if ((i.low < Pi) && (i.high > Pi)) cosLow = -1;
+            return Interval(cosLow, cosHigh);
+        }
+
+        // 求f(u) = c1 + (c2 + c3 * u) * cos(ωu) + (c4 + c5 * u) * sin(ωu)在区间内的零点
+        // 区间估计不含0时整段剪掉，否则二分到一定深度后用牛顿迭代求精
+        void IntervalFindZeros(Float c1, Float c2, Float c3, Float c4, Float c5
+                             , Float omega, Interval uInterval
+                             , Float *zeros, int *zeroCount, int maxZeros, int depth = 8)
+        {
+            Interval range = Interval(c1)
+                           + ((Interval(c2) + (Interval(c3) * uInterval)) * Cos(Interval(omega) * uInterval))
+                           + ((Interval(c4) + (Interval(c5) * uInterval)) * Sin(Interval(omega) * uInterval));
+            if ((range.low > 0) || (range.high < 0) || (range.low == range.high))
+            {
+                return;
+            }
+
+            if (depth > 0)
+            {
+                Float mid = (uInterval.low + uInterval.high) * 0.5f;
+                IntervalFindZeros(c1, c2, c3, c4, c5, omega, Interval(uInterval.low, mid), zeros, zeroCount, maxZeros, depth - 1);
+                IntervalFindZeros(c1, c2, c3, c4, c5, omega, Interval(mid, uInterval.high), zeros, zeroCount, maxZeros, depth - 1);
+                return;
+            }
+
+            Float uNewton = (uInterval.low + uInterval.high) * 0.5f;
+            for (int i = 0; i < 4; ++i)
+            {
+                Float cosU = std::cos(omega * uNewton), sinU = std::sin(omega * uNewton);
+                Float f = c1 + ((c2 + (c3 * uNewton)) * cosU) + ((c4 + (c5 * uNewton)) * sinU);
+                Float fPrime = ((c3 + (omega * c4) + (omega * c5 * uNewton)) * cosU)
+                             + ((c5 - (omega * c2) - (omega * c3 * uNewton)) * sinU);
+                if ((0 == f) || (0 == fPrime))
+                {
+                    break;
+                }
+                uNewton -= f / fPrime;
+            }
+            if ((uNewton >= (uInterval.low - 1e-3f)) && (uNewton < (uInterval.high + 1e-3f)) && (*zeroCount < maxZeros))
+            {
+                zeros[(*zeroCount)++] = uNewton;
+            }
+        }
+
+        void BatchTransform(const BatchMatrix &bm, const Float *in, Float *out, size_t count)
+        {
+            if (count <= BatchChunkSize)
+            {
+                TransformRange(bm, in, out, 0, count);
+                return;
+            }
+
+            int64_t nChunks = (int64_t)((count + BatchChunkSize - 1) / BatchChunkSize);
+            ParallelFor(nChunks, 1, [&](int64_t chunk)
+            {
+                size_t begin = (size_t)chunk * BatchChunkSize;
+                size_t end = std::min(begin + BatchChunkSize, count);
+                TransformRange(bm, in, out, begin, end);
+            });
+        }
+    }
+
+    // ----------------------------------------------------------------------------
+    // Matrix4x4
+    // ----------------------------------------------------------------------------
+    Matrix4x4::Matrix4x4(void)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                m[i][j] = (i == j) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    Matrix4x4::Matrix4x4(const Float mat[4][4])
+    {
+        std::memcpy(m, mat, sizeof(m));
+    }
+
+    Matrix4x4::Matrix4x4(Float t00, Float t01, Float t02, Float t03
+                       , Float t10, Float t11, Float t12, Float t13
+                       , Float t20, Float t21, Float t22, Float t23
+                       , Float t30, Float t31, Float t32, Float t33)
+    {
+        m[0][0] = t00; m[0][1] = t01; m[0][2] = t02; m[0][3] = t03;
+        m[1][0] = t10; m[1][1] = t11; m[1][2] = t12; m[1][3] = t13;
+        m[2][0] = t20; m[2][1] = t21; m[2][2] = t22; m[2][3] = t23;
+        m[3][0] = t30; m[3][1] = t31; m[3][2] = t32; m[3][3] = t33;
+    }
+
+    bool Matrix4x4::IsIdentity(void) const
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                if (m[i][j] != ((i == j) ? 1.0f : 0.0f))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    Matrix4x4 Matrix4x4::Mul(const Matrix4x4 &m1, const Matrix4x4 &m2)
+    {
+        Matrix4x4 r;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                r.m[i][j] = (m1.m[i][0] * m2.m[0][j]) + (m1.m[i][1] * m2.m[1][j])
+                          + (m1.m[i][2] * m2.m[2][j]) + (m1.m[i][3] * m2.m[3][j]);
+            }
+        }
+        return r;
+    }
+
+    Matrix4x4 Transpose(const Matrix4x4 &m)
+    {
+        return Matrix4x4(m.m[0][0], m.m[1][0], m.m[2][0], m.m[3][0]
+                       , m.m[0][1], m.m[1][1], m.m[2][1], m.m[3][1]
+                       , m.m[0][2], m.m[1][2], m.m[2][2], m.m[3][2]
+                       , m.m[0][3], m.m[1][3], m.m[2][3], m.m[3][3]);
+    }
+
+    Matrix4x4 Inverse(const Matrix4x4 &m)
+    {
+        int indxc[4], indxr[4];
+        int ipiv[4] = { 0, 0, 0, 0 };
+        Float minv[4][4];
+        std::memcpy(minv, m.m, sizeof(minv));
+        for (int i = 0; i < 4; ++i)
+        {
+            // 选主元
+            int irow = 0, icol = 0;
+            Float big = 0.0f;
+            for (int j = 0; j < 4; ++j)
+            {
+                if (1 != ipiv[j])
+                {
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        if (0 == ipiv[k])
+                        {
+                            if (std::abs(minv[j][k]) >= big)
+                            {
+                                big = std::abs(minv[j][k]);
+                                irow = j;
+                                icol = k;
+                            }
+                        }
+                        else if (ipiv[k] > 1)
+                        {
+                            LOG(ERROR) << "Singular matrix in Inverse";
+                        }
+                    }
+                }
+            }
+            ++ipiv[icol];
+
+            // 把主元换到对角线上
+            if (irow != icol)
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    std::swap(minv[irow][k], minv[icol][k]);
+                }
+            }
+            indxr[i] = irow;
+            indxc[i] = icol;
+            if (0 == minv[icol][icol])
+            {
+                LOG(ERROR) << "Singular matrix in Inverse";
+            }
+
+            Float pivinv = 1 / minv[icol][icol];
+            minv[icol][icol] = 1.0f;
+            for (int j = 0; j < 4; ++j)
+            {
+                minv[icol][j] *= pivinv;
+            }
+
+            // 消去其他行的这一列
+            for (int j = 0; j < 4; ++j)
+            {
+                if (j != icol)
+                {
+                    Float save = minv[j][icol];
+                    minv[j][icol] = 0;
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        minv[j][k] -= minv[icol][k] * save;
+                    }
+                }
+            }
+        }
+
+        // 按相反顺序换回列
+        for (int j = 3; j >= 0; --j)
+        {
+            if (indxr[j] != indxc[j])
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    std::swap(minv[k][indxr[j]], minv[k][indxc[j]]);
+                }
+            }
+        }
+        return Matrix4x4(minv);
+    }
+
+    // ----------------------------------------------------------------------------
+    // Transform
+    // ----------------------------------------------------------------------------
+    bool Transform::HasScale(void) const
+    {
+        Float la2 = (*this)(Vector3f(1, 0, 0)).LengthSquared();
+        Float lb2 = (*this)(Vector3f(0, 1, 0)).LengthSquared();
+        Float lc2 = (*this)(Vector3f(0, 0, 1)).LengthSquared();
+#define NOT_ONE(x) (((x) < .999f) || ((x) > 1.001f))
+        return (NOT_ONE(la2) || NOT_ONE(lb2) || NOT_ONE(lc2));
+#undef NOT_ONE
+    }
+
+    bool Transform::SwapsHandedness(void) const
+    {
+        Float det = (m.m[0][0] * ((m.m[1][1] * m.m[2][2]) - (m.m[1][2] * m.m[2][1])))
+                  - (m.m[0][1] * ((m.m[1][0] * m.m[2][2]) - (m.m[1][2] * m.m[2][0])))
+                  + (m.m[0][2] * ((m.m[1][0] * m.m[2][1]) - (m.m[1][1] * m.m[2][0])));
+        return (det < 0);
+    }
+
+    RayDifferential Transform::operator()(const RayDifferential &r) const
+    {
+        RayDifferential ret((*this)(Ray(r)));
+        ret.hasDifferentials = r.hasDifferentials;
+        ret.rxOrigin = (*this)(r.rxOrigin);
+        ret.ryOrigin = (*this)(r.ryOrigin);
+        ret.rxDir = (*this)(r.rxDir);
+        ret.ryDir = (*this)(r.ryDir);
+        return ret;
+    }
+
+    Bounds3f Transform::operator()(const Bounds3f &b) const
+    {
+        if (!m.IsAffine())
+        {
+            Bounds3f ret((*this)(b.Corner(0)));
+            for (int corner = 1; corner < 8; ++corner)
+            {
+                ret = Union(ret, (*this)(b.Corner(corner)));
+            }
+            return ret;
+        }
+
+        // Arvo: 输出的每个轴从平移量出发，逐项累加矩阵元素与min/max乘积中较小/较大的一个
+        Point3f minPoint(m.m[0][3], m.m[1][3], m.m[2][3]);
+        Point3f maxPoint = minPoint;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                Float a = m.m[i][j] * b.minPoint[j];
+                Float c = m.m[i][j] * b.maxPoint[j];
+                minPoint[i] += std::min(a, c);
+                maxPoint[i] += std::max(a, c);
+            }
+        }
+        return Bounds3f(minPoint, maxPoint);
+    }
+
+    Transform Transform::operator*(const Transform &t2) const
+    {
+        return Transform(Matrix4x4::Mul(m, t2.m), Matrix4x4::Mul(t2.mInv, mInv));
+    }
+
+    void Transform::TransformPoints(const Point3f *in, Point3f *out, size_t count) const
+    {
+        BatchMatrix bm;
+        for (int j = 0; j < 4; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                bm.c[j][i] = m.m[i][j];
+            }
+        }
+        bm.project = !m.IsAffine();
+        BatchTransform(bm, &in->x, &out->x, count);
+    }
+
+    void Transform::TransformVectors(const Vector3f *in, Vector3f *out, size_t count) const
+    {
+        BatchMatrix bm;
+        for (int j = 0; j < 4; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                bm.c[j][i] = ((j < 3) && (i < 3)) ? m.m[i][j] : 0.0f;
+            }
+        }
+        bm.project = false;
+        BatchTransform(bm, &in->x, &out->x, count);
+    }
+
+    void Transform::TransformNormals(const Normal3f *in, Normal3f *out, size_t count) const
+    {
+        // 逆矩阵转置的第j列就是逆矩阵的第j行
+        BatchMatrix bm;
+        for (int j = 0; j < 4; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                bm.c[j][i] = ((j < 3) && (i < 3)) ? mInv.m[j][i] : 0.0f;
+            }
+        }
+        bm.project = false;
+        BatchTransform(bm, &in->x, &out->x, count);
+    }
+
+    // ----------------------------------------------------------------------------
+    // 常用变换
+    // ----------------------------------------------------------------------------
+    Transform Translate(const Vector3f &delta)
+    {
+        Matrix4x4 m(1, 0, 0, delta.x
+                  , 0, 1, 0, delta.y
+                  , 0, 0, 1, delta.z
+                  , 0, 0, 0, 1);
+        Matrix4x4 mInv(1, 0, 0, -delta.x
+                     , 0, 1, 0, -delta.y
+                     , 0, 0, 1, -delta.z
+                     , 0, 0, 0, 1);
+        return Transform(m, mInv);
+    }
+
+    Transform Scale(Float x, Float y, Float z)
+    {
+        Matrix4x4 m(x, 0, 0, 0
+                  , 0, y, 0, 0
+                  , 0, 0, z, 0
+                  , 0, 0, 0, 1);
+        Matrix4x4 mInv(1 / x, 0, 0, 0
+                     , 0, 1 / y, 0, 0
+                     , 0, 0, 1 / z, 0
+                     , 0, 0, 0, 1);
+        return Transform(m, mInv);
+    }
+
+    // 旋转矩阵是正交矩阵，逆矩阵就是转置
+    Transform RotateX(Float theta)
+    {
+        Float sinTheta = std::sin(Radians(theta));
+        Float cosTheta = std::cos(Radians(theta));
+        Matrix4x4 m(1, 0, 0, 0
+                  , 0, cosTheta, -sinTheta, 0
+                  , 0, sinTheta, cosTheta, 0
+                  , 0, 0, 0, 1);
+        return Transform(m, Transpose(m));
+    }
+
+    Transform RotateY(Float theta)
+    {
+        Float sinTheta = std::sin(Radians(theta));
+        Float cosTheta = std::cos(Radians(theta));
+        Matrix4x4 m(cosTheta, 0, sinTheta, 0
+                  , 0, 1, 0, 0
+                  , -sinTheta, 0, cosTheta, 0
+                  , 0, 0, 0, 1);
+        return Transform(m, Transpose(m));
+    }
+
+    Transform RotateZ(Float theta)
+    {
+        Float sinTheta = std::sin(Radians(theta));
+        Float cosTheta = std::cos(Radians(theta));
+        Matrix4x4 m(cosTheta, -sinTheta, 0, 0
+                  , sinTheta, cosTheta, 0, 0
+                  , 0, 0, 1, 0
+                  , 0, 0, 0, 1);
+        return Transform(m, Transpose(m));
+    }
+
+    Transform Rotate(Float theta, const Vector3f &axis)
+    {
+        Vector3f a = Normalize(axis);
+        Float sinTheta = std::sin(Radians(theta));
+        Float cosTheta = std::cos(Radians(theta));
+        Matrix4x4 m;
+        m.m[0][0] = (a.x * a.x) + ((1 - (a.x * a.x)) * cosTheta);
+        m.m[0][1] = (a.x * a.y * (1 - cosTheta)) - (a.z * sinTheta);
+        m.m[0][2] = (a.x * a.z * (1 - cosTheta)) + (a.y * sinTheta);
+        m.m[0][3] = 0;
+
+        m.m[1][0] = (a.x * a.y * (1 - cosTheta)) + (a.z * sinTheta);
+        m.m[1][1] = (a.y * a.y) + ((1 - (a.y * a.y)) * cosTheta);
+        m.m[1][2] = (a.y * a.z * (1 - cosTheta)) - (a.x * sinTheta);
+        m.m[1][3] = 0;
+
+        m.m[2][0] = (a.x * a.z * (1 - cosTheta)) - (a.y * sinTheta);
+        m.m[2][1] = (a.y * a.z * (1 - cosTheta)) + (a.x * sinTheta);
+        m.m[2][2] = (a.z * a.z) + ((1 - (a.z * a.z)) * cosTheta);
+        m.m[2][3] = 0;
+        return Transform(m, Transpose(m));
+    }
+
+    Transform LookAt(const Point3f &pos, const Point3f &look, const Vector3f &up)
+    {
+        Matrix4x4 cameraToWorld;
+        cameraToWorld.m[0][3] = pos.x;
+        cameraToWorld.m[1][3] = pos.y;
+        cameraToWorld.m[2][3] = pos.z;
+        cameraToWorld.m[3][3] = 1;
+
+        Vector3f dir = Normalize(look - pos);
+        if (0 == Cross(Normalize(up), dir).Length())
+        {
+            LOG(ERROR) << "\"up\" vector and viewing direction passed to LookAt are pointing in the same direction";
+            return Transform();
+        }
+        Vector3f right = Normalize(Cross(Normalize(up), dir));
+        Vector3f newUp = Cross(dir, right);
+        cameraToWorld.m[0][0] = right.x;
+        cameraToWorld.m[1][0] = right.y;
+        cameraToWorld.m[2][0] = right.z;
+        cameraToWorld.m[3][0] = 0.0f;
+        cameraToWorld.m[0][1] = newUp.x;
+        cameraToWorld.m[1][1] = newUp.y;
+        cameraToWorld.m[2][1] = newUp.z;
+        cameraToWorld.m[3][1] = 0.0f;
+        cameraToWorld.m[0][2] = dir.x;
+        cameraToWorld.m[1][2] = dir.y;
+        cameraToWorld.m[2][2] = dir.z;
+        cameraToWorld.m[3][2] = 0.0f;
+        return Transform(Inverse(cameraToWorld), cameraToWorld);
+    }
+
+    // ----------------------------------------------------------------------------
+    // AnimatedTransform
+    // ----------------------------------------------------------------------------
+    AnimatedTransform::AnimatedTransform(const Transform &startTransform, Float startTime
+                                       , const Transform &endTransform, Float endTime)
+        : startTransform(startTransform), endTransform(endTransform)
+        , startTime(startTime), endTime(endTime)
+        , actuallyAnimated(startTransform != endTransform)
+        , hasRotation(false), theta(0)
+    {
+        if (!actuallyAnimated)
+        {
+            return;
+        }
+
+        Decompose(startTransform.GetMatrix(), &T[0], &R[0], &S[0]);
+        Decompose(endTransform.GetMatrix(), &T[1], &R[1], &S[1]);
+
+        // 取较短的一段弧
+        if (Dot(R[0], R[1]) < 0)
+        {
+            R[1] = -R[1];
+        }
+        hasRotation = (Dot(R[0], R[1]) < 0.9995f);
+        if (!hasRotation)
+        {
+            return;
+        }
+
+        // Slerp: q(u) = q0 * cos(θu) + qperp * sin(θu)，旋转矩阵是q的二次型，
+        // 用倍角公式展开成常数项、cos(2θu)项和sin(2θu)项
+        theta = std::acos(Clamp(Dot(R[0], R[1]), -1, 1));
+        Quaternion qperp = Normalize(R[1] - (R[0] * Dot(R[0], R[1])));
+        Float r0[3][3], rperp[3][3], rsum[3][3], rdiff[3][3];
+        R[0].ToMatrix(r0);
+        qperp.ToMatrix(rperp);
+        (R[0] + qperp).ToMatrix(rsum);
+        (R[0] - qperp).ToMatrix(rdiff);
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                rotA[i][j] = (r0[i][j] + rperp[i][j]) * 0.5f;
+                rotB[i][j] = (r0[i][j] - rperp[i][j]) * 0.5f;
+                rotC[i][j] = (rsum[i][j] - rdiff[i][j]) * 0.25f;
+            }
+        }
+    }
+
+    void AnimatedTransform::Decompose(const Matrix4x4 &m, Vector3f *T, Quaternion *Rquat, Matrix4x4 *S)
+    {
+        T->x = m.m[0][3];
+        T->y = m.m[1][3];
+        T->z = m.m[2][3];
+
+        // 去掉平移
+        Matrix4x4 M = m;
+        for (int i = 0; i < 3; ++i)
+        {
+            M.m[i][3] = M.m[3][i] = 0.0f;
+        }
+        M.m[3][3] = 1.0f;
+
+        // 极分解：反复对M与它的逆转置取平均，收敛到旋转部分
+        Float norm;
+        int count = 0;
+        Matrix4x4 R = M;
+        do
+        {
+            Matrix4x4 Rnext;
+            Matrix4x4 Rit = Inverse(Transpose(R));
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    Rnext.m[i][j] = 0.5f * (R.m[i][j] + Rit.m[i][j]);
+                }
+            }
+
+            norm = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                Float n = std::abs(R.m[i][0] - Rnext.m[i][0])
+                        + std::abs(R.m[i][1] - Rnext.m[i][1])
+                        + std::abs(R.m[i][2] - Rnext.m[i][2]);
+                norm = std::max(norm, n);
+            }
+            R = Rnext;
+        } while ((++count < 100) && (norm > 0.0001f));
+
+        *Rquat = Quaternion(R);
+        *S = Matrix4x4::Mul(Inverse(R), M);
+    }
+
+    Matrix4x4 AnimatedTransform::InterpolateMatrix(Float time) const
+    {
+        if (!actuallyAnimated || (time <= startTime))
+        {
+            return startTransform.GetMatrix();
+        }
+        if (time >= endTime)
+        {
+            return endTransform.GetMatrix();
+        }
+
+        Float dt = (time - startTime) / (endTime - startTime);
+        Vector3f trans = (T[0] * (1 - dt)) + (T[1] * dt);
+        Float r[3][3];
+        Slerp(dt, R[0], R[1]).ToMatrix(r);
+
+        // 缩放部分没有平移，M = [R * S | T]
+        Matrix4x4 m;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                Float sum = 0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    sum += r[i][k] * Lerp(dt, S[0].m[k][j], S[1].m[k][j]);
+                }
+                m.m[i][j] = sum;
+            }
+        }
+        m.m[0][3] = trans.x;
+        m.m[1][3] = trans.y;
+        m.m[2][3] = trans.z;
+        return m;
+    }
+
+    void AnimatedTransform::Interpolate(Float time, Transform *t) const
+    {
+        if (!actuallyAnimated || (time <= startTime))
+        {
+            *t = startTransform;
+            return;
+        }
+        if (time >= endTime)
+        {
+            *t = endTransform;
+            return;
+        }
+        *t = Transform(InterpolateMatrix(time));
+    }
+
+    Ray AnimatedTransform::operator()(const Ray &r) const
+    {
+        if (!actuallyAnimated || (r.time <= startTime))
+        {
+            return startTransform(r);
+        }
+        if (r.time >= endTime)
+        {
+            return endTransform(r);
+        }
+        // 变换光线只用到正向矩阵，逆矩阵随便填一个，省去每条光线求逆
+        return Transform(InterpolateMatrix(r.time), Matrix4x4())(r);
+    }
+
+    RayDifferential AnimatedTransform::operator()(const RayDifferential &r) const
+    {
+        if (!actuallyAnimated || (r.time <= startTime))
+        {
+            return startTransform(r);
+        }
+        if (r.time >= endTime)
+        {
+            return endTransform(r);
+        }
+        return Transform(InterpolateMatrix(r.time), Matrix4x4())(r);
+    }
+
+    Point3f AnimatedTransform::operator()(Float time, const Point3f &p) const
+    {
+        if (!actuallyAnimated || (time <= startTime))
+        {
+            return startTransform(p);
+        }
+        if (time >= endTime)
+        {
+            return endTransform(p);
+        }
+        return Transform(InterpolateMatrix(time), Matrix4x4())(p);
+    }
+
+    Vector3f AnimatedTransform::operator()(Float time, const Vector3f &v) const
+    {
+        if (!actuallyAnimated || (time <= startTime))
+        {
+            return startTransform(v);
+        }
+        if (time >= endTime)
+        {
+            return endTransform(v);
+        }
+        return Transform(InterpolateMatrix(time), Matrix4x4())(v);
+    }
+
+    Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b) const
+    {
+        if (!actuallyAnimated)
+        {
+            return startTransform(b);
+        }
+        // 没有旋转时每个点的轨迹是t的线性函数，两端的包围盒就是精确的
+        if (!hasRotation)
+        {
+            return Union(startTransform(b), endTransform(b));
+        }
+
+        Bounds3f bounds;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            bounds = Union(bounds, BoundPointMotion(b.Corner(corner)));
+        }
+        return bounds;
+    }
+
+    Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const
+    {
+        if (!actuallyAnimated)
+        {
+            return Bounds3f(startTransform(p));
+        }
+
+        Bounds3f bounds(startTransform(p), endTransform(p));
+        if (!hasRotation)
+        {
+            return bounds;
+        }
+
+        // S(u) * p = s0 + s1 * u
+        Float s0[3], s1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            s0[k] = (S[0].m[k][0] * p.x) + (S[0].m[k][1] * p.y) + (S[0].m[k][2] * p.z);
+            s1[k] = ((S[1].m[k][0] - S[0].m[k][0]) * p.x)
+                  + ((S[1].m[k][1] - S[0].m[k][1]) * p.y)
+                  + ((S[1].m[k][2] - S[0].m[k][2]) * p.z);
+        }
+
+        // 第c个分量的轨迹x(u) = A + B * u + (C + D * u) * cos(ωu) + (E + F * u) * sin(ωu)，
+        // 极值点是x'(u)的零点
+        Float omega = 2 * theta;
+        for (int c = 0; c < 3; ++c)
+        {
+            Float B = T[1][c] - T[0][c];
+            Float C = 0, D = 0, E = 0, F = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                B += rotA[c][k] * s1[k];
+                C += rotB[c][k] * s0[k];
+                D += rotB[c][k] * s1[k];
+                E += rotC[c][k] * s0[k];
+                F += rotC[c][k] * s1[k];
+            }
+
+            Float zeros[8];
+            int zeroCount = 0;
+            IntervalFindZeros(B, D + (omega * E), omega * F, F - (omega * C), -omega * D
+                            , omega, Interval(0.0f, 1.0f), zeros, &zeroCount, 8);
+            for (int i = 0; i < zeroCount; ++i)
+            {
+                Point3f pz = (*this)(Lerp(zeros[i], startTime, endTime), p);
+                bounds = Union(bounds, pz);
+            }
+        }
+        return bounds;
+    }
+}
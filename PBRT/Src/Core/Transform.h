@@ -0,0 +1,264 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "Quaternion.h"
+#include <cstddef>
+
+namespace PBRT
+{
+    // 4x4矩阵，按行存储
+    struct Matrix4x4
+    {
+        Matrix4x4(void);
+
+        Matrix4x4(const Float mat[4][4]);
+
+        Matrix4x4(Float t00, Float t01, Float t02, Float t03
+                , Float t10, Float t11, Float t12, Float t13
+                , Float t20, Float t21, Float t22, Float t23
+                , Float t30, Float t31, Float t32, Float t33);
+
+        bool operator==(const Matrix4x4 &m2) const
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    if (m[i][j] != m2.m[i][j])
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool operator!=(const Matrix4x4 &m2) const
+        {
+            return !(*this == m2);
+        }
+
+        bool IsIdentity(void) const;
+
+        // 最后一行为(0, 0, 0, 1)，变换点时不需要透视除法
+        bool IsAffine(void) const
+        {
+            return ((0 == m[3][0]) && (0 == m[3][1]) && (0 == m[3][2]) && (1 == m[3][3]));
+        }
+
+        static Matrix4x4 Mul(const Matrix4x4 &m1, const Matrix4x4 &m2);
+
+        Float m[4][4];
+    };
+
+    Matrix4x4 Transpose(const Matrix4x4 &m);
+
+    // 全主元高斯-约当消元求逆
+    Matrix4x4 Inverse(const Matrix4x4 &m);
+
+    // 变换同时保存矩阵和它的逆，避免变换法线、求逆变换时重复求逆
+    class Transform
+    {
+    public:
+        Transform(void)
+        {}
+
+        Transform(const Float mat[4][4])
+            : m(mat), mInv(Inverse(m))
+        {}
+
+        Transform(const Matrix4x4 &m)
+            : m(m), mInv(Inverse(m))
+        {}
+
+        Transform(const Matrix4x4 &m, const Matrix4x4 &mInv)
+            : m(m), mInv(mInv)
+        {}
+
+        friend Transform Inverse(const Transform &t)
+        {
+            return Transform(t.mInv, t.m);
+        }
+
+        friend Transform Transpose(const Transform &t)
+        {
+            return Transform(Transpose(t.m), Transpose(t.mInv));
+        }
+
+        bool operator==(const Transform &t) const
+        {
+            return ((t.m == m) && (t.mInv == mInv));
+        }
+
+        bool operator!=(const Transform &t) const
+        {
+            return !(*this == t);
+        }
+
+        bool IsIdentity(void) const
+        {
+            return m.IsIdentity();
+        }
+
+        bool HasScale(void) const;
+
+        // 左手系与右手系互换（3x3部分的行列式为负）
+        bool SwapsHandedness(void) const;
+
+        const Matrix4x4 &GetMatrix(void) const
+        {
+            return m;
+        }
+
+        const Matrix4x4 &GetInverseMatrix(void) const
+        {
+            return mInv;
+        }
+
+        template <typename T>
+        inline Point3<T> operator()(const Point3<T> &p) const;
+
+        template <typename T>
+        inline Vector3<T> operator()(const Vector3<T> &v) const;
+
+        // 法线按逆矩阵的转置变换，保持与切平面垂直
+        template <typename T>
+        inline Normal3<T> operator()(const Normal3<T> &n) const;
+
+        inline Ray operator()(const Ray &r) const;
+
+        RayDifferential operator()(const RayDifferential &r) const;
+
+        // 仿射变换用Arvo的方法直接求变换后的包围盒，否则变换8个角点
+        Bounds3f operator()(const Bounds3f &b) const;
+
+        Transform operator*(const Transform &t2) const;
+
+        // 批量变换顶点数组，加载场景时用；in和out可以是同一个数组
+        // @remarks: 启用SIMD时每个点用一组SSE乘加完成，数组很大时再按块分给线程池
+        void TransformPoints(const Point3f *in, Point3f *out, size_t count) const;
+        void TransformVectors(const Vector3f *in, Vector3f *out, size_t count) const;
+        void TransformNormals(const Normal3f *in, Normal3f *out, size_t count) const;
+
+    private:
+        Matrix4x4 m, mInv;
+    };
+
+    // ----------------------------------------------------------------------------
+    // 常用变换
+    // ----------------------------------------------------------------------------
+    Transform Translate(const Vector3f &delta);
+
+    Transform Scale(Float x, Float y, Float z);
+
+    // 角度以度为单位
+    Transform RotateX(Float theta);
+
+    Transform RotateY(Float theta);
+
+    Transform RotateZ(Float theta);
+
+    Transform Rotate(Float theta, const Vector3f &axis);
+
+    // 世界空间到相机空间的变换，相机位于pos并看向look
+    Transform LookAt(const Point3f &pos, const Point3f &look, const Vector3f &up);
+
+    // 两个关键帧之间的运动变换，按光线的time插值，用于运动模糊
+    // 关键帧分解为平移T、旋转R（四元数）和缩放S，M(t) = T(t) * R(t) * S(t)
+    class AnimatedTransform
+    {
+    public:
+        AnimatedTransform(const Transform &startTransform, Float startTime
+                        , const Transform &endTransform, Float endTime);
+
+        // 用极分解把M拆成平移、旋转和缩放
+        static void Decompose(const Matrix4x4 &m, Vector3f *T, Quaternion *R, Matrix4x4 *S);
+
+        void Interpolate(Float time, Transform *t) const;
+
+        Ray operator()(const Ray &r) const;
+
+        RayDifferential operator()(const RayDifferential &r) const;
+
+        Point3f operator()(Float time, const Point3f &p) const;
+
+        Vector3f operator()(Float time, const Vector3f &v) const;
+
+        bool IsAnimated(void) const
+        {
+            return actuallyAnimated;
+        }
+
+        bool HasScale(void) const
+        {
+            return (startTransform.HasScale() || endTransform.HasScale());
+        }
+
+        // 包围盒在[startTime, endTime]内扫过的范围
+        // @remarks: 有旋转时逐个角点求轨迹的极值点，而不是简单合并两端的包围盒
+        Bounds3f MotionBounds(const Bounds3f &b) const;
+
+        Bounds3f BoundPointMotion(const Point3f &p) const;
+
+    private:
+        // 只求正向矩阵，变换光线和点时不需要逆矩阵
+        Matrix4x4 InterpolateMatrix(Float time) const;
+
+        Transform startTransform, endTransform;
+        Float startTime, endTime;
+        bool actuallyAnimated;
+        Vector3f T[2];
+        Quaternion R[2];
+        Matrix4x4 S[2];
+        bool hasRotation;
+
+        // 单位化时间u下旋转矩阵R(u) = rotA + rotB * cos(2θu) + rotC * sin(2θu)
+        Float theta;
+        Float rotA[3][3], rotB[3][3], rotC[3][3];
+    };
+
+    // ----------------------------------------------------------------------------
+    // Transform inline functions
+    // ----------------------------------------------------------------------------
+    template <typename T>
+    inline Point3<T> Transform::operator()(const Point3<T> &p) const
+    {
+        T x = p.x, y = p.y, z = p.z;
+        T xp = (m.m[0][0] * x) + (m.m[0][1] * y) + (m.m[0][2] * z) + m.m[0][3];
+        T yp = (m.m[1][0] * x) + (m.m[1][1] * y) + (m.m[1][2] * z) + m.m[1][3];
+        T zp = (m.m[2][0] * x) + (m.m[2][1] * y) + (m.m[2][2] * z) + m.m[2][3];
+        T wp = (m.m[3][0] * x) + (m.m[3][1] * y) + (m.m[3][2] * z) + m.m[3][3];
+        CHECK_NE(wp, 0);
+        if (1 == wp)
+        {
+            return Point3<T>(xp, yp, zp);
+        }
+        else
+        {
+            return Point3<T>(xp / wp, yp / wp, zp / wp);
+        }
+    }
+
+    template <typename T>
+    inline Vector3<T> Transform::operator()(const Vector3<T> &v) const
+    {
+        T x = v.x, y = v.y, z = v.z;
+        return Vector3<T>((m.m[0][0] * x) + (m.m[0][1] * y) + (m.m[0][2] * z)
+                        , (m.m[1][0] * x) + (m.m[1][1] * y) + (m.m[1][2] * z)
+                        , (m.m[2][0] * x) + (m.m[2][1] * y) + (m.m[2][2] * z));
+    }
+
+    template <typename T>
+    inline Normal3<T> Transform::operator()(const Normal3<T> &n) const
+    {
+        T x = n.x, y = n.y, z = n.z;
+        return Normal3<T>((mInv.m[0][0] * x) + (mInv.m[1][0] * y) + (mInv.m[2][0] * z)
+                        , (mInv.m[0][1] * x) + (mInv.m[1][1] * y) + (mInv.m[2][1] * z)
+                        , (mInv.m[0][2] * x) + (mInv.m[1][2] * y) + (mInv.m[2][2] * z));
+    }
+
+    inline Ray Transform::operator()(const Ray &r) const
+    {
+        return Ray((*this)(r.origin), (*this)(r.dir), r.tMax, r.time, r.medium);
+    }
+}
@@ -0,0 +1,351 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include <cstdint>
+#include <iterator>
+
+namespace PBRT
+{
+    // 遍历二维、三维整数范围的顺序
+    enum class TraversalOrder
+    {
+        RowMajor,   // 先x后y（再z），与Bounds2iIterator相同
+        Morton,     // Z形曲线，解码最快
+        Hilbert,    // 相邻的两个格子总是相邻，局部性最好
+    };
+
+    // 去掉间隔的位：第2k位移到第k位
+    inline uint32_t CompactBy1(uint32_t x)
+    {
+        x &= 0x55555555;
+        x = (x ^ (x >> 1)) & 0x33333333;
+        x = (x ^ (x >> 2)) & 0x0F0F0F0F;
+        x = (x ^ (x >> 4)) & 0x00FF00FF;
+        x = (x ^ (x >> 8)) & 0x0000FFFF;
+        return x;
+    }
+
+    // 第3k位移到第k位
+    inline uint32_t CompactBy2(uint32_t x)
+    {
+        x &= 0x09249249;
+        x = (x ^ (x >> 2)) & 0x030C30C3;
+        x = (x ^ (x >> 4)) & 0x0300F00F;
+        x = (x ^ (x >> 8)) & 0xFF0000FF;
+        x = (x ^ (x >> 16)) & 0x000003FF;
+        return x;
+    }
+
+    inline void DecodeMorton2(uint32_t code, int c[2])
+    {
+        c[0] = (int)CompactBy1(code);
+        c[1] = (int)CompactBy1(code >> 1);
+    }
+
+    inline void DecodeMorton3(uint32_t code, int c[3])
+    {
+        c[0] = (int)CompactBy2(code);
+        c[1] = (int)CompactBy2(code >> 1);
+        c[2] = (int)CompactBy2(code >> 2);
+    }
+
+    // 边长为2^bits的正方形中第d个格子的坐标
+    inline void DecodeHilbert2(uint32_t d, int bits, int c[2])
+    {
+        int x = 0, y = 0;
+        for (int s = 1; s < (1 << bits); s <<= 1)
+        {
+            int rx = 1 & (int)(d >> 1);
+            int ry = 1 & (int)(d ^ (uint32_t)rx);
+            // 按象限旋转或翻转
+            if (0 == ry)
+            {
+                if (1 == rx)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            d >>= 2;
+        }
+        c[0] = x;
+        c[1] = y;
+    }
+
+    // 边长为2^bits的立方体中第d个格子的坐标（Skilling的转置算法）
+    inline void DecodeHilbert3(uint32_t d, int bits, int c[3])
+    {
+        // d的各位从高到低轮流分给z、y、x（转置形式），X[0]对应最高位
+        uint32_t X[3] = { 0, 0, 0 };
+        for (int b = 0; b < bits; ++b)
+        {
+            X[2] |= ((d >> (3 * b)) & 1) << b;
+            X[1] |= ((d >> (3 * b + 1)) & 1) << b;
+            X[0] |= ((d >> (3 * b + 2)) & 1) << b;
+        }
+
+        if (bits > 0)
+        {
+            // Gray解码
+            uint32_t t = X[2] >> 1;
+            X[2] ^= X[1];
+            X[1] ^= X[0];
+            X[0] ^= t;
+
+            // 撤销编码时多做的变换
+            for (uint32_t q = 2; q != (2u << (bits - 1)); q <<= 1)
+            {
+                uint32_t p = q - 1;
+                for (int i = 2; i >= 0; --i)
+                {
+                    if (X[i] & q)
+                    {
+                        X[0] ^= p;
+                    }
+                    else
+                    {
+                        t = (X[0] ^ X[i]) & p;
+                        X[0] ^= t;
+                        X[i] ^= t;
+                    }
+                }
+            }
+        }
+
+        c[0] = (int)X[0];
+        c[1] = (int)X[1];
+        c[2] = (int)X[2];
+    }
+
+    // 按指定顺序遍历[minPoint, maxPoint)中的每个格子
+    // Morton和Hilbert顺序下把范围划分为边长为2的幂的正方形（立方体）块，块按行排列，块内沿曲线遍历并跳过范围外的格子；
+    // 块的边长是不小于最短边的2的幂，跳过的格子不超过实际格子数的常数倍
+    template <typename PointT, int Dim>
+    class TraversalIterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef PointT value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const PointT *pointer;
+        typedef const PointT &reference;
+
+        // end为true时构造结束位置
+        TraversalIterator(const PointT &minPoint, const PointT &maxPoint, TraversalOrder order, bool end)
+            : order(order)
+        {
+            int minExtent = 0;
+            bool empty = false;
+            for (int i = 0; i < Dim; ++i)
+            {
+                lo[i] = minPoint[i];
+                hi[i] = maxPoint[i];
+                block[i] = 0;
+                int extent = hi[i] - lo[i];
+                empty = empty || (extent <= 0);
+                minExtent = (0 == i) ? extent : std::min(minExtent, extent);
+            }
+
+            done = end || empty;
+            index = 0;
+            if (done)
+            {
+                return;
+            }
+
+            if (TraversalOrder::RowMajor == order)
+            {
+                // 整个范围作为一个块
+                blockCells = 1;
+                for (int i = 0; i < Dim; ++i)
+                {
+                    nBlocks[i] = 1;
+                    blockCells *= (uint64_t)(hi[i] - lo[i]);
+                }
+            }
+            else
+            {
+                // 曲线编码为32位：二维每轴最多16位，三维每轴最多10位
+                const int MaxBits = (2 == Dim) ? 16 : 10;
+                bits = 0;
+                while (((1 << bits) < minExtent) && (bits < MaxBits))
+                {
+                    ++bits;
+                }
+                blockCells = (uint64_t)1 << (Dim * bits);
+                for (int i = 0; i < Dim; ++i)
+                {
+                    nBlocks[i] = ((hi[i] - lo[i]) + (1 << bits) - 1) >> bits;
+                }
+            }
+
+            Decode();
+            SkipOutside();
+        }
+
+        TraversalIterator &operator++()
+        {
+            Step();
+            SkipOutside();
+            return *this;
+        }
+
+        TraversalIterator operator++(int)
+        {
+            TraversalIterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const TraversalIterator &it) const
+        {
+            if (done || it.done)
+            {
+                return (done == it.done);
+            }
+            for (int i = 0; i < Dim; ++i)
+            {
+                if (block[i] != it.block[i])
+                {
+                    return false;
+                }
+            }
+            return (index == it.index);
+        }
+
+        bool operator!=(const TraversalIterator &it) const
+        {
+            return !(*this == it);
+        }
+
+        const PointT &operator*() const
+        {
+            return p;
+        }
+
+    private:
+        void Step(void)
+        {
+            if (++index == blockCells)
+            {
+                // 块按行排列
+                index = 0;
+                int i = 0;
+                while ((i < Dim) && (++block[i] == nBlocks[i]))
+                {
+                    block[i] = 0;
+                    ++i;
+                }
+                if (Dim == i)
+                {
+                    done = true;
+                    return;
+                }
+            }
+            Decode();
+        }
+
+        void SkipOutside(void)
+        {
+            while (!done && !IsInside())
+            {
+                Step();
+            }
+        }
+
+        bool IsInside(void) const
+        {
+            for (int i = 0; i < Dim; ++i)
+            {
+                if (p[i] >= hi[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void Decode(void)
+        {
+            int c[Dim];
+            if (TraversalOrder::RowMajor == order)
+            {
+                uint64_t rest = index;
+                for (int i = 0; i < Dim; ++i)
+                {
+                    uint64_t extent = (uint64_t)(hi[i] - lo[i]);
+                    c[i] = (int)(rest % extent);
+                    rest /= extent;
+                }
+            }
+            else if (TraversalOrder::Morton == order)
+            {
+                DecodeMorton(c);
+            }
+            else
+            {
+                DecodeHilbert(c);
+            }
+
+            for (int i = 0; i < Dim; ++i)
+            {
+                p[i] = lo[i] + (block[i] << bits) + c[i];
+            }
+        }
+
+        void DecodeMorton(int *c) const
+        {
+            (2 == Dim) ? DecodeMorton2((uint32_t)index, c) : DecodeMorton3((uint32_t)index, c);
+        }
+
+        void DecodeHilbert(int *c) const
+        {
+            (2 == Dim) ? DecodeHilbert2((uint32_t)index, bits, c) : DecodeHilbert3((uint32_t)index, bits, c);
+        }
+
+        TraversalOrder order;
+        int lo[Dim], hi[Dim];
+        int bits = 0;
+        int nBlocks[Dim], block[Dim];
+        uint64_t blockCells = 0, index;
+        bool done;
+        PointT p;
+    };
+
+    template <typename PointT, int Dim>
+    class TraversalRange
+    {
+    public:
+        TraversalRange(const PointT &minPoint, const PointT &maxPoint, TraversalOrder order)
+            : minPoint(minPoint), maxPoint(maxPoint), order(order)
+        {}
+
+        TraversalIterator<PointT, Dim> begin(void) const
+        {
+            return TraversalIterator<PointT, Dim>(minPoint, maxPoint, order, false);
+        }
+
+        TraversalIterator<PointT, Dim> end(void) const
+        {
+            return TraversalIterator<PointT, Dim>(minPoint, maxPoint, order, true);
+        }
+
+    private:
+        PointT minPoint, maxPoint;
+        TraversalOrder order;
+    };
+
+    // for (Point2i p : Traverse(bounds, TraversalOrder::Hilbert))
+    inline TraversalRange<Point2i, 2> Traverse(const Bounds2i &b, TraversalOrder order)
+    {
+        return TraversalRange<Point2i, 2>(b.minPoint, b.maxPoint, order);
+    }
+
+    inline TraversalRange<Point3i, 3> Traverse(const Bounds3i &b, TraversalOrder order)
+    {
+        return TraversalRange<Point3i, 3>(b.minPoint, b.maxPoint, order);
+    }
+}
@@ -0,0 +1,167 @@
+﻿#include "Grid.h"
+#include "Src/Core/Parallel.h"
+#include "Src/Core/ParamSet.h"
+#include "Src/Core/Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace PBRT
+{
+    GridDensityMedium::GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g
+                                       , const Point3i &resolution, const Float *d
+                                       , const Bounds3f &bounds, const Transform &mediumToWorld
+                                       , int majorantCellSize)
+        : sigma_a(sigma_a), sigma_s(sigma_s), g(g)
+        , resolution(resolution)
+        , density(new Float[(size_t)resolution.x * resolution.y * resolution.z])
+        , bounds(bounds), worldToMedium(Inverse(mediumToWorld))
+    {
+        CHECK((resolution.x > 0) && (resolution.y > 0) && (resolution.z > 0));
+        CHECK_GT(majorantCellSize, 0);
+        memcpy(density.get(), d, sizeof(Float) * resolution.x * resolution.y * resolution.z);
+
+        Spectrum sigma_tSpectrum = sigma_a + sigma_s;
+        sigma_t = sigma_tSpectrum.Average();
+        if ((sigma_tSpectrum[0] != sigma_tSpectrum[1]) || (sigma_tSpectrum[0] != sigma_tSpectrum[2]))
+        {
+            LOG(WARNING) << "GridDensityMedium requires a grey sigma_a + sigma_s, using the average " << sigma_t;
+        }
+
+        // 每个单元格的上界取能影响其中任意一点三线性插值的所有体素的最大值
+        Point3i majorantRes((resolution.x + majorantCellSize - 1) / majorantCellSize
+                          , (resolution.y + majorantCellSize - 1) / majorantCellSize
+                          , (resolution.z + majorantCellSize - 1) / majorantCellSize);
+        majorantGrid = MajorantGrid(bounds, majorantRes);
+        ParallelFor(majorantRes.z, 1, [&](int64_t z)
+        {
+            for (int y = 0; y < majorantRes.y; ++y)
+            {
+                for (int x = 0; x < majorantRes.x; ++x)
+                {
+                    // 单元格对应的插值坐标范围是[p0 * res - 0.5, p1 * res - 0.5]
+                    Bounds3f cellBounds = majorantGrid.VoxelBounds(Point3i(x, y, (int)z));
+                    Point3i vMin, vMax;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        int res = resolution[axis];
+                        vMin[axis] = std::max((int)std::floor((cellBounds.minPoint[axis] * res) - 0.5f), 0);
+                        vMax[axis] = std::min((int)std::floor((cellBounds.maxPoint[axis] * res) - 0.5f) + 1, res - 1);
+                    }
+
+                    Float maxDensity = 0;
+                    for (int vz = vMin.z; vz <= vMax.z; ++vz)
+                    {
+                        for (int vy = vMin.y; vy <= vMax.y; ++vy)
+                        {
+                            for (int vx = vMin.x; vx <= vMax.x; ++vx)
+                            {
+                                maxDensity = std::max(maxDensity, D(Point3i(vx, vy, vz)));
+                            }
+                        }
+                    }
+                    majorantGrid.Set(Point3i(x, y, (int)z), maxDensity);
+                }
+            }
+        });
+    }
+
+    Float GridDensityMedium::Density(const Point3f &p) const
+    {
+        // 体素中心位于(i + 0.5) / res
+        Point3f pSamples((p.x * resolution.x) - 0.5f, (p.y * resolution.y) - 0.5f, (p.z * resolution.z) - 0.5f);
+        Point3i pi(Floor(pSamples));
+        Vector3f d = pSamples - Point3f(pi);
+
+        Float d00 = Lerp(d.x, D(pi), D(pi + Vector3i(1, 0, 0)));
+        Float d10 = Lerp(d.x, D(pi + Vector3i(0, 1, 0)), D(pi + Vector3i(1, 1, 0)));
+        Float d01 = Lerp(d.x, D(pi + Vector3i(0, 0, 1)), D(pi + Vector3i(1, 0, 1)));
+        Float d11 = Lerp(d.x, D(pi + Vector3i(0, 1, 1)), D(pi + Vector3i(1, 1, 1)));
+        Float d0 = Lerp(d.y, d00, d10);
+        Float d1 = Lerp(d.y, d01, d11);
+        return Lerp(d.z, d0, d1);
+    }
+
+    bool GridDensityMedium::MediumRay(const Ray &ray, Ray *mediumRay, Float *tMin, Float *tMax) const
+    {
+        // 方向单位化后t就是世界空间中的距离，σt可以直接乘以t
+        Float dirLength = ray.dir.Length();
+        *mediumRay = worldToMedium(Ray(ray.origin, ray.dir / dirLength, ray.tMax * dirLength));
+        return bounds.IntersectP(*mediumRay, tMin, tMax);
+    }
+
+    Spectrum GridDensityMedium::Tr(const Ray &ray, Sampler &sampler) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        Ray mediumRay;
+        Float tMin, tMax;
+        if (!MediumRay(ray, &mediumRay, &tMin, &tMax))
+        {
+            return Spectrum(1);
+        }
+
+        DDAMajorantIterator iter(mediumRay, tMin, tMax, &majorantGrid, sigma_t);
+        return Spectrum(RatioTrack(iter, sampler, [&](Float t)
+        {
+            return sigma_t * Density(Point3f(bounds.Offset(mediumRay(t))));
+        }));
+    }
+
+    Spectrum GridDensityMedium::Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        Ray mediumRay;
+        Float tMin, tMax;
+        if (!MediumRay(ray, &mediumRay, &tMin, &tMax))
+        {
+            return Spectrum(1);
+        }
+
+        DDAMajorantIterator iter(mediumRay, tMin, tMax, &majorantGrid, sigma_t);
+        Float t = DeltaTrack(iter, sampler, [&](Float t)
+        {
+            return sigma_t * Density(Point3f(bounds.Offset(mediumRay(t))));
+        });
+        if (Infinity == t)
+        {
+            return Spectrum(1);
+        }
+
+        Float dirLength = ray.dir.Length();
+        mi->p = ray(t / dirLength);
+        mi->wo = ray.dir * (-1 / dirLength);
+        mi->time = ray.time;
+        mi->medium = this;
+        mi->phase = HenyeyGreenstein(g);
+        return sigma_s / sigma_t;
+    }
+
+    std::shared_ptr<Medium> CreateGridDensityMedium(const ParamSet &params, const Transform &mediumToWorld)
+    {
+        Spectrum sigma_a = params.FindOneRGB("sigma_a", Spectrum(0.0011f, 0.0024f, 0.014f));
+        Spectrum sigma_s = params.FindOneRGB("sigma_s", Spectrum(2.55f, 3.21f, 3.77f));
+        Float scale = params.FindOneFloat("scale", 1);
+        Float g = params.FindOneFloat("g", 0);
+        if ((g <= -1) || (g >= 1))
+        {
+            LOG(ERROR) << "heterogeneous medium: \"g\" must be in (-1, 1), got " << g << ", clamping";
+            g = Clamp(g, (Float)-0.99, (Float)0.99);
+        }
+
+        int nDensity;
+        const Float *density = params.FindFloat("density", &nDensity);
+        Point3i resolution(params.FindOneInt("nx", 1), params.FindOneInt("ny", 1), params.FindOneInt("nz", 1));
+        if ((nullptr == density) || (resolution.x <= 0) || (resolution.y <= 0) || (resolution.z <= 0)
+         || ((int64_t)nDensity != (int64_t)resolution.x * resolution.y * resolution.z))
+        {
+            LOG(ERROR) << "heterogeneous medium: \"density\" has " << nDensity << " values, expected nx * ny * nz = "
+                       << (int64_t)resolution.x * resolution.y * resolution.z << ", discarding";
+            return nullptr;
+        }
+
+        Bounds3f bounds(params.FindOnePoint3f("p0", Point3f(0, 0, 0)), params.FindOnePoint3f("p1", Point3f(1, 1, 1)));
+        int majorantCellSize = std::max(1, params.FindOneInt("majorantcellsize", 16));
+        return std::make_shared<GridDensityMedium>(sigma_a * scale, sigma_s * scale, g, resolution, density, bounds
+                                                 , mediumToWorld, majorantCellSize);
+    }
+}
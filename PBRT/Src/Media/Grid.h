@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include "MajorantGrid.h"
+#include "Src/Core/Medium.h"
+#include "Src/Core/Transform.h"
+#include <memory>
+
+namespace PBRT
+{
+    // 密度由规则体素网格给出的非均匀介质，σa、σs乘以三线性插值的密度得到该点的系数
+    // 用粗粒度的MajorantGrid按单元格给出消光系数上界，3D-DDA沿光线逐格取上界：
+    // Sample()用delta tracking，Tr()用ratio tracking（见MajorantGrid.h），空的单元格整段跳过
+    // @remarks: 消光系数按灰度处理，σt的三个通道不同时取平均值
+    class GridDensityMedium : public Medium
+    {
+    public:
+        // density有nx * ny * nz个值，x变化最快；体素均匀分布在介质空间的bounds中
+        // majorantCellSize为一个上界单元格覆盖的体素数（每个轴）
+        GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g
+                        , const Point3i &resolution, const Float *density
+                        , const Bounds3f &bounds, const Transform &mediumToWorld
+                        , int majorantCellSize = 16);
+
+        Spectrum Tr(const Ray &ray, Sampler &sampler) const override;
+        Spectrum Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const override;
+
+        // p为bounds中的相对位置[0, 1]^3
+        Float Density(const Point3f &p) const;
+
+        const MajorantGrid &GetMajorantGrid(void) const
+        {
+            return majorantGrid;
+        }
+
+    private:
+        // 体素的密度，网格之外为0
+        Float D(const Point3i &p) const
+        {
+            if ((p.x < 0) || (p.x >= resolution.x) || (p.y < 0) || (p.y >= resolution.y) || (p.z < 0) || (p.z >= resolution.z))
+            {
+                return 0;
+            }
+            return density[((size_t)p.z * resolution.y + p.y) * resolution.x + p.x];
+        }
+
+        // 把世界空间的光线变换到介质空间并单位化方向，返回它与bounds相交的[tMin, tMax]
+        bool MediumRay(const Ray &ray, Ray *mediumRay, Float *tMin, Float *tMax) const;
+
+        const Spectrum sigma_a, sigma_s;
+        const Float g;
+        Float sigma_t;
+        const Point3i resolution;
+        std::unique_ptr<Float[]> density;
+        const Bounds3f bounds;
+        const Transform worldToMedium;
+        MajorantGrid majorantGrid;
+    };
+
+    // 按pbrt-v3的"heterogeneous"介质参数创建："float density"、"integer nx/ny/nz"、"point p0/p1"，
+    // 以及与homogeneous相同的sigma_a、sigma_s、scale、g；另外可以用"integer majorantcellsize"指定上界单元格大小
+    std::shared_ptr<Medium> CreateGridDensityMedium(const ParamSet &params, const Transform &mediumToWorld);
+}
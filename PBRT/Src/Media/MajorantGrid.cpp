@@ -0,0 +1,8 @@
+﻿#include "MajorantGrid.h"
+
+namespace PBRT
+{
+    STAT_COUNTER("Media/Majorant segments", nMajorantSegments);
+    STAT_INT_DISTRIBUTION("Media/Tracking steps per ray", trackingSteps);
+    STAT_PERCENT("Media/Null collisions", nNullCollisions, nTrackingCollisions);
+}
@@ -0,0 +1,235 @@
+﻿#pragma once
+
+#include "Src/Core/Geometry.h"
+#include "Src/Core/Sampler.h"
+#include "Src/Core/Stats.h"
+#include <cmath>
+#include <vector>
+
+namespace PBRT
+{
+    // 把介质包围盒均分成粗粒度的单元格，每个单元格保存其中密度的上界
+    // @remarks: 单元格内的上界越紧，delta/ratio tracking被拒绝的空碰撞越少；上界为0的单元格可以整段跳过
+    class MajorantGrid
+    {
+    public:
+        MajorantGrid(void)
+        {}
+
+        MajorantGrid(const Bounds3f &bounds, const Point3i &resolution)
+            : bounds(bounds), resolution(resolution)
+            , voxels((size_t)resolution.x * resolution.y * resolution.z, 0)
+        {}
+
+        Float Lookup(const Point3i &p) const
+        {
+            DCHECK(InsideExclusive(p, Bounds3i(Point3i(0, 0, 0), resolution)));
+            return voxels[Offset(p)];
+        }
+
+        void Set(const Point3i &p, Float v)
+        {
+            DCHECK(InsideExclusive(p, Bounds3i(Point3i(0, 0, 0), resolution)));
+            voxels[Offset(p)] = v;
+        }
+
+        // 单元格p在[0, 1]^3中覆盖的范围
+        Bounds3f VoxelBounds(const Point3i &p) const
+        {
+            Point3f p0((Float)p.x / resolution.x, (Float)p.y / resolution.y, (Float)p.z / resolution.z);
+            Point3f p1((Float)(p.x + 1) / resolution.x, (Float)(p.y + 1) / resolution.y, (Float)(p.z + 1) / resolution.z);
+            return Bounds3f(p0, p1);
+        }
+
+        Bounds3f bounds;
+        Point3i resolution;
+
+    private:
+        size_t Offset(const Point3i &p) const
+        {
+            return ((size_t)p.z * resolution.y + p.y) * resolution.x + p.x;
+        }
+
+        std::vector<Float> voxels;
+    };
+
+    // 光线上一段[tMin, tMax)及其中的消光系数上界
+    struct MajorantSegment
+    {
+        Float tMin, tMax;
+        Float sigma_maj;
+    };
+
+    // 用3D-DDA按顺序遍历光线穿过的单元格，每个单元格产生一段MajorantSegment
+    class DDAMajorantIterator
+    {
+    public:
+        // ray在介质空间中，[tMin, tMax]是它与grid.bounds的交集；sigma_t乘以单元格的密度上界得到消光系数上界
+        DDAMajorantIterator(const Ray &ray, Float tMin, Float tMax, const MajorantGrid *grid, Float sigma_t)
+            : sigma_t(sigma_t), tMin(tMin), tMax(tMax), grid(grid)
+        {
+            // 变换到单元格坐标[0, 1]^3中，t的含义保持不变
+            Vector3f diagonal = grid->bounds.Diagonal();
+            Point3f origin = Point3f(0, 0, 0) + grid->bounds.Offset(ray.origin);
+            Vector3f dir(ray.dir.x / diagonal.x, ray.dir.y / diagonal.y, ray.dir.z / diagonal.z);
+            Point3f gridIntersect = origin + (dir * tMin);
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                int res = grid->resolution[axis];
+                voxel[axis] = Clamp((int)(gridIntersect[axis] * res), 0, res - 1);
+                deltaT[axis] = 1 / (std::abs(dir[axis]) * res);
+                if (0 == dir[axis])
+                {
+                    // 不沿这个轴移动，-0也按正方向处理
+                    nextCrossingT[axis] = Infinity;
+                    step[axis] = 1;
+                    voxelLimit[axis] = res;
+                }
+                else if (dir[axis] > 0)
+                {
+                    Float nextVoxelPos = (Float)(voxel[axis] + 1) / res;
+                    nextCrossingT[axis] = tMin + ((nextVoxelPos - gridIntersect[axis]) / dir[axis]);
+                    step[axis] = 1;
+                    voxelLimit[axis] = res;
+                }
+                else
+                {
+                    Float nextVoxelPos = (Float)voxel[axis] / res;
+                    nextCrossingT[axis] = tMin + ((nextVoxelPos - gridIntersect[axis]) / dir[axis]);
+                    step[axis] = -1;
+                    voxelLimit[axis] = -1;
+                }
+            }
+        }
+
+        // 取下一段，光线离开网格或到达tMax时返回false
+        bool Next(MajorantSegment *segment)
+        {
+            if (tMin >= tMax)
+            {
+                return false;
+            }
+
+            // 比较三个轴的nextCrossingT，找出最先穿过的轴
+            int bits = ((nextCrossingT[0] < nextCrossingT[1]) << 2)
+                     + ((nextCrossingT[0] < nextCrossingT[2]) << 1)
+                     + ((nextCrossingT[1] < nextCrossingT[2]));
+            static const int cmpToAxis[8] = { 2, 1, 2, 1, 2, 2, 0, 0 };
+            int stepAxis = cmpToAxis[bits];
+
+            Float tVoxelExit = std::min(tMax, nextCrossingT[stepAxis]);
+            segment->tMin = tMin;
+            segment->tMax = tVoxelExit;
+            segment->sigma_maj = sigma_t * grid->Lookup(voxel);
+
+            tMin = tVoxelExit;
+            if (nextCrossingT[stepAxis] > tMax)
+            {
+                tMin = tMax;
+            }
+            voxel[stepAxis] += step[stepAxis];
+            if (voxel[stepAxis] == voxelLimit[stepAxis])
+            {
+                tMin = tMax;
+            }
+            nextCrossingT[stepAxis] += deltaT[stepAxis];
+            return true;
+        }
+
+    private:
+        Float sigma_t, tMin, tMax;
+        const MajorantGrid *grid;
+        Float nextCrossingT[3], deltaT[3];
+        int step[3], voxelLimit[3];
+        Point3i voxel;
+    };
+
+    // 在MajorantGrid.cpp中定义
+    STAT_EXTERN_COUNTER(nMajorantSegments);
+    STAT_EXTERN_INT_DISTRIBUTION(trackingSteps);
+    STAT_EXTERN_PERCENT(nNullCollisions, nTrackingCollisions);
+
+    // delta tracking：按上界采样碰撞点，以σt / σmaj的概率接受为真实碰撞，否则是空碰撞继续前进
+    // sigma_t(t)返回光线上t处的消光系数；返回第一次真实碰撞的t，没有碰撞时返回Infinity
+    // @remarks: 指数分布无记忆，每一段都从段的起点按该段的上界重新采样
+    template <typename SigmaT>
+    Float DeltaTrack(DDAMajorantIterator iter, Sampler &sampler, SigmaT sigma_t)
+    {
+        int64_t nSteps = 0;
+        MajorantSegment segment;
+        while (iter.Next(&segment))
+        {
+            ++nMajorantSegments;
+            if (0 == segment.sigma_maj)
+            {
+                continue;
+            }
+
+            Float t = segment.tMin;
+            while (true)
+            {
+                t -= std::log(1 - sampler.Get1D()) / segment.sigma_maj;
+                if (t >= segment.tMax)
+                {
+                    break;
+                }
+
+                ++nSteps;
+                ++nTrackingCollisions;
+                if (sigma_t(t) > (sampler.Get1D() * segment.sigma_maj))
+                {
+                    STAT_REPORT_VALUE(trackingSteps, nSteps);
+                    return t;
+                }
+                ++nNullCollisions;
+            }
+        }
+        STAT_REPORT_VALUE(trackingSteps, nSteps);
+        return Infinity;
+    }
+
+    // ratio tracking：每次碰撞把透射率乘以1 - σt / σmaj，返回透射率的无偏估计
+    // @remarks: 透射率已经很小时用俄罗斯轮盘赌提前结束
+    template <typename SigmaT>
+    Float RatioTrack(DDAMajorantIterator iter, Sampler &sampler, SigmaT sigma_t)
+    {
+        Float tr = 1;
+        int64_t nSteps = 0;
+        MajorantSegment segment;
+        while (iter.Next(&segment))
+        {
+            ++nMajorantSegments;
+            if (0 == segment.sigma_maj)
+            {
+                continue;
+            }
+
+            Float t = segment.tMin;
+            while (true)
+            {
+                t -= std::log(1 - sampler.Get1D()) / segment.sigma_maj;
+                if (t >= segment.tMax)
+                {
+                    break;
+                }
+
+                ++nSteps;
+                tr *= 1 - std::max((Float)0, sigma_t(t) / segment.sigma_maj);
+
+                if (tr < 0.05f)
+                {
+                    const Float q = 0.75f;
+                    if (sampler.Get1D() < q)
+                    {
+                        STAT_REPORT_VALUE(trackingSteps, nSteps);
+                        return 0;
+                    }
+                    tr /= 1 - q;
+                }
+            }
+        }
+        STAT_REPORT_VALUE(trackingSteps, nSteps);
+        return tr;
+    }
+}
@@ -0,0 +1,281 @@
+﻿#include "SparseVolume.h"
+#include "Src/Core/ParamSet.h"
+#include "Src/Core/Profiler.h"
+#include <algorithm>
+#include <limits>
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // SparseVolume
+    // ----------------------------------------------------------------------------
+    SparseVolume::SparseVolume(const Point3i &resolution)
+        : resolution(resolution)
+        , brickResolution((resolution.x + BrickSize - 1) >> BrickLog2
+                        , (resolution.y + BrickSize - 1) >> BrickLog2
+                        , (resolution.z + BrickSize - 1) >> BrickLog2)
+        , brickIndices((size_t)brickResolution.x * brickResolution.y * brickResolution.z, -1)
+    {
+        CHECK((resolution.x > 0) && (resolution.y > 0) && (resolution.z > 0));
+    }
+
+    void SparseVolume::Set(const Point3i &p, Float v)
+    {
+        DCHECK(InsideExclusive(p, Bounds3i(Point3i(0, 0, 0), resolution)));
+
+        int32_t &brick = brickIndices[BrickOffset(p.x >> BrickLog2, p.y >> BrickLog2, p.z >> BrickLog2)];
+        if (brick < 0)
+        {
+            if (0 == v)
+            {
+                return;
+            }
+
+            CHECK_LT(bricks.size(), (size_t)std::numeric_limits<int32_t>::max());
+            brick = (int32_t)bricks.size();
+            bricks.push_back(Brick());
+        }
+
+        Brick &b = bricks[brick];
+        b.values[VoxelOffset(p.x & (BrickSize - 1), p.y & (BrickSize - 1), p.z & (BrickSize - 1))] = v;
+        b.minValue = std::min(b.minValue, v);
+        b.maxValue = std::max(b.maxValue, v);
+    }
+
+    Float SparseVolume::Lookup(const Point3f &p) const
+    {
+        Point3f pSamples((p.x * resolution.x) - 0.5f, (p.y * resolution.y) - 0.5f, (p.z * resolution.z) - 0.5f);
+        Point3i pi(Floor(pSamples));
+        Vector3f d = pSamples - Point3f(pi);
+
+        // v[i]对应偏移(i & 1, (i >> 1) & 1, i >> 2)
+        Float v[8];
+        const int lastInBrick = BrickSize - 1;
+        if ((pi.x >= 0) && (pi.y >= 0) && (pi.z >= 0)
+         && ((pi.x & lastInBrick) != lastInBrick) && ((pi.y & lastInBrick) != lastInBrick) && ((pi.z & lastInBrick) != lastInBrick)
+         && (pi.x + 1 < resolution.x) && (pi.y + 1 < resolution.y) && (pi.z + 1 < resolution.z))
+        {
+            // 8个体素都在同一个砖块中
+            int32_t brick = brickIndices[BrickOffset(pi.x >> BrickLog2, pi.y >> BrickLog2, pi.z >> BrickLog2)];
+            if (brick < 0)
+            {
+                return 0;
+            }
+
+            const Float *v0 = &bricks[brick].values[VoxelOffset(pi.x & lastInBrick, pi.y & lastInBrick, pi.z & lastInBrick)];
+            for (int i = 0; i < 8; ++i)
+            {
+                v[i] = v0[VoxelOffset(i & 1, (i >> 1) & 1, i >> 2)];
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                v[i] = Get(Point3i(pi.x + (i & 1), pi.y + ((i >> 1) & 1), pi.z + (i >> 2)));
+            }
+        }
+
+        Float d00 = Lerp(d.x, v[0], v[1]);
+        Float d10 = Lerp(d.x, v[2], v[3]);
+        Float d01 = Lerp(d.x, v[4], v[5]);
+        Float d11 = Lerp(d.x, v[6], v[7]);
+        Float d0 = Lerp(d.y, d00, d10);
+        Float d1 = Lerp(d.y, d01, d11);
+        return Lerp(d.z, d0, d1);
+    }
+
+    void SparseVolume::Prune(void)
+    {
+        // 保留的砖块按原来的顺序前移，新位置不会超过旧位置，可以原地压缩
+        std::vector<int32_t> remap(bricks.size(), -1);
+        int32_t nKept = 0;
+        for (size_t i = 0; i < bricks.size(); ++i)
+        {
+            Brick &b = bricks[i];
+            b.minValue = *std::min_element(b.values, b.values + BrickVoxels);
+            b.maxValue = *std::max_element(b.values, b.values + BrickVoxels);
+            if ((0 == b.minValue) && (0 == b.maxValue))
+            {
+                continue;
+            }
+
+            if ((size_t)nKept != i)
+            {
+                bricks[nKept] = b;
+            }
+            remap[i] = nKept++;
+        }
+        bricks.resize(nKept);
+        bricks.shrink_to_fit();
+
+        for (int32_t &brick : brickIndices)
+        {
+            if (brick >= 0)
+            {
+                brick = remap[brick];
+            }
+        }
+    }
+
+    // ----------------------------------------------------------------------------
+    // SparseGridMedium
+    // ----------------------------------------------------------------------------
+    SparseGridMedium::SparseGridMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g
+                                     , std::unique_ptr<SparseVolume> density
+                                     , const Bounds3f &bounds, const Transform &mediumToWorld
+                                     , int majorantCellBricks)
+        : sigma_a(sigma_a), sigma_s(sigma_s), g(g)
+        , density(std::move(density))
+        , bounds(bounds), worldToMedium(Inverse(mediumToWorld))
+    {
+        CHECK_GT(majorantCellBricks, 0);
+
+        Spectrum sigma_tSpectrum = sigma_a + sigma_s;
+        sigma_t = sigma_tSpectrum.Average();
+        if ((sigma_tSpectrum[0] != sigma_tSpectrum[1]) || (sigma_tSpectrum[0] != sigma_tSpectrum[2]))
+        {
+            LOG(WARNING) << "SparseGridMedium requires a grey sigma_a + sigma_s, using the average " << sigma_t;
+        }
+
+        // 上界网格覆盖整数个砖块，可能比体数据大一些：按比例扩大它的包围盒，使单元格与砖块对齐
+        const SparseVolume &volume = *this->density;
+        Point3i brickRes = volume.BrickResolution();
+        Point3i majorantRes((brickRes.x + majorantCellBricks - 1) / majorantCellBricks
+                          , (brickRes.y + majorantCellBricks - 1) / majorantCellBricks
+                          , (brickRes.z + majorantCellBricks - 1) / majorantCellBricks);
+        Vector3f diagonal = bounds.Diagonal();
+        Point3f gridMax;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int cellVoxels = majorantRes[axis] * majorantCellBricks * SparseVolume::BrickSize;
+            gridMax[axis] = bounds.minPoint[axis] + (diagonal[axis] * cellVoxels / volume.Resolution()[axis]);
+        }
+        majorantGrid = MajorantGrid(Bounds3f(bounds.minPoint, gridMax), majorantRes);
+
+        // 三线性插值会用到相邻砖块边上的体素，所以上界也包括周围一圈砖块
+        for (int z = 0; z < majorantRes.z; ++z)
+        {
+            for (int y = 0; y < majorantRes.y; ++y)
+            {
+                for (int x = 0; x < majorantRes.x; ++x)
+                {
+                    Point3i cell(x, y, z);
+                    Point3i bMin, bMax;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        bMin[axis] = std::max((cell[axis] * majorantCellBricks) - 1, 0);
+                        bMax[axis] = std::min((cell[axis] + 1) * majorantCellBricks, brickRes[axis] - 1);
+                    }
+
+                    Float maxDensity = 0;
+                    for (int bz = bMin.z; bz <= bMax.z; ++bz)
+                    {
+                        for (int by = bMin.y; by <= bMax.y; ++by)
+                        {
+                            for (int bx = bMin.x; bx <= bMax.x; ++bx)
+                            {
+                                maxDensity = std::max(maxDensity, volume.BrickMax(Point3i(bx, by, bz)));
+                            }
+                        }
+                    }
+                    majorantGrid.Set(cell, maxDensity);
+                }
+            }
+        }
+    }
+
+    bool SparseGridMedium::MediumRay(const Ray &ray, Ray *mediumRay, Float *tMin, Float *tMax) const
+    {
+        Float dirLength = ray.dir.Length();
+        *mediumRay = worldToMedium(Ray(ray.origin, ray.dir / dirLength, ray.tMax * dirLength));
+        return bounds.IntersectP(*mediumRay, tMin, tMax);
+    }
+
+    Spectrum SparseGridMedium::Tr(const Ray &ray, Sampler &sampler) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        Ray mediumRay;
+        Float tMin, tMax;
+        if (!MediumRay(ray, &mediumRay, &tMin, &tMax))
+        {
+            return Spectrum(1);
+        }
+
+        DDAMajorantIterator iter(mediumRay, tMin, tMax, &majorantGrid, sigma_t);
+        return Spectrum(RatioTrack(iter, sampler, [&](Float t)
+        {
+            return sigma_t * density->Lookup(Point3f(bounds.Offset(mediumRay(t))));
+        }));
+    }
+
+    Spectrum SparseGridMedium::Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const
+    {
+        ProfilePhase _(Prof::MediumSampling);
+        Ray mediumRay;
+        Float tMin, tMax;
+        if (!MediumRay(ray, &mediumRay, &tMin, &tMax))
+        {
+            return Spectrum(1);
+        }
+
+        DDAMajorantIterator iter(mediumRay, tMin, tMax, &majorantGrid, sigma_t);
+        Float t = DeltaTrack(iter, sampler, [&](Float t)
+        {
+            return sigma_t * density->Lookup(Point3f(bounds.Offset(mediumRay(t))));
+        });
+        if (Infinity == t)
+        {
+            return Spectrum(1);
+        }
+
+        Float dirLength = ray.dir.Length();
+        mi->p = ray(t / dirLength);
+        mi->wo = ray.dir * (-1 / dirLength);
+        mi->time = ray.time;
+        mi->medium = this;
+        mi->phase = HenyeyGreenstein(g);
+        return sigma_s / sigma_t;
+    }
+
+    std::shared_ptr<Medium> CreateSparseGridMedium(const ParamSet &params, const Transform &mediumToWorld)
+    {
+        Spectrum sigma_a = params.FindOneRGB("sigma_a", Spectrum(0.0011f, 0.0024f, 0.014f));
+        Spectrum sigma_s = params.FindOneRGB("sigma_s", Spectrum(2.55f, 3.21f, 3.77f));
+        Float scale = params.FindOneFloat("scale", 1);
+        Float g = params.FindOneFloat("g", 0);
+        if ((g <= -1) || (g >= 1))
+        {
+            LOG(ERROR) << "sparse grid medium: \"g\" must be in (-1, 1), got " << g << ", clamping";
+            g = Clamp(g, (Float)-0.99, (Float)0.99);
+        }
+
+        int nDensity;
+        const Float *density = params.FindFloat("density", &nDensity);
+        Point3i resolution(params.FindOneInt("nx", 1), params.FindOneInt("ny", 1), params.FindOneInt("nz", 1));
+        if ((nullptr == density) || (resolution.x <= 0) || (resolution.y <= 0) || (resolution.z <= 0)
+         || ((int64_t)nDensity != (int64_t)resolution.x * resolution.y * resolution.z))
+        {
+            LOG(ERROR) << "sparse grid medium: \"density\" has " << nDensity << " values, expected nx * ny * nz = "
+                       << (int64_t)resolution.x * resolution.y * resolution.z << ", discarding";
+            return nullptr;
+        }
+
+        std::unique_ptr<SparseVolume> volume(new SparseVolume(resolution));
+        for (int z = 0; z < resolution.z; ++z)
+        {
+            for (int y = 0; y < resolution.y; ++y)
+            {
+                for (int x = 0; x < resolution.x; ++x)
+                {
+                    volume->Set(Point3i(x, y, z), density[((size_t)z * resolution.y + y) * resolution.x + x]);
+                }
+            }
+        }
+
+        Bounds3f bounds(params.FindOnePoint3f("p0", Point3f(0, 0, 0)), params.FindOnePoint3f("p1", Point3f(1, 1, 1)));
+        int majorantCellBricks = std::max(1, params.FindOneInt("majorantcellbricks", 2));
+        return std::make_shared<SparseGridMedium>(sigma_a * scale, sigma_s * scale, g, std::move(volume), bounds
+                                                , mediumToWorld, majorantCellBricks);
+    }
+}
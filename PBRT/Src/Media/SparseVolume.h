@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include "MajorantGrid.h"
+#include "Src/Core/Medium.h"
+#include "Src/Core/Transform.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace PBRT
+{
+    // 两级稀疏体数据：顶层是每个砖块一个索引的稠密网格，只有含非零值的8^3砖块才分配存储
+    // 每个砖块记录其中的最小值和最大值，最大值为0的区域可以整块跳过
+    // @remarks: 顶层每个砖块只占4字节，分辨率为2048^3时顶层为64MB；
+    //           构建时不是线程安全的，构建完成后可以从多个线程同时读取
+    class SparseVolume
+    {
+    public:
+        static const int BrickLog2 = 3;
+        static const int BrickSize = 1 << BrickLog2;
+        static const int BrickVoxels = BrickSize * BrickSize * BrickSize;
+
+        // 所有体素初始为0
+        explicit SparseVolume(const Point3i &resolution);
+
+        const Point3i &Resolution(void) const
+        {
+            return resolution;
+        }
+
+        // 每个轴上的砖块数
+        const Point3i &BrickResolution(void) const
+        {
+            return brickResolution;
+        }
+
+        // 网格之外和未分配的砖块中为0
+        Float Get(const Point3i &p) const
+        {
+            if ((p.x < 0) || (p.x >= resolution.x) || (p.y < 0) || (p.y >= resolution.y) || (p.z < 0) || (p.z >= resolution.z))
+            {
+                return 0;
+            }
+
+            int32_t brick = brickIndices[BrickOffset(p.x >> BrickLog2, p.y >> BrickLog2, p.z >> BrickLog2)];
+            return (brick < 0) ? 0 : bricks[brick].values[VoxelOffset(p.x & (BrickSize - 1), p.y & (BrickSize - 1), p.z & (BrickSize - 1))];
+        }
+
+        // 写入0不会分配砖块
+        // @remarks: 砖块的最小、最大值在写入时只扩大不缩小，覆盖写入后可以调用Prune()重新计算
+        void Set(const Point3i &p, Float v);
+
+        // p为[0, 1]^3中的位置，体素中心位于(i + 0.5) / resolution；8个体素在同一个砖块中时只查一次顶层
+        Float Lookup(const Point3f &p) const;
+
+        // 砖块b中体素的取值范围，未分配的砖块为[0, 0]
+        Float BrickMin(const Point3i &b) const
+        {
+            int32_t brick = brickIndices[BrickOffset(b.x, b.y, b.z)];
+            return (brick < 0) ? 0 : bricks[brick].minValue;
+        }
+
+        Float BrickMax(const Point3i &b) const
+        {
+            int32_t brick = brickIndices[BrickOffset(b.x, b.y, b.z)];
+            return (brick < 0) ? 0 : bricks[brick].maxValue;
+        }
+
+        // 重新计算所有砖块的取值范围，并释放全为0的砖块
+        void Prune(void);
+
+        size_t BrickCount(void) const
+        {
+            return bricks.size();
+        }
+
+        size_t MemoryBytes(void) const
+        {
+            return (brickIndices.size() * sizeof(int32_t)) + (bricks.size() * sizeof(Brick));
+        }
+
+    private:
+        struct Brick
+        {
+            Float values[BrickVoxels];
+            Float minValue, maxValue;
+        };
+
+        size_t BrickOffset(int bx, int by, int bz) const
+        {
+            return ((size_t)bz * brickResolution.y + by) * brickResolution.x + bx;
+        }
+
+        static int VoxelOffset(int x, int y, int z)
+        {
+            return (((z << BrickLog2) + y) << BrickLog2) + x;
+        }
+
+        const Point3i resolution;
+        const Point3i brickResolution;
+
+        // -1表示砖块为空
+        std::vector<int32_t> brickIndices;
+        std::vector<Brick> bricks;
+    };
+
+    // 密度由SparseVolume给出的非均匀介质，追踪方式与GridDensityMedium相同
+    // 上界网格的单元格由majorantCellBricks^3个砖块组成，直接由砖块的最大值得到，不需要遍历体素
+    // @remarks: 消光系数按灰度处理，σt的三个通道不同时取平均值
+    class SparseGridMedium : public Medium
+    {
+    public:
+        // 体素均匀分布在介质空间的bounds中
+        SparseGridMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g
+                       , std::unique_ptr<SparseVolume> density
+                       , const Bounds3f &bounds, const Transform &mediumToWorld
+                       , int majorantCellBricks = 2);
+
+        Spectrum Tr(const Ray &ray, Sampler &sampler) const override;
+        Spectrum Sample(const Ray &ray, Sampler &sampler, MediumInteraction *mi) const override;
+
+        const SparseVolume &GetDensity(void) const
+        {
+            return *density;
+        }
+
+        const MajorantGrid &GetMajorantGrid(void) const
+        {
+            return majorantGrid;
+        }
+
+    private:
+        // 把世界空间的光线变换到介质空间并单位化方向，返回它与bounds相交的[tMin, tMax]
+        bool MediumRay(const Ray &ray, Ray *mediumRay, Float *tMin, Float *tMax) const;
+
+        const Spectrum sigma_a, sigma_s;
+        const Float g;
+        Float sigma_t;
+        std::unique_ptr<SparseVolume> density;
+        const Bounds3f bounds;
+        const Transform worldToMedium;
+        MajorantGrid majorantGrid;
+    };
+
+    // 参数与"heterogeneous"相同，稠密的"density"在创建时转换为稀疏存储；
+    // 另外可以用"integer majorantcellbricks"指定上界单元格包含的砖块数
+    std::shared_ptr<Medium> CreateSparseGridMedium(const ParamSet &params, const Transform &mediumToWorld);
+}
@@ -0,0 +1,763 @@
+﻿#include "PLYMesh.h"
+#include "Src/Core/Parallel.h"
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+
+namespace PBRT
+{
+    namespace
+    {
+        // 转换顶点和面时每次分给一个线程的数量
+        const int ChunkSize = 16384;
+
+        enum class PLYFormat
+        {
+            Ascii,
+            BinaryLittleEndian,
+            BinaryBigEndian,
+        };
+
+        enum class PLYType
+        {
+            Int8,
+            UInt8,
+            Int16,
+            UInt16,
+            Int32,
+            UInt32,
+            Float32,
+            Float64,
+        };
+
+        bool ParseType(const std::string &name, PLYType *type)
+        {
+            static const struct
+            {
+                const char *name;
+                PLYType type;
+            } types[] =
+            {
+                { "char", PLYType::Int8 }, { "int8", PLYType::Int8 },
+                { "uchar", PLYType::UInt8 }, { "uint8", PLYType::UInt8 },
+                { "short", PLYType::Int16 }, { "int16", PLYType::Int16 },
+                { "ushort", PLYType::UInt16 }, { "uint16", PLYType::UInt16 },
+                { "int", PLYType::Int32 }, { "int32", PLYType::Int32 },
+                { "uint", PLYType::UInt32 }, { "uint32", PLYType::UInt32 },
+                { "float", PLYType::Float32 }, { "float32", PLYType::Float32 },
+                { "double", PLYType::Float64 }, { "float64", PLYType::Float64 },
+            };
+            for (const auto &entry : types)
+            {
+                if (name == entry.name)
+                {
+                    *type = entry.type;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int TypeSize(PLYType type)
+        {
+            switch (type)
+            {
+            case PLYType::Int8:
+            case PLYType::UInt8:
+                return 1;
+            case PLYType::Int16:
+            case PLYType::UInt16:
+                return 2;
+            case PLYType::Int32:
+            case PLYType::UInt32:
+            case PLYType::Float32:
+                return 4;
+            default:
+                return 8;
+            }
+        }
+
+        struct PLYProperty
+        {
+            std::string name;
+            PLYType type;
+            bool isList = false;
+            PLYType countType = PLYType::UInt8;
+            // 在一个元素的二进制记录中的字节偏移，只对不含list的元素有效
+            int offset = 0;
+        };
+
+        struct PLYElement
+        {
+            int Find(const char *name) const
+            {
+                for (size_t i = 0; i < properties.size(); ++i)
+                {
+                    if (properties[i].name == name)
+                    {
+                        return (int)i;
+                    }
+                }
+                return -1;
+            }
+
+            std::string name;
+            int64_t count = 0;
+            std::vector<PLYProperty> properties;
+            // 一条二进制记录的字节数，含list属性时记录不定长，为-1
+            int stride = 0;
+        };
+
+        struct PLYHeader
+        {
+            PLYFormat format = PLYFormat::Ascii;
+            std::vector<PLYElement> elements;
+            size_t dataOffset = 0;
+        };
+
+        bool ParseHeader(const std::string &filename, const char *data, size_t size, PLYHeader *header)
+        {
+            const char *cur = data;
+            const char *end = data + size;
+            bool first = true;
+            bool hasFormat = false;
+            while (true)
+            {
+                const char *lineEnd = (const char *)std::memchr(cur, '\n', end - cur);
+                if (nullptr == lineEnd)
+                {
+                    LOG(ERROR) << filename << ": missing end_header";
+                    return false;
+                }
+                std::istringstream line(std::string(cur, lineEnd));
+                cur = lineEnd + 1;
+
+                std::string keyword;
+                line >> keyword;
+                if (first)
+                {
+                    if ("ply" != keyword)
+                    {
+                        LOG(ERROR) << filename << ": not a PLY file";
+                        return false;
+                    }
+                    first = false;
+                }
+                else if ("format" == keyword)
+                {
+                    std::string format;
+                    line >> format;
+                    if ("ascii" == format)
+                    {
+                        header->format = PLYFormat::Ascii;
+                    }
+                    else if ("binary_little_endian" == format)
+                    {
+                        header->format = PLYFormat::BinaryLittleEndian;
+                    }
+                    else if ("binary_big_endian" == format)
+                    {
+                        header->format = PLYFormat::BinaryBigEndian;
+                    }
+                    else
+                    {
+                        LOG(ERROR) << filename << ": unknown format \"" << format << "\"";
+                        return false;
+                    }
+                    hasFormat = true;
+                }
+                else if ("element" == keyword)
+                {
+                    PLYElement element;
+                    line >> element.name >> element.count;
+                    if (line.fail() || (element.count < 0))
+                    {
+                        LOG(ERROR) << filename << ": bad element declaration";
+                        return false;
+                    }
+                    header->elements.push_back(element);
+                }
+                else if ("property" == keyword)
+                {
+                    if (header->elements.empty())
+                    {
+                        LOG(ERROR) << filename << ": property before any element";
+                        return false;
+                    }
+                    PLYElement &element = header->elements.back();
+
+                    PLYProperty property;
+                    std::string typeName;
+                    line >> typeName;
+                    if ("list" == typeName)
+                    {
+                        std::string countTypeName;
+                        line >> countTypeName >> typeName;
+                        property.isList = true;
+                        if (!ParseType(countTypeName, &property.countType))
+                        {
+                            LOG(ERROR) << filename << ": unknown type \"" << countTypeName << "\"";
+                            return false;
+                        }
+                    }
+                    if (!ParseType(typeName, &property.type))
+                    {
+                        LOG(ERROR) << filename << ": unknown type \"" << typeName << "\"";
+                        return false;
+                    }
+                    line >> property.name;
+
+                    if (property.isList)
+                    {
+                        element.stride = -1;
+                    }
+                    else if (element.stride >= 0)
+                    {
+                        property.offset = element.stride;
+                        element.stride += TypeSize(property.type);
+                    }
+                    element.properties.push_back(property);
+                }
+                else if ("end_header" == keyword)
+                {
+                    break;
+                }
+                // comment、obj_info和空行直接忽略
+            }
+
+            if (!hasFormat)
+            {
+                LOG(ERROR) << filename << ": missing format";
+                return false;
+            }
+            header->dataOffset = cur - data;
+            return true;
+        }
+
+        bool IsLittleEndianHost(void)
+        {
+            const uint16_t value = 1;
+            uint8_t firstByte;
+            std::memcpy(&firstByte, &value, 1);
+            return (1 == firstByte);
+        }
+
+        template <typename T>
+        T Load(const char *ptr, bool swap)
+        {
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, ptr, sizeof(T));
+            if (swap)
+            {
+                for (size_t i = 0; i < sizeof(T) / 2; ++i)
+                {
+                    std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+                }
+            }
+
+            T value;
+            std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        double ReadBinary(const char *ptr, PLYType type, bool swap)
+        {
+            switch (type)
+            {
+            case PLYType::Int8:    return Load<int8_t>(ptr, swap);
+            case PLYType::UInt8:   return Load<uint8_t>(ptr, swap);
+            case PLYType::Int16:   return Load<int16_t>(ptr, swap);
+            case PLYType::UInt16:  return Load<uint16_t>(ptr, swap);
+            case PLYType::Int32:   return Load<int32_t>(ptr, swap);
+            case PLYType::UInt32:  return Load<uint32_t>(ptr, swap);
+            case PLYType::Float32: return Load<float>(ptr, swap);
+            default:               return Load<double>(ptr, swap);
+            }
+        }
+
+        // 按空白分隔依次读取ascii数据中的数值
+        class AsciiCursor
+        {
+        public:
+            AsciiCursor(const char *begin, const char *end)
+                : cur(begin), end(end)
+            {}
+
+            bool Next(double *value)
+            {
+                while ((cur < end) && std::isspace((unsigned char)*cur))
+                {
+                    ++cur;
+                }
+                const char *tokenBegin = cur;
+                while ((cur < end) && !std::isspace((unsigned char)*cur))
+                {
+                    ++cur;
+                }
+
+                // 映射的内存不以'\0'结尾，复制到局部缓冲区再转换
+                char token[64];
+                size_t length = cur - tokenBegin;
+                if ((0 == length) || (length >= sizeof(token)))
+                {
+                    return false;
+                }
+                std::memcpy(token, tokenBegin, length);
+                token[length] = '\0';
+
+                char *tokenEnd;
+                *value = std::strtod(token, &tokenEnd);
+                return (token + length == tokenEnd);
+            }
+
+        private:
+            const char *cur;
+            const char *end;
+        };
+
+        // 跳过一个含list属性的二进制元素，数据不完整时返回nullptr
+        const char *SkipBinaryElement(const PLYElement &element, const char *cur, const char *end, bool swap)
+        {
+            if (element.stride >= 0)
+            {
+                return ((uint64_t)(end - cur) >= ((uint64_t)element.count * element.stride)) ? cur + (element.count * element.stride) : nullptr;
+            }
+
+            for (int64_t i = 0; i < element.count; ++i)
+            {
+                for (const PLYProperty &property : element.properties)
+                {
+                    int64_t count = 1;
+                    if (property.isList)
+                    {
+                        if (end - cur < TypeSize(property.countType))
+                        {
+                            return nullptr;
+                        }
+                        count = (int64_t)ReadBinary(cur, property.countType, swap);
+                        cur += TypeSize(property.countType);
+                    }
+                    if ((count < 0) || ((end - cur) < (count * TypeSize(property.type))))
+                    {
+                        return nullptr;
+                    }
+                    cur += count * TypeSize(property.type);
+                }
+            }
+            return cur;
+        }
+
+        // 顶点属性的下标：x y z、nx ny nz、u v
+        struct VertexLayout
+        {
+            explicit VertexLayout(const PLYElement &vertex)
+            {
+                static const char *const uvNames[][2] =
+                {
+                    { "u", "v" }, { "s", "t" }, { "texture_u", "texture_v" }, { "texture_s", "texture_t" },
+                };
+
+                p[0] = vertex.Find("x");
+                p[1] = vertex.Find("y");
+                p[2] = vertex.Find("z");
+                n[0] = vertex.Find("nx");
+                n[1] = vertex.Find("ny");
+                n[2] = vertex.Find("nz");
+                uv[0] = uv[1] = -1;
+                for (const auto &names : uvNames)
+                {
+                    if ((vertex.Find(names[0]) >= 0) && (vertex.Find(names[1]) >= 0))
+                    {
+                        uv[0] = vertex.Find(names[0]);
+                        uv[1] = vertex.Find(names[1]);
+                        break;
+                    }
+                }
+            }
+
+            bool HasPositions(void) const
+            {
+                return ((p[0] >= 0) && (p[1] >= 0) && (p[2] >= 0));
+            }
+
+            bool HasNormals(void) const
+            {
+                return ((n[0] >= 0) && (n[1] >= 0) && (n[2] >= 0));
+            }
+
+            bool HasUV(void) const
+            {
+                return (uv[0] >= 0);
+            }
+
+            int p[3], n[3], uv[2];
+        };
+
+        // 顶点记录恰好由依次排列的float属性x、y、z组成，并且数据满足对齐要求时，
+        // 位置数组可以直接指向文件内存
+        // @remarks: 法线和uv与x、y、z在同一条记录中，记录一定比Normal3f或Point2f长，所以总是转换
+        const Point3f *DirectPositions(const PLYElement &vertex, const char *data, bool swap, const int *indices)
+        {
+            static_assert(sizeof(Point3f) == 3 * sizeof(Float), "unexpected padding");
+            if (swap || !std::is_same<Float, float>::value || (vertex.stride != (int)sizeof(Point3f))
+             || (0 != ((uintptr_t)data % alignof(Point3f))))
+            {
+                return nullptr;
+            }
+
+            for (int i = 0; i < 3; ++i)
+            {
+                const PLYProperty &property = vertex.properties[indices[i]];
+                if ((PLYType::Float32 != property.type) || (property.offset != i * (int)sizeof(float)))
+                {
+                    return nullptr;
+                }
+            }
+            return (const Point3f *)data;
+        }
+
+        void ReadBinaryVertices(const PLYElement &vertex, const VertexLayout &layout, const char *data, bool swap, PLYMesh *mesh)
+        {
+            int nVertices = mesh->nVertices;
+            mesh->p = DirectPositions(vertex, data, swap, layout.p);
+
+            bool convertP = (nullptr == mesh->p);
+            bool convertN = layout.HasNormals();
+            bool convertUV = layout.HasUV();
+            if (!convertP && !convertN && !convertUV)
+            {
+                return;
+            }
+
+            if (convertP) mesh->pStorage.resize(nVertices);
+            if (convertN) mesh->nStorage.resize(nVertices);
+            if (convertUV) mesh->uvStorage.resize(nVertices);
+
+            auto read = [&](const char *record, int propertyIndex) -> Float
+            {
+                const PLYProperty &property = vertex.properties[propertyIndex];
+                return (Float)ReadBinary(record + property.offset, property.type, swap);
+            };
+
+            ParallelFor(nVertices, ChunkSize, [&](int64_t i)
+            {
+                const char *record = data + (i * vertex.stride);
+                if (convertP)
+                {
+                    mesh->pStorage[i] = Point3f(read(record, layout.p[0]), read(record, layout.p[1]), read(record, layout.p[2]));
+                }
+                if (convertN)
+                {
+                    mesh->nStorage[i] = Normal3f(read(record, layout.n[0]), read(record, layout.n[1]), read(record, layout.n[2]));
+                }
+                if (convertUV)
+                {
+                    mesh->uvStorage[i] = Point2f(read(record, layout.uv[0]), read(record, layout.uv[1]));
+                }
+            });
+
+            if (convertP) mesh->p = mesh->pStorage.data();
+            if (convertN) mesh->n = mesh->nStorage.data();
+            if (convertUV) mesh->uv = mesh->uvStorage.data();
+        }
+
+        // 多边形按扇形拆成三角形
+        void AddPolygon(const int *indices, int count, std::vector<int> *vertexIndices)
+        {
+            for (int i = 2; i < count; ++i)
+            {
+                vertexIndices->push_back(indices[0]);
+                vertexIndices->push_back(indices[i - 1]);
+                vertexIndices->push_back(indices[i]);
+            }
+        }
+
+        // 所有面都是三角形、顶点数为1字节、下标为4字节整数且没有其他属性时（最常见的情况），
+        // 每个面的记录定长13字节，可以并行复制；遇到其他情况返回false
+        // @remarks: 第一个不是三角形的面之前的记录位置都是对的，所以它一定会被检查到
+        bool ReadTriangleFaces(const PLYElement &face, const char *data, const char *end, bool swap, std::vector<int> *vertexIndices)
+        {
+            const int RecordSize = 1 + sizeof(int32_t);
+            if ((1 != face.properties.size()) || (1 != TypeSize(face.properties[0].countType))
+             || ((PLYType::Int32 != face.properties[0].type) && (PLYType::UInt32 != face.properties[0].type))
+             || ((uint64_t)(end - data) < (uint64_t)face.count * RecordSize))
+            {
+                return false;
+            }
+
+            vertexIndices->resize(3 * face.count);
+            std::atomic<bool> allTriangles(true);
+            ParallelFor(face.count, ChunkSize, [&](int64_t i)
+            {
+                const char *record = data + (i * RecordSize);
+                if (3 != (uint8_t)record[0])
+                {
+                    allTriangles = false;
+                    return;
+                }
+                for (int j = 0; j < 3; ++j)
+                {
+                    (*vertexIndices)[(3 * i) + j] = Load<int32_t>(record + 1 + (j * sizeof(int32_t)), swap);
+                }
+            });
+
+            if (!allTriangles)
+            {
+                vertexIndices->clear();
+                return false;
+            }
+            return true;
+        }
+
+        // 返回面数据之后的位置，数据不完整时返回nullptr
+        const char *ReadBinaryFaces(const PLYElement &face, int indicesProperty, const char *data, const char *end, bool swap, std::vector<int> *vertexIndices)
+        {
+            if (ReadTriangleFaces(face, data, end, swap, vertexIndices))
+            {
+                return data + (face.count * (1 + sizeof(int32_t)));
+            }
+
+            vertexIndices->reserve(3 * face.count);
+            std::vector<int> polygon;
+            const char *cur = data;
+            for (int64_t i = 0; i < face.count; ++i)
+            {
+                for (size_t j = 0; j < face.properties.size(); ++j)
+                {
+                    const PLYProperty &property = face.properties[j];
+                    int64_t count = 1;
+                    if (property.isList)
+                    {
+                        if (end - cur < TypeSize(property.countType))
+                        {
+                            return nullptr;
+                        }
+                        count = (int64_t)ReadBinary(cur, property.countType, swap);
+                        cur += TypeSize(property.countType);
+                    }
+                    int typeSize = TypeSize(property.type);
+                    if ((count < 0) || ((end - cur) < (count * typeSize)))
+                    {
+                        return nullptr;
+                    }
+
+                    if ((int)j == indicesProperty)
+                    {
+                        polygon.resize(count);
+                        for (int64_t k = 0; k < count; ++k)
+                        {
+                            polygon[k] = (int)ReadBinary(cur + (k * typeSize), property.type, swap);
+                        }
+                        AddPolygon(polygon.data(), (int)count, vertexIndices);
+                    }
+                    cur += count * typeSize;
+                }
+            }
+            return cur;
+        }
+
+        bool ReadAscii(const PLYHeader &header, const char *begin, const char *end, const VertexLayout &layout, PLYMesh *mesh)
+        {
+            AsciiCursor cursor(begin, end);
+            std::vector<double> values;
+            std::vector<int> polygon;
+            for (const PLYElement &element : header.elements)
+            {
+                bool isVertex = ("vertex" == element.name);
+                bool isFace = ("face" == element.name);
+                if (isVertex)
+                {
+                    mesh->pStorage.resize(element.count);
+                    if (layout.HasNormals()) mesh->nStorage.resize(element.count);
+                    if (layout.HasUV()) mesh->uvStorage.resize(element.count);
+                }
+
+                for (int64_t i = 0; i < element.count; ++i)
+                {
+                    values.clear();
+                    for (const PLYProperty &property : element.properties)
+                    {
+                        double value;
+                        int64_t count = 1;
+                        if (property.isList)
+                        {
+                            if (!cursor.Next(&value) || (value < 0))
+                            {
+                                return false;
+                            }
+                            count = (int64_t)value;
+                        }
+
+                        polygon.clear();
+                        for (int64_t k = 0; k < count; ++k)
+                        {
+                            if (!cursor.Next(&value))
+                            {
+                                return false;
+                            }
+                            if (property.isList)
+                            {
+                                polygon.push_back((int)value);
+                            }
+                        }
+                        values.push_back(value);
+
+                        if (isFace && property.isList && (("vertex_indices" == property.name) || ("vertex_index" == property.name)))
+                        {
+                            AddPolygon(polygon.data(), (int)polygon.size(), &mesh->vertexIndices);
+                        }
+                    }
+
+                    if (isVertex)
+                    {
+                        mesh->pStorage[i] = Point3f((Float)values[layout.p[0]], (Float)values[layout.p[1]], (Float)values[layout.p[2]]);
+                        if (layout.HasNormals())
+                        {
+                            mesh->nStorage[i] = Normal3f((Float)values[layout.n[0]], (Float)values[layout.n[1]], (Float)values[layout.n[2]]);
+                        }
+                        if (layout.HasUV())
+                        {
+                            mesh->uvStorage[i] = Point2f((Float)values[layout.uv[0]], (Float)values[layout.uv[1]]);
+                        }
+                    }
+                }
+            }
+
+            mesh->p = mesh->pStorage.data();
+            mesh->n = mesh->nStorage.empty() ? nullptr : mesh->nStorage.data();
+            mesh->uv = mesh->uvStorage.empty() ? nullptr : mesh->uvStorage.data();
+            return true;
+        }
+    }
+
+    bool ReadPLY(const std::string &filename, PLYMesh *mesh)
+    {
+        if (!mesh->file.Open(filename))
+        {
+            return false;
+        }
+        const char *data = mesh->file.Data();
+        const char *end = data + mesh->file.Size();
+
+        PLYHeader header;
+        if (!ParseHeader(filename, data, mesh->file.Size(), &header))
+        {
+            return false;
+        }
+
+        const PLYElement *vertex = nullptr;
+        const PLYElement *face = nullptr;
+        for (const PLYElement &element : header.elements)
+        {
+            if ("vertex" == element.name)
+            {
+                vertex = &element;
+            }
+            else if ("face" == element.name)
+            {
+                face = &element;
+            }
+        }
+        if ((nullptr == vertex) || (nullptr == face))
+        {
+            LOG(ERROR) << filename << ": vertex or face element missing";
+            return false;
+        }
+        if (vertex->count > std::numeric_limits<int>::max())
+        {
+            LOG(ERROR) << filename << ": too many vertices";
+            return false;
+        }
+
+        VertexLayout layout(*vertex);
+        if (!layout.HasPositions())
+        {
+            LOG(ERROR) << filename << ": vertex positions missing";
+            return false;
+        }
+
+        int indicesProperty = face->Find("vertex_indices");
+        if (indicesProperty < 0)
+        {
+            indicesProperty = face->Find("vertex_index");
+        }
+        if ((indicesProperty < 0) || !face->properties[indicesProperty].isList)
+        {
+            LOG(ERROR) << filename << ": face vertex indices missing";
+            return false;
+        }
+
+        mesh->nVertices = (int)vertex->count;
+        if (PLYFormat::Ascii == header.format)
+        {
+            if (!ReadAscii(header, data + header.dataOffset, end, layout, mesh))
+            {
+                LOG(ERROR) << filename << ": bad or truncated ascii data";
+                return false;
+            }
+        }
+        else
+        {
+            if (vertex->stride < 0)
+            {
+                LOG(ERROR) << filename << ": list properties in vertex element are not supported";
+                return false;
+            }
+
+            bool swap = ((PLYFormat::BinaryLittleEndian == header.format) != IsLittleEndianHost());
+            // 面数据不定长，由ReadBinaryFaces边读边确定长度，避免为了跳过它而多扫描一遍
+            const char *cur = data + header.dataOffset;
+            int nRead = 0;
+            for (size_t i = 0; (i < header.elements.size()) && (nRead < 2); ++i)
+            {
+                const PLYElement &element = header.elements[i];
+                const char *next = (&element == face) ? ReadBinaryFaces(element, indicesProperty, cur, end, swap, &mesh->vertexIndices)
+                                                      : SkipBinaryElement(element, cur, end, swap);
+                if (nullptr == next)
+                {
+                    LOG(ERROR) << filename << ": truncated \"" << element.name << "\" data";
+                    return false;
+                }
+
+                if (&element == vertex)
+                {
+                    ReadBinaryVertices(element, layout, cur, swap, mesh);
+                }
+                nRead += ((&element == vertex) || (&element == face)) ? 1 : 0;
+                cur = next;
+            }
+        }
+
+        for (int index : mesh->vertexIndices)
+        {
+            if ((index < 0) || (index >= mesh->nVertices))
+            {
+                LOG(ERROR) << filename << ": vertex index out of range: " << index;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::unique_ptr<TriangleMesh> CreatePLYMesh(const Transform &objectToWorld, const std::string &filename
+                                              , TriangleMesh::VertexFormat format)
+    {
+        PLYMesh ply;
+        if (!ReadPLY(filename, &ply))
+        {
+            return nullptr;
+        }
+        if ((0 == ply.nVertices) || ply.vertexIndices.empty())
+        {
+            LOG(ERROR) << filename << ": empty mesh";
+            return nullptr;
+        }
+
+        return std::unique_ptr<TriangleMesh>(new TriangleMesh(objectToWorld, std::move(ply.vertexIndices)
+                                                            , ply.nVertices, ply.p, ply.n, ply.uv, format));
+    }
+}
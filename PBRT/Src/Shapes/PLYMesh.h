@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "Triangle.h"
+#include "Src/Core/MappedFile.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PBRT
+{
+    // 从PLY文件读出的三角形网格数据（物体空间）
+    // 文件以内存映射方式打开；二进制小端文件中顶点只有float类型的x、y、z并且数据按4字节对齐时，
+    // p直接指向映射的内存，不做任何复制，否则由并行的转换过程写入pStorage等数组
+    // @remarks: p/n/uv指向的数据与本对象同生命周期，n和uv在文件中没有时为nullptr
+    struct PLYMesh
+    {
+        int nVertices = 0;
+        const Point3f *p = nullptr;
+        const Normal3f *n = nullptr;
+        const Point2f *uv = nullptr;
+
+        // 多边形面按扇形拆成三角形
+        std::vector<int> vertexIndices;
+
+        MappedFile file;
+        std::vector<Point3f> pStorage;
+        std::vector<Normal3f> nStorage;
+        std::vector<Point2f> uvStorage;
+    };
+
+    // 支持ascii、binary_little_endian和binary_big_endian格式
+    // 失败时输出错误日志并返回false
+    bool ReadPLY(const std::string &filename, PLYMesh *mesh);
+
+    // 读取PLY文件并创建网格，顶点直接从映射的文件内存变换到世界空间；失败时返回nullptr
+    std::unique_ptr<TriangleMesh> CreatePLYMesh(const Transform &objectToWorld, const std::string &filename
+                                              , TriangleMesh::VertexFormat format = TriangleMesh::VertexFormat::Full);
+}
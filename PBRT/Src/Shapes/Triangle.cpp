@@ -0,0 +1,307 @@
+﻿#include "Triangle.h"
+#include "Src/Core/Parallel.h"
+
+namespace PBRT
+{
+    // ----------------------------------------------------------------------------
+    // TriangleMesh
+    // ----------------------------------------------------------------------------
+    TriangleMesh::TriangleMesh(const Transform &objectToWorld
+                             , int nTriangles, const int *vertexIndices
+                             , int nVertices, const Point3f *p, const Normal3f *n, const Point2f *uv
+                             , VertexFormat format)
+        : TriangleMesh(objectToWorld, std::vector<int>(vertexIndices, vertexIndices + (3 * nTriangles)), nVertices, p, n, uv, format)
+    {}
+
+    TriangleMesh::TriangleMesh(const Transform &objectToWorld, std::vector<int> &&vertexIndices
+                             , int nVertices, const Point3f *p, const Normal3f *n, const Point2f *uv
+                             , VertexFormat format)
+        : nTriangles((int)(vertexIndices.size() / 3)), nVertices(nVertices), format(format)
+        , indexStorage(std::move(vertexIndices))
+    {
+        CHECK_EQ(indexStorage.size() % 3, 0u);
+        CHECK_GT(nVertices, 0);
+        for (int index : indexStorage)
+        {
+            CHECK((index >= 0) && (index < nVertices)) << "vertex index out of range: " << index;
+        }
+        this->vertexIndices = indexStorage.data();
+
+        std::unique_ptr<Point3f[]> pWorld(new Point3f[nVertices]);
+        objectToWorld.TransformPoints(p, pWorld.get(), nVertices);
+
+        std::unique_ptr<Normal3f[]> nWorld;
+        if (nullptr != n)
+        {
+            nWorld.reset(new Normal3f[nVertices]);
+            objectToWorld.TransformNormals(n, nWorld.get(), nVertices);
+        }
+
+        if (VertexFormat::Full == format)
+        {
+            pStorage = std::move(pWorld);
+            nStorage = std::move(nWorld);
+            this->p = pStorage.get();
+            this->n = nStorage.get();
+            if (nullptr != uv)
+            {
+                uvStorage.reset(new Point2f[nVertices]);
+                std::copy(uv, uv + nVertices, uvStorage.get());
+                this->uv = uvStorage.get();
+            }
+            return;
+        }
+
+        Bounds3f bounds;
+        for (int i = 0; i < nVertices; ++i)
+        {
+            bounds = Union(bounds, pWorld[i]);
+        }
+        quantizer = PointQuantizer(bounds);
+
+        pEncodedStorage.reset(new QuantizedPoint3[nVertices]);
+        ParallelFor(nVertices, 16384, [&](int64_t i)
+        {
+            pEncodedStorage[i] = quantizer.Encode(pWorld[i]);
+        });
+        pEncoded = pEncodedStorage.get();
+
+        if (nWorld)
+        {
+            nEncodedStorage.reset(new uint32_t[nVertices]);
+            ParallelFor(nVertices, 16384, [&](int64_t i)
+            {
+                // 长度为0的法线没有方向，编码为+z
+                Vector3f v(nWorld[i]);
+                nEncodedStorage[i] = EncodeOctahedral((v.LengthSquared() > 0) ? v : Vector3f(0, 0, 1));
+            });
+            nEncoded = nEncodedStorage.get();
+        }
+
+        if (nullptr != uv)
+        {
+            uvEncodedStorage.reset(new uint32_t[nVertices]);
+            for (int i = 0; i < nVertices; ++i)
+            {
+                uvEncodedStorage[i] = FloatToHalf((float)uv[i].x) | ((uint32_t)FloatToHalf((float)uv[i].y) << 16);
+            }
+            uvEncoded = uvEncodedStorage.get();
+        }
+    }
+
+    TriangleMesh::TriangleMesh(int nTriangles, int nVertices, VertexFormat format, std::shared_ptr<const void> backing)
+        : nTriangles(nTriangles), nVertices(nVertices), format(format), backing(std::move(backing))
+    {
+        CHECK_GT(nTriangles, 0);
+        CHECK_GT(nVertices, 0);
+    }
+
+    size_t TriangleMesh::VertexMemory(void) const
+    {
+        size_t perVertex = 0;
+        if (VertexFormat::Full == format)
+        {
+            perVertex = sizeof(Point3f);
+            if (n) perVertex += sizeof(Normal3f);
+            if (uv) perVertex += sizeof(Point2f);
+        }
+        else
+        {
+            perVertex = sizeof(QuantizedPoint3);
+            if (nEncoded) perVertex += sizeof(uint32_t);
+            if (uvEncoded) perVertex += sizeof(uint32_t);
+        }
+        return (perVertex * nVertices) + (3 * nTriangles * sizeof(int));
+    }
+
+    // ----------------------------------------------------------------------------
+    // Triangle
+    // ----------------------------------------------------------------------------
+    WatertightRay::WatertightRay(const Ray &ray)
+        : origin(ray.origin)
+    {
+        kz = MaxDimension(Abs(ray.dir));
+        kx = kz + 1;
+        if (3 == kx) kx = 0;
+        ky = kx + 1;
+        if (3 == ky) ky = 0;
+
+        // z分量的缩放推迟到确定命中之后
+        Vector3f d = Permute(ray.dir, kx, ky, kz);
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.0f / d.z;
+    }
+
+    bool IntersectTriangle(const WatertightRay &wr, Float tMax
+                         , const Point3f &p0, const Point3f &p1, const Point3f &p2
+                         , Float *tHit, Float *b0Out, Float *b1Out, Float *b2Out)
+    {
+        // 平移到以光线起点为原点，并交换坐标轴
+        Point3f p0t = Permute(p0 - Vector3f(wr.origin), wr.kx, wr.ky, wr.kz);
+        Point3f p1t = Permute(p1 - Vector3f(wr.origin), wr.kx, wr.ky, wr.kz);
+        Point3f p2t = Permute(p2 - Vector3f(wr.origin), wr.kx, wr.ky, wr.kz);
+
+        // 错切
+        p0t.x += wr.Sx * p0t.z;
+        p0t.y += wr.Sy * p0t.z;
+        p1t.x += wr.Sx * p1t.z;
+        p1t.y += wr.Sy * p1t.z;
+        p2t.x += wr.Sx * p2t.z;
+        p2t.y += wr.Sy * p2t.z;
+
+        // 边函数
+        Float e0 = (p1t.x * p2t.y) - (p1t.y * p2t.x);
+        Float e1 = (p2t.x * p0t.y) - (p2t.y * p0t.x);
+        Float e2 = (p0t.x * p1t.y) - (p0t.y * p1t.x);
+
+        // 恰好落在边上时用double重新计算，保证相邻三角形的判断一致
+        if ((sizeof(Float) == sizeof(float)) && ((0.0f == e0) || (0.0f == e1) || (0.0f == e2)))
+        {
+            double p2txp1ty = (double)p2t.x * (double)p1t.y;
+            double p2typ1tx = (double)p2t.y * (double)p1t.x;
+            e0 = (float)(p2typ1tx - p2txp1ty);
+            double p0txp2ty = (double)p0t.x * (double)p2t.y;
+            double p0typ2tx = (double)p0t.y * (double)p2t.x;
+            e1 = (float)(p0typ2tx - p0txp2ty);
+            double p1txp0ty = (double)p1t.x * (double)p0t.y;
+            double p1typ0tx = (double)p1t.y * (double)p0t.x;
+            e2 = (float)(p1typ0tx - p1txp0ty);
+        }
+
+        if (((e0 < 0) || (e1 < 0) || (e2 < 0)) && ((e0 > 0) || (e1 > 0) || (e2 > 0)))
+        {
+            return false;
+        }
+        Float det = e0 + e1 + e2;
+        if (0 == det)
+        {
+            return false;
+        }
+
+        // 用未除以det的t判断范围，省掉不命中时的除法
+        p0t.z *= wr.Sz;
+        p1t.z *= wr.Sz;
+        p2t.z *= wr.Sz;
+        Float tScaled = (e0 * p0t.z) + (e1 * p1t.z) + (e2 * p2t.z);
+        if ((det < 0) && ((tScaled >= 0) || (tScaled < (tMax * det))))
+        {
+            return false;
+        }
+        else if ((det > 0) && ((tScaled <= 0) || (tScaled > (tMax * det))))
+        {
+            return false;
+        }
+
+        Float invDet = 1 / det;
+        Float b0 = e0 * invDet;
+        Float b1 = e1 * invDet;
+        Float b2 = e2 * invDet;
+        Float t = tScaled * invDet;
+
+        // 保守地确认t大于0：估计以上各步的舍入误差
+        Float maxZt = MaxComponent(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
+        Float deltaZ = Gamma(3) * maxZt;
+        Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
+        Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
+        Float deltaX = Gamma(5) * (maxXt + maxZt);
+        Float deltaY = Gamma(5) * (maxYt + maxZt);
+        Float deltaE = 2 * ((Gamma(2) * maxXt * maxYt) + (deltaY * maxXt) + (deltaX * maxYt));
+        Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
+        Float deltaT = 3 * ((Gamma(3) * maxE * maxZt) + (deltaE * maxZt) + (deltaZ * maxE)) * std::abs(invDet);
+        if (t <= deltaT)
+        {
+            return false;
+        }
+
+        *tHit = t;
+        *b0Out = b0;
+        *b1Out = b1;
+        *b2Out = b2;
+        return true;
+    }
+
+    Bounds3f Triangle::WorldBound(void) const
+    {
+        Point3f p0 = mesh->P(v[0]);
+        Point3f p1 = mesh->P(v[1]);
+        Point3f p2 = mesh->P(v[2]);
+        return Union(Bounds3f(p0, p1), p2);
+    }
+
+    Float Triangle::Area(void) const
+    {
+        Point3f p0 = mesh->P(v[0]);
+        Point3f p1 = mesh->P(v[1]);
+        Point3f p2 = mesh->P(v[2]);
+        return 0.5f * Cross(p1 - p0, p2 - p0).Length();
+    }
+
+    bool Triangle::Intersect(const Ray &ray, Float *tHit, Float *b0, Float *b1, Float *b2) const
+    {
+        return IntersectTriangle(WatertightRay(ray), ray.tMax, mesh->P(v[0]), mesh->P(v[1]), mesh->P(v[2]), tHit, b0, b1, b2);
+    }
+
+    bool Triangle::IntersectP(const Ray &ray) const
+    {
+        Float tHit, b0, b1, b2;
+        return Intersect(ray, &tHit, &b0, &b1, &b2);
+    }
+
+    void Triangle::FillHit(Float b0, Float b1, Float b2, TriangleHit *hit) const
+    {
+        Point3f p0 = mesh->P(v[0]);
+        Point3f p1 = mesh->P(v[1]);
+        Point3f p2 = mesh->P(v[2]);
+
+        hit->p = Point3f((p0 * b0) + (p1 * b1) + (p2 * b2));
+        hit->b0 = b0;
+        hit->b1 = b1;
+        hit->b2 = b2;
+        hit->triangleIndex = TriangleIndex();
+
+        if (mesh->HasUV())
+        {
+            hit->uv = (mesh->UV(v[0]) * b0) + (mesh->UV(v[1]) * b1) + (mesh->UV(v[2]) * b2);
+        }
+        else
+        {
+            hit->uv = Point2f(b1, b2);
+        }
+
+        Vector3f ng = Normalize(Cross(p0 - p2, p1 - p2));
+        if (mesh->HasNormals())
+        {
+            Vector3f ns = (Vector3f(mesh->N(v[0])) * b0) + (Vector3f(mesh->N(v[1])) * b1) + (Vector3f(mesh->N(v[2])) * b2);
+            if (ns.LengthSquared() > 0)
+            {
+                ns = Normalize(ns);
+                if (Dot(ng, ns) < 0)
+                {
+                    ng = ng * -1;
+                }
+            }
+            else
+            {
+                ns = ng;
+            }
+            hit->n = Normal3f(ng);
+            hit->shadingN = Normal3f(ns);
+        }
+        else
+        {
+            hit->n = Normal3f(ng);
+            hit->shadingN = hit->n;
+        }
+    }
+
+    std::vector<Bounds3f> TriangleBounds(const TriangleMesh &mesh)
+    {
+        std::vector<Bounds3f> bounds(mesh.nTriangles);
+        ParallelFor(mesh.nTriangles, 4096, [&](int64_t i)
+        {
+            bounds[i] = Triangle(&mesh, (int)i).WorldBound();
+        });
+        return bounds;
+    }
+}
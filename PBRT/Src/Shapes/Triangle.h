@@ -0,0 +1,157 @@
+﻿#pragma once
+
+#include "Src/Core/Encoding.h"
+#include "Src/Core/Geometry.h"
+#include "Src/Core/Transform.h"
+#include <memory>
+#include <vector>
+
+namespace PBRT
+{
+    // 三角形网格：所有三角形共享一份连续的顶点数据，顶点在构造时变换到世界空间
+    // @remarks: 每个三角形只占3个顶点索引（12字节），Triangle句柄按需构造，不需要单独存储
+    struct TriangleMesh
+    {
+        enum class VertexFormat
+        {
+            Full,       // Point3f/Normal3f/Point2f，每个顶点32字节
+            Compressed, // 位置在网格包围盒内量化到16位，法线八面体编码到32位，uv为半精度，每个顶点14字节
+        };
+
+        // n和uv可以为nullptr
+        // @remarks: Compressed格式下求交和FillHit使用解码后的顶点，与原始顶点有量化误差，
+        //           但共享的顶点解码结果相同，网格仍然是水密的
+        TriangleMesh(const Transform &objectToWorld
+                   , int nTriangles, const int *vertexIndices
+                   , int nVertices, const Point3f *p, const Normal3f *n, const Point2f *uv
+                   , VertexFormat format = VertexFormat::Full);
+
+        // 直接接管索引数组，加载大网格时避免再复制一份
+        TriangleMesh(const Transform &objectToWorld, std::vector<int> &&vertexIndices
+                   , int nVertices, const Point3f *p, const Normal3f *n, const Point2f *uv
+                   , VertexFormat format = VertexFormat::Full);
+
+        // 直接引用已变换到世界空间的现成数组，不复制，由调用者设置各数组指针；
+        // backing保证这些数组在网格销毁前一直有效（如场景缓存的内存映射）
+        TriangleMesh(int nTriangles, int nVertices, VertexFormat format, std::shared_ptr<const void> backing);
+
+        size_t VertexMemory(void) const;
+
+        bool HasNormals(void) const
+        {
+            return (n || nEncoded);
+        }
+
+        bool HasUV(void) const
+        {
+            return (uv || uvEncoded);
+        }
+
+        // 按顶点下标取（解码后的）顶点属性
+        Point3f P(int i) const
+        {
+            return p ? p[i] : quantizer.Decode(pEncoded[i]);
+        }
+
+        Normal3f N(int i) const
+        {
+            return n ? n[i] : Normal3f(DecodeOctahedral(nEncoded[i]));
+        }
+
+        Point2f UV(int i) const
+        {
+            return uv ? uv[i] : Point2f(HalfToFloat((uint16_t)(uvEncoded[i] & 0xFFFF)), HalfToFloat((uint16_t)(uvEncoded[i] >> 16)));
+        }
+
+        const int nTriangles, nVertices;
+        const VertexFormat format;
+
+        // 以下数组指向网格自己的存储，或者指向backing持有的外部内存
+        const int *vertexIndices = nullptr;
+
+        // Full格式
+        const Point3f *p = nullptr;
+        const Normal3f *n = nullptr;
+        const Point2f *uv = nullptr;
+
+        // Compressed格式
+        PointQuantizer quantizer;
+        const QuantizedPoint3 *pEncoded = nullptr;
+        const uint32_t *nEncoded = nullptr;
+        const uint32_t *uvEncoded = nullptr;
+
+        std::vector<int> indexStorage;
+        std::unique_ptr<Point3f[]> pStorage;
+        std::unique_ptr<Normal3f[]> nStorage;
+        std::unique_ptr<Point2f[]> uvStorage;
+        std::unique_ptr<QuantizedPoint3[]> pEncodedStorage;
+        std::unique_ptr<uint32_t[]> nEncodedStorage;
+        std::unique_ptr<uint32_t[]> uvEncodedStorage;
+        std::shared_ptr<const void> backing;
+    };
+
+    // 光线与三角形的交点
+    struct TriangleHit
+    {
+        Point3f p;
+        // 几何法线，有顶点法线时翻到与着色法线同一侧
+        Normal3f n;
+        // 插值的顶点法线，没有时与n相同
+        Normal3f shadingN;
+        Point2f uv;
+        Float b0, b1, b2;
+        int triangleIndex;
+    };
+
+    // 水密求交中只与光线有关的部分：交换坐标轴让光线方向绝对值最大的分量成为z，
+    // 再错切使光线方向变为+z；一条光线测试多个三角形时只需计算一次
+    struct WatertightRay
+    {
+        explicit WatertightRay(const Ray &ray);
+
+        Point3f origin;
+        int kx, ky, kz;
+        Float Sx, Sy, Sz;
+    };
+
+    // 水密的光线-三角形求交，命中时返回光线参数和重心坐标
+    // @remarks: Triangle::Intersect和批量内核共用同一套运算，结果逐位一致
+    bool IntersectTriangle(const WatertightRay &wr, Float tMax
+                         , const Point3f &p0, const Point3f &p1, const Point3f &p2
+                         , Float *tHit, Float *b0, Float *b1, Float *b2);
+
+    // 指向网格中某个三角形的轻量句柄
+    class Triangle
+    {
+    public:
+        Triangle(const TriangleMesh *mesh, int triangleIndex)
+            : mesh(mesh), v(&mesh->vertexIndices[3 * triangleIndex])
+        {}
+
+        Bounds3f WorldBound(void) const;
+
+        Float Area(void) const;
+
+        // 水密求交：变换到以光线方向为z轴的坐标系后用2D边函数判断，
+        // 共享边上的交点不会在两个三角形之间漏掉
+        // 命中时返回光线参数和重心坐标，不修改ray.tMax
+        bool Intersect(const Ray &ray, Float *tHit, Float *b0, Float *b1, Float *b2) const;
+
+        bool IntersectP(const Ray &ray) const;
+
+        // 根据重心坐标求交点处的位置、法线和纹理坐标
+        void FillHit(Float b0, Float b1, Float b2, TriangleHit *hit) const;
+
+        int TriangleIndex(void) const
+        {
+            return (int)((v - &mesh->vertexIndices[0]) / 3);
+        }
+
+    private:
+        const TriangleMesh *mesh;
+        const int *v;
+    };
+
+    // 网格中每个三角形的世界空间包围盒，用于构建BVH
+    std::vector<Bounds3f> TriangleBounds(const TriangleMesh &mesh);
+}
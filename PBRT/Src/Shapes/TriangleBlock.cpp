@@ -0,0 +1,318 @@
+﻿#include "TriangleBlock.h"
+#include "Src/Core/Memory.h"
+#include "Src/Core/SIMD.h"
+#include <cstring>
+
+namespace PBRT
+{
+    namespace
+    {
+#if defined(PBRT_HAVE_AVX)
+        const int KernelWidth = 8;
+#elif defined(PBRT_HAVE_SSE)
+        const int KernelWidth = 4;
+#else
+        const int KernelWidth = 1;
+#endif
+
+        // 对W个通道执行与IntersectTriangle相同的运算；p[vertex][axis]指向这W个通道的数据
+        // anyHit为true时找到任意一个命中就返回，否则返回t最小的通道
+        template <int W>
+        int IntersectLanes(const Float *const p[3][3], uint32_t validMask
+                         , const WatertightRay &wr, Float tMax, bool anyHit
+                         , Float *tHit, Float *b0, Float *b1, Float *b2)
+        {
+#ifdef PBRT_HAVE_SSE
+            typedef SIMD::Lanes<W> L;
+            typedef typename L::Vec Vec;
+
+            const int kx = wr.kx, ky = wr.ky, kz = wr.kz;
+            const Vec ox = L::Set1(wr.origin[kx]);
+            const Vec oy = L::Set1(wr.origin[ky]);
+            const Vec oz = L::Set1(wr.origin[kz]);
+            const Vec sx = L::Set1(wr.Sx);
+            const Vec sy = L::Set1(wr.Sy);
+            const Vec zero = L::Zero();
+
+            // 平移、交换坐标轴并错切
+            Vec px[3], py[3], pz[3];
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                pz[vertex] = L::Sub(L::Load(p[vertex][kz]), oz);
+                px[vertex] = L::Add(L::Sub(L::Load(p[vertex][kx]), ox), L::Mul(sx, pz[vertex]));
+                py[vertex] = L::Add(L::Sub(L::Load(p[vertex][ky]), oy), L::Mul(sy, pz[vertex]));
+            }
+
+            Vec e0 = L::Sub(L::Mul(px[1], py[2]), L::Mul(py[1], px[2]));
+            Vec e1 = L::Sub(L::Mul(px[2], py[0]), L::Mul(py[2], px[0]));
+            Vec e2 = L::Sub(L::Mul(px[0], py[1]), L::Mul(py[0], px[1]));
+
+            // 恰好落在边上的通道很少见，逐个用double重新计算
+            uint32_t onEdge = L::MoveMask(L::Or(L::Or(L::CmpEq(e0, zero), L::CmpEq(e1, zero)), L::CmpEq(e2, zero))) & validMask;
+            if (0 != onEdge)
+            {
+                alignas(32) Float x[3][W], y[3][W], e[3][W];
+                for (int vertex = 0; vertex < 3; ++vertex)
+                {
+                    L::Store(x[vertex], px[vertex]);
+                    L::Store(y[vertex], py[vertex]);
+                }
+                L::Store(e[0], e0);
+                L::Store(e[1], e1);
+                L::Store(e[2], e2);
+                for (; 0 != onEdge; onEdge &= (onEdge - 1))
+                {
+                    int i = 0;
+                    while (0 == (onEdge & (1u << i))) ++i;
+                    e[0][i] = (float)(((double)y[2][i] * (double)x[1][i]) - ((double)x[2][i] * (double)y[1][i]));
+                    e[1][i] = (float)(((double)y[0][i] * (double)x[2][i]) - ((double)x[0][i] * (double)y[2][i]));
+                    e[2][i] = (float)(((double)y[1][i] * (double)x[0][i]) - ((double)x[1][i] * (double)y[0][i]));
+                }
+                e0 = L::Load(e[0]);
+                e1 = L::Load(e[1]);
+                e2 = L::Load(e[2]);
+            }
+
+            Vec hasNeg = L::Or(L::Or(L::CmpLt(e0, zero), L::CmpLt(e1, zero)), L::CmpLt(e2, zero));
+            Vec hasPos = L::Or(L::Or(L::CmpGt(e0, zero), L::CmpGt(e1, zero)), L::CmpGt(e2, zero));
+            Vec det = L::Add(L::Add(e0, e1), e2);
+
+            const Vec sz = L::Set1(wr.Sz);
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                pz[vertex] = L::Mul(pz[vertex], sz);
+            }
+            Vec tScaled = L::Add(L::Add(L::Mul(e0, pz[0]), L::Mul(e1, pz[1])), L::Mul(e2, pz[2]));
+
+            // 按det的符号翻转后统一判断0 < t * |det| <= tMax * |det|，与标量版本的两个分支等价
+            Vec detSign = L::SignBit(det);
+            Vec tScaledAbs = L::Xor(tScaled, detSign);
+            Vec detAbs = L::Xor(det, detSign);
+            Vec valid = L::AndNot(L::And(hasNeg, hasPos), L::CmpNeq(det, zero));
+            valid = L::And(valid, L::CmpGt(tScaledAbs, zero));
+            valid = L::And(valid, L::CmpLe(tScaledAbs, L::Mul(L::Set1(tMax), detAbs)));
+            uint32_t mask = L::MoveMask(valid) & validMask;
+            if (0 == mask)
+            {
+                return -1;
+            }
+
+            Vec invDet = L::Div(L::Set1(1.0f), det);
+            Vec t = L::Mul(tScaled, invDet);
+
+            // 保守地确认t大于0
+            Vec maxZt = L::Max(L::Max(L::Abs(pz[0]), L::Abs(pz[1])), L::Abs(pz[2]));
+            Vec maxXt = L::Max(L::Max(L::Abs(px[0]), L::Abs(px[1])), L::Abs(px[2]));
+            Vec maxYt = L::Max(L::Max(L::Abs(py[0]), L::Abs(py[1])), L::Abs(py[2]));
+            Vec maxE = L::Max(L::Max(L::Abs(e0), L::Abs(e1)), L::Abs(e2));
+            Vec deltaZ = L::Mul(L::Set1(Gamma(3)), maxZt);
+            Vec deltaX = L::Mul(L::Set1(Gamma(5)), L::Add(maxXt, maxZt));
+            Vec deltaY = L::Mul(L::Set1(Gamma(5)), L::Add(maxYt, maxZt));
+            Vec deltaE = L::Mul(L::Set1(2.0f), L::Add(L::Add(L::Mul(L::Mul(L::Set1(Gamma(2)), maxXt), maxYt)
+                                                           , L::Mul(deltaY, maxXt))
+                                                    , L::Mul(deltaX, maxYt)));
+            Vec deltaT = L::Mul(L::Mul(L::Set1(3.0f), L::Add(L::Add(L::Mul(L::Mul(L::Set1(Gamma(3)), maxE), maxZt)
+                                                                  , L::Mul(deltaE, maxZt))
+                                                           , L::Mul(deltaZ, maxE)))
+                              , L::Abs(invDet));
+            mask &= L::MoveMask(L::CmpGt(t, deltaT));
+            if (0 == mask)
+            {
+                return -1;
+            }
+
+            alignas(32) Float tLanes[W], invDetLanes[W], e[3][W];
+            L::Store(tLanes, t);
+            int best = -1;
+            for (; 0 != mask; mask &= (mask - 1))
+            {
+                int i = 0;
+                while (0 == (mask & (1u << i))) ++i;
+                if ((best < 0) || (tLanes[i] < tLanes[best]))
+                {
+                    best = i;
+                }
+                if (anyHit)
+                {
+                    break;
+                }
+            }
+
+            L::Store(invDetLanes, invDet);
+            L::Store(e[0], e0);
+            L::Store(e[1], e1);
+            L::Store(e[2], e2);
+            *tHit = tLanes[best];
+            *b0 = e[0][best] * invDetLanes[best];
+            *b1 = e[1][best] * invDetLanes[best];
+            *b2 = e[2][best] * invDetLanes[best];
+            return best;
+#else
+            return -1;
+#endif // PBRT_HAVE_SSE
+        }
+
+#ifndef PBRT_HAVE_SSE
+        // 没有SIMD时KernelWidth为1，逐个三角形测试
+        template <>
+        int IntersectLanes<1>(const Float *const p[3][3], uint32_t validMask
+                            , const WatertightRay &wr, Float tMax, bool anyHit
+                            , Float *tHit, Float *b0, Float *b1, Float *b2)
+        {
+            (void)anyHit;
+            if (0 == (validMask & 1))
+            {
+                return -1;
+            }
+            Point3f p0(p[0][0][0], p[0][1][0], p[0][2][0]);
+            Point3f p1(p[1][0][0], p[1][1][0], p[1][2][0]);
+            Point3f p2(p[2][0][0], p[2][1][0], p[2][2][0]);
+            return IntersectTriangle(wr, tMax, p0, p1, p2, tHit, b0, b1, b2) ? 0 : -1;
+        }
+#endif // PBRT_HAVE_SSE
+
+        // 按内核宽度分段处理整个块，每段用前面找到的最近命中缩短tMax
+        template <int N>
+        int IntersectBlock(const TriangleBlock<N> &block, Float *tMax, const WatertightRay &wr, bool anyHit
+                         , Float *b0, Float *b1, Float *b2)
+        {
+            const int W = (KernelWidth < N) ? KernelWidth : N;
+            int hitLane = -1;
+            for (int offset = 0; offset < N; offset += W)
+            {
+                uint32_t validMask = (block.validMask >> offset) & ((1u << W) - 1);
+                if (0 == validMask)
+                {
+                    break;
+                }
+
+                const Float *const p[3][3] = { { block.p[0][0] + offset, block.p[0][1] + offset, block.p[0][2] + offset }
+                                             , { block.p[1][0] + offset, block.p[1][1] + offset, block.p[1][2] + offset }
+                                             , { block.p[2][0] + offset, block.p[2][1] + offset, block.p[2][2] + offset } };
+                Float t;
+                int lane = IntersectLanes<W>(p, validMask, wr, *tMax, anyHit, &t, b0, b1, b2);
+                if (lane >= 0)
+                {
+                    *tMax = t;
+                    hitLane = offset + lane;
+                    if (anyHit)
+                    {
+                        break;
+                    }
+                }
+            }
+            return hitLane;
+        }
+    }
+
+    template <int N>
+    int Intersect(const TriangleBlock<N> &block, const Ray &ray, const WatertightRay &wr
+                , Float *b0, Float *b1, Float *b2)
+    {
+        return IntersectBlock(block, &ray.tMax, wr, false, b0, b1, b2);
+    }
+
+    template <int N>
+    bool IntersectP(const TriangleBlock<N> &block, const Ray &ray, const WatertightRay &wr)
+    {
+        Float tMax = ray.tMax;
+        Float b0, b1, b2;
+        return (IntersectBlock(block, &tMax, wr, true, &b0, &b1, &b2) >= 0);
+    }
+
+    template <int N>
+    TriangleBlocks<N>::TriangleBlocks(const TriangleMesh &mesh, const BVH &bvh)
+        : mesh(mesh)
+        , bvh(bvh)
+        , leafFirstBlock(bvh.NodeCount(), -1)
+    {
+        const LinearBVHNode *nodes = bvh.Nodes();
+        for (int i = 0; i < bvh.NodeCount(); ++i)
+        {
+            if (nodes[i].nPrimitives > 0)
+            {
+                leafFirstBlock[i] = nBlocks;
+                nBlocks += (nodes[i].nPrimitives + N - 1) / N;
+            }
+        }
+
+        blocks = AllocAligned<TriangleBlock<N>>(nBlocks);
+        std::memset(blocks, 0, nBlocks * sizeof(TriangleBlock<N>));
+
+        const int *primitiveIndices = bvh.PrimitiveIndices();
+        for (int i = 0; i < bvh.NodeCount(); ++i)
+        {
+            for (int j = 0; j < nodes[i].nPrimitives; ++j)
+            {
+                int triangleIndex = primitiveIndices[nodes[i].primitivesOffset + j];
+                const int *v = &mesh.vertexIndices[3 * triangleIndex];
+                blocks[leafFirstBlock[i] + (j / N)].Set(j % N, mesh.P(v[0]), mesh.P(v[1]), mesh.P(v[2]), triangleIndex);
+            }
+        }
+    }
+
+    template <int N>
+    TriangleBlocks<N>::~TriangleBlocks()
+    {
+        FreeAligned(blocks);
+    }
+
+    template <int N>
+    bool TriangleBlocks<N>::Intersect(const Ray &ray, TriangleHit *hit) const
+    {
+        WatertightRay wr(ray);
+        int hitTriangle = -1;
+        Float b0 = 0, b1 = 0, b2 = 0;
+        const LinearBVHNode *nodes = bvh.Nodes();
+        bool found = bvh.IntersectLeaves(ray, [&](int nodeIndex, const Ray &r)
+        {
+            const TriangleBlock<N> *leafBlocks = &blocks[leafFirstBlock[nodeIndex]];
+            int count = (nodes[nodeIndex].nPrimitives + N - 1) / N;
+            bool leafHit = false;
+            for (int i = 0; i < count; ++i)
+            {
+                int lane = PBRT::Intersect(leafBlocks[i], r, wr, &b0, &b1, &b2);
+                if (lane >= 0)
+                {
+                    hitTriangle = leafBlocks[i].triangleIndex[lane];
+                    leafHit = true;
+                }
+            }
+            return leafHit;
+        });
+
+        if (found)
+        {
+            Triangle(&mesh, hitTriangle).FillHit(b0, b1, b2, hit);
+        }
+        return found;
+    }
+
+    template <int N>
+    bool TriangleBlocks<N>::IntersectP(const Ray &ray) const
+    {
+        WatertightRay wr(ray);
+        const LinearBVHNode *nodes = bvh.Nodes();
+        return bvh.IntersectPLeaves(ray, [&](int nodeIndex, const Ray &r)
+        {
+            const TriangleBlock<N> *leafBlocks = &blocks[leafFirstBlock[nodeIndex]];
+            int count = (nodes[nodeIndex].nPrimitives + N - 1) / N;
+            for (int i = 0; i < count; ++i)
+            {
+                if (PBRT::IntersectP(leafBlocks[i], r, wr))
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    template int Intersect(const TriangleBlock<4> &, const Ray &, const WatertightRay &, Float *, Float *, Float *);
+    template int Intersect(const TriangleBlock<8> &, const Ray &, const WatertightRay &, Float *, Float *, Float *);
+    template bool IntersectP(const TriangleBlock<4> &, const Ray &, const WatertightRay &);
+    template bool IntersectP(const TriangleBlock<8> &, const Ray &, const WatertightRay &);
+
+    template class TriangleBlocks<4>;
+    template class TriangleBlocks<8>;
+}
@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include "Triangle.h"
+#include "Src/Accelerators/BVH.h"
+#include <cstdint>
+#include <vector>
+
+namespace PBRT
+{
+    // N个三角形的顶点按SoA存放，供一条光线一次测试N个三角形
+    // @remarks: 水密求交按光线方向交换坐标轴，对所有通道都一样，只需按kx/ky/kz选取对应的数组
+    template <int N>
+    struct alignas(64) TriangleBlock
+    {
+        static_assert((4 == N) || (8 == N), "TriangleBlock only supports 4 or 8 lanes");
+
+        void Set(int i, const Point3f &p0, const Point3f &p1, const Point3f &p2, int index)
+        {
+            DCHECK((i >= 0) && (i < N));
+            const Point3f *const vertices[3] = { &p0, &p1, &p2 };
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    p[vertex][axis][i] = (*vertices[vertex])[axis];
+                }
+            }
+            triangleIndex[i] = index;
+            validMask |= (1u << i);
+        }
+
+        // [顶点][轴][通道]
+        Float p[3][3][N];
+        int32_t triangleIndex[N];
+        uint32_t validMask;
+    };
+
+    // 一条光线与块中所有三角形求交，只保留最近的命中并更新ray.tMax
+    // 返回命中三角形所在的通道，没有命中时返回-1
+    // @remarks: wr由调用者对每条光线预先计算一次；结果与逐个调用IntersectTriangle逐位一致
+    template <int N>
+    int Intersect(const TriangleBlock<N> &block, const Ray &ray, const WatertightRay &wr
+                , Float *b0, Float *b1, Float *b2);
+
+    template <int N>
+    bool IntersectP(const TriangleBlock<N> &block, const Ray &ray, const WatertightRay &wr);
+
+    // 为BVH的每个叶子预先生成SoA三角形块，叶子测试时一次处理N个三角形
+    // @remarks: bvh应由TriangleBounds(mesh)构建；每个三角形额外占用48字节（N = 4时每块192字节，N = 8时384字节），叶子中的块没有填满时更多
+    template <int N>
+    class TriangleBlocks
+    {
+    public:
+        TriangleBlocks(const TriangleMesh &mesh, const BVH &bvh);
+        ~TriangleBlocks();
+
+        TriangleBlocks(const TriangleBlocks &) = delete;
+        TriangleBlocks &operator=(const TriangleBlocks &) = delete;
+
+        // 命中时更新ray.tMax并填写交点
+        bool Intersect(const Ray &ray, TriangleHit *hit) const;
+
+        bool IntersectP(const Ray &ray) const;
+
+        size_t Memory(void) const
+        {
+            return (nBlocks * sizeof(TriangleBlock<N>)) + (leafFirstBlock.size() * sizeof(int));
+        }
+
+    private:
+        const TriangleMesh &mesh;
+        const BVH &bvh;
+        TriangleBlock<N> *blocks = nullptr;
+        int nBlocks = 0;
+
+        // 按节点下标索引，叶子占用ceil(nPrimitives / N)个连续的块
+        std::vector<int> leafFirstBlock;
+    };
+}
@@ -0,0 +1,330 @@
+﻿#include "Benchmarks.h"
+#include "Src/Core/Geometry.h"
+#include "Src/Core/RNG.h"
+#include "glog/logging.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace PBRT
+{
+    namespace
+    {
+        // 每个循环处理的元素数，数据远大于缓存，测的是遍历整个数组的吞吐
+        const int ElementCount = 1 << 20;
+
+        // 重复多次取最短时间，排除其他进程和缓存预热的干扰
+        const int Repetitions = 7;
+
+        // 结果累加到这里，防止编译器删掉结果没有被使用的循环
+        volatile Float sink;
+
+        template <typename Func>
+        double BestTimeMs(Func &&func)
+        {
+            double best = 0;
+            for (int i = 0; i < Repetitions; ++i)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                func();
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                best = ((0 == i) || (ms < best)) ? ms : best;
+            }
+            return best;
+        }
+
+        // baselineMs为改动前的实现的耗时，输出相对它的加速比
+        void Report(const char *name, double ms, double baselineMs)
+        {
+            printf("    %-42s %9.3f ms %7.2fx\n", name, ms, baselineMs / ms);
+        }
+
+        Vector3f RandomVector(RNG &rng)
+        {
+            return Vector3f((2 * rng.UniformFloat()) - 1, (2 * rng.UniformFloat()) - 1, (2 * rng.UniformFloat()) - 1);
+        }
+
+        Vector3f RandomUnitVector(RNG &rng)
+        {
+            Vector3f v;
+            do
+            {
+                v = RandomVector(rng);
+            } while ((v.LengthSquared() > 1) || (v.LengthSquared() < (Float)1e-4));
+            return Normalize(v);
+        }
+
+        // 原点为o、方向倒数为invDir的光线到三个轴上坐标为bound的平面的距离
+        inline Vector3f SlabDistances(const Vector3f &o, const Vector3f &invDir, Float bound)
+        {
+            return Vector3f((bound - o.x) * invDir.x, (bound - o.y) * invDir.y, (bound - o.z) * invDir.z);
+        }
+
+        // --------------------------------------------------------------------
+        // 改动前的实现
+
+        // 逐分量调用std::fmin/std::fmax，与启用SIMD前的Min/Max相同
+        inline Vector3f ScalarMin(const Vector3f &v1, const Vector3f &v2)
+        {
+            return Vector3f(std::fmin(v1.x, v2.x), std::fmin(v1.y, v2.y), std::fmin(v1.z, v2.z));
+        }
+
+        inline Vector3f ScalarMax(const Vector3f &v1, const Vector3f &v2)
+        {
+            return Vector3f(std::fmax(v1.x, v2.x), std::fmax(v1.y, v2.y), std::fmax(v1.z, v2.z));
+        }
+
+        // 所有分量提升到double再相减，避免单精度下相近乘积相减的抵消误差
+        inline Vector3f DoubleCross(const Vector3f &v1, const Vector3f &v2)
+        {
+            double v1x = v1.x, v1y = v1.y, v1z = v1.z;
+            double v2x = v2.x, v2y = v2.y, v2z = v2.z;
+            return Vector3f((Float)(v1y * v2z - v1z * v2y),
+                            (Float)(v1z * v2x - v1x * v2z),
+                            (Float)(v1x * v2y - v1y * v2x));
+        }
+
+#ifndef PBRT_FLOAT_AS_DOUBLE
+        // 以double计算的差为参照，result相差多少个float的ulp
+        // @remarks: float的乘积在double下是精确的，参照只在相减时舍入一次；Float为double时没有更精确的参照
+        double UlpError(Float result, double a, double b, double c, double d)
+        {
+            double exact = (a * b) - (c * d);
+            Float magnitude = (Float)std::abs(exact);
+            double ulp = (double)std::nextafter(magnitude, std::numeric_limits<Float>::infinity()) - magnitude;
+            return std::abs(result - exact) / ulp;
+        }
+
+        double MaxUlpError(const std::vector<Vector3f> &v1, const std::vector<Vector3f> &v2, const std::vector<Vector3f> &result)
+        {
+            double maxError = 0;
+            for (size_t i = 0; i < result.size(); ++i)
+            {
+                const Vector3f &a = v1[i], &b = v2[i];
+                maxError = std::max(maxError, UlpError(result[i].x, a.y, b.z, a.z, b.y));
+                maxError = std::max(maxError, UlpError(result[i].y, a.z, b.x, a.x, b.z));
+                maxError = std::max(maxError, UlpError(result[i].z, a.x, b.y, a.y, b.x));
+            }
+            return maxError;
+        }
+#endif // PBRT_FLOAT_AS_DOUBLE
+
+        // 按较大的分量分支，一次开方和除法，再用叉积求第三个轴
+        inline void BranchingCoordinateSystem(const Vector3f &v1, Vector3f *v2, Vector3f *v3)
+        {
+            if (std::abs(v1.x) > std::abs(v1.y))
+            {
+                *v2 = Vector3f(-v1.z, 0, v1.x) / std::sqrt(v1.x * v1.x + v1.z * v1.z);
+            }
+            else
+            {
+                *v2 = Vector3f(0, v1.z, -v1.y) / std::sqrt(v1.y * v1.y + v1.z * v1.z);
+            }
+            *v3 = Cross(v1, *v2);
+        }
+
+        // --------------------------------------------------------------------
+        // 测试项
+
+        // Min/Max本身，以及光线与包围盒求交时按轴取近远交点的slab运算
+        void BenchMinMax(void)
+        {
+            RNG rng;
+            std::vector<Vector3f> a(ElementCount), b(ElementCount), c(ElementCount), result(ElementCount);
+            for (int i = 0; i < ElementCount; ++i)
+            {
+                a[i] = RandomVector(rng);
+                b[i] = RandomVector(rng);
+                c[i] = RandomVector(rng);
+            }
+
+            double baseline = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    result[i] = ScalarMax(ScalarMin(a[i], b[i]), c[i]);
+                }
+            });
+            sink = sink + result[ElementCount / 2].x;
+            Report("Min/Max, scalar fmin/fmax", baseline, baseline);
+
+            double ms = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    result[i] = Max(Min(a[i], b[i]), c[i]);
+                }
+            });
+            sink = sink + result[ElementCount / 2].x;
+            Report("Min/Max", ms, baseline);
+
+            // 光线原点为a[i]、方向倒数为b[i]，与[-1, 1]^3求交
+            int hits = 0;
+            baseline = BestTimeMs([&]
+            {
+                hits = 0;
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    Vector3f t0 = SlabDistances(a[i], b[i], -1), t1 = SlabDistances(a[i], b[i], 1);
+                    Vector3f tNear = ScalarMin(t0, t1), tFar = ScalarMax(t0, t1);
+                    hits += (MaxComponent(tNear) <= MinComponent(tFar)) ? 1 : 0;
+                }
+            });
+            sink = sink + (Float)hits;
+            Report("slab test, scalar fmin/fmax", baseline, baseline);
+
+            ms = BestTimeMs([&]
+            {
+                hits = 0;
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    Vector3f t0 = SlabDistances(a[i], b[i], -1), t1 = SlabDistances(a[i], b[i], 1);
+                    Vector3f tNear = Min(t0, t1), tFar = Max(t0, t1);
+                    hits += (MaxComponent(tNear) <= MinComponent(tFar)) ? 1 : 0;
+                }
+            });
+            sink = sink + (Float)hits;
+            Report("slab test, Min/Max", ms, baseline);
+        }
+
+        // 为随机的单位法线生成切线框架，方向随机所以分支预测不到
+        void BenchCoordinateSystem(void)
+        {
+            RNG rng;
+            std::vector<Normal3f> n(ElementCount);
+            for (int i = 0; i < ElementCount; ++i)
+            {
+                n[i] = Normal3f(RandomUnitVector(rng));
+            }
+            std::vector<Vector3f> ss(ElementCount), ts(ElementCount);
+
+            double baseline = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    BranchingCoordinateSystem(Vector3f(n[i]), &ss[i], &ts[i]);
+                }
+            });
+            sink = sink + ss[ElementCount / 2].x + ts[ElementCount / 2].y;
+            Report("CoordinateSystem, branching", baseline, baseline);
+
+            double ms = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    CoordinateSystem(Vector3f(n[i]), &ss[i], &ts[i]);
+                }
+            });
+            sink = sink + ss[ElementCount / 2].x + ts[ElementCount / 2].y;
+            Report("CoordinateSystem", ms, baseline);
+
+            ms = BestTimeMs([&]
+            {
+                CoordinateSystems(&n[0], &ss[0], &ts[0], ElementCount);
+            });
+            sink = sink + ss[ElementCount / 2].x + ts[ElementCount / 2].y;
+            Report("CoordinateSystems, batch", ms, baseline);
+        }
+
+        // 一半向量对几乎平行，叉积的分量是相近乘积之差，用来检验抵消误差
+        void BenchCross(void)
+        {
+            RNG rng;
+            std::vector<Vector3f> a(ElementCount), b(ElementCount), result(ElementCount);
+            for (int i = 0; i < ElementCount; ++i)
+            {
+                a[i] = RandomVector(rng);
+                b[i] = (0 == (i & 1)) ? RandomVector(rng) : (a[i] + (RandomVector(rng) * (Float)1e-4));
+            }
+
+            // 名字后面附上与精确结果的最大误差
+            auto withError = [&](const char *name)
+            {
+#ifdef PBRT_FLOAT_AS_DOUBLE
+                return std::string(name);
+#else
+                char buf[64];
+                snprintf(buf, sizeof(buf), "%s (%.2f ulp)", name, MaxUlpError(a, b, result));
+                return std::string(buf);
+#endif // PBRT_FLOAT_AS_DOUBLE
+            };
+
+            double baseline = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    result[i] = DoubleCross(a[i], b[i]);
+                }
+            });
+            sink = sink + result[ElementCount / 2].x;
+            Report(withError("Cross, double promotion").c_str(), baseline, baseline);
+
+            double ms = BestTimeMs([&]
+            {
+                for (int i = 0; i < ElementCount; ++i)
+                {
+                    result[i] = Cross(a[i], b[i]);
+                }
+            });
+            sink = sink + result[ElementCount / 2].x;
+            Report(withError("Cross").c_str(), ms, baseline);
+
+            ms = BestTimeMs([&]
+            {
+                Cross(&a[0], &b[0], &result[0], ElementCount);
+            });
+            sink = sink + result[ElementCount / 2].x;
+            Report(withError("Cross, batch").c_str(), ms, baseline);
+        }
+
+        struct Benchmark
+        {
+            const char *name;
+            void (*run)(void);
+        };
+
+        const Benchmark benchmarks[] =
+        {
+            { "geometry/min-max", BenchMinMax },
+            { "geometry/coordinate-system", BenchCoordinateSystem },
+            { "geometry/cross", BenchCross },
+        };
+    }
+
+    int RunBenchmarks(const std::string &filter)
+    {
+        printf("Benchmarks (%d elements, best of %d runs, SIMD %s, FMA %s):\n", ElementCount, Repetitions
+#ifdef PBRT_HAVE_SSE
+             , "on"
+#else
+             , "off"
+#endif // PBRT_HAVE_SSE
+#ifdef PBRT_HAVE_FMA
+             , "on");
+#else
+             , "off");
+#endif // PBRT_HAVE_FMA
+
+        int nRun = 0;
+        for (const Benchmark &benchmark : benchmarks)
+        {
+            if (std::string::npos == std::string(benchmark.name).find(filter))
+            {
+                continue;
+            }
+            printf("  %s\n", benchmark.name);
+            benchmark.run();
+            ++nRun;
+        }
+
+        if (0 == nRun)
+        {
+            LOG(ERROR) << "No benchmark matches \"" << filter << "\"";
+            return 1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,11 @@
+﻿#pragma once
+
+#include <string>
+
+namespace PBRT
+{
+    // 运行名字中包含filter的微基准测试（filter为空时全部运行），每项输出新实现相对改动前实现的耗时
+    // 返回值作为进程退出码：没有匹配的测试时返回1
+    // @remarks: 改动前的实现在Benchmarks.cpp中保留一份副本作为对照；只在单线程上计时
+    int RunBenchmarks(const std::string &filter);
+}